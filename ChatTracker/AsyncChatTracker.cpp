@@ -0,0 +1,355 @@
+
+#include "AsyncChatTracker.h"
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <cstring>
+using namespace std;
+
+// Ring class declaration
+// A bounded queue that many threads push into and one thread pops from, without locks.
+// Every cell has a sequence number saying whose turn it is: a cell whose sequence equals the
+// enqueue position is free for that producer, and one whose sequence is one past the dequeue
+// position holds an operation ready for the consumer.
+class AsyncChatTracker::Ring
+{
+public:
+    Ring(size_t capacity);
+    template <typename Fill> bool push(Fill fill);
+    template <typename Use> bool pop(Use use);
+private:
+    struct Cell
+    {
+        atomic<size_t> sequence;
+        Op op;
+    };
+    vector<Cell> m_cells;
+    size_t m_mask;
+    // The producers' and the consumer's positions are kept on separate cache lines
+    char m_pad1[64];
+    atomic<size_t> m_enqueuePos;
+    char m_pad2[64];
+    size_t m_dequeuePos;
+};
+
+AsyncChatTracker::Ring::Ring(size_t capacity) : m_cells(capacity), m_mask(capacity - 1), m_enqueuePos(0), m_dequeuePos(0)
+{
+    for(size_t k = 0; k < capacity; k++)
+        m_cells[k].sequence.store(k, memory_order_relaxed);
+}
+
+// Purpose: claim a cell and have fill write the operation into it, in place
+// Returns false if the ring is full
+template <typename Fill>
+bool AsyncChatTracker::Ring::push(Fill fill)
+{
+    size_t pos = m_enqueuePos.load(memory_order_relaxed);
+    for(;;)
+    {
+        Cell& cell = m_cells[pos & m_mask];
+        size_t seq = cell.sequence.load(memory_order_acquire);
+        if(seq == pos)
+        {
+            // The cell is free: claim the position, then fill the cell and hand it to the consumer
+            if(m_enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+            {
+                fill(cell.op);
+                cell.sequence.store(pos + 1, memory_order_release);
+                return true;
+            }
+        }
+        else if(seq < pos)
+            return false;
+        else
+            pos = m_enqueuePos.load(memory_order_relaxed);
+    }
+}
+
+// Purpose: have use deal with the oldest operation, in its cell, and then free the cell (only the writer thread calls this)
+// Returns false if the ring is empty
+template <typename Use>
+bool AsyncChatTracker::Ring::pop(Use use)
+{
+    Cell& cell = m_cells[m_dequeuePos & m_mask];
+    if(cell.sequence.load(memory_order_acquire) != m_dequeuePos + 1)
+        return false;
+    use(cell.op);
+    // Free the cell for the producer that comes around the ring next
+    cell.sequence.store(m_dequeuePos + m_mask + 1, memory_order_release);
+    m_dequeuePos++;
+    return true;
+}
+
+// *************** AsyncResult implementations *******************
+
+// Getters that have stopped spinning sleep on one condition variable shared by every result, so
+// the writer touches a result only to fill it in and need not outlive a getter's wait on it
+static mutex s_resultMutex;
+static condition_variable s_resultReady;
+static atomic<int> s_sleepingGetters(0);
+
+int AsyncResult::get() const
+{
+    for(int k = 0; k < 64; k++)
+    {
+        if(ready())
+            return m_value;
+        this_thread::yield();
+    }
+    // Announce the sleeper before the last look at m_ready; set stores m_ready before it looks
+    // for sleepers, so either this sees the value or set sees the sleeper and wakes it
+    unique_lock<mutex> lock(s_resultMutex);
+    s_sleepingGetters.fetch_add(1);
+    while(!m_ready.load())
+        s_resultReady.wait(lock);
+    s_sleepingGetters.fetch_sub(1);
+    return m_value;
+}
+
+void AsyncResult::set(int value)
+{
+    m_value = value;
+    m_ready.store(true);
+    if(s_sleepingGetters.load() != 0)
+    {
+        lock_guard<mutex> lock(s_resultMutex);
+        s_resultReady.notify_all();
+    }
+}
+
+// *************** AsyncChatTracker implementations *******************
+
+static atomic<uint64_t> s_nextGeneration(1);
+
+// The generations of the trackers that exist, so a thread can forget the rings of trackers that are gone
+static mutex s_liveMutex;
+static unordered_set<uint64_t> s_liveGenerations;
+
+static size_t roundUpToPowerOfTwo(size_t n)
+{
+    size_t p = 1;
+    while(p < n)
+        p <<= 1;
+    return p;
+}
+
+AsyncChatTracker::AsyncChatTracker(const ChatTracker::Options& options, size_t ringCapacity)
+ : m_tracker(options), m_nextRing(0), m_generation(s_nextGeneration.fetch_add(1)), m_stop(false), m_sleeping(false)
+{
+    for(int k = 0; k < k_rings; k++)
+        m_rings[k] = new Ring(roundUpToPowerOfTwo(ringCapacity < 2 ? 2 : ringCapacity));
+    {
+        lock_guard<mutex> lock(s_liveMutex);
+        s_liveGenerations.insert(m_generation);
+    }
+    m_writer = thread(&AsyncChatTracker::run, this);
+}
+
+AsyncChatTracker::~AsyncChatTracker()
+{
+    drain();
+    m_stop.store(true);
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_wake.notify_one();
+    }
+    m_writer.join();
+    for(int k = 0; k < k_rings; k++)
+        delete m_rings[k];
+    lock_guard<mutex> lock(s_liveMutex);
+    s_liveGenerations.erase(m_generation);
+}
+
+static const string s_noName;
+
+void AsyncChatTracker::join(const string& user, const string& chat, AsyncResult* result)
+{
+    submit(JOIN, user, chat, result);
+}
+
+void AsyncChatTracker::terminate(const string& chat, AsyncResult* result)
+{
+    submit(TERMINATE, s_noName, chat, result);
+}
+
+void AsyncChatTracker::contribute(const string& user, AsyncResult* result)
+{
+    submit(CONTRIBUTE, user, s_noName, result);
+}
+
+void AsyncChatTracker::leave(const string& user, const string& chat, AsyncResult* result)
+{
+    submit(LEAVE2, user, chat, result);
+}
+
+void AsyncChatTracker::leave(const string& user, AsyncResult* result)
+{
+    submit(LEAVE1, user, s_noName, result);
+}
+
+void AsyncChatTracker::drain()
+{
+    // A barrier in every ring is applied only after everything queued ahead of it
+    AsyncResult barriers[k_rings];
+    for(int k = 0; k < k_rings; k++)
+    {
+        AsyncResult* result = &barriers[k];
+        while(!m_rings[k]->push([result](Op& op) { op.set(BARRIER, s_noName, s_noName, result); }))
+            this_thread::yield();
+    }
+    atomic_thread_fence(memory_order_seq_cst);
+    if(m_sleeping.load())
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_wake.notify_one();
+    }
+    for(int k = 0; k < k_rings; k++)
+        barriers[k].get();
+}
+
+// Purpose: each thread is given a ring of each tracker the first time it submits to it, round robin
+// A thread remembers its rings by tracker address; a tracker built later at the same address has a
+// new generation, so the thread is given a ring of it afresh.  Whenever the thread's map has doubled
+// since it was last pruned, the rings of trackers that no longer exist are dropped from it, so a
+// thread that submits to many short-lived trackers keeps only about twice as many as are alive.
+AsyncChatTracker::Ring& AsyncChatTracker::ringForThisThread()
+{
+    struct Assignment
+    {
+        uint64_t generation;
+        int ring;
+    };
+    static thread_local unordered_map<const AsyncChatTracker*, Assignment> assignments;
+    static thread_local size_t pruneAt = 16;
+    auto it = assignments.find(this);
+    if(it != assignments.end() && it->second.generation == m_generation)
+        return *m_rings[it->second.ring];
+
+    if(it == assignments.end() && assignments.size() >= pruneAt)
+    {
+        {
+            lock_guard<mutex> lock(s_liveMutex);
+            for(auto a = assignments.begin(); a != assignments.end(); )
+            {
+                if(s_liveGenerations.count(a->second.generation) == 0)
+                    a = assignments.erase(a);
+                else
+                    ++a;
+            }
+        }
+        pruneAt = 2 * assignments.size() < 16 ? 16 : 2 * assignments.size();
+    }
+    Assignment& a = assignments[this];
+    a.generation = m_generation;
+    a.ring = m_nextRing.fetch_add(1, memory_order_relaxed) % k_rings;
+    return *m_rings[a.ring];
+}
+
+void AsyncChatTracker::submit(OpType type, const string& user, const string& chat, AsyncResult* result)
+{
+    Ring& ring = ringForThisThread();
+    // If the ring is full, wait for the writer to make room
+    while(!ring.push([&](Op& op) { op.set(type, user, chat, result); }))
+        this_thread::yield();
+    // Wake the writer if it has gone to sleep (the fence orders the push above before this check,
+    // as the writer's announcement is ordered before its last look at the rings)
+    atomic_thread_fence(memory_order_seq_cst);
+    if(m_sleeping.load())
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_wake.notify_one();
+    }
+}
+
+// The names are assigned into the writer's own strings, which keep their buffers from one operation to the next
+void AsyncChatTracker::Op::set(OpType t, const string& user, const string& chat, AsyncResult* r)
+{
+    type = t;
+    userSize = uint32_t(user.size());
+    chatSize = uint32_t(chat.size());
+    result = r;
+    // A cell's spill keeps its buffer, so a ring that has carried long names before takes more without allocating
+    spill.clear();
+    if(user.size() + chat.size() <= k_inlineNames)
+    {
+        memcpy(names, user.data(), user.size());
+        memcpy(names + user.size(), chat.data(), chat.size());
+    }
+    else
+        spill.append(user).append(chat);
+}
+
+void AsyncChatTracker::apply(const Op& op)
+{
+    int value = perform(op);
+    if(op.result != nullptr)
+        op.result->set(value);
+}
+
+int AsyncChatTracker::perform(const Op& op)
+{
+    m_user.assign(op.text(), op.userSize);
+    m_chat.assign(op.text() + op.userSize, op.chatSize);
+    switch(op.type)
+    {
+      case JOIN:
+        m_tracker.join(m_user, m_chat);
+        return 0;
+      case TERMINATE:
+        return m_tracker.terminate(m_chat);
+      case CONTRIBUTE:
+        return m_tracker.contribute(m_user);
+      case LEAVE2:
+        return m_tracker.leave(m_user, m_chat);
+      case LEAVE1:
+        return m_tracker.leave(m_user);
+      case BARRIER:
+        break;
+    }
+    return 0;
+}
+
+// Purpose: the writer thread's loop
+// Takes up to k_batch operations from each ring in turn; after several rounds with nothing to do it sleeps until woken
+void AsyncChatTracker::run()
+{
+    int idleRounds = 0;
+    auto apply = [this](const Op& op) { this->apply(op); };
+    while(!m_stop.load(memory_order_relaxed))
+    {
+        bool found = false;
+        for(int k = 0; k < k_rings; k++)
+        {
+            for(size_t n = 0; n < k_batch && m_rings[k]->pop(apply); n++)
+                found = true;
+        }
+        if(found)
+        {
+            idleRounds = 0;
+            continue;
+        }
+        if(++idleRounds < 64)
+        {
+            this_thread::yield();
+            continue;
+        }
+
+        // Announce that the writer is going to sleep, then look once more so a push made just
+        // before the announcement is not missed.  A push made after it sees the announcement and
+        // notifies under m_mutex, which this thread holds until it waits, so the wait needs no timeout.
+        unique_lock<mutex> lock(m_mutex);
+        m_sleeping.store(true);
+        atomic_thread_fence(memory_order_seq_cst);
+        bool empty = true;
+        for(int k = 0; k < k_rings && empty; k++)
+        {
+            if(m_rings[k]->pop(apply))
+                empty = false;
+        }
+        if(empty && !m_stop.load())
+            m_wake.wait(lock);
+        m_sleeping.store(false);
+        idleRounds = 0;
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef ASYNCCHATTRACKER_INCLUDED
+#define ASYNCCHATTRACKER_INCLUDED
+
+#include "ChatTracker.h"
+#include <string>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+
+// The result of an operation submitted to an AsyncChatTracker.
+// It is filled in by the tracker's writer thread; get() waits for it, first
+// spinning briefly and then sleeping until the writer wakes it.
+// An AsyncResult must stay alive (and must not be reused) until it is ready.
+class AsyncResult
+{
+  public:
+    AsyncResult() : m_ready(false), m_value(0) {}
+    bool ready() const { return m_ready.load(std::memory_order_acquire); }
+    int get() const;
+  private:
+    friend class AsyncChatTracker;
+    void set(int value);
+    std::atomic<bool> m_ready;
+    int m_value;
+};
+
+// A ChatTracker that any number of threads can submit operations to without
+// locking.  Each submitting thread pushes its operations into one of several
+// lock-free ring buffers (always the same one, so a thread's operations are
+// applied in the order it submitted them).  A single writer thread drains
+// the rings in batches and applies the operations to the tracker.
+// Operations submitted by different threads are not ordered with respect to
+// each other; call drain() first if one thread's operation must see the
+// effect of another's.  An operation's names are copied into the ring
+// itself when together they fit in k_inlineNames bytes, so submitting
+// such an operation allocates nothing.
+class AsyncChatTracker
+{
+  public:
+    AsyncChatTracker(const ChatTracker::Options& options = ChatTracker::Options(), size_t ringCapacity = 4096);
+    ~AsyncChatTracker();
+      // Each of these queues the operation and returns at once.  If result
+      // is not null, it is set to the operation's return value (0 for join)
+      // once the operation has been applied.
+    void join(const std::string& user, const std::string& chat, AsyncResult* result = nullptr);
+    void terminate(const std::string& chat, AsyncResult* result = nullptr);
+    void contribute(const std::string& user, AsyncResult* result = nullptr);
+    void leave(const std::string& user, const std::string& chat, AsyncResult* result = nullptr);
+    void leave(const std::string& user, AsyncResult* result = nullptr);
+      // Waits until every operation submitted before the call has been applied
+    void drain();
+      // The underlying tracker; use it only when no operations are in flight
+    ChatTracker& tracker() { return m_tracker; }
+    AsyncChatTracker(const AsyncChatTracker&) = delete;
+    AsyncChatTracker& operator=(const AsyncChatTracker&) = delete;
+
+    static const size_t k_inlineNames = 48;
+
+  private:
+    enum OpType { JOIN, TERMINATE, CONTRIBUTE, LEAVE2, LEAVE1, BARRIER };
+      // The user's name followed by the chat's, in names if they fit and in
+      // spill if not
+    struct Op
+    {
+        OpType type;
+        uint32_t userSize;
+        uint32_t chatSize;
+        AsyncResult* result;
+        char names[k_inlineNames];
+        std::string spill;
+        void set(OpType t, const std::string& user, const std::string& chat, AsyncResult* r);
+        const char* text() const { return spill.empty() ? names : spill.data(); }
+    };
+    class Ring;
+    static const int k_rings = 8;
+    static const size_t k_batch = 256;
+
+    ChatTracker m_tracker;
+    Ring* m_rings[k_rings];
+    std::atomic<int> m_nextRing;
+      // Tells this tracker apart from earlier ones at the same address
+    uint64_t m_generation;
+    std::atomic<bool> m_stop;
+      // Set while the writer is asleep waiting for work
+    std::atomic<bool> m_sleeping;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::thread m_writer;
+      // The writer's copies of the names of the operation it is applying
+    std::string m_user;
+    std::string m_chat;
+
+    void submit(OpType type, const std::string& user, const std::string& chat, AsyncResult* result);
+    Ring& ringForThisThread();
+    void run();
+    void apply(const Op& op);
+    int perform(const Op& op);
+};
+
+#endif // ASYNCCHATTRACKER_INCLUDED
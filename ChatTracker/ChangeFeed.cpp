@@ -0,0 +1,188 @@
+
+#include "ChangeFeed.h"
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+using namespace std;
+
+// *************** Subscription implementations *******************
+
+static size_t roundUpToPowerOfTwo(size_t n)
+{
+    size_t p = 1;
+    while(p < n)
+        p <<= 1;
+    return p;
+}
+
+ChangeFeed::Subscription::Subscription(size_t capacity, Overflow overflow)
+ : m_events(roundUpToPowerOfTwo(capacity < 2 ? 2 : capacity)), m_mask(m_events.size() - 1), m_overflow(overflow),
+   m_start(0), m_pending(0), m_cachedHead(0), m_tail(0), m_lost(false), m_head(0), m_done(0)
+{
+}
+
+// Polling again means the consumer is done with the names of the events it took before
+size_t ChangeFeed::Subscription::poll(ChangeEvent* out, size_t max)
+{
+    uint64_t head = m_head.load(memory_order_relaxed);
+    m_done.store(head, memory_order_release);
+    uint64_t tail = m_tail.load(memory_order_acquire);
+    size_t n = size_t(min<uint64_t>(tail - head, max));
+    for(size_t k = 0; k < n; k++)
+        out[k] = m_events[(head + k) & m_mask];
+    // Hand the slots back to the producer
+    m_head.store(head + n, memory_order_release);
+    return n;
+}
+
+// *************** ChangeFeed implementations *******************
+
+ChangeFeed::ChangeFeed(size_t batchSize)
+ : m_batchSize(batchSize < 1 ? 1 : batchSize), m_unflushed(0), m_published(0), m_ids(1024), m_names(0)
+{
+    m_blocks = new Name*[k_maxBlocks]();
+}
+
+ChangeFeed::~ChangeFeed()
+{
+    for(Subscription* s : m_subscriptions)
+        delete s;
+    for(size_t k = 0; k < k_maxBlocks && m_blocks[k] != nullptr; k++)
+        delete [] m_blocks[k];
+    delete [] m_blocks;
+}
+
+ChangeFeed::Subscription* ChangeFeed::subscribe(size_t capacity, Overflow overflow)
+{
+    // Publish what is pending first, so the new ring starts at a batch boundary
+    flush();
+    Subscription* s = new Subscription(capacity, overflow);
+    s->m_start = published();
+    m_subscriptions.push_back(s);
+    return s;
+}
+
+void ChangeFeed::unsubscribe(Subscription* s)
+{
+    vector<Subscription*>::iterator it = find(m_subscriptions.begin(), m_subscriptions.end(), s);
+    if(it != m_subscriptions.end())
+    {
+        m_subscriptions.erase(it);
+        delete s;
+    }
+}
+
+void ChangeFeed::flush()
+{
+    for(Subscription* s : m_subscriptions)
+        s->m_tail.store(s->m_pending, memory_order_release);
+    m_unflushed = 0;
+}
+
+const string& ChangeFeed::name(uint32_t id) const
+{
+    return m_blocks[id >> k_blockBits][id & (k_blockSize - 1)].text;
+}
+
+uint32_t ChangeFeed::generation(uint32_t id) const
+{
+    return m_blocks[id >> k_blockBits][id & (k_blockSize - 1)].generation;
+}
+
+// Purpose: whether every subscriber is done with the events published before the ID was forgotten
+// A dropped subscriber gets no more events, so it is done with every name once it is done with its ring
+bool ChangeFeed::reusable(const Retired& retired) const
+{
+    for(const Subscription* s : m_subscriptions)
+    {
+        uint64_t done = s->m_done.load(memory_order_acquire);
+        if(s->m_lost.load(memory_order_relaxed) && done == s->m_pending)
+            continue;
+        if(s->m_start + done < retired.published)
+            return false;
+    }
+    return true;
+}
+
+// The name is stored before any event carrying its ID is made visible, so subscribers can always look it up.
+// Forgotten IDs are given out again oldest first, and only when no subscriber can still be reading their names.
+uint32_t ChangeFeed::intern(const string& name)
+{
+    pair<uint32_t*, bool> id = m_ids.try_emplace(name, 0);
+    if(!id.second)
+        return *id.first;
+    uint32_t next;
+    if(!m_retired.empty() && reusable(m_retired.front()))
+    {
+        next = m_retired.front().id;
+        m_retired.pop_front();
+    }
+    else if(m_names < k_maxBlocks * k_blockSize)
+    {
+        next = m_names++;
+        Name*& block = m_blocks[next >> k_blockBits];
+        if(block == nullptr)
+            block = new Name[k_blockSize]();
+    }
+    else
+    {
+        m_ids.erase(name);
+        throw length_error("the change feed has no IDs left");
+    }
+    Name& slot = m_blocks[next >> k_blockBits][next & (k_blockSize - 1)];
+    slot.text = name;
+    slot.generation++;
+    *id.first = next;
+    return next;
+}
+
+// The name stays in its slot until the ID is given out again, since subscribers may still be reading it
+void ChangeFeed::forget(const string& name)
+{
+    uint32_t* id = m_ids.find(name);
+    if(id == nullptr)
+        return;
+    m_retired.push_back(Retired{*id, published()});
+    m_ids.erase(name);
+}
+
+void ChangeFeed::publish(ChangeEvent::Type type, uint32_t user, uint32_t chat, int value)
+{
+    ChangeEvent event;
+    event.type = type;
+    event.user = user;
+    event.chat = chat;
+    event.value = value;
+    for(Subscription* s : m_subscriptions)
+    {
+        if(s->m_lost.load(memory_order_relaxed))
+            continue;
+        // The producer only rereads the consumer's position when the ring looks full
+        if(s->full())
+        {
+            s->m_cachedHead = s->m_head.load(memory_order_acquire);
+            if(s->full() && s->m_overflow == DROP)
+            {
+                // The subscriber gets what its ring holds, and learns that nothing more is coming
+                s->m_tail.store(s->m_pending, memory_order_release);
+                s->m_lost.store(true, memory_order_release);
+                continue;
+            }
+            if(s->full())
+            {
+                // Make everything visible so the subscriber can catch up, then wait for room
+                s->m_tail.store(s->m_pending, memory_order_release);
+                while(s->full())
+                {
+                    this_thread::yield();
+                    s->m_cachedHead = s->m_head.load(memory_order_acquire);
+                }
+            }
+        }
+        s->m_events[s->m_pending & s->m_mask] = event;
+        s->m_pending++;
+    }
+    m_published.store(m_published.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    if(++m_unflushed >= m_batchSize)
+        flush();
+}
@@ -0,0 +1,140 @@
+#ifndef CHANGEFEED_INCLUDED
+#define CHANGEFEED_INCLUDED
+
+#include "HashMap.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// One change made to a ChatTracker.  Users and chats are identified by IDs
+// interned by the feed; ChangeFeed::name turns an ID back into its name.
+struct ChangeEvent
+{
+    enum Type : uint32_t { JOIN, LEAVE, TERMINATE, CONTRIBUTE };
+    static const uint32_t k_noUser = UINT32_MAX;
+
+    Type type;
+    uint32_t user;   // k_noUser for TERMINATE
+    uint32_t chat;   // for CONTRIBUTE, the user's current chat
+    int value;       // what the operation returned (0 for JOIN)
+};
+
+// The stream of changes made to a ChatTracker (see ChatTracker::enableChangeFeed).
+// Only operations that change the tracker publish an event: a contribute by
+// a user with no current chat, or a leave that returns -1, publishes nothing.
+// Each subscriber has its own single-producer, single-consumer ring; the
+// thread using the tracker writes every event into every ring and makes them
+// visible to the subscribers a batch at a time, so a subscriber sees an event
+// once batchSize events have been published after it or flush is called.
+// If a subscriber's ring is full, the tracker either waits for the
+// subscriber to catch up, so it never misses an event, or (for a subscriber
+// that must never hold up the tracker) drops it: the subscriber gets the
+// events its ring holds and then no more, and must start again from a
+// checkpoint.
+class ChangeFeed
+{
+  public:
+      // What publish does when a subscriber's ring is full
+    enum Overflow { WAIT, DROP };
+
+    class Subscription
+    {
+      public:
+          // Copies up to max available events into out and returns how many.
+          // Only one thread may poll a subscription.
+        size_t poll(ChangeEvent* out, size_t max);
+          // Number of events taken from this subscription so far
+        uint64_t consumed() const { return m_head.load(std::memory_order_relaxed); }
+          // True once the feed has dropped the subscription; the events
+          // published before then can still be polled
+        bool lost() const { return m_lost.load(std::memory_order_acquire); }
+        Subscription(const Subscription&) = delete;
+        Subscription& operator=(const Subscription&) = delete;
+
+      private:
+        friend class ChangeFeed;
+        Subscription(size_t capacity, Overflow overflow);
+        bool full() const { return m_pending - m_cachedHead == m_events.size(); }
+
+        std::vector<ChangeEvent> m_events;
+        size_t m_mask;
+        Overflow m_overflow;
+          // Written by the producer only
+        uint64_t m_start;       // events the feed had published when the subscription began
+        uint64_t m_pending;     // events written to the ring
+        uint64_t m_cachedHead;  // last value of m_head the producer read
+        char m_pad1[64];
+        std::atomic<uint64_t> m_tail;  // events made visible to the consumer
+        std::atomic<bool> m_lost;      // set by the producer, after the last events are made visible
+        char m_pad2[64];
+        std::atomic<uint64_t> m_head;  // events taken by the consumer
+        std::atomic<uint64_t> m_done;  // events whose names the consumer no longer reads
+    };
+
+    explicit ChangeFeed(size_t batchSize = 64);
+    ~ChangeFeed();
+      // Subscribe and unsubscribe must be called by the thread that uses the
+      // tracker.  A new subscriber sees only events published after it joined.
+    Subscription* subscribe(size_t capacity = 1 << 16, Overflow overflow = WAIT);
+    void unsubscribe(Subscription* s);
+      // Makes every event published so far visible to the subscribers
+    void flush();
+      // The name of a user or chat whose ID appeared in an event.  The
+      // names of the events a poll returned stay valid until the next poll
+      // of that subscription.  A user or chat that is gone has its name
+      // forgotten, and its ID is given to a new name once every subscriber
+      // has polled again after taking the events published until then;
+      // generation(id) counts the names the ID has had, so a subscriber
+      // that keeps names (as FeedSender does) can tell when an ID stands
+      // for a new one.
+    const std::string& name(uint32_t id) const;
+    uint32_t generation(uint32_t id) const;
+      // Number of events published so far (including any still in a batch)
+    uint64_t published() const { return m_published.load(std::memory_order_relaxed); }
+
+      // Called by the tracker: intern returns the ID of a name, giving it
+      // an ID if it has none yet (throwing std::length_error if all 2^28 are
+      // in use), and forget drops the name of a user or chat that is gone
+    uint32_t intern(const std::string& name);
+    void forget(const std::string& name);
+    void publish(ChangeEvent::Type type, uint32_t user, uint32_t chat, int value);
+
+    ChangeFeed(const ChangeFeed&) = delete;
+    ChangeFeed& operator=(const ChangeFeed&) = delete;
+
+  private:
+      // Names are kept in fixed-size blocks that never move, so a subscriber
+      // can read a name while the tracker is adding others
+    static const size_t k_blockBits = 14;
+    static const size_t k_blockSize = size_t(1) << k_blockBits;
+    static const size_t k_maxBlocks = size_t(1) << 14;
+    struct Name
+    {
+        std::string text;
+        uint32_t generation;
+    };
+      // A forgotten name's ID, and the events published before it was
+      // forgotten, which every subscriber must be done with before the ID
+      // is given out again
+    struct Retired
+    {
+        uint32_t id;
+        uint64_t published;
+    };
+
+    std::vector<Subscription*> m_subscriptions;
+    size_t m_batchSize;
+    size_t m_unflushed;
+    std::atomic<uint64_t> m_published;
+    HashMap<std::string, uint32_t> m_ids;
+    Name** m_blocks;
+    uint32_t m_names;
+    std::deque<Retired> m_retired;
+
+    bool reusable(const Retired& retired) const;
+};
+
+#endif // CHANGEFEED_INCLUDED
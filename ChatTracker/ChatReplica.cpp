@@ -0,0 +1,420 @@
+
+#include "ChatReplica.h"
+#include <chrono>
+#include <mutex>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+using namespace std;
+
+// The stream a FeedSender writes is a sequence of records, each starting with its kind:
+//   'N'  uint32 id, uint32 length, the name's bytes     (defines an ID's name before its first use with that name)
+//   'E'  a ChangeEvent                                   (one change)
+//   'P'  uint64 count                                    (changes the primary had published when the batch was sent)
+//   'L'                                                  (the feed dropped the sender; nothing follows)
+// Both ends run on the same machine, so numbers are written in its own byte order.
+
+static const char k_nameRecord = 'N';
+static const char k_eventRecord = 'E';
+static const char k_publishedRecord = 'P';
+static const char k_lostRecord = 'L';
+
+// How long a thread with nothing to do sleeps before looking again
+static const chrono::microseconds k_idleSleep(100);
+
+// Purpose: write all n bytes to fd
+// Returns false if the write fails
+static bool writeAll(int fd, const char* data, size_t n)
+{
+    while(n > 0)
+    {
+        ssize_t written = write(fd, data, n);
+        if(written < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return false;
+        }
+        data += written;
+        n -= size_t(written);
+    }
+    return true;
+}
+
+template <typename T>
+static void appendRaw(string& buffer, const T& value)
+{
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// StreamReader class declaration
+// Reads a stream in large pieces and hands it out a few bytes at a time.
+// While waiting for more input it keeps checking a stop flag, so the thread reading can be told to finish.
+class StreamReader
+{
+public:
+    StreamReader(int fd, const atomic<bool>& stop) : m_fd(fd), m_stop(stop), m_buffer(64 * 1024), m_pos(0), m_end(0) {}
+    // Copies the next n bytes to p; returns false at the end of the stream (or when told to stop)
+    bool read(void* p, size_t n);
+    // True if bytes are waiting in the buffer, so reading more will not block
+    bool buffered() const { return m_pos < m_end; }
+private:
+    int m_fd;
+    const atomic<bool>& m_stop;
+    vector<char> m_buffer;
+    size_t m_pos;
+    size_t m_end;
+
+    bool fill();
+};
+
+bool StreamReader::read(void* p, size_t n)
+{
+    char* out = static_cast<char*>(p);
+    while(n > 0)
+    {
+        if(m_pos == m_end && !fill())
+            return false;
+        size_t k = min(n, m_end - m_pos);
+        memcpy(out, &m_buffer[m_pos], k);
+        m_pos += k;
+        out += k;
+        n -= k;
+    }
+    return true;
+}
+
+bool StreamReader::fill()
+{
+    for(;;)
+    {
+        if(m_stop.load(memory_order_acquire))
+            return false;
+        pollfd pfd;
+        pfd.fd = m_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if(poll(&pfd, 1, 100) <= 0)
+            continue;
+        ssize_t n = ::read(m_fd, &m_buffer[0], m_buffer.size());
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        m_pos = 0;
+        m_end = size_t(n);
+        return true;
+    }
+}
+
+// *************** ChatReplica implementations *******************
+
+ChatReplica::ChatReplica(ChatTracker& primary, size_t capacity)
+ : m_tracker(new ChatTracker), m_applied(0), m_published(0), m_connected(true), m_stop(false), m_needsResync(false),
+   m_feed(&primary.enableChangeFeed()), m_capacity(capacity), m_resyncing(false), m_checkpointPublished(0), m_fd(-1)
+{
+    m_subscription = m_feed->subscribe(capacity, ChangeFeed::DROP);
+    m_thread = thread(&ChatReplica::follow, this);
+}
+
+ChatReplica::ChatReplica(int fd)
+ : m_tracker(new ChatTracker), m_applied(0), m_published(0), m_connected(true), m_stop(false), m_needsResync(false),
+   m_feed(nullptr), m_subscription(nullptr), m_capacity(0), m_resyncing(false), m_checkpointPublished(0), m_fd(fd)
+{
+    m_thread = thread(&ChatReplica::receive, this);
+}
+
+ChatReplica::~ChatReplica()
+{
+    m_stop.store(true, memory_order_release);
+    m_thread.join();
+    if(m_feed != nullptr)
+        m_feed->unsubscribe(m_subscription);
+}
+
+int ChatReplica::chatTotal(const string& chat) const
+{
+    shared_lock<shared_timed_mutex> lock(m_mutex);
+    return m_tracker->chatTotal(chat);
+}
+
+vector<string> ChatReplica::members(const string& chat) const
+{
+    shared_lock<shared_timed_mutex> lock(m_mutex);
+    return m_tracker->members(chat);
+}
+
+uint64_t ChatReplica::lag() const
+{
+    uint64_t applied = m_applied.load(memory_order_acquire);
+    uint64_t published = (m_feed != nullptr ? m_feed->published() : m_published.load(memory_order_acquire));
+    return published > applied ? published - applied : 0;
+}
+
+void ChatReplica::waitForApplied(uint64_t count) const
+{
+    // A resync under way will bring the replica up to date, so only one nobody has asked for yet ends the wait
+    while(applied() < count && connected() && !(needsResync() && !m_resyncing.load(memory_order_acquire)))
+        this_thread::sleep_for(k_idleSleep);
+}
+
+// The thread has stopped using the old subscription once it has set m_needsResync, so it can be dropped here.  The
+// checkpoint is taken just after the new subscription begins, so it holds exactly the changes the subscription misses.
+bool ChatReplica::resync(ChatTracker& primary, const string& path)
+{
+    if(m_feed == nullptr || !needsResync() || m_resyncing.load(memory_order_acquire))
+        return false;
+    ChangeFeed::Subscription* fresh = m_feed->subscribe(m_capacity, ChangeFeed::DROP);
+    remove(path.c_str());
+    if(!primary.checkpointAsync(path))
+    {
+        m_feed->unsubscribe(fresh);
+        return false;
+    }
+    m_feed->unsubscribe(m_subscription);
+    m_subscription = fresh;
+    m_checkpointPath = path;
+    m_checkpointPublished = m_feed->published();
+    m_resyncing.store(true, memory_order_release);
+    return true;
+}
+
+const string& ChatReplica::name(uint32_t id) const
+{
+    return m_feed != nullptr ? m_feed->name(id) : m_names[id];
+}
+
+// Purpose: apply a batch of changes to the replica's tracker
+// Readers are locked out for the whole batch rather than for each change
+void ChatReplica::apply(const ChangeEvent* events, size_t n)
+{
+    {
+        unique_lock<shared_timed_mutex> lock(m_mutex);
+        for(size_t k = 0; k < n; k++)
+        {
+            const ChangeEvent& e = events[k];
+            switch(e.type)
+            {
+              case ChangeEvent::JOIN:
+                m_tracker->join(name(e.user), name(e.chat));
+                break;
+              case ChangeEvent::LEAVE:
+                m_tracker->leave(name(e.user), name(e.chat));
+                break;
+              case ChangeEvent::TERMINATE:
+                m_tracker->terminate(name(e.chat));
+                break;
+              case ChangeEvent::CONTRIBUTE:
+                m_tracker->contribute(name(e.user));
+                break;
+            }
+        }
+    }
+    m_applied.fetch_add(n, memory_order_release);
+}
+
+// Purpose: the replica's thread when following a primary in the same process
+// Once the feed has dropped the subscription and its last events are applied, the thread leaves the subscription
+// alone and waits for a resync
+void ChatReplica::follow()
+{
+    ChangeEvent events[1024];
+    while(!m_stop.load(memory_order_acquire))
+    {
+        if(m_resyncing.load(memory_order_acquire))
+        {
+            loadCheckpoint();
+            continue;
+        }
+        if(needsResync())
+        {
+            this_thread::sleep_for(k_idleSleep);
+            continue;
+        }
+        // The feed makes the last events visible before it marks the subscription lost
+        bool lost = m_subscription->lost();
+        size_t n = m_subscription->poll(events, 1024);
+        if(n > 0)
+            apply(events, n);
+        else if(lost)
+            m_needsResync.store(true, memory_order_release);
+        else
+            this_thread::sleep_for(k_idleSleep);
+    }
+}
+
+// Purpose: replace the replica's tracker with the checkpoint resync asked for, once the primary has written it
+// The checkpoint is renamed to its path only when complete, so the thread waits for the path to appear
+void ChatReplica::loadCheckpoint()
+{
+    ifstream in(m_checkpointPath);
+    if(!in)
+    {
+        this_thread::sleep_for(k_idleSleep);
+        return;
+    }
+    ChatTracker::Dump dump;
+    bool readable = ChatTracker::readDump(in, dump);
+    unique_ptr<ChatTracker> loaded(new ChatTracker(dump));
+    {
+        unique_lock<shared_timed_mutex> lock(m_mutex);
+        m_tracker.swap(loaded);
+    }
+    m_applied.store(m_checkpointPublished, memory_order_release);
+    // A checkpoint that cannot be read leaves the replica needing another resync.  The flag is settled before the
+    // resync ends, so waitForApplied never sees a replica needing a resync with none under way while this one finishes.
+    m_needsResync.store(!readable, memory_order_release);
+    m_resyncing.store(false, memory_order_release);
+}
+
+// Purpose: the replica's thread when following a primary through a stream
+// Events are collected until the input read so far is used up, then applied together
+void ChatReplica::receive()
+{
+    StreamReader in(m_fd, m_stop);
+    vector<ChangeEvent> batch;
+    for(;;)
+    {
+        if(!in.buffered() && !batch.empty())
+        {
+            apply(batch.data(), batch.size());
+            batch.clear();
+        }
+        char kind;
+        if(!in.read(&kind, 1))
+            break;
+        if(kind == k_eventRecord)
+        {
+            ChangeEvent e;
+            if(!in.read(&e, sizeof(e)))
+                break;
+            batch.push_back(e);
+        }
+        else if(kind == k_nameRecord)
+        {
+            uint32_t id;
+            uint32_t len;
+            if(!in.read(&id, sizeof(id)) || !in.read(&len, sizeof(len)))
+                break;
+            string name(len, '\0');
+            if(len > 0 && !in.read(&name[0], len))
+                break;
+            if(id >= m_names.size())
+                m_names.resize(id + 1);
+            // An ID given to a new name may still stand for its old one in the events collected so far
+            else if(!batch.empty())
+            {
+                apply(batch.data(), batch.size());
+                batch.clear();
+            }
+            m_names[id] = std::move(name);
+        }
+        else if(kind == k_publishedRecord)
+        {
+            uint64_t published;
+            if(!in.read(&published, sizeof(published)))
+                break;
+            m_published.store(published, memory_order_release);
+        }
+        else if(kind == k_lostRecord)
+        {
+            m_needsResync.store(true, memory_order_release);
+            break;
+        }
+        else
+            break;
+    }
+    if(!batch.empty())
+        apply(batch.data(), batch.size());
+    m_connected.store(false, memory_order_release);
+}
+
+// *************** FeedSender implementations *******************
+
+FeedSender::FeedSender(ChatTracker& tracker, int fd, size_t capacity)
+ : m_feed(tracker.enableChangeFeed()), m_fd(fd), m_ok(true), m_stop(false)
+{
+    m_subscription = m_feed.subscribe(capacity, ChangeFeed::DROP);
+    m_thread = thread(&FeedSender::run, this);
+}
+
+FeedSender::~FeedSender()
+{
+    // Everything flushed before the stop flag is set is sent before the thread finishes
+    m_feed.flush();
+    m_stop.store(true, memory_order_release);
+    m_thread.join();
+    m_feed.unsubscribe(m_subscription);
+}
+
+void FeedSender::run()
+{
+    while(m_ok.load(memory_order_relaxed))
+    {
+        bool stopping = m_stop.load(memory_order_acquire);
+        // The feed makes the last events visible before it marks the subscription lost
+        bool lost = m_subscription->lost();
+        bool sent = sendAvailable();
+        if(lost && !sent)
+        {
+            // Tell the replica it has been dropped, so it does not wait for events that will never come
+            char record = k_lostRecord;
+            writeAll(m_fd, &record, 1);
+            break;
+        }
+        if(stopping && !sent)
+            break;
+        if(!sent)
+            this_thread::sleep_for(k_idleSleep);
+    }
+}
+
+// Purpose: send every event the subscription has available, followed by the feed's count of published events
+// Returns true if there was anything to send
+bool FeedSender::sendAvailable()
+{
+    ChangeEvent events[1024];
+    size_t n;
+    bool any = false;
+    m_buffer.clear();
+    // Stop after about a megabyte, so a primary that never pauses still sees its events go out in pieces
+    while(m_buffer.size() < (1 << 20) && (n = m_subscription->poll(events, 1024)) > 0)
+    {
+        any = true;
+        for(size_t k = 0; k < n; k++)
+        {
+            if(events[k].user != ChangeEvent::k_noUser)
+                sendName(events[k].user);
+            sendName(events[k].chat);
+            m_buffer += k_eventRecord;
+            appendRaw(m_buffer, events[k]);
+        }
+    }
+    if(!any)
+        return false;
+    m_buffer += k_publishedRecord;
+    appendRaw(m_buffer, uint64_t(m_feed.published()));
+    if(!writeAll(m_fd, m_buffer.data(), m_buffer.size()))
+        m_ok.store(false, memory_order_release);
+    return true;
+}
+
+// Purpose: define the ID's name for the replica, unless the name it was last sent is still the ID's name
+// The feed gives the IDs of forgotten names to new names, and the replica replaces the name it holds for the ID
+void FeedSender::sendName(uint32_t id)
+{
+    if(id >= m_sentGenerations.size())
+        m_sentGenerations.resize(id + 1, 0);
+    uint32_t generation = m_feed.generation(id);
+    if(m_sentGenerations[id] == generation)
+        return;
+    m_sentGenerations[id] = generation;
+    const string& name = m_feed.name(id);
+    m_buffer += k_nameRecord;
+    appendRaw(m_buffer, id);
+    appendRaw(m_buffer, uint32_t(name.size()));
+    m_buffer += name;
+}
@@ -0,0 +1,141 @@
+#ifndef CHATREPLICA_INCLUDED
+#define CHATREPLICA_INCLUDED
+
+#include "ChatTracker.h"
+#include "ChangeFeed.h"
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <shared_mutex>
+#include <cstdint>
+
+// A read-only copy of a ChatTracker that follows the tracker's change feed.
+// A thread of the replica's own applies the changes to a second tracker, so
+// the primary only pays for publishing its events; readers of the replica
+// share a lock that the applying thread takes once per batch of events.
+// The replica sees the primary's changes as the feed makes them visible
+// (see ChangeFeed), and lag() says how many published changes it has not
+// applied yet.  The primary never waits for the replica: if the replica
+// falls a whole ring of changes behind (say, because readers hold the lock
+// for long), the feed drops it, and it needs a resync from a checkpoint of
+// the primary before it follows the primary again.
+class ChatReplica
+{
+  public:
+      // Follows a primary in the same process.  Constructing and destroying
+      // the replica must be done by the thread that uses the primary.
+    explicit ChatReplica(ChatTracker& primary, size_t capacity = 1 << 16);
+      // Follows a primary in another process, reading the stream a
+      // FeedSender writes to fd (a pipe or a socket).  The replica does not
+      // close fd.
+    explicit ChatReplica(int fd);
+    ~ChatReplica();
+
+    int chatTotal(const std::string& chat) const;
+    std::vector<std::string> members(const std::string& chat) const;
+      // Calls f with the replica's tracker, which nothing changes until f
+      // returns, so several reads see the same state
+    template <typename Func>
+    void read(Func f) const
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(m_mutex);
+        const ChatTracker& tracker = *m_tracker;
+        f(tracker);
+    }
+      // Changes applied so far, and changes published by the primary but
+      // not applied yet (for a stream, as of the last batch received)
+    uint64_t applied() const { return m_applied.load(std::memory_order_acquire); }
+    uint64_t lag() const;
+      // False once the stream from the primary has ended
+    bool connected() const { return m_connected.load(std::memory_order_acquire); }
+      // Waits until count changes have been applied, the stream has ended
+      // or the replica needs a resync
+    void waitForApplied(uint64_t count) const;
+      // True once the replica has missed changes: the feed dropped it, or
+      // (for a stream) the sender was dropped.  Its reads then show the
+      // primary as it was some time ago.
+    bool needsResync() const { return m_needsResync.load(std::memory_order_acquire); }
+      // Starts following the primary afresh: subscribes again and has the
+      // primary write a checkpoint to path (see ChatTracker::checkpointAsync),
+      // which the replica's thread loads in place of its tracker before
+      // applying the changes made since.  Must be called by the thread that
+      // uses the primary, on a replica of a primary in the same process that
+      // needs a resync; returns false if the checkpoint cannot be started.
+      // needsResync stays true until the checkpoint is loaded.
+    bool resync(ChatTracker& primary, const std::string& path);
+
+    ChatReplica(const ChatReplica&) = delete;
+    ChatReplica& operator=(const ChatReplica&) = delete;
+
+  private:
+    std::unique_ptr<ChatTracker> m_tracker;
+    mutable std::shared_timed_mutex m_mutex;
+    std::atomic<uint64_t> m_applied;
+    std::atomic<uint64_t> m_published;
+    std::atomic<bool> m_connected;
+    std::atomic<bool> m_stop;
+    std::atomic<bool> m_needsResync;
+      // In-process: the primary's feed and this replica's subscription to it
+    ChangeFeed* m_feed;
+    ChangeFeed::Subscription* m_subscription;
+    size_t m_capacity;
+      // A resync the thread is to carry out: the checkpoint to load, and the
+      // changes the primary had published when it was taken
+    std::atomic<bool> m_resyncing;
+    std::string m_checkpointPath;
+    uint64_t m_checkpointPublished;
+      // Stream: the descriptor and the names the sender has defined so far
+    int m_fd;
+    std::vector<std::string> m_names;
+    std::thread m_thread;
+
+    void follow();
+    void loadCheckpoint();
+    void receive();
+    void apply(const ChangeEvent* events, size_t n);
+    const std::string& name(uint32_t id) const;
+};
+
+// Sends a tracker's change feed over a pipe or socket to a ChatReplica in
+// another process.  A thread of the sender's own drains its subscription
+// and writes the events, preceded by the names they use that the replica
+// has not been sent yet (or that stood for another name when last sent).
+// Like an in-process replica, the sender never holds up the tracker: if the
+// replica reads too slowly for the sender to keep up, the feed drops the
+// sender, which tells the replica it needs a resync and stops (a replica
+// in another process is resynced by starting it again from a checkpoint,
+// with a new sender).  Constructing and destroying the sender must be
+// done by the thread that uses the tracker; destroying it flushes the feed
+// and sends everything published until then.  The sender does not close fd.
+class FeedSender
+{
+  public:
+    FeedSender(ChatTracker& tracker, int fd, size_t capacity = 1 << 16);
+    ~FeedSender();
+      // False if writing to fd has failed (the replica has gone away)
+    bool ok() const { return m_ok.load(std::memory_order_acquire); }
+      // True once the feed has dropped the sender
+    bool lost() const { return m_subscription->lost(); }
+
+    FeedSender(const FeedSender&) = delete;
+    FeedSender& operator=(const FeedSender&) = delete;
+
+  private:
+    ChangeFeed& m_feed;
+    ChangeFeed::Subscription* m_subscription;
+    int m_fd;
+      // The generation of each ID's name when it was last sent (0 if never)
+    std::vector<uint32_t> m_sentGenerations;
+    std::string m_buffer;
+    std::atomic<bool> m_ok;
+    std::atomic<bool> m_stop;
+    std::thread m_thread;
+
+    void run();
+    bool sendAvailable();
+    void sendName(uint32_t id);
+};
+
+#endif // CHATREPLICA_INCLUDED
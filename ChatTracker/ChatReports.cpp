@@ -0,0 +1,140 @@
+
+#include "ChatReports.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+using namespace std;
+
+// Each thread's share of the tables is split into this many parts, so a thread that finishes early takes more
+static const size_t k_partsPerThread = 16;
+
+// Purpose: the histogram bucket of a chat's total: 0 for 0, k for 2^(k-1) to 2^k - 1
+static size_t totalBucket(int total)
+{
+    size_t k = 0;
+    for(unsigned t = unsigned(max(total, 0)); t != 0; t >>= 1)
+        k++;
+    return k;
+}
+
+// Purpose: add to counts[k], growing counts if needed
+static void addCount(vector<size_t>& counts, size_t k, size_t n)
+{
+    if(k >= counts.size())
+        counts.resize(k + 1, 0);
+    counts[k] += n;
+}
+
+// True if chat a ranks before chat b among the largest chats
+static bool ranksBefore(const ChatTracker::ChatInfo& a, const ChatTracker::ChatInfo& b)
+{
+    if(a.members != b.members)
+        return a.members > b.members;
+    return *a.name < *b.name;
+}
+
+// Partial class declaration
+// One thread's part of the report; the largest chats are kept as a heap whose top is the one ranked last
+class Partial
+{
+public:
+    explicit Partial(size_t largest) : m_largest(largest) {}
+    void addUsers(const vector<ChatTracker::UserInfo>& users);
+    void addChats(const vector<ChatTracker::ChatInfo>& chats);
+    // Adds this part into report; the largest chats are only collected into candidates
+    void mergeInto(ChatReport& report, vector<ChatTracker::ChatInfo>& candidates) const;
+private:
+    size_t m_largest;
+    ChatReport m_report;
+    vector<ChatTracker::ChatInfo> m_top;
+};
+
+void Partial::addUsers(const vector<ChatTracker::UserInfo>& users)
+{
+    m_report.users += users.size();
+    for(const ChatTracker::UserInfo& u : users)
+        addCount(m_report.chatsPerUser, u.chats, 1);
+}
+
+void Partial::addChats(const vector<ChatTracker::ChatInfo>& chats)
+{
+    // Summed here first, so threads do not keep writing next to each other's parts
+    long long total = 0;
+    for(const ChatTracker::ChatInfo& c : chats)
+    {
+        total += c.total;
+        addCount(m_report.contributionsPerChat, totalBucket(c.total), 1);
+        if(m_largest == 0)
+            continue;
+        if(m_top.size() < m_largest)
+        {
+            m_top.push_back(c);
+            push_heap(m_top.begin(), m_top.end(), ranksBefore);
+        }
+        else if(ranksBefore(c, m_top.front()))
+        {
+            pop_heap(m_top.begin(), m_top.end(), ranksBefore);
+            m_top.back() = c;
+            push_heap(m_top.begin(), m_top.end(), ranksBefore);
+        }
+    }
+    m_report.chats += chats.size();
+    m_report.totalContributions += total;
+}
+
+void Partial::mergeInto(ChatReport& report, vector<ChatTracker::ChatInfo>& candidates) const
+{
+    report.users += m_report.users;
+    report.chats += m_report.chats;
+    report.totalContributions += m_report.totalContributions;
+    for(size_t k = 0; k < m_report.contributionsPerChat.size(); k++)
+        addCount(report.contributionsPerChat, k, m_report.contributionsPerChat[k]);
+    for(size_t k = 0; k < m_report.chatsPerUser.size(); k++)
+        addCount(report.chatsPerUser, k, m_report.chatsPerUser[k]);
+    candidates.insert(candidates.end(), m_top.begin(), m_top.end());
+}
+
+ChatReport buildReport(const ChatTracker& tracker, int threads, size_t largest)
+{
+    if(threads <= 0)
+        threads = max(1, int(thread::hardware_concurrency()));
+    size_t parts = threads * k_partsPerThread;
+    vector<Partial> partials(threads, Partial(largest));
+
+    // Users and chats are numbered together: part k < parts is a part of the users, and parts + k of the chats
+    atomic<size_t> next(0);
+    auto work = [&](int t)
+    {
+        vector<ChatTracker::UserInfo> users;
+        vector<ChatTracker::ChatInfo> chats;
+        size_t k;
+        while((k = next.fetch_add(1)) < 2 * parts)
+        {
+            if(k < parts)
+            {
+                tracker.scanUsers(k, parts, users);
+                partials[t].addUsers(users);
+            }
+            else
+            {
+                tracker.scanChats(k - parts, parts, chats);
+                partials[t].addChats(chats);
+            }
+        }
+    };
+    vector<thread> pool;
+    for(int t = 1; t < threads; t++)
+        pool.push_back(thread(work, t));
+    work(0);
+    for(thread& t : pool)
+        t.join();
+
+    ChatReport report;
+    vector<ChatTracker::ChatInfo> candidates;
+    for(const Partial& p : partials)
+        p.mergeInto(report, candidates);
+    sort(candidates.begin(), candidates.end(), ranksBefore);
+    for(size_t k = 0; k < candidates.size() && k < largest; k++)
+        report.largestChats.push_back(make_pair(*candidates[k].name, candidates[k].members));
+    return report;
+}
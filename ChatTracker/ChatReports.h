@@ -0,0 +1,35 @@
+#ifndef CHATREPORTS_INCLUDED
+#define CHATREPORTS_INCLUDED
+
+#include "ChatTracker.h"
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstddef>
+
+// Aggregates over every user and chat of a tracker, for the nightly reports
+struct ChatReport
+{
+    ChatReport() : users(0), chats(0), totalContributions(0) {}
+    size_t users;
+    size_t chats;
+    long long totalContributions;  // the sum of every chat's total
+      // contributionsPerChat[0] is the number of chats with a total of 0,
+      // and contributionsPerChat[k] the number with a total from 2^(k-1)
+      // to 2^k - 1
+    std::vector<size_t> contributionsPerChat;
+      // chatsPerUser[k] is the number of users who are in k chats
+    std::vector<size_t> chatsPerUser;
+      // The chats with the most members and their numbers of members, most
+      // first (chats with as many members as each other in name order)
+    std::vector<std::pair<std::string, size_t>> largestChats;
+};
+
+// Builds the report from the tracker's scans on the given number of threads
+// (0 means one per core), listing the given number of largest chats.  Each
+// thread takes parts of the tables one at a time and adds them into a report
+// of its own, and the threads' reports are merged at the end.  Nothing may
+// change the tracker meanwhile.
+ChatReport buildReport(const ChatTracker& tracker, int threads = 0, size_t largest = 10);
+
+#endif // CHATREPORTS_INCLUDED
@@ -0,0 +1,522 @@
+// ChatServer implementation
+
+#include "ChatServer.h"
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+using namespace std;
+
+// *************** Addresses *******************
+
+// Purpose: parse tcp:PORT, tcp:HOST:PORT or unix:PATH into a socket address
+// Returns false if the address is malformed
+bool parseAddress(const string& text, sockaddr_storage& addr, socklen_t& len)
+{
+    memset(&addr, 0, sizeof(addr));
+    if(text.compare(0, 5, "unix:") == 0)
+    {
+        sockaddr_un* un = reinterpret_cast<sockaddr_un*>(&addr);
+        string path = text.substr(5);
+        if(path.empty() || path.size() >= sizeof(un->sun_path))
+            return false;
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, path.c_str());
+        len = sizeof(sockaddr_un);
+        return true;
+    }
+    if(text.compare(0, 4, "tcp:") == 0)
+    {
+        sockaddr_in* in = reinterpret_cast<sockaddr_in*>(&addr);
+        string rest = text.substr(4);
+        string host = "127.0.0.1";
+        size_t colon = rest.rfind(':');
+        if(colon != string::npos)
+        {
+            host = rest.substr(0, colon);
+            rest = rest.substr(colon + 1);
+        }
+        int port = atoi(rest.c_str());
+        if(port <= 0 || port > 65535 || inet_pton(AF_INET, host.c_str(), &in->sin_addr) != 1)
+            return false;
+        in->sin_family = AF_INET;
+        in->sin_port = htons(uint16_t(port));
+        len = sizeof(sockaddr_in);
+        return true;
+    }
+    return false;
+}
+
+void setNonBlocking(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+void setNoDelay(int fd, const sockaddr_storage& addr)
+{
+    int one = 1;
+    if(addr.ss_family == AF_INET)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// *************** Requests *******************
+
+// Purpose: carry out one request line on the tracker and append its answer (and a newline) to out
+// Fields are split the same way the tester splits them: the chat name is the rest of the line, spaces included
+void ChatServer::execute(ChatTracker& ct, const string& line, string& out)
+{
+    istringstream iss(line);
+    string op;
+    string user;
+    string chat;
+    int result = 0;
+    bool ok = false;
+    char ch;
+    if(iss >> op && op.size() == 1)
+    {
+        switch(op[0])
+        {
+          case 'j':
+            if(iss >> user >> ch)
+            {
+                iss.unget();
+                getline(iss, chat);
+                ct.join(user, chat);
+                ok = true;
+            }
+            break;
+          case 't':
+            if(iss >> ch)
+            {
+                iss.unget();
+                getline(iss, chat);
+                result = ct.terminate(chat);
+                ok = true;
+            }
+            break;
+          case 'c':
+            if(iss >> user)
+            {
+                result = ct.contribute(user);
+                ok = true;
+            }
+            break;
+          case 'l':
+            if(iss >> user)
+            {
+                if(iss >> ch)
+                {
+                    iss.unget();
+                    getline(iss, chat);
+                    result = ct.leave(user, chat);
+                }
+                else
+                    result = ct.leave(user);
+                ok = true;
+            }
+            break;
+        }
+    }
+    if(ok)
+        out += to_string(result);
+    else
+        out += "error";
+    out += '\n';
+}
+
+// *************** Connections *******************
+
+struct Connection
+{
+    int fd;
+    string in;      // bytes read but not yet part of a complete line
+    string out;     // answers not yet written
+    bool writable;  // false while the socket's send buffer is full
+    bool ended;     // the client has shut down its side; nothing more will be read
+    bool skipping;  // the line being read is too long and is discarded up to its newline
+};
+
+// Purpose: carry out the complete request lines in c.in, appending their answers to c.out
+// A line longer than k_maxLine is answered with "error" once and discarded; once the input has ended,
+// what is left of it is the last line
+void executeLines(ChatTracker& ct, Connection& c)
+{
+    size_t start = 0;
+    size_t end;
+    while((end = c.in.find('\n', start)) != string::npos)
+    {
+        size_t len = end - start;
+        if(len > 0 && c.in[end - 1] == '\r')
+            len--;
+        if(c.skipping)
+            c.skipping = false;
+        else if(len > ChatServer::k_maxLine)
+            c.out += "error\n";
+        else if(len > 0)
+            ChatServer::execute(ct, c.in.substr(start, len), c.out);
+        start = end + 1;
+    }
+    c.in.erase(0, start);
+    if(c.in.size() > ChatServer::k_maxLine)
+    {
+        if(!c.skipping)
+            c.out += "error\n";
+        c.skipping = true;
+        c.in.clear();
+    }
+    if(c.ended)
+    {
+        if(!c.skipping && !c.in.empty())
+            ChatServer::execute(ct, c.in, c.out);
+        c.in.clear();
+    }
+}
+
+// Purpose: write as much of c.out as the socket accepts
+// Returns false if the connection has failed
+bool flush(Connection& c)
+{
+    size_t sent = 0;
+    while(sent < c.out.size())
+    {
+        ssize_t n = ::send(c.fd, c.out.data() + sent, c.out.size() - sent, 0);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return false;
+        }
+        sent += size_t(n);
+    }
+    c.out.erase(0, sent);
+    return true;
+}
+
+// *************** Poller *******************
+
+// Event loop wrapper: epoll on Linux, poll elsewhere
+// wait() returns the fds that are ready.  A connection is watched for reading until its input ends (but not
+// while too many of its answers are unsent), and for writing only while it has unsent answers.
+class Poller
+{
+public:
+    Poller();
+    ~Poller();
+    void add(int fd);
+    void remove(int fd);
+    void watch(int fd, bool reads, bool writes);
+    void wait(vector<int>& ready);
+private:
+#ifdef __linux__
+    int m_epoll;
+#else
+    vector<pollfd> m_fds;
+#endif
+};
+
+#ifdef __linux__
+Poller::Poller()
+{
+    m_epoll = epoll_create1(0);
+}
+
+Poller::~Poller()
+{
+    close(m_epoll);
+}
+
+void Poller::add(int fd)
+{
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev);
+}
+
+void Poller::remove(int fd)
+{
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+void Poller::watch(int fd, bool reads, bool writes)
+{
+    epoll_event ev;
+    ev.events = (reads ? uint32_t(EPOLLIN) : 0) | (writes ? uint32_t(EPOLLOUT) : 0);
+    ev.data.fd = fd;
+    epoll_ctl(m_epoll, EPOLL_CTL_MOD, fd, &ev);
+}
+
+void Poller::wait(vector<int>& ready)
+{
+    epoll_event events[256];
+    int n = epoll_wait(m_epoll, events, 256, -1);
+    ready.clear();
+    for(int k = 0; k < n; k++)
+        ready.push_back(events[k].data.fd);
+}
+#else
+Poller::Poller()
+{
+}
+
+Poller::~Poller()
+{
+}
+
+void Poller::add(int fd)
+{
+    pollfd p;
+    p.fd = fd;
+    p.events = POLLIN;
+    p.revents = 0;
+    m_fds.push_back(p);
+}
+
+void Poller::remove(int fd)
+{
+    for(size_t k = 0; k < m_fds.size(); k++)
+    {
+        if(m_fds[k].fd == fd)
+        {
+            m_fds.erase(m_fds.begin() + k);
+            return;
+        }
+    }
+}
+
+void Poller::watch(int fd, bool reads, bool writes)
+{
+    for(pollfd& p : m_fds)
+        if(p.fd == fd)
+            p.events = (reads ? POLLIN : 0) | (writes ? POLLOUT : 0);
+}
+
+void Poller::wait(vector<int>& ready)
+{
+    ready.clear();
+    if(::poll(m_fds.data(), m_fds.size(), -1) <= 0)
+        return;
+    for(const pollfd& p : m_fds)
+        if(p.revents != 0)
+            ready.push_back(p.fd);
+}
+#endif
+
+// *************** Server *******************
+
+ChatServer::ChatServer(ChatTracker& ct)
+ : m_ct(ct), m_listener(-1), m_stopping(false)
+{
+    memset(&m_addr, 0, sizeof(m_addr));
+    m_wake[0] = m_wake[1] = -1;
+    if(pipe(m_wake) == 0)
+    {
+        setNonBlocking(m_wake[0]);
+        setNonBlocking(m_wake[1]);
+    }
+}
+
+ChatServer::~ChatServer()
+{
+    if(m_listener >= 0)
+        close(m_listener);
+    if(m_wake[0] >= 0)
+    {
+        close(m_wake[0]);
+        close(m_wake[1]);
+    }
+}
+
+bool ChatServer::listen(const string& address)
+{
+    sockaddr_storage addr;
+    socklen_t addrLen;
+    if(m_listener >= 0 || !parseAddress(address, addr, addrLen))
+        return false;
+    if(addr.ss_family == AF_UNIX)
+        unlink(reinterpret_cast<sockaddr_un*>(&addr)->sun_path);
+
+    int listener = socket(addr.ss_family, SOCK_STREAM, 0);
+    if(listener < 0)
+        return false;
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if(::bind(listener, reinterpret_cast<sockaddr*>(&addr), addrLen) != 0 || ::listen(listener, 128) != 0)
+    {
+        close(listener);
+        return false;
+    }
+    setNonBlocking(listener);
+    m_listener = listener;
+    m_addr = addr;
+    return true;
+}
+
+void ChatServer::stop()
+{
+    m_stopping.store(true);
+    char byte = 0;
+    // If the pipe is full, the event loop is about to wake anyway
+    if(write(m_wake[1], &byte, 1) < 0)
+        return;
+}
+
+void ChatServer::run()
+{
+    Poller poller;
+    poller.add(m_listener);
+    poller.add(m_wake[0]);
+    vector<Connection*> connections;  // indexed by fd
+    vector<int> ready;
+    vector<Connection*> batch;
+    char buf[64 * 1024];
+    // A descriptor kept open so that a connection can still be accepted, and closed, when the process has no others
+    int reserve = open("/dev/null", O_RDONLY);
+    bool listening = true;
+
+    // Purpose: forget a connection that is finished or has failed
+    // Its descriptor is free again, so a listener that ran out of them is watched again
+    auto drop = [&](Connection* c)
+    {
+        poller.remove(c->fd);
+        close(c->fd);
+        connections[c->fd] = nullptr;
+        delete c;
+        if(!listening)
+        {
+            poller.watch(m_listener, true, false);
+            listening = true;
+        }
+    };
+
+    while(!m_stopping.load())
+    {
+        poller.wait(ready);
+        batch.clear();
+
+        // Read everything that is available on the ready connections
+        for(int fd : ready)
+        {
+            if(fd == m_wake[0])
+            {
+                while(read(fd, buf, sizeof(buf)) > 0)
+                    ;
+                continue;
+            }
+            if(fd == m_listener)
+            {
+                for(;;)
+                {
+                    int client = accept(m_listener, nullptr, nullptr);
+                    if(client < 0 && (errno == EINTR || errno == ECONNABORTED))
+                        continue;
+                    if(client < 0 && (errno == EMFILE || errno == ENFILE))
+                    {
+                        // A pending connection would keep the listener ready, so it is turned away with the
+                        // reserve descriptor (accept fails this way even with none pending); without the reserve,
+                        // the listener is left alone until a connection closes
+                        if(reserve >= 0)
+                        {
+                            close(reserve);
+                            int turnedAway = accept(m_listener, nullptr, nullptr);
+                            bool pending = turnedAway >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+                            if(turnedAway >= 0)
+                                close(turnedAway);
+                            reserve = open("/dev/null", O_RDONLY);
+                            if(turnedAway >= 0)
+                                continue;
+                            if(!pending)
+                                break;
+                        }
+                        poller.watch(m_listener, false, false);
+                        listening = false;
+                    }
+                    if(client < 0)
+                        break;
+                    setNonBlocking(client);
+                    setNoDelay(client, m_addr);
+                    if(size_t(client) >= connections.size())
+                        connections.resize(client + 1, nullptr);
+                    connections[client] = new Connection{client, "", "", true, false, false};
+                    poller.add(client);
+                }
+                continue;
+            }
+            Connection* c = (size_t(fd) < connections.size() ? connections[fd] : nullptr);
+            if(c == nullptr)
+                continue;
+            // The rest of a large burst is read the next time round (the connection stays ready), and a
+            // connection with too many answers waiting is not read at all until they are written
+            bool failed = false;
+            size_t received = 0;
+            while(!c->ended && received < k_maxRead && c->out.size() < k_maxPending)
+            {
+                ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+                if(n > 0)
+                {
+                    c->in.append(buf, size_t(n));
+                    received += size_t(n);
+                    continue;
+                }
+                if(n < 0 && errno == EINTR)
+                    continue;
+                if(n == 0)
+                    c->ended = true;
+                else if(errno != EAGAIN && errno != EWOULDBLOCK)
+                    failed = true;
+                break;
+            }
+            if(failed)
+            {
+                drop(c);
+                continue;
+            }
+            // A connection that was waiting for its send buffer may be writable again
+            c->writable = true;
+            batch.push_back(c);
+        }
+
+        // Apply every complete request of the batch, connection by connection, in order
+        for(Connection* c : batch)
+            executeLines(m_ct, *c);
+
+        // Write the answers; connections whose send buffer fills up are watched until they can take more,
+        // and a connection whose input has ended is closed once its answers are written
+        for(Connection* c : batch)
+        {
+            if(c->writable && !c->out.empty() && !flush(*c))
+            {
+                drop(c);
+                continue;
+            }
+            if(c->ended && c->out.empty())
+            {
+                drop(c);
+                continue;
+            }
+            c->writable = c->out.empty();
+            poller.watch(c->fd, !c->ended && c->out.size() < k_maxPending, !c->writable);
+        }
+    }
+
+    for(Connection* c : connections)
+        if(c != nullptr)
+            drop(c);
+    if(reserve >= 0)
+        close(reserve);
+}
@@ -0,0 +1,77 @@
+#ifndef CHATSERVER_INCLUDED
+#define CHATSERVER_INCLUDED
+
+#include "ChatTracker.h"
+#include <string>
+#include <atomic>
+#include <cstddef>
+#include <sys/socket.h>
+
+// Serves a ChatTracker over stream sockets.  Each request is one line in the
+// tester's format:
+//   j userName chatName     join       (answered with 0)
+//   t chatName              terminate
+//   c userName              contribute
+//   l userName [chatName]   leave
+// and is answered with one line holding the int result.  Clients may
+// pipeline: send many requests before reading the answers, which come back
+// in order.  A line that cannot be parsed, or that is longer than
+// k_maxLine bytes, is answered with "error".  A client that shuts down its
+// side of the connection still gets the answers to every request it sent
+// (the end of input ends a last line that has no newline); the server
+// closes the connection once they are written.
+//
+// The server is single threaded: one event loop (epoll on Linux, poll
+// elsewhere) reads every connection that is ready, applies all the complete
+// requests it read to the tracker as one batch, and then writes the answers.
+// The event loop is therefore the tracker's only writer.  It reads at most
+// k_maxRead bytes from a connection each time round, so one busy client
+// cannot hold up the others, and stops reading a connection while it has
+// k_maxPending bytes of answers still to write, so a client that sends
+// without reading cannot make the server hold ever more answers.  When the
+// process runs out of file descriptors, a connection that cannot be kept is
+// accepted with a descriptor held in reserve for that and closed at once
+// (or, if the reserve cannot be had, the server stops accepting until a
+// connection closes) rather than left waiting to wake the loop again.
+class ChatServer
+{
+  public:
+    static const size_t k_maxLine = 64 * 1024;
+    static const size_t k_maxRead = 256 * 1024;
+    static const size_t k_maxPending = 1024 * 1024;
+
+      // Serves ct, which must outlive the server and which nothing else
+      // may use while run is running
+    explicit ChatServer(ChatTracker& ct);
+    ~ChatServer();
+      // Listens on address: tcp:PORT, tcp:HOST:PORT or unix:PATH.  Returns
+      // false if the address is malformed or cannot be listened on.
+    bool listen(const std::string& address);
+      // Serves connections until stop is called; the connections still open
+      // are then closed
+    void run();
+      // Makes run return; may be called from any thread
+    void stop();
+      // Carries out one request line on ct and appends its answer (and a
+      // newline) to out
+    static void execute(ChatTracker& ct, const std::string& line, std::string& out);
+      // We prevent a ChatServer object from being copied or assigned
+    ChatServer(const ChatServer&) = delete;
+    ChatServer& operator=(const ChatServer&) = delete;
+
+  private:
+    ChatTracker& m_ct;
+    int m_listener;
+    int m_wake[2];  // a pipe that stop writes to, to wake the event loop
+    sockaddr_storage m_addr;  // the address listened on
+    std::atomic<bool> m_stopping;
+};
+
+// Parses tcp:PORT, tcp:HOST:PORT or unix:PATH into a socket address; returns
+// false if the address is malformed
+bool parseAddress(const std::string& text, sockaddr_storage& addr, socklen_t& len);
+// Turns off Nagle's algorithm on a TCP socket, so pipelined requests and
+// answers are not held back
+void setNoDelay(int fd, const sockaddr_storage& addr);
+
+#endif // CHATSERVER_INCLUDED
@@ -0,0 +1,224 @@
+// ChatTracker server and load generator
+//
+//   ChatServer serve ADDRESS [expectedUsers]
+//      Serves one ChatTracker on ADDRESS, which is tcp:PORT or unix:PATH,
+//      with the line protocol described in ChatServer.h.
+//
+//   ChatServer load ADDRESS TRACEFILE CONCURRENCY[,CONCURRENCY...] [DEPTH]
+//      For each concurrency level, opens that many connections (one thread
+//      each), replays TRACEFILE on every connection keeping up to DEPTH
+//      requests in flight, and reports throughput and latency percentiles.
+
+#include "ChatTracker.h"
+#include "ChatServer.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+using namespace std;
+
+// *************** Server *******************
+
+int serve(const string& address, size_t expectedUsers)
+{
+    ChatTracker::Options options;
+    options.expectedUsers = expectedUsers;
+    options.expectedChats = expectedUsers / 10;
+    options.expectedMemberships = expectedUsers * 2;
+    ChatTracker ct(options);
+    ChatServer server(ct);
+    if(!server.listen(address))
+    {
+        cerr << "Cannot listen on " << address << endl;
+        return 1;
+    }
+    cerr << "Serving on " << address << endl;
+    server.run();
+    return 0;
+}
+
+// *************** Load generator *******************
+
+class Timer
+{
+  public:
+    Timer()
+    {
+        start();
+    }
+    void start()
+    {
+        m_time = std::chrono::steady_clock::now();
+    }
+    double elapsed() const
+    {
+        std::chrono::duration<double,std::milli> diff =
+                          std::chrono::steady_clock::now() - m_time;
+        return diff.count();
+    }
+  private:
+    std::chrono::steady_clock::time_point m_time;
+};
+
+// Purpose: replay the trace over one connection, keeping up to depth requests in flight,
+// and record the latency (in microseconds) of every request in latencies
+void runClient(const sockaddr_storage& addr, socklen_t addrLen, const vector<string>& lines, size_t depth,
+               vector<double>& latencies, bool& failed)
+{
+    int fd = socket(addr.ss_family, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, reinterpret_cast<const sockaddr*>(&addr), addrLen) != 0)
+    {
+        failed = true;
+        return;
+    }
+    setNoDelay(fd, addr);
+
+    vector<std::chrono::steady_clock::time_point> sentAt(lines.size());
+    size_t sent = 0;
+    size_t answered = 0;
+    string in;
+    string out;
+    char buf[64 * 1024];
+    latencies.reserve(lines.size());
+    while(answered < lines.size())
+    {
+        // Top up the pipeline
+        out.clear();
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        while(sent < lines.size() && sent - answered < depth)
+        {
+            out += lines[sent];
+            out += '\n';
+            sentAt[sent++] = now;
+        }
+        size_t off = 0;
+        while(off < out.size())
+        {
+            ssize_t n = ::send(fd, out.data() + off, out.size() - off, 0);
+            if(n <= 0)
+            {
+                failed = true;
+                close(fd);
+                return;
+            }
+            off += size_t(n);
+        }
+
+        // Read at least one answer
+        ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+        if(n <= 0)
+        {
+            failed = true;
+            close(fd);
+            return;
+        }
+        in.append(buf, size_t(n));
+        now = std::chrono::steady_clock::now();
+        size_t start = 0;
+        size_t end;
+        while((end = in.find('\n', start)) != string::npos)
+        {
+            std::chrono::duration<double,std::micro> d = now - sentAt[answered++];
+            latencies.push_back(d.count());
+            start = end + 1;
+        }
+        in.erase(0, start);
+    }
+    close(fd);
+}
+
+double percentile(const vector<double>& sorted, double p)
+{
+    if(sorted.empty())
+        return 0;
+    size_t k = size_t(p * (sorted.size() - 1));
+    return sorted[k];
+}
+
+int load(const string& address, const string& traceFile, const string& levels, size_t depth)
+{
+    sockaddr_storage addr;
+    socklen_t addrLen;
+    if(!parseAddress(address, addr, addrLen))
+    {
+        cerr << "Bad address " << address << endl;
+        return 1;
+    }
+    ifstream tracef(traceFile);
+    if(!tracef)
+    {
+        cerr << "Cannot open " << traceFile << endl;
+        return 1;
+    }
+    vector<string> lines;
+    string line;
+    while(getline(tracef, line))
+        if(!line.empty())
+            lines.push_back(line);
+
+    cout << "connections   requests/sec     p50 usec     p99 usec   p99.9 usec" << endl;
+    istringstream levelss(levels);
+    string level;
+    while(getline(levelss, level, ','))
+    {
+        int conns = atoi(level.c_str());
+        if(conns <= 0)
+            continue;
+        vector<vector<double>> latencies(conns);
+        vector<char> failed(conns, false);
+        vector<thread> threads;
+        Timer timer;
+        for(int k = 0; k < conns; k++)
+        {
+            threads.push_back(thread([&, k]
+            {
+                bool f = false;
+                runClient(addr, addrLen, lines, depth, latencies[k], f);
+                failed[k] = f;
+            }));
+        }
+        for(thread& t : threads)
+            t.join();
+        double elapsed = timer.elapsed();
+
+        vector<double> all;
+        for(int k = 0; k < conns; k++)
+        {
+            if(failed[k])
+                cerr << "Connection " << k << " failed" << endl;
+            all.insert(all.end(), latencies[k].begin(), latencies[k].end());
+        }
+        sort(all.begin(), all.end());
+        cout.width(11);
+        cout << conns;
+        cout.width(15);
+        cout << size_t(all.size() / (elapsed / 1000));
+        cout.width(13);
+        cout << percentile(all, 0.5);
+        cout.width(13);
+        cout << percentile(all, 0.99);
+        cout.width(13);
+        cout << percentile(all, 0.999) << endl;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    signal(SIGPIPE, SIG_IGN);
+    if(argc >= 3 && string(argv[1]) == "serve")
+        return serve(argv[2], argc >= 4 ? size_t(atol(argv[3])) : 0);
+    if(argc >= 5 && string(argv[1]) == "load")
+        return load(argv[2], argv[3], argv[4], argc >= 6 ? size_t(atol(argv[5])) : 16);
+    cerr << "usage: " << argv[0] << " serve tcp:PORT|unix:PATH [expectedUsers]" << endl
+         << "       " << argv[0] << " load tcp:[HOST:]PORT|unix:PATH TRACEFILE CONCURRENCY[,CONCURRENCY...] [DEPTH]" << endl;
+    return 1;
+}
@@ -1,166 +1,428 @@
 
 #include "ChatTracker.h"
+#include "HashMap.h"
+#include "NodePool.h"
+#include "ChangeFeed.h"
+#include "NameStore.h"
+#include "TenantPool.h"
+#include "DeltaCounters.h"
+#include "Varint.h"
+#include "TraceEvents.h"
 #include <string>
 #include <list>
 #include <vector>
 #include <functional>
+#include <memory>
 #include <utility>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/wait.h>
 using namespace std;
 
+// Estimated heap bytes owned by a copy of s (nothing if s fits in the string's small buffer)
+static size_t stringBytes(const string& s)
+{
+    static const size_t smallCapacity = string().capacity();
+    return s.size() > smallCapacity ? s.size() + 1 : 0;
+}
+
+// Estimated bytes of one std::list node holding a T (two links plus the element)
+template <typename T>
+static size_t listNodeBytes()
+{
+    return 2 * sizeof(void*) + sizeof(T);
+}
+
+
+// Marks a user or chat whose name has not been given an ID by the change feed yet
+static const uint32_t k_noFeedId = UINT32_MAX;
+// Marks a membership whose slot in its chat's list of users is not known (the user was reloaded from the spill file)
+static const uint32_t k_noSlot = UINT32_MAX;
+
+class User;
+// List of users ordered by activity
+typedef list<User*, PoolAllocator<User*>> RecencyList;
 
-// Templated HashMap class declaration
-// Class accepts two different types of data types: one that represents the key value and one that represents the value
-template <typename KeyType, typename ValueType>
-class HashMap
+// MemberList class declaration
+// The users in a chat, in the order they joined, kept as the IDs of their names in an array of slots so that the
+// members can be counted in O(1) and read a page at a time by slot number.  A user who leaves leaves an empty slot;
+// once at least half of the slots are empty the members are moved down to fill them.  The list also points at the
+// chat's name and total, which the tracker's tables own, so a user in the chat can reach them without a lookup.
+// Each list has an ID the tracker gives it, which stays the same while the chat exists.
+class MemberList
 {
 public:
-    HashMap(int maxBuckets);
-    ~HashMap();
-    void associate(const KeyType& key, const ValueType& value);
-    void erase(const KeyType& key);
-    ValueType* find(const KeyType& key);
-private:
-    vector<list<pair<KeyType, ValueType>>> m_map;
-    int m_maxBucks;
-    size_t m_size;
-    unsigned getBucketNumber(const KeyType& key)
+    MemberList() : m_count(0), m_id(0), m_name(nullptr), m_total(nullptr) {}
+    // Adds user in a new slot at the end and returns the slot
+    uint32_t add(NameStore::Id user);
+    // Removes user, looking in the given slot first (it may be k_noSlot)
+    // Returns false if user is not a member
+    bool remove(NameStore::Id user, uint32_t slot);
+    // True once at least half of the slots are empty
+    bool needsCompaction() const { return m_members.size() >= 2 * size_t(m_count); }
+    // Moves the members down over the empty slots, keeping their order, and calls moved(user, slot) for each
+    // member that moved
+    template <typename Func>
+    void compact(Func moved);
+    size_t size() const { return m_count; }
+    bool empty() const { return m_count == 0; }
+    size_t slots() const { return m_members.size(); }
+    // The member in a slot, or NameStore::k_noName if the slot is empty
+    NameStore::Id member(size_t slot) const { return m_members[slot]; }
+    // Purpose: call f(user) for each member, in the order they joined
+    template <typename Func>
+    void forEach(Func f) const
     {
-        std::hash<KeyType> hash;
-        unsigned h = hash(key);
-        return h % m_map.size();
+        for(NameStore::Id user : m_members)
+        {
+            if(user != NameStore::k_noName)
+                f(user);
+        }
     }
+    // Heap bytes owned by the list
+    size_t memoryUsage() const { return m_members.capacity() * sizeof(NameStore::Id); }
+    // The chat's name (the key of its entry in the table of totals) and its total
+    const string& name() const { return *m_name; }
+    int& total() const { return *m_total; }
+    void setChat(const string* name, int* total) { m_name = name; m_total = total; }
+    uint32_t id() const { return m_id; }
+    void setId(uint32_t id) { m_id = id; }
+private:
+    vector<NameStore::Id> m_members;
+    // (32 bits each, so the ID fits without growing the list)
+    uint32_t m_count;
+    uint32_t m_id;
+    const string* m_name;
+    int* m_total;
 };
 
-
 // User class declaration
 // Each user object has a list of Chat struct objects that keeps track of the user's contributinos to that chat
 class User
 {
 public:
-    User(string name, int maxBuckets);
+    User(NameStore::Id name, NodePool* pool);
     ~User();
-    bool operator==(const User& other);
-    string name();
+    // The ID of the user's name in the tracker's store of names
+    NameStore::Id name() const;
     int currentCount();
-    void addCurrentChat(const string& name);
-    bool getCurrentChat(string& name);
-    int leaveChat(const string& name);
+    bool addCurrentChat(MemberList* chat);
+    MemberList* currentChat() const;
+    bool hasNoChats() const;
+    // Also sets slot to the user's slot in the chat's list of users
+    int leaveChat(const MemberList* chat, uint32_t& slot);
     int leaveCurrentChat();
     void setCurrentCount(int num);
-    
+    // The user's slot in its current chat's list of users, and in the list of users of the given chat
+    uint32_t currentChatSlot() const;
+    void setCurrentChatSlot(uint32_t slot);
+    void setChatSlot(const MemberList* chat, uint32_t slot);
+    template <typename Func>
+    void forEachChat(Func f) const;
+    size_t chatCount() const;
+    // Sets position to the chat's place in the user's chats (0 for the current chat) and count to the user's
+    // contributions to it; returns false if the user is not in the chat
+    bool findChat(const MemberList* chat, size_t& position, int& count) const;
+    size_t memoryUsage() const;
+    void save(ostream& out) const;
+    // chatOf(name) finds the list of users of the chat with the name (chats that are not found are skipped)
+    template <typename ChatOf>
+    void load(istream& in, ChatOf chatOf);
+    // Calls f(chatName, count) for each chat of a record written by save, in order; returns false if the record
+    // cannot be read
+    template <typename Func>
+    static bool readRecord(istream& in, Func f);
+    // Adds a chat after all of the user's other chats (used when building the user from a dump)
+    void appendChat(MemberList* chat, int count, uint32_t slot);
+    // The user's chats (in order) with their counts and slots, compressed for the cold tier into a blob appended
+    // to blobs, and the (empty) list of chats rebuilt from such a blob.  Chats are coded by the IDs of their lists
+    // of users, and chats (indexed by ID) gives the list each ID stands for.  A slot that its chat's list of users
+    // has since moved is not kept, and a chat whose ID no longer stands for a list is skipped.
+    void compress(string& blobs) const;
+    void decompress(const char* blob, const vector<MemberList*>& chats);
+    // Calls f(chat, count, slot) for each chat of a blob that compress made of the user whose name has the given
+    // ID, as decompress would rebuild them, without rebuilding anything; returns false if it skipped a chat
+    template <typename Func>
+    static bool forEachCompressedChat(const char* blob, const vector<MemberList*>& chats, NameStore::Id name, Func f);
+    // The number of chats and the contributions to them that a compressed user holds, and the blob's length
+    static void summarize(const char* blob, size_t& chats, long long& contributions);
+    static size_t compressedSize(const char* blob);
+    RecencyList::iterator recency() const;
+    void setRecency(RecencyList::iterator pos);
+    // When the user was last active, in milliseconds of the tracker's clock (kept only while it has a cold tier)
+    uint32_t touched() const;
+    void setTouched(uint32_t msec);
+    // IDs of the user's name and of its current chat's name in the change feed
+    uint32_t feedId() const;
+    void setFeedId(uint32_t id);
+    uint32_t currentChatFeedId() const;
+    void setCurrentChatFeedId(uint32_t id);
+    // Sets aside pool memory for count more chats (in any users' lists of chats)
+    static void reserveChats(NodePool& pool, size_t count);
+
 private:
-    string m_name;
     struct Chat
     {
-        string name;
+        // The chat's list of users, which also leads to the chat's name and total
+        MemberList* chat;
         int count;
+        uint32_t feedId;
+        // Where the user is in the chat's list of users, so leaving the chat does not search the list
+        uint32_t slot;
     };
-    list<Chat> m_allChats;
-    int m_numBucks;
+    list<Chat, PoolAllocator<Chat>> m_allChats;
+    // Heap bytes owned by this user: the nodes of its list of chats
+    // (32 bits are plenty for one user, and leave room for the feed ID without growing the user)
+    uint32_t m_bytes;
+    uint32_t m_feedId;
+    NameStore::Id m_name;
+    uint32_t m_touched;
+    // This user's position in the tracker's list of users ordered by recent activity
+    RecencyList::iterator m_recency;
 };
     
 class ChatTrackerImpl
 {
 public:
-    ChatTrackerImpl(int maxBuckets);
-    void join(string user, string chat);
-    int terminate(string chat);
-    int contribute(string user);
-    int leave(string user, string chat);
-    int leave(string user);
-    
+    // Tables start with at least buckets buckets, which (unlike the options' sizes) sets no nodes aside
+    ChatTrackerImpl(const ChatTracker::Options& options, size_t buckets = 0);
+    ~ChatTrackerImpl();
+    void reserve(size_t users, size_t chats, size_t memberships);
+    void join(const string& user, const string& chat);
+    int terminate(const string& chat);
+    int contribute(const string& user);
+    int leave(const string& user, const string& chat);
+    int leave(const string& user);
+    int chatTotal(const string& chat) const;
+    vector<string> members(const string& chat) const;
+    size_t memberCount(const string& chat) const;
+    void forEachMember(const string& chat, void (*callback)(void*, const string&), void* context) const;
+    size_t members(const string& chat, size_t cursor, size_t limit, vector<string>& out) const;
+    string currentChat(const string& user);
+    void setMemoryBudget(size_t maxBytes, const string& spillPath);
+    void setColdTier(unsigned idleMsec);
+    size_t memoryUsage() const;
+    ChangeFeed& enableChangeFeed(size_t batchSize);
+    ChangeFeed* changeFeed() const;
+    // Builds the state a dump describes into this (empty) tracker
+    void bulkLoad(const ChatTracker::Dump& dump, int threads);
+    void scanUsers(size_t part, size_t parts, vector<ChatTracker::UserInfo>& out) const;
+    void scanChats(size_t part, size_t parts, vector<ChatTracker::ChatInfo>& out) const;
+    bool checkpointAsync(const string& path);
+    bool checkpointRunning();
+    bool waitForCheckpoint();
+    LatencyRecorder& latency() { return *m_latency; }
+
 private:
-    // Hash table that hashes by user's name and returns a User object:
-    HashMap<string, User> m_users;
+    // Memory for table entries and list nodes (declared first, so it outlives everything allocated from it),
+    // and the pool they come from: m_pool, or the pool of the tenant pool the tracker was built with
+    NodePool m_pool;
+    NodePool* m_nodes;
+    // The chats' table entries come from a pool apart from the users' nodes (unless the tracker has a tenant
+    // pool), so the chats, which outlive most of their members, do not keep the chunks of users who are frozen
+    // or evicted from being given back
+    NodePool m_chatPool;
+    NodePool* m_chatNodes;
+    // The pools the threads that built the tracker from a dump took the users' nodes from.  Once the load is
+    // done m_pool owns their chunks, since the table frees entries to m_pool; the lists of the users they built
+    // still take nodes from them.  (The chats' entries came from pools of their own, which m_chatPool took
+    // over outright.)
+    list<NodePool> m_loadPools;
+    // The names of the users, once each, front coded; member lists and users refer to them by ID.  m_names is
+    // m_ownNames, or the store of names of the tenant pool the tracker was built with.
+    NameStore m_ownNames;
+    NameStore* m_names;
+    // Hash table that hashes by user's name and returns a User object.  A user is keyed by the ID of its name, so
+    // the name is kept once, in m_names; a lookup compares the name only with entries whose hash is the name's
+    // (see findUser).
+    HashMap<NameStore::Id, User> m_users;
     // Hash table that hashes by chat's name and returns an integer that tracks number of contributions to that chat:
     HashMap<string, int> m_chatCount;
-    // Hash table that hashes by chat's name and returns a list of strings that represents the names of users in the chat:
-    HashMap<string, list<string>> m_chatID;
-    
-    int m_numBucks;
+    // Hash table that hashes by chat's name and returns the list of the users in the chat.  A chat with members
+    // always has a total, so a list is keyed by the address of its chat's name in m_chatCount, and the name is
+    // kept once (see findChat).
+    HashMap<const string*, MemberList> m_chatID;
+    // The chats' lists of users by their IDs (nullptr for an unused ID), and the unused IDs below the last one
+    vector<MemberList*> m_chatsById;
+    vector<uint32_t> m_freeChatIds;
+
+    // Memory accounting: heap bytes owned by keys, users and member lists (the tables count their own nodes)
+    size_t m_heapBytes;
+    // Memory budget in bytes (0 means unlimited)
+    size_t m_budget;
+    // Users in order of activity, most recently active first; the last user is the first to be evicted
+    RecencyList m_recency;
+    // Evicted users are appended to this file; m_spilled maps the ID each evicted user's name keeps while the user
+    // is still a member of its chats to its record's offset and length (hashed by the name, as m_users is)
+    struct SpilledUser
+    {
+        long long offset;
+        uint32_t bytes;
+    };
+    // (the stream is made when a spill file is first set, so a tracker without one does not carry it)
+    string m_spillPath;
+    unique_ptr<fstream> m_spill;
+    HashMap<NameStore::Id, SpilledUser> m_spilled;
+    // Bytes of the spill file in the records of users still spilled, and in the records of users since reloaded
+    long long m_spillLive;
+    long long m_spillDead;
+    // Receives an event for every change when the change feed is enabled (nullptr otherwise)
+    ChangeFeed* m_feed;
+    // The child process writing a checkpoint (0 if none is being written), and whether the last one was written
+    pid_t m_checkpointer;
+    bool m_checkpointOk;
+    // Sampled latencies of the operations (the ChatTracker functions time them), in a recorder of the
+    // tracker's own or its tenant pool's
+    unique_ptr<LatencyRecorder> m_ownLatency;
+    LatencyRecorder* m_latency;
+    // The cold tier: users idle for m_coldAfter milliseconds (0 for no cold tier) are kept compressed in m_cold,
+    // out of m_users and m_recency, until they are next used.  Times are milliseconds since m_epoch.
+    // A cold user is keyed by the ID of its name, which it keeps in its chats' lists of users, and hashed by the
+    // name itself (see findUser), so it costs an entry of the table's own pool (where cold users do not keep the
+    // chunks freed by hot ones from being given back) and its blob.  The blobs are appended to m_coldBlobs; a
+    // thawed user's blob is left there as dead bytes until m_coldBlobs is compacted.
+    struct ColdUser
+    {
+        size_t offset;  // of the user's blob in m_coldBlobs (see User::compress)
+    };
+    NodePool m_coldPool;
+    HashMap<NameStore::Id, ColdUser> m_cold;
+    string m_coldBlobs;
+    size_t m_coldDead;
+    uint32_t m_coldAfter;
+    chrono::steady_clock::time_point m_epoch;
+    // With concurrent contributions, the increments of chats' totals that contributing threads have not yet had
+    // folded into m_chatCount (nullptr otherwise)
+    unique_ptr<DeltaCounters> m_deltas;
+    // Estimated bytes of nodes that freezing and evicting users have freed since the pools were last trimmed
+    size_t m_freedBytes;
+
+    // The hash the tables of users (hot, cold and evicted) are hashed by: the hash of the user's name
+    static uint64_t hashName(const string& user);
+    // Finds a user, reloading it from the spill file if it was evicted
+    User* findUser(const string& user);
+    // Finds a member of a chat, whose name is known to have the given ID, so entries are matched by ID
+    User* findMember(const string& user, NameStore::Id name);
+    // Both find the user whose name hashes as user's and has an ID for which match(id) is true
+    template <typename Match>
+    User* findUser(const string& user, Match match);
+    // Creates a user whose name has the given ID, or a new ID if it is k_noName
+    User* createUser(const string& user, NameStore::Id name = NameStore::k_noName);
+    void eraseUser(const string& user, User* u);
+    // Heap bytes a user's name is counted as: nothing in the tracker's own store of names, which is counted
+    // whole, and the name's length in a store shared with other trackers
+    size_t nameBytes(const string& user) const;
+    // Marks the user as the most recently active one
+    void touchUser(User* u);
+    // The tracker's clock, in milliseconds (it wraps after 49 days, which only matters to a user that no sweep
+    // has seen for that long)
+    uint32_t clockMsec() const;
+    // Compresses the users idle for m_coldAfter milliseconds, least recently active first
+    void coolIdleUsers();
+    void freezeUser(User* u);
+    // Copies the blobs of the cold users together, leaving out the dead bytes
+    void compactColdBlobs();
+    // Gives the chunks of the pools that hold only freed nodes back to the system once freezing or evicting users
+    // has freed enough of them to be worth walking the free lists for
+    void trimPools();
+    // The chat's list of users, or nullptr if it has none
+    MemberList* findChat(const string& chat);
+    const MemberList* findChat(const string& chat) const;
+    // Gives a new chat's list of users an ID, and frees the ID of a list about to be erased
+    void assignChatId(MemberList* chat);
+    void releaseChatId(const MemberList* chat);
+    // Puts a user that was just reloaded or thawed, and has not been active yet, last in the order of activity
+    void markIdle(User* u);
+    // Adds the contributions pending in the threads' deltas to the chats' totals, before an operation that may
+    // read, erase or add a total
+    void foldContributions();
+    // A chat's total, with the contributions still pending in the deltas
+    int totalOf(const int& count) const;
+    // Evicts least recently active users until the tracker is within its budget
+    void enforceBudget();
+    void evictUser(User* u);
+    // Rewrites the spill file with only the records of users still spilled
+    void compactSpill();
+    // Adds a user to a chat's list of users and returns its slot
+    uint32_t addMember(MemberList& chatUsers, NameStore::Id user);
+    // Removes a user from a chat's list of users, given the user's slot in it (or k_noSlot)
+    void removeMember(MemberList& chatUsers, NameStore::Id user, uint32_t slot);
+    // Frees the chat's member list once it has no members, and the chat entirely if it also has no contributions
+    void reclaimChat(MemberList* chatUsers);
+    // Frees the user once it is not associated with any chat
+    void reclaimUser(const string& user, User* u);
+    // IDs of a user's name and its current chat's name in the change feed, interned the first time they are needed
+    uint32_t feedUserId(User* u);
+    uint32_t feedCurrentChatId(User* u);
+    // Writes the tracker as a dump to path; only called in the child process a checkpoint forks
+    bool writeCheckpoint(const string& path);
+    // Calls f(name, chat, position, count, slot) for each membership of every user, hot, cold or evicted, without
+    // changing the tracker; name is the ID of the user's name, and an evicted user's record is read through spill
+    // and gives no slots.  Returns false if a record cannot be read or a cold user's chat is gone.
+    template <typename Func>
+    bool forEachMembership(istream& spill, Func f) const;
 };
 
-template<typename KeyType, typename ValueType>
-HashMap<KeyType, ValueType>::HashMap(int maxBuckets) : m_map(maxBuckets)
-{
-    m_size = 0;
-    m_maxBucks = maxBuckets;
-}
+// *************** MemberList implementations *******************
 
-template<typename KeyType, typename ValueType>
-HashMap<KeyType, ValueType>::~HashMap()
+uint32_t MemberList::add(NameStore::Id user)
 {
-    
+    TRACE_SPAN("member list add");
+    m_members.push_back(user);
+    m_count++;
+    return uint32_t(m_members.size() - 1);
 }
 
-
-template<typename KeyType, typename ValueType>
-void HashMap<KeyType, ValueType>::associate(const KeyType& key, const ValueType& value)
+bool MemberList::remove(NameStore::Id user, uint32_t slot)
 {
-    // Determine bucket number by calling hash function on key
-    unsigned bucketNum = getBucketNumber(key);
-    
-    // Look for value in the list of pairs at the bucketNumber
-    for(pair<KeyType, ValueType>& p : m_map[bucketNum])
+    // A user appears at most once in a chat's list of users; search for it only if its slot is not known
+    size_t k = slot;
+    if(slot == k_noSlot || k >= m_members.size() || m_members[k] != user)
     {
-        // If the key in the pair in the linked list matches the key we want, set value to the matching value and return
-        if(p.first == key)
-        {
-            p.second = value;
-            return;
-        }
+        TRACE_SPAN("member list scan");
+        k = find(m_members.begin(), m_members.end(), user) - m_members.begin();
+        if(k == m_members.size())
+            return false;
     }
-    
-    // if key is not already in map:
-    // Insert the key-value pair into the linked list at the determined bucket number
-    m_map[bucketNum].emplace_back(key, value);
-    m_size++;
-}
-
-template<typename KeyType, typename ValueType>
-void HashMap<KeyType, ValueType>::erase(const KeyType& key)
-{
-    // Determine the bucket number where the key should be located by calling hash function on key
-    unsigned bucketNum = getBucketNumber(key);
-    
-    // Find the value in hashmap
-    ValueType* v = find(key);
-    // If value is not found, nothing to erase, return
-    if(v == nullptr)
-        return;
-    
-    // Create a pair with the same values as the key and the found value and remove it from the list
-    pair<KeyType, ValueType> p;
-    p.first = key;
-    p.second = *v;
-    m_map[bucketNum].remove(p);
-    m_size--;
+    m_members[k] = NameStore::k_noName;
+    m_count--;
+    return true;
 }
 
-template<typename KeyType, typename ValueType>
-ValueType* HashMap<KeyType, ValueType>::find(const KeyType &key)
+template <typename Func>
+void MemberList::compact(Func moved)
 {
-    // Determine the bucket number where the key should be located by calling hash function on key
-    unsigned bucketNum = getBucketNumber(key);
-    
-    // Look for value in the list of pairs at the bucketNumber
-    for(pair<KeyType, ValueType>& p : m_map[bucketNum])
+    TRACE_SPAN("member list compact");
+    size_t to = 0;
+    for(size_t k = 0; k < m_members.size(); k++)
     {
-        // If the key in the pair in the linked list matches the key we want, return address of matching value
-        if(p.first == key)
+        if(m_members[k] != NameStore::k_noName)
         {
-            return &p.second;
+            if(to != k)
+            {
+                m_members[to] = m_members[k];
+                moved(m_members[to], uint32_t(to));
+            }
+            to++;
         }
     }
-    return nullptr;
+    m_members.resize(to);
+    // Give back the array of a chat that has shrunk to a small fraction of its peak
+    if(m_members.capacity() > 4 * (to + 16))
+        m_members.shrink_to_fit();
 }
 
-
 // *************** User implementations *******************
-User::User(string name, int maxBuckets)
+User::User(NameStore::Id name, NodePool* pool) : m_allChats(PoolAllocator<Chat>(pool)), m_bytes(0), m_feedId(k_noFeedId), m_name(name), m_touched(0)
 {
-    m_numBucks = maxBuckets;
-    m_name = name;
 }
 
 User::~User()
@@ -168,16 +430,7 @@ User::~User()
     
 }
 
-bool User::operator==(const User& other)
-{
-    if(m_name == other.m_name)
-    {
-        return true;
-    }
-    return false;
-}
-
-string User::name()
+NameStore::Id User::name() const
 {
     return m_name;
 }
@@ -187,83 +440,74 @@ int User::currentCount()
     // Return the user's current count by looking at the count of the front most chat of the list
     if(!m_allChats.empty())
     {
-        Chat c = m_allChats.front();
-        return c.count;
+        return m_allChats.front().count;
     }
     return 0;
 }
 
-void User::addCurrentChat(const string& name)
+// Returns true if the user was not associated with the chat before
+bool User::addCurrentChat(MemberList* chat)
 {
-    list<Chat>::iterator it;
-    Chat oldChat;
-    bool exists = false;
+    TRACE_SPAN("chat list scan");
+    list<Chat, PoolAllocator<Chat>>::iterator it;
     // Look through all of the user's existing chats to see if user is already associated with chat
     for(it = m_allChats.begin(); it != m_allChats.end(); it++)
     {
-        // If user is already associated with chat (i.e. chat is already within user's list of chats)
-        if(it->name == name)
+        // If user is already associated with chat (i.e. chat is already within user's list of chats),
+        // move its node to the front of the list; the chat's name and count are not copied
+        if(it->chat == chat)
         {
-            // Create new chat object with same variables as the chat found
-            oldChat.name = it->name;
-            oldChat.count = it->count;
-            // Erase the chat found
-            it = m_allChats.erase(it);
-            exists = true;
-            break;
+            m_allChats.splice(m_allChats.begin(), m_allChats, it);
+            return false;
         }
     }
-    if(exists)
-    {
-        // If the user was already associated with the chat, push the newly created chat variable to the front of the list
-        m_allChats.push_front(oldChat);
-    }
-    else
-    {
-        // Otherwise if the user was not associated with the chat
-        // Create a new chat variable and push it to the front of the user's list of chats
-        int count = 0;
-        Chat c;
-        c.name = name;
-        c.count = count;
-        m_allChats.push_front(c);
-    }
-    
+    // Otherwise if the user was not associated with the chat
+    // Create a new chat at the front of the user's list of chats
+    m_allChats.push_front(Chat{chat, 0, k_noFeedId, k_noSlot});
+    m_bytes += listNodeBytes<Chat>();
+    return true;
 }
 
-// Purpose: store the name of the current chat into the passed string parameter
-// Returns true if user has a current chat (i.e. user's list is not empty)
-// Returns false if user does not have a current chat (i.e. user's list is empty)
-bool User::getCurrentChat(string& name)
+// Purpose: return the list of users of the user's current chat
+// Returns nullptr if user does not have a current chat (i.e. user's list is empty)
+MemberList* User::currentChat() const
 {
     if(!m_allChats.empty())
     {
-        // Return the name of the user's current chat by looking at the front of the users' list of chats
-        name = m_allChats.front().name;
-        return true;
+        // The user's current chat is at the front of the users' list of chats
+        return m_allChats.front().chat;
     }
-    return false;
+    return nullptr;
+}
+
+// Returns true if the user has left (or never joined) every chat
+bool User::hasNoChats() const
+{
+    return m_allChats.empty();
 }
 
 // Purpose: remove chat from user's list of chats and store the user's contributions in that chat in the count variable
 // Returns true if user is associated with chat
 // Returns false if user is not associated with chat
-int User::leaveChat(const string& name)
+int User::leaveChat(const MemberList* chat, uint32_t& slot)
 {
+    TRACE_SPAN("chat list scan");
     int result = -1;
     
     if(!m_allChats.empty())
     {
         // Look through user's list of Chat struct objects
-        list<Chat>::iterator it;
+        list<Chat, PoolAllocator<Chat>>::iterator it;
         for(it = m_allChats.begin(); it != m_allChats.end(); it++)
         {
-            // If current Chat object's name matches name passed in
-            if(it->name == name)
+            // If current Chat object's chat matches the chat passed in
+            if(it->chat == chat)
             {
                 // Store the chat's associated number of contributions
                 result = it->count;
+                slot = it->slot;
                 // Erase the chat from the list from the user's list of chat objects
+                m_bytes -= listNodeBytes<Chat>();
                 it = m_allChats.erase(it);
                 break;
             }
@@ -282,6 +526,7 @@ int User::leaveCurrentChat()
     if(!m_allChats.empty())
     {
         result = m_allChats.front().count;
+        m_bytes -= listNodeBytes<Chat>();
         m_allChats.erase(m_allChats.begin());
     }
     return result;
@@ -296,95 +541,365 @@ void User::setCurrentCount(int num)
     }
 }
 
-// *************** ChatTrackerImpl implementations *******************
+// Only called while the user has a current chat
+uint32_t User::currentChatSlot() const
+{
+    return m_allChats.front().slot;
+}
 
-ChatTrackerImpl::ChatTrackerImpl(int maxBuckets) : m_users(maxBuckets), m_chatCount(maxBuckets), m_chatID(maxBuckets), m_numBucks(maxBuckets)
+void User::setCurrentChatSlot(uint32_t slot)
 {
-    
+    m_allChats.front().slot = slot;
 }
 
-void ChatTrackerImpl::join(string user, string chat)
+void User::setChatSlot(const MemberList* chat, uint32_t slot)
 {
-    User* u = m_users.find(user);
-    
-    // User exists: add chat or make chat their current chat
-    if(u != nullptr)
+    TRACE_SPAN("chat list scan");
+    for(Chat& c : m_allChats)
     {
-        // Call the user's add current chat method
-        u->addCurrentChat(chat);
-        
-        // Find chat in hash table to add user to that chat's list of strings
-        list<string>* chatUsers = m_chatID.find(chat);
-        
-        // Chat exists: add user to list of strings
-        if(chatUsers != nullptr)
+        if(c.chat == chat)
         {
-            chatUsers->push_back(user);
+            c.slot = slot;
+            return;
         }
-        // Chat does not exist: add chat to hash table to chats and push user to the new chat's list of strings
-        else
+    }
+}
+
+// Purpose: call f(chat, count, slot) for each of the user's chats, starting with the current chat
+template <typename Func>
+void User::forEachChat(Func f) const
+{
+    for(const Chat& c : m_allChats)
+        f(c.chat, c.count, c.slot);
+}
+
+size_t User::chatCount() const
+{
+    return m_allChats.size();
+}
+
+bool User::findChat(const MemberList* chat, size_t& position, int& count) const
+{
+    position = 0;
+    for(const Chat& c : m_allChats)
+    {
+        if(c.chat == chat)
         {
-            list<string> newChatUsers;
-            newChatUsers.push_back(user);
-            m_chatID.associate(chat, newChatUsers);
+            count = c.count;
+            return true;
         }
+        position++;
     }
-    // User does not exist: make a new user, add chat
-    else
+    return false;
+}
+
+size_t User::memoryUsage() const
+{
+    return m_bytes;
+}
+
+// Purpose: write the user's chats (in order) and their counts to out, in a form load can read back
+// Record layout: chat count, then for each chat its name length, name and contribution count
+void User::save(ostream& out) const
+{
+    uint32_t n = uint32_t(m_allChats.size());
+    out.write(reinterpret_cast<const char*>(&n), sizeof(n));
+    for(const Chat& c : m_allChats)
     {
-        // Create a new user and add it to the hash table of users
-        User newUser(user, m_numBucks);
-        m_users.associate(user, newUser);
-        m_users.find(user)->addCurrentChat(chat);
-        
-        // Find chat in hash table of chats to add user to that chat's list of strings
-        list<string>* chatUsers = m_chatID.find(chat);
-        
-        // Chat exists: add new user to list of strings for chat
-        if(chatUsers != nullptr)
+        const string& name = c.chat->name();
+        uint32_t len = uint32_t(name.size());
+        int32_t count = c.count;
+        out.write(reinterpret_cast<const char*>(&len), sizeof(len));
+        out.write(name.data(), len);
+        out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    }
+}
+
+// Purpose: append the chats of a record written by save to the user's (empty) list of chats
+// The user is still a member of every chat it saved, so each one is found
+template <typename ChatOf>
+void User::load(istream& in, ChatOf chatOf)
+{
+    readRecord(in, [&](const string& name, int count)
+    {
+        MemberList* chat = chatOf(name);
+        if(chat != nullptr)
+            appendChat(chat, count, k_noSlot);
+    });
+}
+
+template <typename Func>
+bool User::readRecord(istream& in, Func f)
+{
+    uint32_t n = 0;
+    in.read(reinterpret_cast<char*>(&n), sizeof(n));
+    string name;
+    for(uint32_t k = 0; k < n && in; k++)
+    {
+        uint32_t len = 0;
+        int32_t count = 0;
+        in.read(reinterpret_cast<char*>(&len), sizeof(len));
+        name.resize(len);
+        in.read(&name[0], len);
+        in.read(reinterpret_cast<char*>(&count), sizeof(count));
+        if(in)
+            f(name, int(count));
+    }
+    return bool(in);
+}
+
+void User::appendChat(MemberList* chat, int count, uint32_t slot)
+{
+    m_bytes += listNodeBytes<Chat>();
+    m_allChats.push_back(Chat{chat, count, k_noFeedId, slot});
+}
+
+RecencyList::iterator User::recency() const
+{
+    return m_recency;
+}
+
+void User::setRecency(RecencyList::iterator pos)
+{
+    m_recency = pos;
+}
+
+uint32_t User::touched() const
+{
+    return m_touched;
+}
+
+void User::setTouched(uint32_t msec)
+{
+    m_touched = msec;
+}
+
+// Purpose: append the user's chats to blobs as varints: the number of chats, then for each chat the ID of its
+// list of users, its count, and its slot + 1 (0 for k_noSlot)
+// IDs are reused, so they stay about as small as the number of chats and most take two or three bytes; unlike an
+// address, an ID means the same chat in a checkpoint's child or a copy of the blob.
+void User::compress(string& blobs) const
+{
+    appendVarint(blobs, m_allChats.size());
+    for(const Chat& c : m_allChats)
+    {
+        appendVarint(blobs, c.chat->id());
+        appendVarint(blobs, uint32_t(c.count));
+        appendVarint(blobs, uint32_t(c.slot + 1));
+    }
+}
+
+// The user is still a member of every chat it was in when it was compressed, so every ID still stands for its
+// list of users; an ID that does not means the tracker lost track of a chat, and the chat is skipped rather than
+// followed.  A slot is kept only if the list still has the user there.
+template <typename Func>
+bool User::forEachCompressedChat(const char* blob, const vector<MemberList*>& chats, NameStore::Id name, Func f)
+{
+    const char* p = blob;
+    uint64_t n = readVarint(p);
+    bool complete = true;
+    for(uint64_t k = 0; k < n; k++)
+    {
+        uint64_t id = readVarint(p);
+        int count = int(uint32_t(readVarint(p)));
+        uint32_t slot = uint32_t(readVarint(p)) - 1;
+        MemberList* chat = (id < chats.size() ? chats[id] : nullptr);
+        if(chat == nullptr)
         {
-            chatUsers->push_back(user);
+            complete = false;
+            continue;
         }
-        
-        // Chat does not exist: add chat to hash table of chats and push user to new chat's list of strings
-        else
+        if(slot != k_noSlot && (slot >= chat->slots() || chat->member(slot) != name))
+            slot = k_noSlot;
+        f(chat, count, slot);
+    }
+    return complete;
+}
+
+void User::decompress(const char* blob, const vector<MemberList*>& chats)
+{
+    forEachCompressedChat(blob, chats, m_name, [&](MemberList* chat, int count, uint32_t slot)
+    {
+        appendChat(chat, count, slot);
+    });
+}
+
+void User::summarize(const char* blob, size_t& chats, long long& contributions)
+{
+    const char* p = blob;
+    chats = size_t(readVarint(p));
+    contributions = 0;
+    for(size_t k = 0; k < chats; k++)
+    {
+        readVarint(p);
+        contributions += int(uint32_t(readVarint(p)));
+        readVarint(p);
+    }
+}
+
+size_t User::compressedSize(const char* blob)
+{
+    const char* p = blob;
+    uint64_t n = readVarint(p);
+    for(uint64_t k = 0; k < 3 * n; k++)
+        readVarint(p);
+    return size_t(p - blob);
+}
+
+uint32_t User::feedId() const
+{
+    return m_feedId;
+}
+
+void User::setFeedId(uint32_t id)
+{
+    m_feedId = id;
+}
+
+// Only called while the user has a current chat
+uint32_t User::currentChatFeedId() const
+{
+    return m_allChats.front().feedId;
+}
+
+void User::setCurrentChatFeedId(uint32_t id)
+{
+    m_allChats.front().feedId = id;
+}
+
+void User::reserveChats(NodePool& pool, size_t count)
+{
+    pool.reserve(listNodeBytes<Chat>(), count);
+}
+
+// *************** ChatTrackerImpl implementations *******************
+
+// Each table starts with as many buckets as entries it is expected to hold; the memory for the expected
+// entries and list nodes is then set aside by reserve, so the tracker does not grow until it passes the estimates
+ChatTrackerImpl::ChatTrackerImpl(const ChatTracker::Options& options, size_t buckets)
+ : m_pool(options.hugePages), m_nodes(options.tenantPool != nullptr ? &options.tenantPool->nodes() : &m_pool),
+   m_chatPool(options.hugePages), m_chatNodes(options.tenantPool != nullptr ? m_nodes : &m_chatPool),
+   m_names(options.tenantPool != nullptr && options.tenantPool->names() != nullptr ? options.tenantPool->names() : &m_ownNames),
+   m_users(int(max(options.expectedUsers, buckets)), m_nodes), m_chatCount(int(max(options.expectedChats, buckets)), m_chatNodes),
+   m_chatID(int(max(options.expectedChats, buckets)), m_chatNodes), m_heapBytes(0), m_budget(0), m_recency(PoolAllocator<User*>(m_nodes)),
+   m_spilled(1, m_nodes), m_spillLive(0), m_spillDead(0), m_feed(nullptr), m_checkpointer(0), m_checkpointOk(true),
+   m_ownLatency(options.tenantPool != nullptr ? nullptr : new LatencyRecorder),
+   m_latency(options.tenantPool != nullptr ? &options.tenantPool->latency() : m_ownLatency.get()),
+   m_coldPool(options.hugePages), m_cold(1, &m_coldPool), m_coldDead(0), m_coldAfter(options.coldAfterMsec),
+   m_epoch(chrono::steady_clock::now()), m_deltas(options.concurrentContributions ? new DeltaCounters : nullptr),
+   m_freedBytes(0)
+{
+    // Evicting, freezing, thawing and publishing all change the tracker, which contributing threads cannot do
+    if(options.concurrentContributions && (options.memoryBudget != 0 || options.coldAfterMsec != 0))
+        throw invalid_argument("a tracker with concurrent contributions cannot have a memory budget or cold tier");
+    reserve(options.expectedUsers, options.expectedChats, options.expectedMemberships);
+    if(options.memoryBudget != 0)
+        setMemoryBudget(options.memoryBudget, options.spillPath);
+}
+
+ChatTrackerImpl::~ChatTrackerImpl()
+{
+    waitForCheckpoint();
+    delete m_feed;
+    // A tenant pool's store of names outlives the tracker, so the tracker's names are taken out of it
+    if(m_names != &m_ownNames)
+    {
+        m_users.forEachInBuckets(0, m_users.bucketCount(), [&](NameStore::Id name, const User&)
         {
-            list<string> newChatUsers;
-            newChatUsers.push_back(user);
-            m_chatID.associate(chat, newChatUsers);
-        }
+            m_names->remove(name);
+        });
+        m_spilled.forEachInBuckets(0, m_spilled.bucketCount(), [&](NameStore::Id name, const SpilledUser&)
+        {
+            m_names->remove(name);
+        });
+        m_cold.forEachInBuckets(0, m_cold.bucketCount(), [&](NameStore::Id name, const ColdUser&)
+        {
+            m_names->remove(name);
+        });
     }
-    
-    // See if the chat exists already in the hash table keeping track of chat's contributions
-    // If it does exist, do nothing
-    if(m_chatCount.find(chat) != nullptr)
-        return;
-    // Otherwise insert it into the hash table by associating chat table with a value of 0
-    m_chatCount.associate(chat, 0);
-    
-    
 }
 
-int ChatTrackerImpl::terminate(string chat)
+void ChatTrackerImpl::reserve(size_t users, size_t chats, size_t memberships)
+{
+    m_users.reserve(users);
+    m_chatCount.reserve(chats);
+    m_chatID.reserve(chats);
+    m_nodes->reserve(listNodeBytes<User*>(), users);
+    // Each membership is a node in its user's list of chats (and a slot in its chat's list of users)
+    User::reserveChats(*m_nodes, memberships);
+}
+
+void ChatTrackerImpl::join(const string& user, const string& chat)
+{
+    TRACE_SPAN("join");
+    foldContributions();
+    // Find the user, or create a new one in the hash table of users
+    User* u = findUser(user);
+    if(u == nullptr)
+        u = createUser(user);
+    touchUser(u);
+
+    // Find the chat's list of users, or create it empty if chat has none yet
+    MemberList* chatUsers = findChat(chat);
+    if(chatUsers == nullptr)
+    {
+        // If the chat does not exist in the hash table keeping track of chat's contributions, insert it with a
+        // count of 0; its name there is the list's key
+        pair<int*, bool> total = m_chatCount.try_emplace(chat, 0);
+        if(total.second)
+            m_heapBytes += stringBytes(chat);
+        const string* name = m_chatCount.findKey(chat);
+        chatUsers = m_chatID.emplaceHashed(m_chatCount.hash(chat), name);
+        chatUsers->setChat(name, total.first);
+        assignChatId(chatUsers);
+    }
+
+    // Call the user's add current chat method
+    // Add user to the chat's list of users if the user was not already in it
+    size_t before = u->memoryUsage();
+    bool added = u->addCurrentChat(chatUsers);
+    m_heapBytes += u->memoryUsage() - before;
+    if(added)
+        u->setCurrentChatSlot(addMember(*chatUsers, u->name()));
+
+    if(m_feed != nullptr)
+        m_feed->publish(ChangeEvent::JOIN, feedUserId(u), feedCurrentChatId(u), 0);
+    enforceBudget();
+}
+
+int ChatTrackerImpl::terminate(const string& chat)
 {
+    TRACE_SPAN("terminate");
+    foldContributions();
     // Find chat in hash table of chats
-    list<string>* chatUsers = m_chatID.find(chat);
+    MemberList* chatUsers = findChat(chat);
     if(chatUsers != nullptr)
     {
-        // Iterate through the chat's list of strings (its list of users) and call leave chat on every user
-        list<string>::iterator it;
-        for(it = chatUsers->begin(); it != chatUsers->end(); it++)
+        // Iterate through the chat's list of users and call leave chat on every user
+        TRACE_SPAN("remove members");
+        string member;
+        chatUsers->forEach([&](NameStore::Id id)
         {
-            User* u = m_users.find(*it);
+            // (not read through a NameStore::Reader, since reclaiming a user changes the store)
+            m_names->get(id, member);
+            User* u = findMember(member, id);
             if(u != nullptr)
             {
-                 u->leaveChat(chat);
+                 size_t before = u->memoryUsage();
+                 uint32_t slot;
+                 u->leaveChat(chatUsers, slot);
+                 m_heapBytes += u->memoryUsage() - before;
+                 // Users who were only in this chat are no longer needed
+                 reclaimUser(member, u);
             }
-        }
+        });
+        // Erase the chat's list of users from the hash table of chats (before its name, the list's key, is erased)
+        m_heapBytes -= chatUsers->memoryUsage();
+        releaseChatId(chatUsers);
+        const string* key = &chatUsers->name();
+        m_chatID.eraseHashed(m_chatCount.hash(chat), [&](const string* name) { return name == key; });
     }
-    // Erase the chat from the hash table of chats
-    m_chatID.erase(chat);
-    
+
     int count = 0;
     // Find the chat's name in the hash table of chats with their counts of contributions
     int* countPtr = m_chatCount.find(chat);
@@ -392,133 +907,1575 @@ int ChatTrackerImpl::terminate(string chat)
     {
         // store the value found in the hash table
         count = *countPtr;
+        // Erase the chat from the the hash table of chats with their counts of contributions
+        m_heapBytes -= stringBytes(chat);
+        m_chatCount.erase(chat);
+    }
+    if(m_feed != nullptr && (chatUsers != nullptr || countPtr != nullptr))
+    {
+        m_feed->publish(ChangeEvent::TERMINATE, ChangeEvent::k_noUser, m_feed->intern(chat), count);
+        m_feed->forget(chat);
     }
-    // Erase the chat from the the hash table of chats with their counts of contributions
-    m_chatCount.erase(chat);
+
+    // Users reloaded from the spill file may have put the tracker over its budget
+    enforceBudget();
     return count;
-    
+
 }
 
-int ChatTrackerImpl::contribute(string user)
+int ChatTrackerImpl::contribute(const string& user)
 {
-    // Find the user in the hash table of users
-    User* u = m_users.find(user);
-    // If the user exists:
-    if(u != nullptr)
+    TRACE_SPAN("contribute");
+    // Find the user in the hash table of users (when other threads may be contributing there are no cold or
+    // evicted users, and looking one up must not change the table)
+    User* u = (m_deltas == nullptr ? findUser(user)
+                                   : m_users.findHashed(hashName(user), [&](NameStore::Id id) { return m_names->equals(id, user); }));
+    // If the user exists and has a current chat:
+    MemberList* ch = (u != nullptr ? u->currentChat() : nullptr);
+    if(ch != nullptr)
     {
+        // Other threads may be contributing at the same time when m_deltas is set; such a tracker has no budget
+        // or cold tier, so the order of activity is not kept
+        if(m_deltas == nullptr)
+            touchUser(u);
+
         // Increment its contributions in its current chat
         u->setCurrentCount(u->currentCount()+1);
-        
-        string ch = "";
-        // Get the name of the user's chat (if it has one)
-        if(u->getCurrentChat(ch))
-        {
-            // Find name of chat in hash table of chats with chat's contributions
-            int* count = m_chatCount.find(ch);
-            if(count != nullptr)
-            {
-                // Increment the value found in the hash table so chat now has 1 greater contribution than it did before
-                m_chatCount.associate(ch, (*count)+1);
-            }
-        }
-        // Return the user's new contributions in its current chat (0 if there is no current chat)
-        return u->currentCount();
+
+        // Increment the chat's total, which its list of users leads to without a lookup (or this thread's delta
+        // for it, so threads contributing to one chat do not all write its total)
+        if(m_deltas == nullptr)
+            ch->total()++;
+        else
+            m_deltas->increment(&ch->total());
+        // Return the user's new contributions in its current chat
+        int result = u->currentCount();
+        if(m_feed != nullptr)
+            m_feed->publish(ChangeEvent::CONTRIBUTE, feedUserId(u), feedCurrentChatId(u), result);
+        if(m_deltas == nullptr)
+            enforceBudget();
+        return result;
     }
-    // Or return 0 if the user does not exist
+    // Or return 0 if the user does not exist or has no current chat
+    if(m_deltas == nullptr)
+        enforceBudget();
     return 0;
 }
 
-int ChatTrackerImpl::leave(string user, string chat)
+int ChatTrackerImpl::leave(const string& user, const string& chat)
 {
+    TRACE_SPAN("leave");
+    foldContributions();
     int contri = -1;
     // Find the user in the hash table of users
-    User* u = m_users.find(user);
-    
+    User* u = findUser(user);
+
     // If the user exists:
     if(u != nullptr)
     {
+        touchUser(u);
+
+        // Find chat in hash table of chats
         // Call leave chat on the user and store its amount of contributions in variable
-        contri = u->leaveChat(chat);
-        
-            // Find chat in hash table of chats
-            list<string>* chatUsers = m_chatID.find(chat);
-            if(chatUsers != nullptr)
-            {
-                // Remove the user's name from the chat's list of users
-                chatUsers->remove(user);
-            }
+        MemberList* chatUsers = findChat(chat);
+        size_t before = u->memoryUsage();
+        uint32_t slot = k_noSlot;
+        if(chatUsers != nullptr)
+            contri = u->leaveChat(chatUsers, slot);
+        m_heapBytes += u->memoryUsage() - before;
+        if(m_feed != nullptr && contri != -1)
+            m_feed->publish(ChangeEvent::LEAVE, feedUserId(u), m_feed->intern(chat), contri);
+
+        if(contri != -1)
+        {
+            // Remove the user from the chat's list of users
+            removeMember(*chatUsers, u->name(), slot);
+            reclaimChat(chatUsers);
+        }
+        reclaimUser(user, u);
     }
-    
+
+    enforceBudget();
     // Return the variable that stored user's contributions (or -1 if user does not exist)
     return contri;
 }
 
-int ChatTrackerImpl::leave(string user)
+int ChatTrackerImpl::leave(const string& user)
 {
+    TRACE_SPAN("leave current");
+    foldContributions();
     int contri = -1;
     // Find user in hash table of users:
-    User* u = m_users.find(user);
-    
-    // If the user exists:
-    if(u != nullptr)
+    User* u = findUser(user);
+
+    // If the user exists and has a current chat:
+    MemberList* chatUsers = (u != nullptr ? u->currentChat() : nullptr);
+    if(chatUsers != nullptr)
     {
-        string ch = "";
-        // Get the user's current chat name (if it exists)
-        if(u->getCurrentChat(ch))
-        {
-            // Call leave user and store user's contributions in variable
-            contri = u->leaveCurrentChat();
-            
-            
-            // Find chat in hash table of chats
-            list<string>* chatUsers = m_chatID.find(ch);
-            if(chatUsers != nullptr)
-            {
-                // Remove the user's name from list of chat's users
-                chatUsers->remove(user);
-            }
-            
-        }
+        touchUser(u);
+        if(m_feed != nullptr)
+            m_feed->publish(ChangeEvent::LEAVE, feedUserId(u), feedCurrentChatId(u), u->currentCount());
+
+        // Call leave user and store user's contributions in variable
+        uint32_t slot = u->currentChatSlot();
+        size_t before = u->memoryUsage();
+        contri = u->leaveCurrentChat();
+        m_heapBytes += u->memoryUsage() - before;
+
+        // Remove the user from the chat's list of users
+        removeMember(*chatUsers, u->name(), slot);
+        reclaimChat(chatUsers);
+        reclaimUser(user, u);
     }
+    enforceBudget();
     // Return the variable that stored the user's contributions (or -1 if the user does not exist)
     return contri;
 }
 
-//*********** ChatTracker functions **************
-
-// These functions simply delegate to ChatTrackerImpl's functions.
-
-ChatTracker::ChatTracker(int maxBuckets)
+int ChatTrackerImpl::chatTotal(const string& chat) const
 {
-    m_impl = new ChatTrackerImpl(maxBuckets);
+    const int* count = m_chatCount.find(chat);
+    return count != nullptr ? totalOf(*count) : 0;
 }
 
-ChatTracker::~ChatTracker()
+// Evicted users stay in their chats' lists of users, so this needs no reloading
+vector<string> ChatTrackerImpl::members(const string& chat) const
 {
-    delete m_impl;
+    vector<string> result;
+    const MemberList* chatUsers = findChat(chat);
+    if(chatUsers != nullptr)
+    {
+        result.reserve(chatUsers->size());
+        NameStore::Reader names(*m_names);
+        chatUsers->forEach([&](NameStore::Id member)
+        {
+            result.push_back(names.read(member));
+        });
+    }
+    return result;
 }
 
-void ChatTracker::join(string user, string chat)
+size_t ChatTrackerImpl::memberCount(const string& chat) const
 {
-    m_impl->join(user, chat);
+    const MemberList* chatUsers = findChat(chat);
+    return chatUsers != nullptr ? chatUsers->size() : 0;
 }
 
-int ChatTracker::terminate(string chat)
+// Each name is decoded into the reader's string, which keeps its memory from one member to the next.  Members
+// who joined one after another mostly have names in consecutive places, so the reader decodes each from the last.
+void ChatTrackerImpl::forEachMember(const string& chat, void (*callback)(void*, const string&), void* context) const
 {
-    return m_impl->terminate(chat);
+    const MemberList* chatUsers = findChat(chat);
+    if(chatUsers != nullptr)
+    {
+        NameStore::Reader names(*m_names);
+        chatUsers->forEach([&](NameStore::Id id)
+        {
+            callback(context, names.read(id));
+        });
+    }
 }
 
-int ChatTracker::contribute(string user)
+// The cursor is a slot number, so a page starts where the last one ended without walking the slots before it.
+// The names are decoded into the strings out already has, so a caller reusing out does not allocate for each page.
+size_t ChatTrackerImpl::members(const string& chat, size_t cursor, size_t limit, vector<string>& out) const
 {
-    return m_impl->contribute(user);
+    const MemberList* chatUsers = findChat(chat);
+    if(chatUsers == nullptr)
+    {
+        out.clear();
+        return 0;
+    }
+    NameStore::Reader names(*m_names);
+    size_t n = 0;
+    size_t slot = cursor;
+    for(; slot < chatUsers->slots() && n < limit; slot++)
+    {
+        NameStore::Id member = chatUsers->member(slot);
+        if(member != NameStore::k_noName)
+        {
+            if(n == out.size())
+                out.emplace_back();
+            out[n++] = names.read(member);
+        }
+    }
+    out.resize(n);
+    // Skip empty slots, so the cursor is 0 exactly when no members are left
+    while(slot < chatUsers->slots() && chatUsers->member(slot) == NameStore::k_noName)
+        slot++;
+    return slot < chatUsers->slots() ? slot : 0;
 }
 
-int ChatTracker::leave(string user, string chat)
+string ChatTrackerImpl::currentChat(const string& user)
 {
-    return m_impl->leave(user, chat);
+    User* u = findUser(user);
+    const MemberList* ch = (u != nullptr ? u->currentChat() : nullptr);
+    string result = (ch != nullptr ? ch->name() : string());
+    // Reloading the user may have put the tracker over its budget
+    enforceBudget();
+    return result;
+}
+
+uint32_t ChatTrackerImpl::addMember(MemberList& chatUsers, NameStore::Id user)
+{
+    size_t before = chatUsers.memoryUsage();
+    uint32_t slot = chatUsers.add(user);
+    m_heapBytes += chatUsers.memoryUsage() - before;
+    return slot;
+}
+
+// Compacting moves members to new slots, which their users are told of (a chat that is now empty is reclaimed instead)
+void ChatTrackerImpl::removeMember(MemberList& chatUsers, NameStore::Id user, uint32_t slot)
+{
+    size_t before = chatUsers.memoryUsage();
+    chatUsers.remove(user, slot);
+    if(!chatUsers.empty() && chatUsers.needsCompaction())
+    {
+        NameStore::Reader names(*m_names);
+        chatUsers.compact([&](NameStore::Id id, uint32_t newSlot)
+        {
+            // Evicted and cold users are not told: a user reloaded from the spill file does not know its slots
+            // anyway, and a cold user checks its slots when it is thawed
+            User* u = m_users.findHashed(hashName(names.read(id)), [=](NameStore::Id name) { return name == id; });
+            if(u != nullptr)
+                u->setChatSlot(&chatUsers, newSlot);
+        });
+    }
+    m_heapBytes -= before - chatUsers.memoryUsage();
+}
+
+// Purpose: free the memory of a chat that has become empty
+// A chat with no members but with contributions must stay in m_chatCount, since terminate still reports its total.
+// A chat with no members and no contributions behaves exactly like a chat that was never joined, so it is erased.
+// The chat's name is the key of its total's entry, which the member list's entry is keyed by, so the list is
+// erased first.
+void ChatTrackerImpl::reclaimChat(MemberList* chatUsers)
+{
+    if(!chatUsers->empty())
+        return;
+    const string& chat = chatUsers->name();
+    bool unused = chatUsers->total() == 0;
+    m_heapBytes -= chatUsers->memoryUsage();
+    releaseChatId(chatUsers);
+    m_chatID.eraseHashed(m_chatCount.hash(chat), [&](const string* name) { return name == &chat; });
+    if(unused)
+    {
+        if(m_feed != nullptr)
+            m_feed->forget(chat);
+        m_heapBytes -= stringBytes(chat);
+        m_chatCount.erase(chat);
+    }
+}
+
+// A list's key is its chat's name in m_chatCount, so only the entries with the name's hash have a name compared
+MemberList* ChatTrackerImpl::findChat(const string& chat)
+{
+    return m_chatID.findHashed(m_chatCount.hash(chat), [&](const string* name) { return *name == chat; });
+}
+
+const MemberList* ChatTrackerImpl::findChat(const string& chat) const
+{
+    return m_chatID.findHashed(m_chatCount.hash(chat), [&](const string* name) { return *name == chat; });
+}
+
+// IDs of erased chats are given out again first, so the IDs (and the cold users' varints) stay small
+void ChatTrackerImpl::assignChatId(MemberList* chat)
+{
+    uint32_t id;
+    if(!m_freeChatIds.empty())
+    {
+        id = m_freeChatIds.back();
+        m_freeChatIds.pop_back();
+        m_chatsById[id] = chat;
+    }
+    else
+    {
+        id = uint32_t(m_chatsById.size());
+        m_chatsById.push_back(chat);
+    }
+    chat->setId(id);
+}
+
+void ChatTrackerImpl::releaseChatId(const MemberList* chat)
+{
+    m_chatsById[chat->id()] = nullptr;
+    m_freeChatIds.push_back(chat->id());
+}
+
+// Purpose: free the memory of a user that has left every chat
+// A user with no chats behaves exactly like an unknown user (contribute returns 0, leave returns -1)
+void ChatTrackerImpl::reclaimUser(const string& user, User* u)
+{
+    if(u->hasNoChats())
+    {
+        m_names->remove(u->name());
+        if(m_feed != nullptr)
+            m_feed->forget(user);
+        eraseUser(user, u);
+    }
+}
+
+// *************** Change feed *******************
+
+ChangeFeed& ChatTrackerImpl::enableChangeFeed(size_t batchSize)
+{
+    // Contributing threads would publish to the feed at once
+    if(m_deltas != nullptr)
+        throw invalid_argument("a tracker with concurrent contributions cannot have a change feed");
+    if(m_feed == nullptr)
+        m_feed = new ChangeFeed(batchSize);
+    return *m_feed;
+}
+
+ChangeFeed* ChatTrackerImpl::changeFeed() const
+{
+    return m_feed;
+}
+
+// The IDs are kept in the user and its list of chats, so contribute publishes its event without a table lookup
+uint32_t ChatTrackerImpl::feedUserId(User* u)
+{
+    if(u->feedId() == k_noFeedId)
+        u->setFeedId(m_feed->intern(m_names->name(u->name())));
+    return u->feedId();
+}
+
+uint32_t ChatTrackerImpl::feedCurrentChatId(User* u)
+{
+    if(u->currentChatFeedId() == k_noFeedId)
+        u->setCurrentChatFeedId(m_feed->intern(u->currentChat()->name()));
+    return u->currentChatFeedId();
+}
+
+// *************** Bulk load *******************
+
+// Rows are split into shards by the low bits of their hashes.  Every table has at least k_loadShards buckets
+// (a power of two), so a bucket's number ends in its shard's bits and no two shards share a bucket.
+static const size_t k_loadShards = 64;
+
+// A row's index with the hash of the name it is grouped by and its place among that name's rows.
+// Rows are sorted as these, so sorting (and counting names) never has to read the rows themselves.
+struct HashedRow
+{
+    uint64_t hash;
+    size_t order;
+    size_t row;
+    bool operator<(const HashedRow& other) const
+    {
+        if(hash != other.hash)
+            return hash < other.hash;
+        if(order != other.order)
+            return order < other.order;
+        return row < other.row;
+    }
+};
+typedef vector<HashedRow>::iterator HashedRowIter;
+
+// Purpose: call work(t) for t from 0 to n-1 at the same time, on n threads (the calling thread is thread 0)
+template <typename Func>
+static void runThreads(int n, Func work)
+{
+    vector<thread> pool;
+    for(int t = 1; t < n; t++)
+        pool.push_back(thread(work, t));
+    work(0);
+    for(thread& th : pool)
+        th.join();
+}
+
+// Purpose: call work(t, shard) for every shard, each thread taking the next shard not yet taken
+template <typename Func>
+static void forEachShard(int threads, Func work)
+{
+    atomic<size_t> next(0);
+    runThreads(threads, [&](int t)
+    {
+        size_t shard;
+        while((shard = next.fetch_add(1)) < k_loadShards)
+            work(t, shard);
+    });
+}
+
+// Purpose: list the rows grouped by shard, row k with place orderOf(k) among its name's rows
+// order[start[s]] to order[start[s+1]-1] are the rows in shard s
+template <typename OrderOf>
+static void shardByHash(int threads, const vector<uint64_t>& hashes, OrderOf orderOf, vector<HashedRow>& order, vector<size_t>& start)
+{
+    // Each thread counts its part of the rows per shard, then puts its rows after the earlier threads' ones
+    size_t n = hashes.size();
+    vector<size_t> counts(threads * k_loadShards, 0);
+    runThreads(threads, [&](int t)
+    {
+        for(size_t k = n * t / threads; k < n * (t + 1) / threads; k++)
+            counts[t * k_loadShards + (hashes[k] & (k_loadShards - 1))]++;
+    });
+    start.assign(k_loadShards + 1, 0);
+    size_t total = 0;
+    for(size_t s = 0; s < k_loadShards; s++)
+    {
+        start[s] = total;
+        for(int t = 0; t < threads; t++)
+        {
+            size_t c = counts[t * k_loadShards + s];
+            counts[t * k_loadShards + s] = total;
+            total += c;
+        }
+    }
+    start[k_loadShards] = total;
+    order.resize(n);
+    runThreads(threads, [&](int t)
+    {
+        for(size_t k = n * t / threads; k < n * (t + 1) / threads; k++)
+            order[counts[t * k_loadShards + (hashes[k] & (k_loadShards - 1))]++] = HashedRow{hashes[k], orderOf(k), k};
+    });
+}
+
+// Purpose: find the end of the run of sorted rows starting at begin that have the same hash
+static HashedRowIter runEnd(HashedRowIter begin, HashedRowIter end)
+{
+    HashedRowIter run = begin + 1;
+    while(run != end && run->hash == begin->hash)
+        run++;
+    return run;
+}
+
+// Purpose: find the end of the group of sorted rows starting at begin, the rows with the same name as the first
+// A group is normally a run of equal hashes.  If different names share a hash, the run is sorted by name
+// (keeping each name's rows in order) so that each name's rows are together.
+template <typename NameOf>
+static HashedRowIter groupEnd(HashedRowIter begin, HashedRowIter end, NameOf nameOf)
+{
+    HashedRowIter run = runEnd(begin, end);
+    HashedRowIter group = begin + 1;
+    while(group != run && nameOf(group->row) == nameOf(begin->row))
+        group++;
+    if(group != run)
+    {
+        stable_sort(begin, run, [&](const HashedRow& a, const HashedRow& b)
+        {
+            return nameOf(a.row) < nameOf(b.row);
+        });
+        group = begin + 1;
+        while(group != run && nameOf(group->row) == nameOf(begin->row))
+            group++;
+    }
+    return group;
+}
+
+// The tracker is built in passes: hash every name, shard the rows, sort each shard so a user's (or chat's) rows
+// are together, size the tables, then build each shard's users and chats in its own buckets.
+// Tables are sized by the number of distinct hashes, which can only fall short of the number of names
+// if two names share a hash, and are counted exactly as they are built.
+// Only the list of users by activity is built by one thread, since it is a single list.
+void ChatTrackerImpl::bulkLoad(const ChatTracker::Dump& dump, int threads)
+{
+    const vector<ChatTracker::Dump::Membership>& rows = dump.memberships;
+    const vector<ChatTracker::Dump::Total>& totals = dump.totals;
+    if(threads <= 0)
+        threads = int(thread::hardware_concurrency());
+    threads = max(1, min(threads, int(k_loadShards)));
+    // A tracker with a tenant pool takes every thread's nodes from that pool (the threads share its lock)
+    // rather than starting pools of its own.  Each thread takes the chats' entries from a second pool, which
+    // m_chatPool takes over once the load is done, so they are freed to the pool they came from.
+    vector<NodePool*> pools;
+    vector<NodePool*> chatPools;
+    list<NodePool> loadChatPools;
+    for(int t = 0; t < threads; t++)
+    {
+        if(m_nodes != &m_pool)
+        {
+            pools.push_back(m_nodes);
+            chatPools.push_back(m_nodes);
+            continue;
+        }
+        m_loadPools.emplace_back(m_pool.hugePages());
+        pools.push_back(&m_loadPools.back());
+        loadChatPools.emplace_back(m_chatPool.hugePages());
+        chatPools.push_back(&loadChatPools.back());
+    }
+
+    // A chat's rows are its memberships followed by its total: row k < rows.size() is membership k,
+    // and row rows.size() + k is total k
+    size_t n = rows.size();
+    vector<uint64_t> userHashes(n);
+    vector<uint64_t> chatHashes(n + totals.size());
+    runThreads(threads, [&](int t)
+    {
+        for(size_t k = n * t / threads; k < n * (t + 1) / threads; k++)
+        {
+            userHashes[k] = hashName(rows[k].user);
+            chatHashes[k] = m_chatCount.hash(rows[k].chat);
+        }
+        for(size_t k = totals.size() * t / threads; k < totals.size() * (t + 1) / threads; k++)
+            chatHashes[n + k] = m_chatCount.hash(totals[k].chat);
+    });
+    vector<HashedRow> userOrder;
+    vector<size_t> userStart;
+    vector<HashedRow> chatOrder;
+    vector<size_t> chatStart;
+    // A user's rows are in the order of its chats, and a chat's in the order they came (the order of its members)
+    shardByHash(threads, userHashes, [&](size_t k) { return rows[k].position; }, userOrder, userStart);
+    shardByHash(threads, chatHashes, [](size_t k) { return k; }, chatOrder, chatStart);
+    auto userName = [&](size_t k) -> const string&
+    {
+        return rows[k].user;
+    };
+    auto chatName = [&](size_t k) -> const string&
+    {
+        return k < n ? rows[k].chat : totals[k - n].chat;
+    };
+
+    // Sort each shard and count its distinct user and chat hashes
+    vector<size_t> userHashCount(k_loadShards, 0);
+    vector<size_t> chatHashCount(k_loadShards, 0);
+    forEachShard(threads, [&](int, size_t s)
+    {
+        HashedRowIter end = userOrder.begin() + userStart[s + 1];
+        sort(userOrder.begin() + userStart[s], end);
+        for(HashedRowIter i = userOrder.begin() + userStart[s]; i != end; i = runEnd(i, end))
+            userHashCount[s]++;
+        end = chatOrder.begin() + chatStart[s + 1];
+        sort(chatOrder.begin() + chatStart[s], end);
+        for(HashedRowIter i = chatOrder.begin() + chatStart[s]; i != end; i = runEnd(i, end))
+            chatHashCount[s]++;
+    });
+    size_t userHashTotal = 0;
+    size_t chatHashTotal = 0;
+    for(size_t s = 0; s < k_loadShards; s++)
+    {
+        userHashTotal += userHashCount[s];
+        chatHashTotal += chatHashCount[s];
+    }
+    m_users.reserveBuckets(max(userHashTotal, k_loadShards));
+    m_chatID.reserveBuckets(max(chatHashTotal, k_loadShards));
+    m_chatCount.reserveBuckets(max(chatHashTotal, k_loadShards));
+
+    // Build the users, then the chats, then the users' lists of chats, each thread from its own pool.  The users
+    // go first so their names have IDs for the chats' lists of users, and the chats before the users' lists so each
+    // membership's chat and slot are known.  Each shard's names go in a part of the store of names of its own.
+    static_assert(NameStore::k_parts == k_loadShards, "each shard needs a part of the store of names");
+    m_names->makeParts(k_loadShards);
+    vector<vector<User*>> shardUserList(k_loadShards);
+    vector<size_t> shardBytes(k_loadShards, 0);
+    vector<size_t> shardMemberLists(k_loadShards, 0);
+    vector<size_t> shardChatCounts(k_loadShards, 0);
+    vector<NameStore::Id> rowUsers(n);
+    vector<MemberList*> rowChats(n);
+    vector<uint32_t> rowSlots(n);
+    vector<int> shardThread(k_loadShards, 0);
+    forEachShard(threads, [&](int t, size_t s)
+    {
+        NodePool* pool = pools[t];
+        shardThread[s] = t;
+        HashedRowIter end = userOrder.begin() + userStart[s + 1];
+        for(HashedRowIter i = userOrder.begin() + userStart[s]; i != end; )
+        {
+            HashedRowIter group = groupEnd(i, end, userName);
+            const string& user = rows[i->row].user;
+            NameStore::Id name = m_names->add(user, s);
+            shardUserList[s].push_back(m_users.emplaceNew(pool, i->hash, name, name, pool));
+            for(; i != group; i++)
+                rowUsers[i->row] = name;
+        }
+    });
+    forEachShard(threads, [&](int t, size_t s)
+    {
+        NodePool* pool = chatPools[t];
+        size_t bytes = 0;
+        HashedRowIter end = chatOrder.begin() + chatStart[s + 1];
+        for(HashedRowIter i = chatOrder.begin() + chatStart[s]; i != end; )
+        {
+            HashedRowIter group = groupEnd(i, end, chatName);
+            const string& chat = chatName(i->row);
+            uint64_t hash = i->hash;
+            MemberList* chatUsers = nullptr;
+            int* count = nullptr;
+            // Memberships sort before the total, so the chat has members if its first row is one.  Its total is
+            // made first, since its list is keyed by the total's copy of the chat's name.
+            if(i->row < n)
+            {
+                count = m_chatCount.emplaceNew(pool, hash, chat, 0);
+                const string* name = m_chatCount.findKey(chat);
+                chatUsers = m_chatID.emplaceNew(pool, hash, name);
+                chatUsers->setChat(name, count);
+                shardMemberLists[s]++;
+            }
+            long long sum = 0;
+            bool hasTotal = false;
+            int total = 0;
+            for(; i != group; i++)
+            {
+                size_t k = i->row;
+                if(k < n)
+                {
+                    rowSlots[k] = chatUsers->add(rowUsers[k]);
+                    rowChats[k] = chatUsers;
+                    sum += rows[k].count;
+                }
+                else
+                {
+                    hasTotal = true;
+                    total = totals[k - n].total;
+                }
+            }
+            if(chatUsers != nullptr)
+                bytes += chatUsers->memoryUsage();
+            if(!hasTotal)
+                total = int(sum);
+            if(count == nullptr && total != 0)
+                count = m_chatCount.emplaceNew(pool, hash, chat, total);
+            if(count != nullptr)
+            {
+                *count = total;
+                bytes += stringBytes(chat);
+                shardChatCounts[s]++;
+            }
+        }
+        shardBytes[s] += bytes;
+    });
+    // A user's list of chats takes its nodes from the pool of the thread that built the user, so each shard's
+    // lists are built by the thread that built its users
+    runThreads(threads, [&](int t)
+    {
+        for(size_t s = 0; s < k_loadShards; s++)
+        {
+            if(shardThread[s] != t)
+                continue;
+            size_t bytes = 0;
+            size_t j = 0;
+            HashedRowIter end = userOrder.begin() + userStart[s + 1];
+            for(HashedRowIter i = userOrder.begin() + userStart[s]; i != end; )
+            {
+                HashedRowIter group = groupEnd(i, end, userName);
+                const string& user = rows[i->row].user;
+                User* u = shardUserList[s][j++];
+                for(; i != group; i++)
+                    u->appendChat(rowChats[i->row], rows[i->row].count, rowSlots[i->row]);
+                bytes += nameBytes(user) + u->memoryUsage();
+            }
+            shardBytes[s] += bytes;
+        }
+    });
+
+    for(size_t s = 0; s < k_loadShards; s++)
+    {
+        m_users.addBulkCount(shardUserList[s].size());
+        m_chatID.addBulkCount(shardMemberLists[s]);
+        m_chatCount.addBulkCount(shardChatCounts[s]);
+        m_heapBytes += shardBytes[s];
+        for(User* u : shardUserList[s])
+        {
+            m_recency.push_front(u);
+            u->setRecency(m_recency.begin());
+        }
+    }
+    m_chatsById.reserve(m_chatID.size());
+    for(HashMap<const string*, MemberList>::iterator it = m_chatID.begin(); it != m_chatID.end(); ++it)
+        assignChatId(&it->second);
+    for(NodePool& pool : m_loadPools)
+        m_pool.merge(pool);
+    for(NodePool& pool : loadChatPools)
+        m_chatPool.merge(pool);
+}
+
+// *************** Scans *******************
+
+// Purpose: the first bucket of part k when a table of the given number of buckets is split into parts
+static size_t partStart(size_t buckets, size_t k, size_t parts)
+{
+    return buckets * k / parts;
+}
+
+// The names are assigned to the strings out already holds, so a vector scanned into again reuses their memory
+void ChatTrackerImpl::scanUsers(size_t part, size_t parts, vector<ChatTracker::UserInfo>& out) const
+{
+    size_t n = 0;
+    auto next = [&]() -> ChatTracker::UserInfo&
+    {
+        if(n == out.size())
+            out.emplace_back();
+        return out[n++];
+    };
+    size_t buckets = m_users.bucketCount();
+    m_users.forEachInBuckets(partStart(buckets, part, parts), partStart(buckets, part + 1, parts),
+                             [&](NameStore::Id name, const User& u)
+    {
+        ChatTracker::UserInfo& info = next();
+        m_names->get(name, info.name);
+        info.chats = u.chatCount();
+        info.contributions = 0;
+        u.forEachChat([&](const MemberList*, int count, uint32_t)
+        {
+            info.contributions += count;
+        });
+    });
+    buckets = m_cold.bucketCount();
+    m_cold.forEachInBuckets(partStart(buckets, part, parts), partStart(buckets, part + 1, parts),
+                            [&](NameStore::Id name, const ColdUser& cold)
+    {
+        ChatTracker::UserInfo& info = next();
+        m_names->get(name, info.name);
+        User::summarize(m_coldBlobs.data() + cold.offset, info.chats, info.contributions);
+    });
+    // Evicted users' records are read through a spill file stream of the scan's own, as the checkpoint child
+    // reads them, so scans on several threads do not share a file offset or change the tracker.  Only the
+    // chats that still exist are counted, as reloading the user would.
+    ifstream spill;
+    buckets = m_spilled.bucketCount();
+    m_spilled.forEachInBuckets(partStart(buckets, part, parts), partStart(buckets, part + 1, parts),
+                               [&](NameStore::Id name, const SpilledUser& spilled)
+    {
+        if(!spill.is_open())
+            spill.open(m_spillPath, ios::in | ios::binary);
+        ChatTracker::UserInfo& info = next();
+        m_names->get(name, info.name);
+        info.chats = 0;
+        info.contributions = 0;
+        spill.clear();
+        spill.seekg(spilled.offset);
+        User::readRecord(spill, [&](const string& chat, int count)
+        {
+            if(findChat(chat) == nullptr)
+                return;
+            info.chats++;
+            info.contributions += count;
+        });
+    });
+    out.resize(n);
+}
+
+// Every chat with members also has a count, so scanning the counts finds every chat
+void ChatTrackerImpl::scanChats(size_t part, size_t parts, vector<ChatTracker::ChatInfo>& out) const
+{
+    out.clear();
+    size_t buckets = m_chatCount.bucketCount();
+    m_chatCount.forEachInBuckets(partStart(buckets, part, parts), partStart(buckets, part + 1, parts),
+                                 [&](const string& name, const int& total)
+    {
+        const MemberList* chatUsers = m_chatID.findHashed(m_chatCount.hash(name), [&](const string* key) { return key == &name; });
+        out.push_back(ChatTracker::ChatInfo{&name, totalOf(total), chatUsers != nullptr ? chatUsers->size() : 0});
+    });
+}
+
+// *************** Checkpoints *******************
+
+// Purpose: append value to text in decimal
+static void appendNumber(string& text, long long value)
+{
+    char digits[24];
+    char* p = digits + sizeof(digits);
+    unsigned long long v = value < 0 ? 0 - (unsigned long long)value : value;
+    do
+    {
+        *--p = char('0' + v % 10);
+        v /= 10;
+    } while(v != 0);
+    if(value < 0)
+        *--p = '-';
+    text.append(p, digits + sizeof(digits) - p);
+}
+
+// Purpose: append one row of a dump to text as a line
+// Rows are built in a string and written a chunk at a time, which is several times faster than formatting
+// each field with the stream's operators
+static void appendMembershipRow(string& text, const string& user, size_t position, int count, const string& chat)
+{
+    text += "m ";
+    text += user;
+    text += ' ';
+    appendNumber(text, (long long)position);
+    text += ' ';
+    appendNumber(text, count);
+    text += ' ';
+    text += chat;
+    text += '\n';
+}
+
+static void appendTotalRow(string& text, int total, const string& chat)
+{
+    text += "t ";
+    appendNumber(text, total);
+    text += ' ';
+    text += chat;
+    text += '\n';
+}
+
+// Purpose: write out the rows in text once they pass a chunk's size (or whatever there is, if all is true)
+static void flushRows(ostream& out, string& text, bool all)
+{
+    static const size_t chunk = 1 << 20;
+    if(text.size() >= chunk || all)
+    {
+        out.write(text.data(), text.size());
+        text.clear();
+    }
+}
+
+// The child is a copy of this process as it was at the fork, so it writes that state no matter how the
+// parent changes afterwards.  The child ends with _exit, which runs no destructors and flushes nothing the
+// parent will also flush.
+bool ChatTrackerImpl::checkpointAsync(const string& path)
+{
+    if(checkpointRunning())
+        return false;
+    foldContributions();
+    // The child reads evicted users' records from the file, so none may still be in the stream's buffer
+    if(m_spill != nullptr && m_spill->is_open())
+        m_spill->flush();
+    pid_t pid = fork();
+    if(pid < 0)
+        return false;
+    if(pid == 0)
+        _exit(writeCheckpoint(path) ? 0 : 1);
+    m_checkpointer = pid;
+    return true;
+}
+
+bool ChatTrackerImpl::checkpointRunning()
+{
+    if(m_checkpointer == 0)
+        return false;
+    int status = 0;
+    pid_t pid = waitpid(m_checkpointer, &status, WNOHANG);
+    if(pid == 0)
+        return true;
+    // The status is only set if the child was reaped (waitpid fails with ECHILD if it already was)
+    m_checkpointer = 0;
+    m_checkpointOk = pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    return false;
+}
+
+bool ChatTrackerImpl::waitForCheckpoint()
+{
+    if(m_checkpointer != 0)
+    {
+        int status;
+        pid_t pid = waitpid(m_checkpointer, &status, 0);
+        m_checkpointer = 0;
+        m_checkpointOk = pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    return m_checkpointOk;
+}
+
+// A membership row as the checkpoint collects it, before the rows are put in order
+struct CheckpointRow
+{
+    NameStore::Id name;   // the user's, decoded when the row is written
+    const MemberList* chat;
+    uint32_t position;
+    int count;
+};
+
+template <typename Func>
+bool ChatTrackerImpl::forEachMembership(istream& spill, Func f) const
+{
+    m_users.forEachInBuckets(0, m_users.bucketCount(), [&](NameStore::Id name, const User& u)
+    {
+        uint32_t position = 0;
+        u.forEachChat([&](const MemberList* chat, int count, uint32_t slot)
+        {
+            f(name, chat, position++, count, slot);
+        });
+    });
+    bool readable = true;
+    m_cold.forEachInBuckets(0, m_cold.bucketCount(), [&](NameStore::Id name, const ColdUser& cold)
+    {
+        uint32_t position = 0;
+        if(!User::forEachCompressedChat(m_coldBlobs.data() + cold.offset, m_chatsById, name,
+                                        [&](const MemberList* chat, int count, uint32_t slot)
+        {
+            f(name, chat, position++, count, slot);
+        }))
+            readable = false;
+    });
+    m_spilled.forEachInBuckets(0, m_spilled.bucketCount(), [&](NameStore::Id name, const SpilledUser& spilled)
+    {
+        uint32_t position = 0;
+        spill.clear();
+        spill.seekg(spilled.offset);
+        if(!User::readRecord(spill, [&](const string& chatName, int count)
+        {
+            const MemberList* chat = findChat(chatName);
+            if(chat != nullptr)
+                f(name, chat, position++, count, k_noSlot);
+        }))
+            readable = false;
+    });
+    return readable;
+}
+
+// The rows come from walking the users, which finds each row's position and count without a lookup.  Sorting
+// the rows by their slots in their chats' lists of users (a counting sort) puts each chat's members in the order
+// they joined.  A user that was reloaded or is still evicted does not know its slots; the rows of the chats it is
+// in are collected by chat and put in the order of the chat's list of users instead.
+// The child changes nothing in the tracker, so it copies none of the pages it shares with the parent: cold users
+// are decoded from their blobs where they are, and evicted users' records are read through a spill file stream of
+// the child's own (the inherited one shares its file offset with the parent, which may be appending to it).
+bool ChatTrackerImpl::writeCheckpoint(const string& path)
+{
+    ifstream spill;
+    if(!m_spilled.empty())
+    {
+        spill.open(m_spillPath, ios::in | ios::binary);
+        if(!spill)
+            return false;
+    }
+
+    // The chats with a member whose slot is not known, and their rows
+    HashMap<const MemberList*, vector<CheckpointRow>> unordered(1);
+    vector<size_t> slotStart(1, 0);
+    size_t rows = 0;
+    bool readable = forEachMembership(spill, [&](NameStore::Id, const MemberList* chat, uint32_t, int, uint32_t slot)
+    {
+        if(slot == k_noSlot)
+        {
+            unordered.try_emplace(chat);
+            return;
+        }
+        if(slot + 2 > slotStart.size())
+            slotStart.resize(slot + 2, 0);
+        slotStart[slot + 1]++;
+        rows++;
+    });
+    for(size_t k = 1; k < slotStart.size(); k++)
+        slotStart[k] += slotStart[k - 1];
+    vector<CheckpointRow> sorted(rows);
+    readable = forEachMembership(spill, [&](NameStore::Id name, const MemberList* chat, uint32_t position, int count,
+                                            uint32_t slot)
+    {
+        CheckpointRow row{name, chat, position, count};
+        if(slot != k_noSlot)
+            sorted[slotStart[slot]++] = row;
+        vector<CheckpointRow>* chatRows = (unordered.empty() ? nullptr : unordered.find(chat));
+        if(chatRows != nullptr)
+            chatRows->push_back(row);
+    }) && readable;
+    if(!readable)
+        return false;
+
+    string temporary = path + ".tmp";
+    ofstream out(temporary, ios::out | ios::trunc | ios::binary);
+    if(!out)
+        return false;
+    string text;
+    string decoded;
+    auto userOf = [&](const CheckpointRow& row) -> const string&
+    {
+        m_names->get(row.name, decoded);
+        return decoded;
+    };
+    for(const CheckpointRow& row : sorted)
+    {
+        if(unordered.empty() || unordered.find(row.chat) == nullptr)
+        {
+            appendMembershipRow(text, userOf(row), row.position, row.count, row.chat->name());
+            flushRows(out, text, false);
+        }
+    }
+    bool consistent = true;
+    unordered.forEachInBuckets(0, unordered.bucketCount(), [&](const MemberList* chat, const vector<CheckpointRow>& chatRows)
+    {
+        HashMap<NameStore::Id, uint32_t> order(int(chat->size()));
+        uint32_t joined = 0;
+        chat->forEach([&](NameStore::Id member)
+        {
+            order.try_emplace(member, joined++);
+        });
+        vector<const CheckpointRow*> byOrder(joined, nullptr);
+        for(const CheckpointRow& row : chatRows)
+        {
+            const uint32_t* place = order.find(row.name);
+            if(place == nullptr || byOrder[*place] != nullptr)
+                consistent = false;
+            else
+                byOrder[*place] = &row;
+        }
+        for(const CheckpointRow* row : byOrder)
+        {
+            if(row == nullptr)
+            {
+                consistent = false;
+                continue;
+            }
+            appendMembershipRow(text, userOf(*row), row->position, row->count, chat->name());
+            flushRows(out, text, false);
+        }
+    });
+    m_chatCount.forEachInBuckets(0, m_chatCount.bucketCount(), [&](const string& chat, int total)
+    {
+        appendTotalRow(text, total, chat);
+        flushRows(out, text, false);
+    });
+    flushRows(out, text, true);
+    out.close();
+    return consistent && !out.fail() && rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+// *************** Memory budget *******************
+
+// Dead records in the spill file below this many bytes are not worth rewriting the file for
+static const long long k_spillSlack = 64 * 1024;
+
+// Dead bytes of thawed users' blobs below this many are not worth copying the blobs for, and freed nodes below
+// this many bytes are not worth trimming the pools for
+static const size_t k_coldSlack = 64 * 1024;
+static const size_t k_trimSlack = 1024 * 1024;
+
+void ChatTrackerImpl::setMemoryBudget(size_t maxBytes, const string& spillPath)
+{
+    if(m_deltas != nullptr && maxBytes != 0)
+        throw invalid_argument("a tracker with concurrent contributions cannot have a memory budget");
+    m_budget = maxBytes;
+    // The spill file can only be changed while no evicted users are stored in it
+    if(spillPath != m_spillPath && m_spilled.empty())
+    {
+        if(m_spill == nullptr)
+            m_spill.reset(new fstream);
+        m_spill->close();
+        m_spillPath = spillPath;
+        m_spillDead = 0;
+        if(!m_spillPath.empty())
+            m_spill->open(m_spillPath, ios::in | ios::out | ios::binary | ios::trunc);
+    }
+    enforceBudget();
+}
+
+size_t ChatTrackerImpl::memoryUsage() const
+{
+    return m_heapBytes + m_ownNames.memoryUsage() + m_users.memoryUsage() + m_chatCount.memoryUsage() + m_chatID.memoryUsage()
+           + m_spilled.memoryUsage() + m_cold.memoryUsage() + m_coldBlobs.capacity() + m_recency.size() * listNodeBytes<User*>()
+           + m_chatsById.capacity() * sizeof(MemberList*) + m_freeChatIds.capacity() * sizeof(uint32_t)
+           + (m_deltas != nullptr ? m_deltas->memoryUsage() : 0);
+}
+
+uint64_t ChatTrackerImpl::hashName(const string& user)
+{
+    return WyHash()(user);
+}
+
+// Only an entry with the name's hash (nearly always the user's own) has its name compared, in the store of names
+User* ChatTrackerImpl::findUser(const string& user)
+{
+    return findUser(user, [&](NameStore::Id id) { return m_names->equals(id, user); });
+}
+
+User* ChatTrackerImpl::findMember(const string& user, NameStore::Id name)
+{
+    return findUser(user, [=](NameStore::Id id) { return id == name; });
+}
+
+template <typename Match>
+User* ChatTrackerImpl::findUser(const string& user, Match match)
+{
+    uint64_t hash = hashName(user);
+    User* u = m_users.findHashed(hash, match);
+    if(u != nullptr || (m_spilled.empty() && m_cold.empty()))
+        return u;
+
+    // The user may be cold: decompress it.  The cold and evicted users' tables are hashed by name too, and the
+    // ID of the entry found is the ID of the user's name.
+    NameStore::Id name = NameStore::k_noName;
+    auto matchName = [&](NameStore::Id id)
+    {
+        name = id;
+        return match(id);
+    };
+    ColdUser* cold = (m_cold.empty() ? nullptr : m_cold.findHashed(hash, matchName));
+    if(cold != nullptr)
+    {
+        TRACE_SPAN("thaw user");
+        size_t offset = cold->offset;
+        m_cold.eraseHashed(hash, [&](NameStore::Id id) { return id == name; });
+        m_heapBytes -= nameBytes(user);
+        u = createUser(user, name);
+        size_t before = u->memoryUsage();
+        const char* blob = m_coldBlobs.data() + offset;
+        u->decompress(blob, m_chatsById);
+        m_coldDead += User::compressedSize(blob);
+        m_heapBytes += u->memoryUsage() - before;
+        markIdle(u);
+        // Once the thawed users' blobs outweigh the cold users' ones, the blobs are copied together (a
+        // checkpoint's child has its own copy of them, so unlike the spill file they need not wait for it)
+        if(m_cold.empty())
+        {
+            string().swap(m_coldBlobs);
+            m_coldDead = 0;
+        }
+        else if(m_coldDead > m_coldBlobs.size() - m_coldDead && m_coldDead >= k_coldSlack)
+            compactColdBlobs();
+        return u;
+    }
+    if(m_spilled.empty())
+        return nullptr;
+
+    // The user may have been evicted: read its record back from the spill file
+    TRACE_SPAN("reload user");
+    SpilledUser* spilled = m_spilled.findHashed(hash, matchName);
+    if(spilled == nullptr)
+        return nullptr;
+    m_spill->clear();
+    m_spill->seekg(spilled->offset);
+    m_spillLive -= spilled->bytes;
+    m_spillDead += spilled->bytes;
+    m_spilled.eraseHashed(hash, [&](NameStore::Id id) { return id == name; });
+    u = createUser(user, name);
+    size_t before = u->memoryUsage();
+    u->load(*m_spill, [&](const string& chat)
+    {
+        return findChat(chat);
+    });
+    m_heapBytes += u->memoryUsage() - before;
+    markIdle(u);
+    return u;
+}
+
+User* ChatTrackerImpl::createUser(const string& user, NameStore::Id name)
+{
+    if(name == NameStore::k_noName)
+        name = m_names->add(user);
+    User* u = m_users.emplaceHashed(hashName(user), name, name, m_nodes);
+    m_heapBytes += nameBytes(user) + u->memoryUsage();
+    m_recency.push_front(u);
+    u->setRecency(m_recency.begin());
+    return u;
+}
+
+void ChatTrackerImpl::eraseUser(const string& user, User* u)
+{
+    m_recency.erase(u->recency());
+    m_heapBytes -= nameBytes(user) + u->memoryUsage();
+    NameStore::Id name = u->name();
+    m_users.eraseHashed(hashName(user), [=](NameStore::Id id) { return id == name; });
+}
+
+size_t ChatTrackerImpl::nameBytes(const string& user) const
+{
+    return m_names != &m_ownNames ? user.size() : 0;
+}
+
+void ChatTrackerImpl::touchUser(User* u)
+{
+    m_recency.splice(m_recency.begin(), m_recency, u->recency());
+    if(m_coldAfter != 0)
+        u->setTouched(clockMsec());
+}
+
+// A reloaded or thawed user stays first in line for eviction, and for the cold tier, until it is used
+void ChatTrackerImpl::markIdle(User* u)
+{
+    m_recency.splice(m_recency.end(), m_recency, u->recency());
+    if(m_coldAfter != 0)
+        u->setTouched(clockMsec() - m_coldAfter);
+}
+
+void ChatTrackerImpl::foldContributions()
+{
+    if(m_deltas != nullptr)
+        m_deltas->fold();
+}
+
+int ChatTrackerImpl::totalOf(const int& count) const
+{
+    return m_deltas != nullptr ? count + m_deltas->pending(&count) : count;
+}
+
+void ChatTrackerImpl::enforceBudget()
+{
+    // Compressing the idle users may be enough to meet the budget
+    coolIdleUsers();
+    if(m_budget == 0)
+        return;
+    TRACE_SPAN("enforce budget");
+    while(memoryUsage() > m_budget && !m_recency.empty())
+        evictUser(m_recency.back());
+    trimPools();
+    // Reloading a user leaves its record behind, so a tracker whose users come and go would grow its spill file
+    // without end; once the dead records outweigh the live ones the file is rewritten.  A checkpoint's child reads
+    // the file as it was when the child started, so the file is left alone until the child is done.
+    if(m_spillDead > m_spillLive && m_spillDead >= k_spillSlack && !checkpointRunning())
+        compactSpill();
+}
+
+// Purpose: remove a user from memory
+// With a spill file the user's chats are written out and the user stays a member of its chats, so it can be reloaded.
+// Without one the user leaves all of its chats and is forgotten (its contributions still count in the chats' totals),
+// and the change feed gets a leave for each chat, so the feed's subscribers forget the user too.
+void ChatTrackerImpl::evictUser(User* u)
+{
+    // The spilled user keeps the ID of its name, which its chats' lists of users still hold
+    string name = m_names->name(u->name());
+    if(m_spill != nullptr && m_spill->is_open())
+    {
+        m_spill->clear();
+        m_spill->seekp(0, ios::end);
+        long long offset = m_spill->tellp();
+        u->save(*m_spill);
+        m_spill->flush();
+        uint32_t bytes = uint32_t((long long)m_spill->tellp() - offset);
+        m_spilled.emplaceHashed(hashName(name), u->name(), SpilledUser{offset, bytes});
+        m_spillLive += bytes;
+    }
+    else
+    {
+        u->forEachChat([&](MemberList* chatUsers, int count, uint32_t slot)
+        {
+            if(m_feed != nullptr)
+                m_feed->publish(ChangeEvent::LEAVE, feedUserId(u), m_feed->intern(chatUsers->name()), count);
+            removeMember(*chatUsers, u->name(), slot);
+            reclaimChat(chatUsers);
+        });
+        m_names->remove(u->name());
+        if(m_feed != nullptr)
+            m_feed->forget(name);
+    }
+    m_freedBytes += u->memoryUsage() + sizeof(User) + listNodeBytes<User*>();
+    eraseUser(name, u);
+}
+
+// The live records are copied into a new file, which then takes the old one's place, so a failure part way leaves
+// the old file (and the offsets into it) as they were
+void ChatTrackerImpl::compactSpill()
+{
+    TRACE_SPAN("compact spill file");
+    string compactPath = m_spillPath + ".compact";
+    unique_ptr<fstream> compacted(new fstream(compactPath, ios::in | ios::out | ios::binary | ios::trunc));
+    vector<long long> offsets;
+    offsets.reserve(m_spilled.size());
+    string record;
+    long long offset = 0;
+    for(HashMap<NameStore::Id, SpilledUser>::iterator p = m_spilled.begin(); p != m_spilled.end() && *compacted; ++p)
+    {
+        record.resize(p->second.bytes);
+        m_spill->clear();
+        m_spill->seekg(p->second.offset);
+        m_spill->read(&record[0], record.size());
+        compacted->write(record.data(), record.size());
+        offsets.push_back(offset);
+        offset += p->second.bytes;
+    }
+    compacted->flush();
+    if(!*m_spill || !*compacted || rename(compactPath.c_str(), m_spillPath.c_str()) != 0)
+    {
+        compacted->close();
+        remove(compactPath.c_str());
+        m_spill->clear();
+        return;
+    }
+    size_t k = 0;
+    for(HashMap<NameStore::Id, SpilledUser>::iterator p = m_spilled.begin(); p != m_spilled.end(); ++p)
+        p->second.offset = offsets[k++];
+    m_spill.swap(compacted);
+    m_spillDead = 0;
+}
+
+// *************** Cold tier *******************
+
+void ChatTrackerImpl::setColdTier(unsigned idleMsec)
+{
+    if(m_deltas != nullptr && idleMsec != 0)
+        throw invalid_argument("a tracker with concurrent contributions cannot have a cold tier");
+    m_coldAfter = idleMsec;
+    coolIdleUsers();
+}
+
+uint32_t ChatTrackerImpl::clockMsec() const
+{
+    return uint32_t(chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - m_epoch).count());
+}
+
+// The users are in order of activity, so the sweep stops at the first one that is not idle
+void ChatTrackerImpl::coolIdleUsers()
+{
+    if(m_coldAfter == 0 || m_recency.empty())
+        return;
+    uint32_t now = clockMsec();
+    while(!m_recency.empty() && now - m_recency.back()->touched() >= m_coldAfter)
+        freezeUser(m_recency.back());
+    trimPools();
+}
+
+// Purpose: replace a user by its compressed form
+// The user stays a member of its chats, under the same ID of its name
+void ChatTrackerImpl::freezeUser(User* u)
+{
+    TRACE_SPAN("freeze user");
+    string name = m_names->name(u->name());
+    m_cold.emplaceHashed(hashName(name), u->name(), ColdUser{m_coldBlobs.size()});
+    u->compress(m_coldBlobs);
+    m_heapBytes += nameBytes(name);
+    m_freedBytes += u->memoryUsage() + sizeof(User) + listNodeBytes<User*>();
+    eraseUser(name, u);
+}
+
+void ChatTrackerImpl::compactColdBlobs()
+{
+    TRACE_SPAN("compact cold blobs");
+    string blobs;
+    blobs.reserve(m_coldBlobs.size() - m_coldDead);
+    for(HashMap<NameStore::Id, ColdUser>::iterator it = m_cold.begin(); it != m_cold.end(); ++it)
+    {
+        const char* blob = m_coldBlobs.data() + it->second.offset;
+        it->second.offset = blobs.size();
+        blobs.append(blob, User::compressedSize(blob));
+    }
+    m_coldBlobs.swap(blobs);
+    m_coldDead = 0;
+}
+
+// Trimming walks every free list, so it waits until the freed nodes are an eighth of the pool.  The load pools'
+// freed nodes (of the lists of bulk loaded users) are taken over first, since their chunks are m_pool's.
+void ChatTrackerImpl::trimPools()
+{
+    if(m_freedBytes < max(k_trimSlack, m_nodes->capacity() / 8))
+        return;
+    m_freedBytes = 0;
+    for(NodePool& pool : m_loadPools)
+        m_pool.merge(pool);
+    m_pool.trim();
+    if(m_nodes != &m_pool)
+        m_nodes->trim();
+    m_chatPool.trim();
+    m_coldPool.trim();
+}
+
+//*********** ChatTracker functions **************
+
+// These functions simply delegate to ChatTrackerImpl's functions.
+// The operations that change the tracker are timed, one in every sampleEvery, unless timing is compiled out.
+#ifdef CHATTRACKER_NO_LATENCY
+#define TIME_OPERATION(op)
+#else
+#define TIME_OPERATION(op) LatencyTimer latencyTimer(m_impl->latency(), LatencyStats::op)
+#endif
+
+// maxBuckets only sizes the tables, as it always has; a caller who wants nodes set aside up front says so in Options
+ChatTracker::ChatTracker(int maxBuckets)
+{
+    m_impl = new ChatTrackerImpl(Options(), size_t(max(maxBuckets, 0)));
+}
+
+ChatTracker::ChatTracker(const Options& options)
+{
+    m_impl = new ChatTrackerImpl(options);
+}
+
+ChatTracker::ChatTracker(const Dump& dump, int threads, const Options& options)
+{
+    Options loading;
+    loading.hugePages = options.hugePages;
+    loading.tenantPool = options.tenantPool;
+    loading.concurrentContributions = options.concurrentContributions;
+    loading.coldAfterMsec = options.coldAfterMsec;
+    m_impl = new ChatTrackerImpl(loading);
+    m_impl->bulkLoad(dump, threads);
+}
+
+ChatTracker::~ChatTracker()
+{
+    delete m_impl;
+}
+
+void ChatTracker::join(string user, string chat)
+{
+    TIME_OPERATION(JOIN);
+    m_impl->join(user, chat);
+}
+
+int ChatTracker::terminate(string chat)
+{
+    TIME_OPERATION(TERMINATE);
+    return m_impl->terminate(chat);
+}
+
+int ChatTracker::contribute(string user)
+{
+    TIME_OPERATION(CONTRIBUTE);
+    return m_impl->contribute(user);
+}
+
+int ChatTracker::leave(string user, string chat)
+{
+    TIME_OPERATION(LEAVE);
+    return m_impl->leave(user, chat);
 }
 
 int ChatTracker::leave(string user)
 {
+    TIME_OPERATION(LEAVE_CURRENT);
     return m_impl->leave(user);
 }
+
+int ChatTracker::chatTotal(string chat) const
+{
+    return m_impl->chatTotal(chat);
+}
+
+vector<string> ChatTracker::members(string chat) const
+{
+    return m_impl->members(chat);
+}
+
+size_t ChatTracker::memberCount(const string& chat) const
+{
+    return m_impl->memberCount(chat);
+}
+
+void ChatTracker::visitMembers(const string& chat, MemberCallback* callback, void* context) const
+{
+    m_impl->forEachMember(chat, callback, context);
+}
+
+size_t ChatTracker::members(const string& chat, size_t cursor, size_t limit, vector<string>& out) const
+{
+    return m_impl->members(chat, cursor, limit, out);
+}
+
+string ChatTracker::currentChat(string user)
+{
+    return m_impl->currentChat(user);
+}
+
+void ChatTracker::setMemoryBudget(size_t maxBytes, string spillPath)
+{
+    m_impl->setMemoryBudget(maxBytes, spillPath);
+}
+
+void ChatTracker::setColdTier(unsigned idleMsec)
+{
+    m_impl->setColdTier(idleMsec);
+}
+
+void ChatTracker::reserve(size_t users, size_t chats, size_t memberships)
+{
+    m_impl->reserve(users, chats, memberships);
+}
+
+size_t ChatTracker::memoryUsage() const
+{
+    return m_impl->memoryUsage();
+}
+
+void ChatTracker::scanUsers(size_t part, size_t parts, vector<UserInfo>& out) const
+{
+    m_impl->scanUsers(part, parts, out);
+}
+
+void ChatTracker::scanChats(size_t part, size_t parts, vector<ChatInfo>& out) const
+{
+    m_impl->scanChats(part, parts, out);
+}
+
+ChangeFeed& ChatTracker::enableChangeFeed(size_t batchSize)
+{
+    return m_impl->enableChangeFeed(batchSize);
+}
+
+ChangeFeed* ChatTracker::changeFeed() const
+{
+    return m_impl->changeFeed();
+}
+
+bool ChatTracker::checkpointAsync(const string& path)
+{
+    return m_impl->checkpointAsync(path);
+}
+
+bool ChatTracker::checkpointRunning()
+{
+    return m_impl->checkpointRunning();
+}
+
+bool ChatTracker::waitForCheckpoint()
+{
+    return m_impl->waitForCheckpoint();
+}
+
+LatencyStats ChatTracker::latencyStats() const
+{
+    return m_impl->latency().read();
+}
+
+LatencyStats ChatTracker::resetLatencyStats()
+{
+    return m_impl->latency().resetAndRead();
+}
+
+void ChatTracker::setLatencySampling(unsigned sampleEvery)
+{
+    m_impl->latency().setSampleEvery(sampleEvery);
+}
+
+void ChatTracker::writeDump(ostream& out, const Dump& dump)
+{
+    string text;
+    for(const Dump::Membership& m : dump.memberships)
+    {
+        appendMembershipRow(text, m.user, m.position, m.count, m.chat);
+        flushRows(out, text, false);
+    }
+    for(const Dump::Total& t : dump.totals)
+    {
+        appendTotalRow(text, t.total, t.chat);
+        flushRows(out, text, false);
+    }
+    flushRows(out, text, true);
+}
+
+// Purpose: split off the field of line that starts at pos (and ends at the next space), moving pos past the space
+// Returns false if there is no such field
+static bool nextField(const string& line, size_t& pos, string& field)
+{
+    if(pos >= line.size())
+        return false;
+    size_t end = line.find(' ', pos);
+    if(end == string::npos)
+        end = line.size();
+    field.assign(line, pos, end - pos);
+    pos = end + 1;
+    return !field.empty();
+}
+
+// Purpose: read a number that makes up all of field
+static bool parseNumber(const string& field, long long& value)
+{
+    char* end;
+    value = strtoll(field.c_str(), &end, 10);
+    return !field.empty() && *end == '\0';
+}
+
+bool ChatTracker::readDump(istream& in, Dump& dump)
+{
+    string line;
+    string field;
+    while(getline(in, line))
+    {
+        if(line.empty())
+            continue;
+        size_t pos = 2;
+        long long a;
+        long long b;
+        if(line.compare(0, 2, "m ") == 0)
+        {
+            Dump::Membership m;
+            if(!nextField(line, pos, m.user) || !nextField(line, pos, field) || !parseNumber(field, a) || a < 0
+               || !nextField(line, pos, field) || !parseNumber(field, b) || pos >= line.size())
+                return false;
+            m.position = size_t(a);
+            m.count = int(b);
+            m.chat.assign(line, pos, string::npos);
+            dump.memberships.push_back(std::move(m));
+        }
+        else if(line.compare(0, 2, "t ") == 0)
+        {
+            Dump::Total t;
+            if(!nextField(line, pos, field) || !parseNumber(field, a) || pos >= line.size())
+                return false;
+            t.total = int(a);
+            t.chat.assign(line, pos, string::npos);
+            dump.totals.push_back(std::move(t));
+        }
+        else
+            return false;
+    }
+    return true;
+}
@@ -1,26 +1,231 @@
 #ifndef CHATTRACKER_INCLUDED
 #define CHATTRACKER_INCLUDED
 
+#include "LatencyStats.h"
 #include <string>
+#include <vector>
+#include <iosfwd>
+#include <type_traits>
+#include <cstddef>
 
 class ChatTrackerImpl;
+class ChangeFeed;
+class TenantPool;
 
 class ChatTracker
 {
   public:
+      // Sizes the tracker is built for.  Tables and nodes for the expected
+      // numbers are allocated when the tracker is constructed, so it does not
+      // grow (or rehash) until it passes them; 0 means start small and grow.
+    struct Options
+    {
+        Options() : expectedUsers(0), expectedChats(0), expectedMemberships(0), memoryBudget(0), hugePages(false),
+                    tenantPool(nullptr), concurrentContributions(false), coldAfterMsec(0) {}
+        size_t expectedUsers;
+        size_t expectedChats;
+        size_t expectedMemberships;  // (user, chat) pairs, summed over all users
+        size_t memoryBudget;         // see setMemoryBudget
+        std::string spillPath;
+          // Map the hash tables' buckets and the memory for users, chats
+          // and memberships in 2 MB huge pages where the system has them
+          // (reserved hugetlbfs pages, else transparent huge pages), and in
+          // ordinary pages where it does not.  Fewer, larger pages mean
+          // fewer TLB misses on the random probes of a large tracker.
+        bool hugePages;
+          // Share memory with the other trackers built with the same pool
+          // (see TenantPool.h), which must outlive this tracker.  With the
+          // default sizes, the tracker then starts with a handful of bytes
+          // per table and grows only with its own users and chats; hugePages
+          // is the pool's setting.
+        TenantPool* tenantPool;
+          // Let any number of threads call contribute at once (for
+          // different users), while no other function is called.  Each
+          // thread adds to the chats' totals in deltas of its own, so threads
+          // contributing to one hot chat share no cache line; the next call
+          // of another function folds the deltas into the totals, and
+          // chatTotal and scanChats add them in, so every total and terminate
+          // stays exact.  Such a tracker can have no memory budget, cold
+          // tier or change feed: the constructors, setMemoryBudget,
+          // setColdTier and enableChangeFeed throw std::invalid_argument
+          // rather than give it one.
+        bool concurrentContributions;
+        unsigned coldAfterMsec;      // see setColdTier
+    };
+
+      // A tracker's state as rows, such as a database export.  Each
+      // membership row gives a user's contributions to one of its chats and
+      // the chat's place in the user's chats: position 0 is the current
+      // chat, 1 the one the user was in before that, and so on.  A chat's
+      // members are in the order of its rows (the order they joined).  A
+      // total row gives a chat's total, which counts members who have left;
+      // without one, a chat's total is the sum of its rows' counts.  Each
+      // (user, chat) pair and each chat's total appear at most once.
+    struct Dump
+    {
+        struct Membership
+        {
+            std::string user;
+            std::string chat;
+            size_t position;
+            int count;
+        };
+        struct Total
+        {
+            std::string chat;
+            int total;
+        };
+        std::vector<Membership> memberships;
+        std::vector<Total> totals;
+    };
+
+      // Starts each table with about maxBuckets buckets; nodes are allocated
+      // as the tracker grows
     ChatTracker(int maxBuckets = 20000);
+    explicit ChatTracker(const Options& options);
+      // Builds the tracker the dump describes, as if its users had joined
+      // and contributed, on the given number of threads (0 means one per
+      // core).  Every table is sized once, and threads build the users and
+      // chats whose hash table buckets are theirs alone.  Of the options,
+      // only hugePages, tenantPool, concurrentContributions and
+      // coldAfterMsec are used (the sizes come from the dump, and the loaded
+      // users count as idle since the tracker was made).
+    explicit ChatTracker(const Dump& dump, int threads = 0, const Options& options = Options());
     ~ChatTracker();
     void join(std::string user, std::string chat);
     int terminate(std::string chat);
     int contribute(std::string user);
     int leave(std::string user, std::string chat);
     int leave(std::string user);
+      // Reads that do not change the tracker: the contributions made to a
+      // chat so far (what terminate would return) and the chat's members in
+      // the order they joined
+    int chatTotal(std::string chat) const;
+    std::vector<std::string> members(std::string chat) const;
+      // The number of members of a chat, in O(1)
+    size_t memberCount(const std::string& chat) const;
+      // Calls f with the name of each member of the chat, in the order they
+      // joined.  f may be any callable taking a const std::string&; it is
+      // called directly, without wrapping it in a std::function, and the
+      // names are decoded into one string that is reused for every member.
+    template <typename F>
+    void forEachMember(const std::string& chat, F&& f) const
+    {
+        typedef typename std::remove_reference<F>::type Callable;
+        visitMembers(chat, &callMember<Callable>, const_cast<void*>(static_cast<const void*>(&f)));
+    }
+      // A page of the chat's members: out is set to the names of up to limit
+      // members, starting at cursor (0 for the first page).  Returns the
+      // cursor of the next page, or 0 once there are no more.  The names are
+      // written into out's strings, so passing the same vector for each page
+      // reuses their memory; if the chat changes between pages, later pages
+      // may skip or repeat members.
+    size_t members(const std::string& chat, size_t cursor, size_t limit,
+                   std::vector<std::string>& out) const;
+      // The user's current chat, or "" if the user has none (not const,
+      // since it reloads a user who has been evicted to the spill file)
+    std::string currentChat(std::string user);
+      // Limits the memory used by the tracker to about maxBytes (0 means no
+      // limit).  Over the limit, the least recently active users are evicted:
+      // written to spillPath and reloaded when next used or, if spillPath is
+      // empty, forgotten (their past contributions still count in chat totals;
+      // the change feed gets a leave for each chat a forgotten user was in).
+      // Once the records of reloaded users outweigh those of users still
+      // evicted, the spill file is rewritten with only the live records.
+    void setMemoryBudget(size_t maxBytes, std::string spillPath = "");
+      // Keeps users who have not joined, contributed or left for idleMsec
+      // milliseconds (0 means never) compressed in memory: each one's chats,
+      // counts and slots as a few bytes of varints in one shared buffer, and
+      // its name only as an ID, instead of a table entry and a list node per
+      // chat.  The memory the hot users held is given back to the system as
+      // whole chunks of it are freed.  A cold user is decompressed when next used, and is
+      // compressed again if it stays idle (a terminate or currentChat that
+      // decompresses it does not count as activity).  Users are idle from
+      // their last activity while the tier was on, or else from when the
+      // tracker was made.
+    void setColdTier(unsigned idleMsec);
+      // Allocates room for the given numbers of users, chats and memberships
+    void reserve(size_t users, size_t chats, size_t memberships);
+      // Estimated bytes used by the users, chats, member lists and tables
+    size_t memoryUsage() const;
+      // Starts publishing every change to a ChangeFeed (the first call
+      // creates it) and returns the feed; without it no events are built.
+    ChangeFeed& enableChangeFeed(size_t batchSize = 64);
+      // The feed, or nullptr if it has not been enabled
+    ChangeFeed* changeFeed() const;
+      // What a scan reports about each user and chat.  A chat's name
+      // belongs to the tracker and is valid until it next changes; a user's
+      // name is decoded from the tracker's store of names (where alone it
+      // is kept) into the strings out already holds, so scanning into the
+      // same vector again reuses their memory.
+    struct UserInfo
+    {
+        std::string name;
+        size_t chats;             // the chats the user is in
+        long long contributions;  // the user's contributions to those chats
+    };
+    struct ChatInfo
+    {
+        const std::string* name;
+        int total;                // what terminate would return
+        size_t members;
+    };
+      // Read-only scans for reports.  The users (and the chats) are split
+      // into parts ranges of hash table buckets; scanning part k of parts
+      // puts the users (or chats) in the k-th range in out, replacing what
+      // it held.  Scanning every part visits each user and chat once.  Parts
+      // may be scanned by several threads at once while nothing changes the
+      // tracker.  Cold users are scanned from their compressed form and
+      // users evicted to the spill file from their records, which each scan
+      // reads through a stream of its own.
+    void scanUsers(size_t part, size_t parts, std::vector<UserInfo>& out) const;
+    void scanChats(size_t part, size_t parts, std::vector<ChatInfo>& out) const;
+      // A dump as text, one row per line: "m user position count chat" for
+      // a membership and "t total chat" for a total (the chat's name is the
+      // rest of the line).  readDump appends the rows it reads to dump and
+      // returns false if it finds a line that is not a row.
+    static void writeDump(std::ostream& out, const Dump& dump);
+    static bool readDump(std::istream& in, Dump& dump);
+      // Writes the tracker as it is now to path, as a text dump, while the
+      // tracker goes on changing.  The process forks, and the child writes
+      // the copy of the tracker it was forked with (the pages are shared
+      // until the parent changes them), so the caller waits only for the
+      // fork.  The dump goes to path + ".tmp" and is renamed to path once
+      // it is complete.  Returns false if a checkpoint is still being
+      // written or the process cannot fork.
+    bool checkpointAsync(const std::string& path);
+      // True while a checkpoint is being written
+    bool checkpointRunning();
+      // Waits for the checkpoint being written, if there is one, and
+      // returns false if it could not be written
+    bool waitForCheckpoint();
+      // Latency histograms of join, terminate, contribute and the two
+      // leaves, timed on one operation in every sampleEvery (64 unless set;
+      // 0 turns the timing off; each thread picks up a new setting when it
+      // next samples).  latencyStats is a snapshot of the
+      // histograms since the last reset, and may be called from any thread
+      // while the tracker is in use; resetLatencyStats returns the snapshot
+      // and starts the histograms afresh.  Trackers built with a tenant pool
+      // share its histograms and sampling rate.  Building with
+      // CHATTRACKER_NO_LATENCY compiles the timing out, and the histograms
+      // stay empty.
+    LatencyStats latencyStats() const;
+    LatencyStats resetLatencyStats();
+    void setLatencySampling(unsigned sampleEvery);
       // We prevent a ChatTracker object from being copied or assigned
     ChatTracker(const ChatTracker&) = delete;
     ChatTracker& operator=(const ChatTracker&) = delete;
 
   private:
     ChatTrackerImpl* m_impl;
+
+    typedef void MemberCallback(void* context, const std::string& name);
+    void visitMembers(const std::string& chat, MemberCallback* callback, void* context) const;
+    template <typename Callable>
+    static void callMember(void* context, const std::string& name)
+    {
+        (*static_cast<Callable*>(context))(name);
+    }
 };
 
 #endif // SYMBOLTABLE_INCLUDED
@@ -0,0 +1,106 @@
+
+#include "DeltaCounters.h"
+#include <atomic>
+using namespace std;
+
+// *************** DeltaCounters implementations *******************
+
+thread_local DeltaCounters::ShardCache DeltaCounters::t_shardCache = { 0, nullptr };
+static atomic<uint64_t> s_nextCountersId(1);
+
+DeltaCounters::DeltaCounters() : m_id(s_nextCountersId.fetch_add(1))
+{
+}
+
+DeltaCounters::~DeltaCounters()
+{
+    for(Shard* shard : m_shards)
+        delete shard;
+}
+
+DeltaCounters::Shard* DeltaCounters::shardOfThisThread()
+{
+    // This thread has not incremented these counters yet, or has incremented others since
+    lock_guard<mutex> lock(m_mutex);
+    thread::id self = this_thread::get_id();
+    Shard* shard = nullptr;
+    for(Shard* s : m_shards)
+    {
+        if(s->owner == self)
+            shard = s;
+    }
+    if(shard == nullptr)
+    {
+        shard = new Shard;
+        shard->owner = self;
+        shard->slots.assign(size_t(1) << k_initialBits, Slot{nullptr, 0});
+        shard->used = 0;
+        shard->shift = 64 - k_initialBits;
+        m_shards.push_back(shard);
+    }
+    t_shardCache.owner = m_id;
+    t_shardCache.shard = shard;
+    return shard;
+}
+
+// Once half the slots are used the table doubles, and the counters are placed again
+DeltaCounters::Slot* DeltaCounters::Shard::claim(Slot* s, int* counter)
+{
+    s->counter = counter;
+    used++;
+    if(used * 2 <= slots.size())
+        return s;
+    vector<Slot> old(slots.size() * 2, Slot{nullptr, 0});
+    old.swap(slots);
+    shift--;
+    Slot* moved = nullptr;
+    for(const Slot& o : old)
+    {
+        if(o.counter == nullptr)
+            continue;
+        Slot& n = slots[place(o.counter)];
+        n = o;
+        if(o.counter == counter)
+            moved = &n;
+    }
+    return moved;
+}
+
+// No thread increments while the deltas are read or folded, so the shards are read without the lock
+int DeltaCounters::pending(const int* counter) const
+{
+    int total = 0;
+    for(const Shard* shard : m_shards)
+    {
+        if(shard->used != 0)
+            total += shard->slots[shard->place(counter)].delta;
+    }
+    return total;
+}
+
+// A shard's table keeps its size, since its thread is likely to touch as many counters again
+void DeltaCounters::fold()
+{
+    for(Shard* shard : m_shards)
+    {
+        if(shard->used == 0)
+            continue;
+        for(Slot& s : shard->slots)
+        {
+            if(s.counter != nullptr)
+            {
+                *s.counter += s.delta;
+                s = Slot{nullptr, 0};
+            }
+        }
+        shard->used = 0;
+    }
+}
+
+size_t DeltaCounters::memoryUsage() const
+{
+    size_t total = m_shards.capacity() * sizeof(Shard*);
+    for(const Shard* shard : m_shards)
+        total += sizeof(Shard) + shard->slots.capacity() * sizeof(Slot);
+    return total;
+}
@@ -0,0 +1,82 @@
+#ifndef DELTACOUNTERS_INCLUDED
+#define DELTACOUNTERS_INCLUDED
+
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <cstddef>
+#include <cstdint>
+
+// DeltaCounters class declaration
+// Increments to int counters made by many threads at once, kept apart until they are folded into the counters.
+// Each thread that increments gets a shard of its own, a small open-addressed table from counter to the delta
+// the thread has added to it so far, so threads incrementing the same counter write no shared cache line.  A
+// thread finds its shard through a cache of the last DeltaCounters it used, or else by a search, as
+// LatencyRecorder finds its shards.  fold adds every delta to its counter and empties the shards.  fold, pending
+// and memoryUsage must not run while any thread increments (the caller orders them, as it orders the tracker's
+// operations).
+class DeltaCounters
+{
+public:
+    DeltaCounters();
+    ~DeltaCounters();
+    // The hot path: adds one to this thread's delta for the counter
+    void increment(int* counter)
+    {
+        Shard* shard = (t_shardCache.owner == m_id ? static_cast<Shard*>(t_shardCache.shard) : shardOfThisThread());
+        Slot* s = &shard->slots[shard->place(counter)];
+        if(s->counter == nullptr)
+            s = shard->claim(s, counter);
+        s->delta++;
+    }
+    // The deltas not yet folded into the counter, summed over the threads
+    int pending(const int* counter) const;
+    // Adds every delta to its counter
+    void fold();
+    // Bytes of the shards and their tables
+    size_t memoryUsage() const;
+    DeltaCounters(const DeltaCounters&) = delete;
+    DeltaCounters& operator=(const DeltaCounters&) = delete;
+
+private:
+    struct Slot
+    {
+        int* counter;  // nullptr for an empty slot
+        int delta;
+    };
+    struct Shard
+    {
+        std::thread::id owner;
+        // A power of two slots, at most half of them used; empty when the deltas have been folded
+        std::vector<Slot> slots;
+        size_t used;
+        unsigned shift;
+        // The index of the counter's slot, or of the empty slot where it would go
+        size_t place(const int* counter) const
+        {
+            size_t i = size_t((reinterpret_cast<uintptr_t>(counter) >> 2) * 0x9e3779b97f4a7c15ull >> shift);
+            while(slots[i].counter != counter && slots[i].counter != nullptr)
+                i = (i + 1) & (slots.size() - 1);
+            return i;
+        }
+        // Puts the counter in the empty slot s (from place), growing the table if it gets too full
+        Slot* claim(Slot* s, int* counter);
+    };
+    struct ShardCache
+    {
+        uint64_t owner;
+        void* shard;
+    };
+    static const unsigned k_initialBits = 4;
+    // This thread's shard of the DeltaCounters it last incremented
+    static thread_local ShardCache t_shardCache;
+    // Tells these counters apart from any earlier ones at the same address in the threads' shard caches
+    uint64_t m_id;
+    // Guards m_shards against threads adding their shards at the same time
+    std::mutex m_mutex;
+    std::vector<Shard*> m_shards;
+
+    Shard* shardOfThisThread();
+};
+
+#endif // DELTACOUNTERS_INCLUDED
@@ -0,0 +1,274 @@
+#ifndef DENSECHATTRACKER_INCLUDED
+#define DENSECHATTRACKER_INCLUDED
+
+#include <string>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <type_traits>
+#include <cstdint>
+#include <cstddef>
+
+// The smallest unsigned type that holds every value up to and including N
+template <size_t N>
+struct DenseIndex
+{
+    typedef typename std::conditional<N <= UINT8_MAX, uint8_t,
+            typename std::conditional<N <= UINT16_MAX, uint16_t,
+            typename std::conditional<N <= UINT32_MAX, uint32_t, uint64_t>::type>::type>::type type;
+};
+
+// DenseChatTracker class declaration
+// A tracker for populations with known bounds, whose users and chats are numbered 0 to MaxUsers-1 and
+// 0 to MaxChats-1.  It behaves exactly like ChatTracker, but a user or chat is found by indexing an array
+// with its number instead of by hashing its name.  The numbers are stored in the narrowest types that hold
+// them, and each membership's contribution count in CountT (which the caller picks wide enough for the
+// contributions one user makes to one chat; a chat's total is an int, as ChatTracker returns).
+// The user and chat tables are fixed-size arrays inside the object, so a tracker with large bounds should
+// be allocated with new rather than on the stack.
+template <size_t MaxUsers, size_t MaxChats, typename CountT = unsigned int>
+class DenseChatTracker
+{
+public:
+    static_assert(MaxUsers > 0 && MaxChats > 0, "a dense tracker needs room for at least one user and chat");
+    static_assert(std::is_integral<CountT>::value, "contribution counts must be integers");
+    // Returned for a user with no current chat, and by idOf for a name with no number or a number out of range
+    static const size_t k_none = size_t(-1);
+
+    DenseChatTracker() {}
+    // The operations of ChatTracker, on user and chat numbers; numbers out of range are ignored (join and
+    // terminate do nothing and return 0, contribute returns 0 and leave -1)
+    void join(size_t user, size_t chat);
+    int terminate(size_t chat);
+    int contribute(size_t user);
+    int leave(size_t user, size_t chat);
+    int leave(size_t user);
+    int chatTotal(size_t chat) const;
+    size_t memberCount(size_t chat) const;
+    // The user's current chat, or k_none
+    size_t currentChat(size_t user) const;
+    // The chat's members, in the order they joined
+    std::vector<size_t> members(size_t chat) const;
+    // The same operations on names, each of which is numbered by the digits it ends with (as the test
+    // generator names them: "uuuuuuuuuuu00042" is user 42)
+    void join(const std::string& user, const std::string& chat) { join(idOf(user), idOf(chat)); }
+    int terminate(const std::string& chat) { return terminate(idOf(chat)); }
+    int contribute(const std::string& user) { return contribute(idOf(user)); }
+    int leave(const std::string& user, const std::string& chat) { return leave(idOf(user), idOf(chat)); }
+    int leave(const std::string& user) { return leave(idOf(user)); }
+    static size_t idOf(const std::string& name);
+
+    DenseChatTracker(const DenseChatTracker&) = delete;
+    DenseChatTracker& operator=(const DenseChatTracker&) = delete;
+
+private:
+    typedef typename DenseIndex<MaxUsers>::type UserId;
+    typedef typename DenseIndex<MaxChats>::type ChatId;
+    // Slots are never more than twice the members (plus one), since a chat's list is compacted at half empty
+    typedef typename DenseIndex<2 * MaxUsers + 1>::type Slot;
+    // Marks an empty slot in a chat's list of members
+    // (UserId holds MaxUsers, so no user's number is the largest UserId)
+    static const UserId k_emptySlot = UserId(-1);
+
+    struct Membership
+    {
+        ChatId chat;
+        Slot slot;     // the user's slot in the chat's list of members
+        CountT count;
+    };
+    // A user's chats, least recently joined first, so the current chat is the last one
+    typedef std::vector<Membership> UserChats;
+    struct Chat
+    {
+        Chat() : count(0), total(0) {}
+        std::vector<UserId> slots;  // members in the order they joined, with k_emptySlot where one left
+        size_t count;
+        int total;
+    };
+    std::array<UserChats, MaxUsers> m_users;
+    std::array<Chat, MaxChats> m_chats;
+
+    typename UserChats::iterator findChat(UserChats& chats, size_t chat);
+    void removeMember(size_t chat, Slot slot);
+};
+
+template <size_t MaxUsers, size_t MaxChats, typename CountT>
+const size_t DenseChatTracker<MaxUsers, MaxChats, CountT>::k_none;
+
+template <size_t MaxUsers, size_t MaxChats, typename CountT>
+const typename DenseChatTracker<MaxUsers, MaxChats, CountT>::UserId DenseChatTracker<MaxUsers, MaxChats, CountT>::k_emptySlot;
+
+template <size_t MaxUsers, size_t MaxChats, typename CountT>
+size_t DenseChatTracker<MaxUsers, MaxChats, CountT>::idOf(const std::string& name)
+{
+    size_t start = name.size();
+    while(start > 0 && name[start - 1] >= '0' && name[start - 1] <= '9')
+        start--;
+    if(start == name.size())
+        return k_none;
+    // A number past both bounds names no user or chat; stopping there also keeps a long run of digits from
+    // wrapping around into range
+    const size_t bound = (MaxUsers > MaxChats ? MaxUsers : MaxChats);
+    size_t id = 0;
+    for(size_t k = start; k < name.size(); k++)
+    {
+        id = id * 10 + size_t(name[k] - '0');
+        if(id >= bound)
+            return k_none;
+    }
+    return id;
+}
+
+template <size_t MaxUsers, size_t MaxChats, typename CountT>
+typename DenseChatTracker<MaxUsers, MaxChats, CountT>::UserChats::iterator
+DenseChatTracker<MaxUsers, MaxChats, CountT>::findChat(UserChats& chats, size_t chat)
+{
+    // Users are in few chats, and the recent ones are at the back
+    typename UserChats::iterator it = chats.end();
+    while(it != chats.begin())
+    {
+        --it;
+        if(it->chat == chat)
+            return it;
+    }
+    return chats.end();
+}
+
+// Purpose: empty a member's slot in the chat's list of members, moving the members down over the empty
+// slots once at least half of them are empty
+template <size_t MaxUsers, size_t MaxChats, typename CountT>
+void DenseChatTracker<MaxUsers, MaxChats, CountT>::removeMember(size_t chat, Slot slot)
+{
+    Chat& c = m_chats[chat];
+    c.slots[slot] = k_emptySlot;
+    c.count--;
+    if(c.slots.size() < 2 * c.count)
+        return;
+    size_t to = 0;
+    for(size_t from = 0; from < c.slots.size(); from++)
+    {
+        UserId member = c.slots[from];
+        if(member == k_emptySlot)
+            continue;
+        if(from != to)
+        {
+            c.slots[to] = member;
+            findChat(m_users[member], chat)->slot = Slot(to);
+        }
+        to++;
+    }
+    c.slots.resize(to);
+}
+
+template <size_t MaxUsers, size_t MaxChats, typename CountT>
+void DenseChatTracker<MaxUsers, MaxChats, CountT>::join(size_t user, size_t chat)
+{
+    if(user >= MaxUsers || chat >= MaxChats)
+        return;
+    UserChats& chats = m_users[user];
+    typename UserChats::iterator it = findChat(chats, chat);
+    if(it != chats.end())
+    {
+        // Already a member: the chat becomes the current one, and keeps its place in the chat's members
+        std::rotate(it, it + 1, chats.end());
+        return;
+    }
+    Chat& c = m_chats[chat];
+    chats.push_back(Membership{ChatId(chat), Slot(c.slots.size()), CountT(0)});
+    c.slots.push_back(UserId(user));
+    c.count++;
+}
+
+template <size_t MaxUsers, size_t MaxChats, typename CountT>
+int DenseChatTracker<MaxUsers, MaxChats, CountT>::terminate(size_t chat)
+{
+    if(chat >= MaxChats)
+        return 0;
+    Chat& c = m_chats[chat];
+    for(UserId member : c.slots)
+    {
+        if(member != k_emptySlot)
+        {
+            UserChats& chats = m_users[member];
+            chats.erase(findChat(chats, chat));
+        }
+    }
+    int total = c.total;
+    c.slots.clear();
+    c.count = 0;
+    c.total = 0;
+    return total;
+}
+
+template <size_t MaxUsers, size_t MaxChats, typename CountT>
+int DenseChatTracker<MaxUsers, MaxChats, CountT>::contribute(size_t user)
+{
+    if(user >= MaxUsers || m_users[user].empty())
+        return 0;
+    Membership& current = m_users[user].back();
+    current.count++;
+    m_chats[current.chat].total++;
+    return int(current.count);
+}
+
+template <size_t MaxUsers, size_t MaxChats, typename CountT>
+int DenseChatTracker<MaxUsers, MaxChats, CountT>::leave(size_t user, size_t chat)
+{
+    if(user >= MaxUsers || chat >= MaxChats)
+        return -1;
+    UserChats& chats = m_users[user];
+    typename UserChats::iterator it = findChat(chats, chat);
+    if(it == chats.end())
+        return -1;
+    int count = int(it->count);
+    Slot slot = it->slot;
+    chats.erase(it);
+    removeMember(chat, slot);
+    return count;
+}
+
+template <size_t MaxUsers, size_t MaxChats, typename CountT>
+int DenseChatTracker<MaxUsers, MaxChats, CountT>::leave(size_t user)
+{
+    if(user >= MaxUsers || m_users[user].empty())
+        return -1;
+    Membership current = m_users[user].back();
+    m_users[user].pop_back();
+    removeMember(current.chat, current.slot);
+    return int(current.count);
+}
+
+template <size_t MaxUsers, size_t MaxChats, typename CountT>
+int DenseChatTracker<MaxUsers, MaxChats, CountT>::chatTotal(size_t chat) const
+{
+    return chat < MaxChats ? m_chats[chat].total : 0;
+}
+
+template <size_t MaxUsers, size_t MaxChats, typename CountT>
+size_t DenseChatTracker<MaxUsers, MaxChats, CountT>::memberCount(size_t chat) const
+{
+    return chat < MaxChats ? m_chats[chat].count : 0;
+}
+
+template <size_t MaxUsers, size_t MaxChats, typename CountT>
+size_t DenseChatTracker<MaxUsers, MaxChats, CountT>::currentChat(size_t user) const
+{
+    return user < MaxUsers && !m_users[user].empty() ? m_users[user].back().chat : k_none;
+}
+
+template <size_t MaxUsers, size_t MaxChats, typename CountT>
+std::vector<size_t> DenseChatTracker<MaxUsers, MaxChats, CountT>::members(size_t chat) const
+{
+    std::vector<size_t> result;
+    if(chat < MaxChats)
+    {
+        for(UserId member : m_chats[chat].slots)
+        {
+            if(member != k_emptySlot)
+                result.push_back(member);
+        }
+    }
+    return result;
+}
+
+#endif // DENSECHATTRACKER_INCLUDED
@@ -0,0 +1,634 @@
+#ifndef HASHMAP_INCLUDED
+#define HASHMAP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include "NodePool.h"
+#include "TraceEvents.h"
+
+// *************** Hash policies *******************
+// A hash policy is any type with an operator() that takes a key and returns a 64-bit hash.
+// HashMap keeps only the low bits of the hash to pick a bucket, so a policy must mix well into its low bits.
+
+// StdHash: the hash the HashMap used originally (std::hash), widened to 64 bits
+struct StdHash
+{
+    template <typename KeyType>
+    uint64_t operator()(const KeyType& key) const
+    {
+        return std::hash<KeyType>()(key);
+    }
+};
+
+const uint64_t k_wySecret0 = 0xa0761d6478bd642full;
+const uint64_t k_wySecret1 = 0xe7037ed1a0b428dbull;
+
+// WyHash: a wyhash-style hash; strings are read 8 bytes at a time and folded with 64x64->128 bit multiplies
+struct WyHash
+{
+    uint64_t operator()(const std::string& key) const
+    {
+        return hashBytes(key.data(), key.size());
+    }
+
+    // Integral keys (and anything else std::hash accepts) only need their bits mixed
+    template <typename KeyType>
+    uint64_t operator()(const KeyType& key) const
+    {
+        return mix(std::hash<KeyType>()(key) ^ k_wySecret0, k_wySecret1);
+    }
+
+    static uint64_t hashBytes(const char* data, size_t len)
+    {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+        uint64_t seed = mix(k_wySecret0, k_wySecret1);
+        uint64_t a;
+        uint64_t b;
+        if(len <= 16)
+        {
+            if(len >= 8)
+            {
+                // Two (possibly overlapping) 8-byte reads cover every byte
+                a = read8(p);
+                b = read8(p + len - 8);
+            }
+            else if(len >= 4)
+            {
+                // Two (possibly overlapping) 4-byte reads cover every byte
+                a = read4(p);
+                b = read4(p + len - 4);
+            }
+            else if(len > 0)
+            {
+                a = (uint64_t(p[0]) << 16) | (uint64_t(p[len >> 1]) << 8) | p[len - 1];
+                b = 0;
+            }
+            else
+            {
+                a = 0;
+                b = 0;
+            }
+        }
+        else
+        {
+            size_t i = len;
+            // Fold all but the last 16 bytes into the seed, 16 bytes per round
+            while(i > 16)
+            {
+                seed = mix(read8(p) ^ k_wySecret1, read8(p + 8) ^ seed);
+                p += 16;
+                i -= 16;
+            }
+            // The last 16 bytes (overlapping the previous round if needed)
+            a = read8(p + i - 16);
+            b = read8(p + i - 8);
+        }
+        a ^= k_wySecret1;
+        b ^= seed;
+        multiply(a, b);
+        return mix(a ^ k_wySecret0 ^ len, b ^ k_wySecret1);
+    }
+
+private:
+    static void multiply(uint64_t& a, uint64_t& b)
+    {
+        __uint128_t r = a;
+        r *= b;
+        a = uint64_t(r);
+        b = uint64_t(r >> 64);
+    }
+    static uint64_t mix(uint64_t a, uint64_t b)
+    {
+        multiply(a, b);
+        return a ^ b;
+    }
+    static uint64_t read8(const unsigned char* p)
+    {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        return v;
+    }
+    static uint64_t read4(const unsigned char* p)
+    {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        return v;
+    }
+};
+
+
+// Templated HashMap class declaration
+// Class accepts two different types of data types: one that represents the key value and one that represents the value
+// The third (optional) type is the hash policy used to hash keys
+// Each bucket is a singly linked chain of entries; entries come from a NodePool if one is given
+template <typename KeyType, typename ValueType, typename Hasher = WyHash>
+class HashMap
+{
+public:
+    // Each entry keeps the full hash of its key, so rehashing never calls the hash function again
+    // and a lookup can skip entries whose hash differs without comparing keys
+    struct Entry
+    {
+        template <typename K, typename... Args>
+        Entry(uint64_t h, K&& k, Args&&... args) : next(nullptr), hash(h), first(std::forward<K>(k)), second(std::forward<Args>(args)...) {}
+        Entry* next;
+        uint64_t hash;
+        KeyType first;
+        ValueType second;
+    };
+    class iterator;
+    class NodeHandle;
+
+    HashMap(int maxBuckets, NodePool* pool = nullptr);
+    ~HashMap();
+    void associate(const KeyType& key, const ValueType& value);
+    template <typename K, typename... Args>
+    std::pair<ValueType*, bool> try_emplace(K&& key, Args&&... args);
+    template <typename K, typename V>
+    std::pair<ValueType*, bool> insert_or_assign(K&& key, V&& value);
+    bool erase(const KeyType& key);
+    iterator erase(iterator pos);
+    NodeHandle extract(const KeyType& key);
+    std::pair<ValueType*, bool> insert(NodeHandle&& node);
+    ValueType* find(const KeyType& key);
+    const ValueType* find(const KeyType& key) const;
+    // The map's copy of key, or nullptr if key is not in the map; it stays where it is until its entry is erased
+    const KeyType* findKey(const KeyType& key) const;
+    void reserve(size_t count);
+    iterator begin();
+    iterator end();
+    // Calls f(key, value) for each entry in buckets first to last-1, so a scan can be split into ranges of buckets
+    template <typename Func>
+    void forEachInBuckets(size_t first, size_t last, Func f) const;
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    size_t bucketCount() const { return m_map.size(); }
+    // Bulk insertion by several threads at once.  After reserveBuckets has made room for every new key,
+    // threads may call emplaceNew at the same time as long as no two of them use the same bucket
+    // (bucketOf tells which bucket a hash goes to); the map does not grow or count the entries
+    // until addBulkCount is called with the number inserted.  Each key must not be in the map yet.
+    // The entry comes from the given pool, which must outlive the map; the map frees it to its own
+    // pool, so this is only for maps that have one.
+    void reserveBuckets(size_t count);
+    uint64_t hash(const KeyType& key) const
+    {
+        TRACE_SPAN("hash");
+        return m_hasher(key);
+    }
+    size_t bucketOf(uint64_t hash) const { return getBucketNumber(hash); }
+    template <typename K, typename... Args>
+    ValueType* emplaceNew(NodePool* pool, uint64_t hash, K&& key, Args&&... args);
+    void addBulkCount(size_t count) { m_size += count; }
+    // Lookups by a hash the caller computes from something the key stands for (such as the name a name's ID
+    // stands for), so the key can be smaller than what it is looked up by.  match(key) tells whether an entry
+    // whose hash is hash is the one sought; it is only called for such entries.  A map used this way must be
+    // used only this way (and by iterating), since the other functions hash the keys themselves.
+    template <typename Match>
+    ValueType* findHashed(uint64_t hash, Match match);
+    template <typename Match>
+    const ValueType* findHashed(uint64_t hash, Match match) const;
+    template <typename Match>
+    bool eraseHashed(uint64_t hash, Match match);
+    // Adds an entry under the given hash; the key must not be in the map yet
+    template <typename K, typename... Args>
+    ValueType* emplaceHashed(uint64_t hash, K&& key, Args&&... args);
+    // Bytes used by the table itself: the bucket array and one node per entry
+    // (memory owned by the keys and values, such as the contents of long strings, is not included)
+    size_t memoryUsage() const { return m_map.capacity() * sizeof(Entry*) + m_size * sizeof(Entry); }
+    HashMap(const HashMap&) = delete;
+    HashMap& operator=(const HashMap&) = delete;
+private:
+    // The buckets are mapped as huge page regions if the map's pool is set to use huge pages
+    typedef std::vector<Entry*, RegionAllocator<Entry*>> Buckets;
+    Buckets m_map;
+    size_t m_size;
+    Hasher m_hasher;
+    NodePool* m_pool;
+
+    // The number of buckets is always a power of two, so the bucket number is the low bits of the hash
+    size_t getBucketNumber(uint64_t hash) const
+    {
+        return hash & (m_map.size() - 1);
+    }
+    static size_t roundUpToPowerOfTwo(size_t n);
+    // Returns the link (the bucket head or a previous entry's next pointer) that points to the entry with the key,
+    // or the null link at the end of the chain if there is no such entry
+    Entry** findLink(uint64_t hash, const KeyType& key);
+    template <typename Match>
+    Entry** findLinkWhere(uint64_t hash, Match match);
+    template <typename K, typename... Args>
+    Entry* newEntry(uint64_t hash, K&& key, Args&&... args);
+    void deleteEntry(Entry* e);
+    void link(Entry* e);
+    void rehash(size_t buckets);
+};
+
+// Forward iterator over every entry of the map, bucket by bucket
+// Dereferencing gives the Entry, so (like std::unordered_map) ->first is the key and ->second the value
+template<typename KeyType, typename ValueType, typename Hasher>
+class HashMap<KeyType, ValueType, Hasher>::iterator
+{
+public:
+    iterator() : m_buckets(nullptr), m_index(0), m_entry(nullptr) {}
+    Entry& operator*() const { return *m_entry; }
+    Entry* operator->() const { return m_entry; }
+    iterator& operator++()
+    {
+        m_entry = m_entry->next;
+        skipEmpty();
+        return *this;
+    }
+    bool operator==(const iterator& other) const { return m_entry == other.m_entry; }
+    bool operator!=(const iterator& other) const { return m_entry != other.m_entry; }
+private:
+    friend class HashMap;
+    iterator(Buckets* buckets, size_t index, Entry* entry)
+     : m_buckets(buckets), m_index(index), m_entry(entry)
+    {
+        skipEmpty();
+    }
+    // Move forward to the first entry of the next non-empty bucket if the current chain has ended
+    void skipEmpty()
+    {
+        while(m_entry == nullptr && m_index + 1 < m_buckets->size())
+        {
+            m_index++;
+            m_entry = (*m_buckets)[m_index];
+        }
+    }
+    Buckets* m_buckets;
+    size_t m_index;
+    Entry* m_entry;
+};
+
+// A node handle owns one entry removed from the map by extract()
+// The entry can be inspected or changed and put back (in this map or another of the same type) with insert()
+template<typename KeyType, typename ValueType, typename Hasher>
+class HashMap<KeyType, ValueType, Hasher>::NodeHandle
+{
+public:
+    NodeHandle() : m_entry(nullptr), m_owner(nullptr) {}
+    NodeHandle(NodeHandle&& other) : m_entry(other.m_entry), m_owner(other.m_owner) { other.m_entry = nullptr; }
+    ~NodeHandle()
+    {
+        if(m_entry != nullptr)
+            m_owner->deleteEntry(m_entry);
+    }
+    bool empty() const { return m_entry == nullptr; }
+    const KeyType& key() const { return m_entry->first; }
+    ValueType& mapped() { return m_entry->second; }
+    NodeHandle(const NodeHandle&) = delete;
+    NodeHandle& operator=(const NodeHandle&) = delete;
+private:
+    friend class HashMap;
+    Entry* m_entry;
+    // The map the entry came from, which knows how to free it
+    HashMap* m_owner;
+};
+
+template<typename KeyType, typename ValueType, typename Hasher>
+size_t HashMap<KeyType, ValueType, Hasher>::roundUpToPowerOfTwo(size_t n)
+{
+    size_t p = 1;
+    while(p < n)
+        p <<= 1;
+    return p;
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+HashMap<KeyType, ValueType, Hasher>::HashMap(int maxBuckets, NodePool* pool)
+ : m_map(roundUpToPowerOfTwo(maxBuckets > 0 ? maxBuckets : 1), nullptr,
+         RegionAllocator<Entry*>(pool != nullptr && pool->hugePages())),
+   m_pool(pool)
+{
+    m_size = 0;
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+HashMap<KeyType, ValueType, Hasher>::~HashMap()
+{
+    // Free every entry of every chain
+    for(Entry* e : m_map)
+    {
+        while(e != nullptr)
+        {
+            Entry* next = e->next;
+            deleteEntry(e);
+            e = next;
+        }
+    }
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+template <typename K, typename... Args>
+typename HashMap<KeyType, ValueType, Hasher>::Entry* HashMap<KeyType, ValueType, Hasher>::newEntry(uint64_t hash, K&& key, Args&&... args)
+{
+    TRACE_SPAN("allocate entry");
+    void* p = (m_pool != nullptr ? m_pool->allocate(sizeof(Entry)) : ::operator new(sizeof(Entry)));
+    return new (p) Entry(hash, std::forward<K>(key), std::forward<Args>(args)...);
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+void HashMap<KeyType, ValueType, Hasher>::deleteEntry(Entry* e)
+{
+    e->~Entry();
+    if(m_pool != nullptr)
+        m_pool->deallocate(e, sizeof(Entry));
+    else
+        ::operator delete(e);
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+typename HashMap<KeyType, ValueType, Hasher>::Entry** HashMap<KeyType, ValueType, Hasher>::findLink(uint64_t hash, const KeyType& key)
+{
+    // Only compare keys of entries whose stored hash matches
+    TRACE_SPAN("bucket walk");
+    Entry** link = &m_map[getBucketNumber(hash)];
+    while(*link != nullptr && !((*link)->hash == hash && (*link)->first == key))
+        link = &(*link)->next;
+    return link;
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+template <typename Match>
+typename HashMap<KeyType, ValueType, Hasher>::Entry** HashMap<KeyType, ValueType, Hasher>::findLinkWhere(uint64_t hash, Match match)
+{
+    TRACE_SPAN("bucket walk");
+    Entry** link = &m_map[getBucketNumber(hash)];
+    while(*link != nullptr && !((*link)->hash == hash && match((*link)->first)))
+        link = &(*link)->next;
+    return link;
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+void HashMap<KeyType, ValueType, Hasher>::link(Entry* e)
+{
+    // Put the entry at the head of its bucket's chain
+    Entry*& head = m_map[getBucketNumber(e->hash)];
+    e->next = head;
+    head = e;
+    m_size++;
+
+    // Keep the average chain length at most one
+    if(m_size > m_map.size())
+        rehash(m_map.size() * 2);
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+void HashMap<KeyType, ValueType, Hasher>::rehash(size_t buckets)
+{
+    // Move every entry into its bucket in a new table of the given (power of two) size
+    // Entries are relinked, so no key is copied or re-hashed
+    TRACE_SPAN("rehash");
+    Buckets newMap(buckets, nullptr, m_map.get_allocator());
+    size_t mask = newMap.size() - 1;
+    for(Entry* e : m_map)
+    {
+        while(e != nullptr)
+        {
+            Entry* next = e->next;
+            Entry*& head = newMap[e->hash & mask];
+            e->next = head;
+            head = e;
+            e = next;
+        }
+    }
+    m_map.swap(newMap);
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+void HashMap<KeyType, ValueType, Hasher>::reserve(size_t count)
+{
+    // Make room for count entries at an average chain length of at most one
+    if(count > m_map.size())
+        rehash(roundUpToPowerOfTwo(count));
+    // and have the pool set aside memory for the entries not yet in the map
+    if(m_pool != nullptr && count > m_size)
+        m_pool->reserve(sizeof(Entry), count - m_size);
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+void HashMap<KeyType, ValueType, Hasher>::reserveBuckets(size_t count)
+{
+    // Like reserve, but the entries will come from elsewhere
+    if(count > m_map.size())
+        rehash(roundUpToPowerOfTwo(count));
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+void HashMap<KeyType, ValueType, Hasher>::associate(const KeyType& key, const ValueType& value)
+{
+    insert_or_assign(key, value);
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+template <typename K, typename... Args>
+std::pair<ValueType*, bool> HashMap<KeyType, ValueType, Hasher>::try_emplace(K&& key, Args&&... args)
+{
+    // Determine bucket number by calling hash function on key
+    // (hashed as a KeyType, so a key of another type hashes the same as its KeyType conversion)
+    const KeyType& k = key;
+    uint64_t h = hash(k);
+
+    // If the key is already in the map, leave its value alone
+    Entry** found = findLink(h, k);
+    if(*found != nullptr)
+        return std::make_pair(&(*found)->second, false);
+
+    // Otherwise construct the entry in place and link it into its bucket
+    Entry* e = newEntry(h, std::forward<K>(key), std::forward<Args>(args)...);
+    link(e);
+    return std::make_pair(&e->second, true);
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+template <typename K, typename... Args>
+ValueType* HashMap<KeyType, ValueType, Hasher>::emplaceNew(NodePool* pool, uint64_t hash, K&& key, Args&&... args)
+{
+    // No lookup, no size update and no rehash: the caller owns the bucket and has reserved room
+    Entry* e = new (pool->allocate(sizeof(Entry))) Entry(hash, std::forward<K>(key), std::forward<Args>(args)...);
+    Entry*& head = m_map[getBucketNumber(hash)];
+    e->next = head;
+    head = e;
+    return &e->second;
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+template <typename K, typename V>
+std::pair<ValueType*, bool> HashMap<KeyType, ValueType, Hasher>::insert_or_assign(K&& key, V&& value)
+{
+    std::pair<ValueType*, bool> result = try_emplace(std::forward<K>(key), std::forward<V>(value));
+    // The key was already there: replace its value
+    if(!result.second)
+        *result.first = std::forward<V>(value);
+    return result;
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+bool HashMap<KeyType, ValueType, Hasher>::erase(const KeyType& key)
+{
+    // Find the link to the entry by calling hash function on key
+    Entry** found = findLink(hash(key), key);
+    if(*found == nullptr)
+        return false;
+
+    // Unlink the entry and free it; the value is never copied or compared
+    Entry* e = *found;
+    *found = e->next;
+    deleteEntry(e);
+    m_size--;
+    return true;
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+typename HashMap<KeyType, ValueType, Hasher>::iterator HashMap<KeyType, ValueType, Hasher>::erase(iterator pos)
+{
+    // Find the link that points to the entry in its (short) chain
+    Entry** link = &m_map[pos.m_index];
+    while(*link != pos.m_entry)
+        link = &(*link)->next;
+    Entry* next = pos.m_entry->next;
+    *link = next;
+    deleteEntry(pos.m_entry);
+    m_size--;
+    return iterator(&m_map, pos.m_index, next);
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+typename HashMap<KeyType, ValueType, Hasher>::NodeHandle HashMap<KeyType, ValueType, Hasher>::extract(const KeyType& key)
+{
+    NodeHandle node;
+    Entry** found = findLink(hash(key), key);
+
+    // Unlink the entry into the handle without copying it
+    if(*found != nullptr)
+    {
+        node.m_entry = *found;
+        node.m_owner = this;
+        *found = node.m_entry->next;
+        node.m_entry->next = nullptr;
+        m_size--;
+    }
+    return node;
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+std::pair<ValueType*, bool> HashMap<KeyType, ValueType, Hasher>::insert(NodeHandle&& node)
+{
+    if(node.empty())
+        return std::make_pair(nullptr, false);
+
+    // If the key is already in the map the handle keeps its entry
+    Entry** found = findLink(node.m_entry->hash, node.key());
+    if(*found != nullptr)
+        return std::make_pair(&(*found)->second, false);
+
+    // An entry from another map's pool cannot be freed by this map, so it is moved into a new entry and the old
+    // one is freed by its map; either way the handle is left empty
+    Entry* e = node.m_entry;
+    if(node.m_owner->m_pool != m_pool)
+    {
+        e = newEntry(e->hash, std::move(e->first), std::move(e->second));
+        node.m_owner->deleteEntry(node.m_entry);
+    }
+    node.m_entry = nullptr;
+    link(e);
+    return std::make_pair(&e->second, true);
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+ValueType* HashMap<KeyType, ValueType, Hasher>::find(const KeyType &key)
+{
+    // Determine the bucket number where the key should be located by calling hash function on key
+    // and return address of the matching value, if there is one
+    Entry* e = *findLink(hash(key), key);
+    if(e == nullptr)
+        return nullptr;
+    return &e->second;
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+const ValueType* HashMap<KeyType, ValueType, Hasher>::find(const KeyType &key) const
+{
+    // A lookup does not change the map
+    return const_cast<HashMap*>(this)->find(key);
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+template <typename Match>
+ValueType* HashMap<KeyType, ValueType, Hasher>::findHashed(uint64_t hash, Match match)
+{
+    Entry* e = *findLinkWhere(hash, match);
+    if(e == nullptr)
+        return nullptr;
+    return &e->second;
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+template <typename Match>
+const ValueType* HashMap<KeyType, ValueType, Hasher>::findHashed(uint64_t hash, Match match) const
+{
+    return const_cast<HashMap*>(this)->findHashed(hash, match);
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+template <typename Match>
+bool HashMap<KeyType, ValueType, Hasher>::eraseHashed(uint64_t hash, Match match)
+{
+    Entry** found = findLinkWhere(hash, match);
+    if(*found == nullptr)
+        return false;
+    Entry* e = *found;
+    *found = e->next;
+    deleteEntry(e);
+    m_size--;
+    return true;
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+template <typename K, typename... Args>
+ValueType* HashMap<KeyType, ValueType, Hasher>::emplaceHashed(uint64_t hash, K&& key, Args&&... args)
+{
+    Entry* e = newEntry(hash, std::forward<K>(key), std::forward<Args>(args)...);
+    link(e);
+    return &e->second;
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+const KeyType* HashMap<KeyType, ValueType, Hasher>::findKey(const KeyType &key) const
+{
+    Entry* e = *const_cast<HashMap*>(this)->findLink(hash(key), key);
+    if(e == nullptr)
+        return nullptr;
+    return &e->first;
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+template <typename Func>
+void HashMap<KeyType, ValueType, Hasher>::forEachInBuckets(size_t first, size_t last, Func f) const
+{
+    for(size_t b = first; b < last && b < m_map.size(); b++)
+    {
+        for(const Entry* e = m_map[b]; e != nullptr; e = e->next)
+            f(e->first, e->second);
+    }
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+typename HashMap<KeyType, ValueType, Hasher>::iterator HashMap<KeyType, ValueType, Hasher>::begin()
+{
+    return iterator(&m_map, 0, m_map[0]);
+}
+
+template<typename KeyType, typename ValueType, typename Hasher>
+typename HashMap<KeyType, ValueType, Hasher>::iterator HashMap<KeyType, ValueType, Hasher>::end()
+{
+    return iterator(&m_map, m_map.size() - 1, nullptr);
+}
+
+#endif // HASHMAP_INCLUDED
@@ -0,0 +1,178 @@
+
+#include "LatencyStats.h"
+#include <thread>
+using namespace std;
+
+// *************** LatencyHistogram implementations *******************
+
+uint64_t LatencyHistogram::samples() const
+{
+    uint64_t total = 0;
+    for(uint64_t c : counts)
+        total += c;
+    return total;
+}
+
+uint64_t LatencyHistogram::percentile(double fraction) const
+{
+    uint64_t total = samples();
+    if(total == 0)
+        return 0;
+    // The rank of the sample wanted, counting from 1
+    uint64_t rank = uint64_t(fraction * double(total) + 0.5);
+    if(rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for(size_t b = 0; b < counts.size(); b++)
+    {
+        seen += counts[b];
+        if(seen >= rank)
+            return bucketHigh(b);
+    }
+    return bucketHigh(counts.size() - 1);
+}
+
+// A value of 2^e to 2^(e+1) - 1 (e >= 4) goes in one of 16 buckets by the 4 bits after its leading bit
+size_t LatencyHistogram::bucketOf(uint64_t nanoseconds)
+{
+    if(nanoseconds < k_subBuckets)
+        return size_t(nanoseconds);
+    size_t e = 63 - size_t(__builtin_clzll(nanoseconds));
+    if(e >= k_maxPower)
+        return k_buckets - 1;
+    return (e - 3) * k_subBuckets + size_t((nanoseconds >> (e - 4)) & (k_subBuckets - 1));
+}
+
+uint64_t LatencyHistogram::bucketLow(size_t bucket)
+{
+    if(bucket < k_subBuckets)
+        return bucket;
+    size_t e = bucket / k_subBuckets + 3;
+    return uint64_t(k_subBuckets + bucket % k_subBuckets) << (e - 4);
+}
+
+uint64_t LatencyHistogram::bucketHigh(size_t bucket)
+{
+    if(bucket < k_subBuckets)
+        return bucket;
+    size_t e = bucket / k_subBuckets + 3;
+    return bucketLow(bucket) + (uint64_t(1) << (e - 4)) - 1;
+}
+
+// *************** LatencyStats implementations *******************
+
+const char* LatencyStats::name(Op op)
+{
+    static const char* const names[k_ops] = { "join", "terminate", "contribute", "leave", "leave current" };
+    return op < k_ops ? names[op] : "";
+}
+
+// *************** LatencyRecorder implementations *******************
+
+// A thread's first operation is sampled, and then one in every sampleEvery
+thread_local unsigned LatencyRecorder::t_countdown = 1;
+
+// Each thread remembers the shard it last used, and which recorder it belongs to
+struct ShardCache
+{
+    uint64_t recorder;
+    void* shard;
+};
+static thread_local ShardCache t_shardCache = { 0, nullptr };
+static atomic<uint64_t> s_nextRecorderId(1);
+
+LatencyRecorder::LatencyRecorder(unsigned sampleEvery)
+ : m_sampleEvery(sampleEvery), m_id(s_nextRecorderId.fetch_add(1))
+{
+}
+
+LatencyRecorder::~LatencyRecorder()
+{
+    for(Shard* shard : m_shards)
+        delete shard;
+}
+
+void LatencyRecorder::setSampleEvery(unsigned sampleEvery)
+{
+    m_sampleEvery.store(sampleEvery, memory_order_relaxed);
+}
+
+LatencyRecorder::Shard* LatencyRecorder::shardOfThisThread()
+{
+    if(t_shardCache.recorder == m_id)
+        return static_cast<Shard*>(t_shardCache.shard);
+    // This thread has not sampled for this recorder yet, or has sampled for another one since
+    lock_guard<mutex> lock(m_mutex);
+    thread::id self = this_thread::get_id();
+    Shard* shard = nullptr;
+    for(Shard* s : m_shards)
+    {
+        if(s->owner == self)
+            shard = s;
+    }
+    if(shard == nullptr)
+    {
+        shard = new Shard;
+        shard->owner = self;
+        for(size_t op = 0; op < LatencyStats::k_ops; op++)
+        {
+            for(size_t b = 0; b < LatencyHistogram::k_buckets; b++)
+                shard->counts[op][b].store(0, memory_order_relaxed);
+        }
+        m_shards.push_back(shard);
+    }
+    t_shardCache.recorder = m_id;
+    t_shardCache.shard = shard;
+    return shard;
+}
+
+// Only this thread writes its shard, so a plain load and store is enough (the reader sees one or the other)
+void LatencyRecorder::record(LatencyStats::Op op, uint64_t nanoseconds)
+{
+    atomic<uint64_t>& count = shardOfThisThread()->counts[op][LatencyHistogram::bucketOf(nanoseconds)];
+    count.store(count.load(memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+// Purpose: take the counts of base from those of stats
+static void subtract(LatencyStats& stats, const LatencyStats& base)
+{
+    for(size_t op = 0; op < LatencyStats::k_ops; op++)
+    {
+        for(size_t b = 0; b < LatencyHistogram::k_buckets; b++)
+            stats.ops[op].counts[b] -= base.ops[op].counts[b];
+    }
+}
+
+// Called with m_mutex held
+LatencyStats LatencyRecorder::merge() const
+{
+    LatencyStats stats;
+    stats.sampleEvery = m_sampleEvery.load(memory_order_relaxed);
+    for(const Shard* shard : m_shards)
+    {
+        for(size_t op = 0; op < LatencyStats::k_ops; op++)
+        {
+            for(size_t b = 0; b < LatencyHistogram::k_buckets; b++)
+                stats.ops[op].counts[b] += shard->counts[op][b].load(memory_order_relaxed);
+        }
+    }
+    return stats;
+}
+
+LatencyStats LatencyRecorder::read() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    LatencyStats stats = merge();
+    subtract(stats, m_baseline);
+    return stats;
+}
+
+LatencyStats LatencyRecorder::resetAndRead()
+{
+    lock_guard<mutex> lock(m_mutex);
+    LatencyStats total = merge();
+    LatencyStats stats = total;
+    subtract(stats, m_baseline);
+    m_baseline = total;
+    return stats;
+}
@@ -0,0 +1,139 @@
+#ifndef LATENCYSTATS_INCLUDED
+#define LATENCYSTATS_INCLUDED
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstddef>
+#include <cstdint>
+
+// A log-linear histogram of latencies in nanoseconds.  Values below 16 have
+// a bucket each, and every power of two from 16 up is split into 16 equal
+// buckets, so a bucket is never wider than a sixteenth of the values in it.
+// The last bucket also holds everything above 2^36 ns (about a minute).
+struct LatencyHistogram
+{
+    static const size_t k_subBuckets = 16;
+    static const size_t k_maxPower = 36;
+    static const size_t k_buckets = (k_maxPower - 3) * k_subBuckets;
+
+    LatencyHistogram() : counts(k_buckets, 0) {}
+    std::vector<uint64_t> counts;
+
+      // Number of latencies recorded
+    uint64_t samples() const;
+      // The latency that the given fraction (0 to 1) of the samples do not
+      // exceed, as the upper end of its bucket; 0 if there are no samples
+    uint64_t percentile(double fraction) const;
+      // The bucket a latency goes in, and the smallest and largest latencies
+      // in a bucket
+    static size_t bucketOf(uint64_t nanoseconds);
+    static uint64_t bucketLow(size_t bucket);
+    static uint64_t bucketHigh(size_t bucket);
+};
+
+// The latencies of a tracker's operations since they were last reset.  Only
+// one operation in every sampleEvery (counted per thread) is timed, so the
+// histograms hold about 1/sampleEvery of the operations.
+struct LatencyStats
+{
+    enum Op { JOIN, TERMINATE, CONTRIBUTE, LEAVE, LEAVE_CURRENT, k_ops };
+    static const char* name(Op op);
+
+    LatencyStats() : sampleEvery(0) {}
+    LatencyHistogram ops[k_ops];
+    unsigned sampleEvery;  // 0 if sampling is off (or compiled out)
+};
+
+// Records sampled latencies into histograms kept per thread: each thread that
+// samples an operation gets a shard of its own, which only it writes, so
+// recording takes no lock and shares no cache lines.  A thread finds its
+// shard through a cache of the last recorder it used, or else by a search.
+// Reading merges the shards.  Resetting does not touch the shards (whose
+// threads may be writing them); it remembers the merged counts, and later
+// reads subtract them.  A shard stays with the recorder when its thread ends.
+class LatencyRecorder
+{
+  public:
+    explicit LatencyRecorder(unsigned sampleEvery = 64);
+    ~LatencyRecorder();
+      // 0 turns sampling off.  Each thread picks up a new setting when it
+      // next samples (within 1024 of its operations if it had sampling off).
+    void setSampleEvery(unsigned sampleEvery);
+      // The histograms since the last reset; resetAndRead also starts a new
+      // period, returning the histograms of the one it ends
+    LatencyStats read() const;
+    LatencyStats resetAndRead();
+
+      // The hot path: counts down this thread's operations and returns true
+      // for the one in every sampleEvery that should be timed
+    bool sampleNext()
+    {
+        if(--t_countdown != 0)
+            return false;
+        t_countdown = m_sampleEvery.load(std::memory_order_relaxed);
+        if(t_countdown == 0)
+        {
+            // Sampling is off: check again after a while, in case it is turned back on
+            t_countdown = k_offCountdown;
+            return false;
+        }
+        return true;
+    }
+    void record(LatencyStats::Op op, uint64_t nanoseconds);
+
+    LatencyRecorder(const LatencyRecorder&) = delete;
+    LatencyRecorder& operator=(const LatencyRecorder&) = delete;
+
+  private:
+    struct Shard
+    {
+        std::thread::id owner;
+        std::atomic<uint64_t> counts[LatencyStats::k_ops][LatencyHistogram::k_buckets];
+    };
+    static const unsigned k_offCountdown = 1024;
+    // Operations this thread has left before the next sample (shared by every recorder the thread uses)
+    static thread_local unsigned t_countdown;
+
+    std::atomic<unsigned> m_sampleEvery;
+    // Tells this recorder apart from any earlier one at the same address in the threads' shard caches
+    uint64_t m_id;
+    mutable std::mutex m_mutex;
+    std::vector<Shard*> m_shards;
+    LatencyStats m_baseline;
+
+    Shard* shardOfThisThread();
+    LatencyStats merge() const;
+};
+
+// Times an operation from construction to destruction, if the recorder picks
+// it as a sample
+class LatencyTimer
+{
+  public:
+    LatencyTimer(LatencyRecorder& recorder, LatencyStats::Op op)
+     : m_recorder(recorder.sampleNext() ? &recorder : nullptr), m_op(op)
+    {
+        if(m_recorder != nullptr)
+            m_start = std::chrono::steady_clock::now();
+    }
+    ~LatencyTimer()
+    {
+        if(m_recorder != nullptr)
+        {
+            std::chrono::steady_clock::duration d = std::chrono::steady_clock::now() - m_start;
+            m_recorder->record(m_op, uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()));
+        }
+    }
+    LatencyTimer(const LatencyTimer&) = delete;
+    LatencyTimer& operator=(const LatencyTimer&) = delete;
+
+  private:
+    LatencyRecorder* m_recorder;
+    LatencyStats::Op m_op;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+#endif // LATENCYSTATS_INCLUDED
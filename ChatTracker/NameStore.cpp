@@ -0,0 +1,299 @@
+
+#include "NameStore.h"
+#include "Varint.h"
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+using namespace std;
+
+// *************** Encoding *******************
+// A block is a run of entries, one per place.  An entry is a varint header, 0 for an empty place and otherwise
+// (shared << 1) | 1, where shared is the length of the prefix the name shares with the last name before it in
+// the block; then the length of the rest of the name as a varint, and the rest of the name.
+
+// Purpose: append the entry for name, which follows prev in the block
+static void appendEntry(string& block, const string& prev, const string& name)
+{
+    size_t shared = 0;
+    size_t most = min(prev.size(), name.size());
+    while(shared < most && prev[shared] == name[shared])
+        shared++;
+    appendVarint(block, (shared << 1) | 1);
+    appendVarint(block, name.size() - shared);
+    block.append(name, shared, string::npos);
+}
+
+// Purpose: decode the entry at p into name (which holds the last name before it) and return the next entry
+// name is left alone, and present set to false, if the place is empty
+static const char* nextEntry(const char* p, string& name, bool& present)
+{
+    size_t header = readVarint(p);
+    present = (header & 1) != 0;
+    if(present)
+    {
+        size_t rest = readVarint(p);
+        name.resize(header >> 1);
+        name.append(p, rest);
+        p += rest;
+    }
+    return p;
+}
+
+// Heap bytes owned by a block (nothing if it fits in the string's small buffer)
+static size_t blockBytes(const string& block)
+{
+    static const size_t smallCapacity = string().capacity();
+    return block.capacity() > smallCapacity ? block.capacity() + 1 : 0;
+}
+
+// *************** NameStore implementations *******************
+
+// blockSize passes k_blockNames to min by reference, so it needs a definition
+const size_t NameStore::k_blockNames;
+
+NameStore::NameStore(bool shared) : m_shared(shared)
+{
+}
+
+size_t NameStore::blockSize(const Part& p, size_t block)
+{
+    return min(k_blockNames, p.used - block * k_blockNames);
+}
+
+// The block is decoded and encoded again in one pass, since the entry after the changed one is encoded against it
+void NameStore::rewriteBlock(Part& p, size_t block, size_t slot, const string* name)
+{
+    string& old = p.blocks[block];
+    size_t n = blockSize(p, block);
+    string rebuilt;
+    rebuilt.reserve(old.size() + (name != nullptr ? name->size() + 4 : 0));
+    string current;
+    string prev;
+    const char* q = old.data();
+    for(size_t k = 0; k < n; k++)
+    {
+        bool present;
+        q = nextEntry(q, current, present);
+        const string* keep = (k == slot ? name : (present ? &current : nullptr));
+        if(keep != nullptr)
+        {
+            appendEntry(rebuilt, prev, *keep);
+            prev = *keep;
+        }
+        else
+            rebuilt += '\0';
+    }
+    rebuilt.shrink_to_fit();
+    p.bytes += blockBytes(rebuilt);
+    p.bytes -= blockBytes(old);
+    old.swap(rebuilt);
+}
+
+void NameStore::makeParts(size_t parts)
+{
+    unique_lock<mutex> lock(m_mutex, defer_lock);
+    if(m_shared)
+        lock.lock();
+    if(parts > m_parts.size())
+        m_parts.resize(parts);
+}
+
+NameStore::Id NameStore::add(const string& name, size_t part)
+{
+    unique_lock<mutex> lock(m_mutex, defer_lock);
+    if(m_shared)
+        lock.lock();
+    if(part >= m_parts.size())
+        m_parts.resize(part + 1);
+    Part& p = m_parts[part];
+    size_t place;
+    if(!p.free.empty())
+    {
+        place = p.free.back();
+        p.free.pop_back();
+        rewriteBlock(p, place / k_blockNames, place % k_blockNames, &name);
+    }
+    else
+    {
+        // A new place at the end: its entry is appended to the last block, encoded against the block's last name.
+        // The last place of part k_parts - 1 would give the ID k_noName, so no part uses its last place.
+        if(p.used >= (size_t(1) << (32 - k_partBits)) - 1)
+            throw length_error("NameStore: part " + to_string(part) + " is full");
+        place = p.used++;
+        if(place % k_blockNames == 0)
+            p.blocks.push_back(string());
+        string& block = p.blocks.back();
+        string prev;
+        const char* q = block.data();
+        for(size_t k = 0; k < place % k_blockNames; k++)
+        {
+            bool present;
+            q = nextEntry(q, prev, present);
+        }
+        p.bytes -= blockBytes(block);
+        appendEntry(block, prev, name);
+        // A full block does not grow again until it is rewritten
+        if(place % k_blockNames == k_blockNames - 1)
+            block.shrink_to_fit();
+        p.bytes += blockBytes(block);
+    }
+    p.count++;
+    return Id(place << k_partBits | part);
+}
+
+void NameStore::remove(Id id)
+{
+    unique_lock<mutex> lock(m_mutex, defer_lock);
+    if(m_shared)
+        lock.lock();
+    Part& p = m_parts[id & (k_parts - 1)];
+    size_t place = id >> k_partBits;
+    p.count--;
+    if(p.count == 0)
+    {
+        // The part is empty: give back all of its memory
+        p = Part();
+        return;
+    }
+    rewriteBlock(p, place / k_blockNames, place % k_blockNames, nullptr);
+    p.free.push_back(uint32_t(place));
+}
+
+// The entries before the name's are only read for their lengths; then the name's bytes are copied from the back,
+// each range of bytes from the last entry before it that has them, so each byte is copied once
+void NameStore::get(Id id, string& out) const
+{
+    unique_lock<mutex> lock(m_mutex, defer_lock);
+    if(m_shared)
+        lock.lock();
+    const Part& p = m_parts[id & (k_parts - 1)];
+    size_t place = id >> k_partBits;
+    size_t slot = place % k_blockNames;
+    const char* q = p.blocks[place / k_blockNames].data();
+    size_t shared[k_blockNames];
+    size_t length[k_blockNames];
+    const char* rest[k_blockNames];
+    for(size_t k = 0; k <= slot; k++)
+    {
+        size_t header = readVarint(q);
+        if(header & 1)
+        {
+            shared[k] = header >> 1;
+            length[k] = readVarint(q);
+            rest[k] = q;
+            q += length[k];
+        }
+        else
+            rest[k] = nullptr;
+    }
+    out.resize(shared[slot] + length[slot]);
+    char* name = &out[0];
+    size_t need = shared[slot];
+    memcpy(name + need, rest[slot], length[slot]);
+    for(size_t k = slot; need > 0 && k-- > 0; )
+    {
+        if(rest[k] != nullptr && shared[k] < need)
+        {
+            memcpy(name + shared[k], rest[k], need - shared[k]);
+            need = shared[k];
+        }
+    }
+}
+
+string NameStore::name(Id id) const
+{
+    string result;
+    get(id, result);
+    return result;
+}
+
+// matched is how many leading bytes the last name decoded shares with name.  An entry that shares no more than
+// that with the last name agrees with name as far as it shares, so only its own bytes need comparing; one that
+// shares more differs from name where the last name did.
+bool NameStore::equals(Id id, const string& name) const
+{
+    unique_lock<mutex> lock(m_mutex, defer_lock);
+    if(m_shared)
+        lock.lock();
+    const Part& p = m_parts[id & (k_parts - 1)];
+    size_t place = id >> k_partBits;
+    size_t slot = place % k_blockNames;
+    const char* q = p.blocks[place / k_blockNames].data();
+    size_t matched = 0;
+    for(size_t k = 0; ; k++)
+    {
+        size_t header = readVarint(q);
+        if(!(header & 1))
+        {
+            if(k == slot)
+                return false;
+            continue;
+        }
+        size_t shared = header >> 1;
+        size_t length = readVarint(q);
+        const char* rest = q;
+        q += length;
+        if(k == slot)
+            return matched >= shared && shared + length == name.size() && memcmp(rest, name.data() + shared, length) == 0;
+        if(matched >= shared)
+        {
+            size_t most = min(shared + length, name.size());
+            matched = shared;
+            while(matched < most && rest[matched - shared] == name[matched])
+                matched++;
+        }
+    }
+}
+
+// *************** NameStore::Reader implementations *******************
+
+const string& NameStore::Reader::read(Id id)
+{
+    if(m_store.m_shared)
+    {
+        m_store.get(id, m_name);
+        m_block = nullptr;
+        return m_name;
+    }
+    const Part& p = m_store.m_parts[id & (k_parts - 1)];
+    size_t place = id >> k_partBits;
+    size_t slot = place % k_blockNames;
+    const string* block = &p.blocks[place / k_blockNames];
+    size_t k = m_slot + 1;
+    if(block != m_block || slot < k)
+    {
+        m_block = block;
+        m_next = block->data();
+        m_name.clear();
+        k = 0;
+    }
+    for(; k <= slot; k++)
+    {
+        bool present;
+        m_next = nextEntry(m_next, m_name, present);
+    }
+    m_slot = slot;
+    return m_name;
+}
+
+size_t NameStore::size() const
+{
+    unique_lock<mutex> lock(m_mutex, defer_lock);
+    if(m_shared)
+        lock.lock();
+    size_t total = 0;
+    for(const Part& p : m_parts)
+        total += p.count;
+    return total;
+}
+
+size_t NameStore::memoryUsage() const
+{
+    unique_lock<mutex> lock(m_mutex, defer_lock);
+    if(m_shared)
+        lock.lock();
+    size_t total = 0;
+    for(const Part& p : m_parts)
+        total += p.bytes + p.blocks.capacity() * sizeof(string) + p.free.capacity() * sizeof(uint32_t);
+    return total;
+}
@@ -0,0 +1,95 @@
+#ifndef NAMESTORE_INCLUDED
+#define NAMESTORE_INCLUDED
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+
+// NameStore class declaration
+// Keeps names compactly and gives each one an ID.  Names are stored in blocks of k_blockNames, front coded: each
+// name is kept as the length of the prefix it shares with the name before it in its block and the bytes after
+// that prefix, so names that share long prefixes (tenant prefixes, generated names) take a few bytes each.
+// An ID is the name's place in the store, so its bytes are found by indexing the blocks and decoding at most
+// one block.  IDs of removed names are reused, and a block is re-encoded when a name in it is added or removed.
+// The store is split into parts, each with blocks of its own, so different threads may add and remove names in
+// different parts at the same time, once makeParts has made them; the low bits of an ID are its part.  Parts are
+// otherwise made when first used, so a store that only ever uses part 0 keeps no others.
+// A part holds at most 2^26 - 1 names (an ID has 32 bits); add throws std::length_error rather than give a place
+// past that.
+// A shared store may be used by several threads at once in any parts: it takes a lock on each call.
+class NameStore
+{
+public:
+    typedef uint32_t Id;
+    static const Id k_noName = UINT32_MAX;
+    static const size_t k_parts = 64;
+
+    explicit NameStore(bool shared = false);
+    // Stores a copy of name (which may already be stored under another ID) and returns its ID
+    // Throws std::length_error if the part is full
+    Id add(const std::string& name, size_t part = 0);
+    void remove(Id id);
+    // Sets out to the name with the ID
+    void get(Id id, std::string& out) const;
+    std::string name(Id id) const;
+    // True if the name with the ID is name; compares as it decodes, without copying the name out
+    bool equals(Id id, const std::string& name) const;
+    // Makes parts 0 to parts - 1 if they are not made yet
+    void makeParts(size_t parts);
+    // Names stored
+    size_t size() const;
+    // Bytes used by the blocks and the index of free IDs
+    size_t memoryUsage() const;
+    NameStore(const NameStore&) = delete;
+    NameStore& operator=(const NameStore&) = delete;
+
+    class Reader;
+
+private:
+    static const size_t k_blockNames = 16;
+    static const unsigned k_partBits = 6;
+    struct Part
+    {
+        Part() : used(0), count(0), bytes(0) {}
+        // Each block is the encoded names of k_blockNames consecutive IDs (fewer in the last block)
+        std::vector<std::string> blocks;
+        // Places given out and then freed, to be given out again before new ones
+        std::vector<uint32_t> free;
+        // Places given out so far (the last block holds the names of places used - 1 back to its start)
+        size_t used;
+        size_t count;
+        // Heap bytes of the blocks
+        size_t bytes;
+    };
+    std::vector<Part> m_parts;
+    bool m_shared;
+    mutable std::mutex m_mutex;
+
+    static size_t blockSize(const Part& p, size_t block);
+    // Rewrites a block with the name in the given slot replaced by name (or removed if name is nullptr)
+    static void rewriteBlock(Part& p, size_t block, size_t slot, const std::string* name);
+};
+
+// NameStore::Reader class declaration
+// Decodes names one after another, picking up where the last name left off when the next one is later in the
+// same block, so names read in the order of their places (as a chat's members mostly are, having been given
+// places as they joined) cost about one entry each rather than the entries before them in the block too.
+// The store must not change while a reader is used; a reader of a shared store decodes each name afresh.
+class NameStore::Reader
+{
+public:
+    explicit Reader(const NameStore& store) : m_store(store), m_block(nullptr), m_slot(0), m_next(nullptr) {}
+    // The name with the ID, valid until the next read
+    const std::string& read(Id id);
+private:
+    const NameStore& m_store;
+    // The block last read from, the slot of the last name decoded and the entry after it, and that name
+    const std::string* m_block;
+    size_t m_slot;
+    const char* m_next;
+    std::string m_name;
+};
+
+#endif // NAMESTORE_INCLUDED
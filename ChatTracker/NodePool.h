@@ -0,0 +1,449 @@
+#ifndef NODEPOOL_INCLUDED
+#define NODEPOOL_INCLUDED
+
+#include <cstddef>
+#include <cassert>
+#include <cstdint>
+#include <new>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include <mutex>
+#include <sys/mman.h>
+#include "TraceEvents.h"
+
+// *************** Huge page regions *******************
+// A table probed at random touches a new page on nearly every probe; with 4 KB pages a large tracker needs
+// far more TLB entries than the processor has, while with 2 MB pages one entry covers 512 times as much.
+
+const size_t k_hugePageSize = 2 * 1024 * 1024;
+
+// Purpose: round bytes up to a whole number of huge pages
+inline size_t hugeRegionSize(size_t bytes)
+{
+    return (bytes + k_hugePageSize - 1) / k_hugePageSize * k_hugePageSize;
+}
+
+// Purpose: map hugeRegionSize(bytes) bytes of zeroed memory, backed by huge pages if the system can:
+// from the reserved hugetlbfs pages if there are enough, otherwise ordinary pages aligned to a huge page and
+// marked for transparent huge pages, which the kernel backs with huge pages when it has them
+// Throws bad_alloc (as operator new does) if no memory can be mapped at all
+inline void* mapHugeRegion(size_t bytes)
+{
+    size_t size = hugeRegionSize(bytes);
+#ifdef MAP_HUGETLB
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(p != MAP_FAILED)
+        return p;
+#endif
+    // Map a huge page more than needed, so an aligned region can be cut out of it and the rest unmapped
+    char* q = static_cast<char*>(mmap(nullptr, size + k_hugePageSize, PROT_READ | PROT_WRITE,
+                                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if(q == MAP_FAILED)
+        throw std::bad_alloc();
+    char* aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(q) + k_hugePageSize - 1)
+                                            & ~uintptr_t(k_hugePageSize - 1));
+    if(aligned != q)
+        munmap(q, aligned - q);
+    munmap(aligned + size, q + k_hugePageSize - aligned);
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+    return aligned;
+}
+
+inline void unmapHugeRegion(void* p, size_t bytes)
+{
+    munmap(p, hugeRegionSize(bytes));
+}
+
+// NodePool class declaration
+// Hands out memory for small objects (hash table entries and list nodes) carved from large chunks.
+// Freed objects go on a free list for their size class and are reused by the next allocation of that size,
+// so a tracker that has reserved its nodes up front never goes back to the system allocator.  trim gives back
+// the chunks whose objects have all been freed; memory set aside by reserve is kept until it has been handed out.
+class NodePool
+{
+public:
+    // With hugePages, chunks are huge page regions (see mapHugeRegion), and tables using the pool map their
+    // bucket arrays the same way.  A shared pool may be used by several threads at once: it takes a lock on
+    // each allocation and free.
+    explicit NodePool(bool hugePages = false, bool shared = false);
+    ~NodePool();
+    void* allocate(size_t bytes);
+    void deallocate(void* p, size_t bytes);
+    // Make sure count objects of the given size can be allocated without asking the system for more memory
+    void reserve(size_t bytes, size_t count);
+    // Takes over other's chunks, freed objects and reserved memory, so an object allocated from either pool may
+    // be freed to this one.  other (which must have the same hugePages setting and must not outlive this pool)
+    // gets chunks of its own for its next objects; the rest of its current chunk is not used.
+    void merge(NodePool& other);
+    // Returns to the system every chunk (other than the one being carved) all of whose objects are on the
+    // free lists, and returns the bytes given back.  It walks every free list, so it is for after many
+    // objects have been freed, not after each one.
+    size_t trim();
+    // Bytes obtained from the system so far
+    size_t capacity() const;
+    bool hugePages() const { return m_hugePages; }
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+private:
+    // Sizes are rounded up to a multiple of k_granularity; larger objects bypass the pool
+    static const size_t k_granularity = 16;
+    static const size_t k_classes = 16;
+    static const size_t k_chunkSize = 64 * 1024;
+    struct FreeNode
+    {
+        FreeNode* next;
+    };
+    struct Chunk
+    {
+        char* start;
+        size_t bytes;
+        // The bytes at the start of the chunk that have been handed out as objects (the rest was never used)
+        size_t carved;
+    };
+    // The part of a chunk set aside by reserve that has not been handed out yet
+    struct Region
+    {
+        char* next;
+        char* end;
+    };
+    FreeNode* m_free[k_classes];
+    std::vector<Region> m_reserved[k_classes];
+    // The rest of the chunk being carved, which is m_chunks[m_current]
+    char* m_next;
+    char* m_end;
+    size_t m_current;
+    std::vector<Chunk> m_chunks;
+    size_t m_capacity;
+    bool m_hugePages;
+    bool m_shared;
+    mutable std::mutex m_mutex;
+
+    static size_t sizeClass(size_t bytes)
+    {
+        return (bytes + k_granularity - 1) / k_granularity - 1;
+    }
+    // Gets a chunk of at least bytes from the system and sets bytes to its size (a huge page region is
+    // rounded up to whole huge pages, and all of it is used)
+    char* newChunk(size_t& bytes);
+    void freeChunk(const Chunk& chunk);
+    // Stops carving from the current chunk, recording how much of it was carved
+    void retireCurrent();
+};
+
+inline NodePool::NodePool(bool hugePages, bool shared)
+ : m_next(nullptr), m_end(nullptr), m_current(0), m_capacity(0), m_hugePages(hugePages), m_shared(shared)
+{
+    for(size_t k = 0; k < k_classes; k++)
+        m_free[k] = nullptr;
+}
+
+inline NodePool::~NodePool()
+{
+    for(const Chunk& chunk : m_chunks)
+        freeChunk(chunk);
+}
+
+inline char* NodePool::newChunk(size_t& bytes)
+{
+    TRACE_SPAN("allocate chunk");
+    char* chunk;
+    if(m_hugePages)
+    {
+        bytes = hugeRegionSize(bytes);
+        chunk = static_cast<char*>(mapHugeRegion(bytes));
+    }
+    else
+        chunk = static_cast<char*>(::operator new(bytes));
+    m_chunks.push_back(Chunk{chunk, bytes, bytes});
+    m_capacity += bytes;
+    return chunk;
+}
+
+inline void NodePool::freeChunk(const Chunk& chunk)
+{
+    if(m_hugePages)
+        unmapHugeRegion(chunk.start, chunk.bytes);
+    else
+        ::operator delete(chunk.start);
+}
+
+inline void NodePool::retireCurrent()
+{
+    if(m_next == nullptr)
+        return;
+    Chunk& chunk = m_chunks[m_current];
+    chunk.carved = size_t(m_next - chunk.start);
+    m_next = nullptr;
+    m_end = nullptr;
+}
+
+inline void* NodePool::allocate(size_t bytes)
+{
+    size_t c = sizeClass(bytes);
+    if(c >= k_classes)
+        return ::operator new(bytes);
+    std::unique_lock<std::mutex> lock(m_mutex, std::defer_lock);
+    if(m_shared)
+        lock.lock();
+
+    // Reuse a freed object of the same size class if there is one
+    if(m_free[c] != nullptr)
+    {
+        FreeNode* node = m_free[c];
+        m_free[c] = node->next;
+        return node;
+    }
+
+    // Otherwise carve it from memory set aside by reserve, or from the current chunk, starting a new chunk if
+    // it is used up
+    size_t size = (c + 1) * k_granularity;
+    if(!m_reserved[c].empty())
+    {
+        Region& region = m_reserved[c].back();
+        void* p = region.next;
+        region.next += size;
+        if(region.next == region.end)
+            m_reserved[c].pop_back();
+        return p;
+    }
+    if(m_next == nullptr || size_t(m_end - m_next) < size)
+    {
+        retireCurrent();
+        size_t bytes = k_chunkSize;
+        m_next = newChunk(bytes);
+        m_end = m_next + bytes;
+        m_current = m_chunks.size() - 1;
+    }
+    void* p = m_next;
+    m_next += size;
+    return p;
+}
+
+inline void NodePool::deallocate(void* p, size_t bytes)
+{
+    size_t c = sizeClass(bytes);
+    if(c >= k_classes)
+    {
+        ::operator delete(p);
+        return;
+    }
+    std::unique_lock<std::mutex> lock(m_mutex, std::defer_lock);
+    if(m_shared)
+        lock.lock();
+    FreeNode* node = static_cast<FreeNode*>(p);
+    node->next = m_free[c];
+    m_free[c] = node;
+}
+
+inline size_t NodePool::capacity() const
+{
+    std::unique_lock<std::mutex> lock(m_mutex, std::defer_lock);
+    if(m_shared)
+        lock.lock();
+    return m_capacity;
+}
+
+inline void NodePool::reserve(size_t bytes, size_t count)
+{
+    size_t c = sizeClass(bytes);
+    if(c >= k_classes)
+        return;
+    std::unique_lock<std::mutex> lock(m_mutex, std::defer_lock);
+    if(m_shared)
+        lock.lock();
+
+    // Count the objects already available for this size class
+    size_t size = (c + 1) * k_granularity;
+    size_t available = (m_next == nullptr ? 0 : size_t(m_end - m_next) / size);
+    for(const Region& region : m_reserved[c])
+        available += size_t(region.end - region.next) / size;
+    for(FreeNode* node = m_free[c]; node != nullptr && available < count; node = node->next)
+        available++;
+    if(available >= count)
+        return;
+
+    // Set the rest aside in a single chunk.  Its nodes count as carved, so until they have all been handed out
+    // and freed, trim sees that it is in use.
+    size_t chunkBytes = (count - available) * size;
+    char* chunk = newChunk(chunkBytes);
+    size_t usable = chunkBytes / size * size;
+    m_chunks.back().carved = usable;
+    m_reserved[c].push_back(Region{chunk, chunk + usable});
+}
+
+inline void NodePool::merge(NodePool& other)
+{
+    assert(other.m_hugePages == m_hugePages);
+    std::unique_lock<std::mutex> lock(m_mutex, std::defer_lock);
+    if(m_shared)
+        lock.lock();
+    std::lock_guard<std::mutex> otherLock(other.m_mutex);
+    // Objects other carved later would be in a chunk this pool might give back
+    other.retireCurrent();
+    m_chunks.insert(m_chunks.end(), other.m_chunks.begin(), other.m_chunks.end());
+    m_capacity += other.m_capacity;
+    other.m_chunks.clear();
+    other.m_capacity = 0;
+    for(size_t c = 0; c < k_classes; c++)
+    {
+        while(other.m_free[c] != nullptr)
+        {
+            FreeNode* node = other.m_free[c];
+            other.m_free[c] = node->next;
+            node->next = m_free[c];
+            m_free[c] = node;
+        }
+        m_reserved[c].insert(m_reserved[c].end(), other.m_reserved[c].begin(), other.m_reserved[c].end());
+        other.m_reserved[c].clear();
+    }
+}
+
+// Purpose: find the free bytes in each chunk, by looking up every freed object's chunk in the chunks sorted by
+// address, and give back the chunks whose carved bytes are all free (dropping their objects from the free lists).
+// Memory reserve set aside counts as carved but is not on a free list, so its chunk stays until it has been used.
+inline size_t NodePool::trim()
+{
+    TRACE_SPAN("trim pool");
+    std::unique_lock<std::mutex> lock(m_mutex, std::defer_lock);
+    if(m_shared)
+        lock.lock();
+    std::vector<size_t> order(m_chunks.size());
+    for(size_t k = 0; k < order.size(); k++)
+        order[k] = k;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return m_chunks[a].start < m_chunks[b].start; });
+    // The chunk holding p, or m_chunks.size() if none does
+    auto chunkOf = [&](const void* p)
+    {
+        const char* c = static_cast<const char*>(p);
+        auto it = std::upper_bound(order.begin(), order.end(), c,
+                                   [&](const char* q, size_t k) { return q < m_chunks[k].start; });
+        if(it == order.begin())
+            return m_chunks.size();
+        size_t k = *(it - 1);
+        return c < m_chunks[k].start + m_chunks[k].bytes ? k : m_chunks.size();
+    };
+    std::vector<size_t> freeBytes(m_chunks.size(), 0);
+    for(size_t c = 0; c < k_classes; c++)
+    {
+        for(FreeNode* node = m_free[c]; node != nullptr; node = node->next)
+        {
+            size_t k = chunkOf(node);
+            if(k < m_chunks.size())
+                freeBytes[k] += (c + 1) * k_granularity;
+        }
+    }
+    std::vector<bool> unused(m_chunks.size(), false);
+    bool any = false;
+    for(size_t k = 0; k < m_chunks.size(); k++)
+    {
+        unused[k] = freeBytes[k] == m_chunks[k].carved && !(m_next != nullptr && k == m_current);
+        any = any || unused[k];
+    }
+    if(!any)
+        return 0;
+
+    for(size_t c = 0; c < k_classes; c++)
+    {
+        FreeNode** link = &m_free[c];
+        while(*link != nullptr)
+        {
+            size_t k = chunkOf(*link);
+            if(k < m_chunks.size() && unused[k])
+                *link = (*link)->next;
+            else
+                link = &(*link)->next;
+        }
+    }
+    size_t released = 0;
+    size_t kept = 0;
+    for(size_t k = 0; k < m_chunks.size(); k++)
+    {
+        if(unused[k])
+        {
+            released += m_chunks[k].bytes;
+            freeChunk(m_chunks[k]);
+            continue;
+        }
+        if(k == m_current)
+            m_current = kept;
+        m_chunks[kept++] = m_chunks[k];
+    }
+    m_chunks.resize(kept);
+    m_capacity -= released;
+    return released;
+}
+
+// PoolAllocator: a standard allocator that takes single objects from a NodePool
+// With no pool (the default) it simply uses operator new, so containers using it behave as usual.
+template <typename T>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+    PoolAllocator(NodePool* pool = nullptr) : m_pool(pool) {}
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& other) : m_pool(other.pool()) {}
+    T* allocate(size_t n)
+    {
+        if(m_pool != nullptr && n == 1)
+            return static_cast<T*>(m_pool->allocate(sizeof(T)));
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    void deallocate(T* p, size_t n)
+    {
+        if(m_pool != nullptr && n == 1)
+            m_pool->deallocate(p, sizeof(T));
+        else
+            ::operator delete(p);
+    }
+    NodePool* pool() const { return m_pool; }
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& other) const { return m_pool == other.pool(); }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>& other) const { return m_pool != other.pool(); }
+private:
+    NodePool* m_pool;
+};
+
+
+// RegionAllocator: a standard allocator for large arrays, such as a hash table's buckets
+// With hugePages, an array of at least a huge page is mapped as a huge page region; anything else comes
+// from operator new.  The setting travels with the array when containers are swapped or moved.
+template <typename T>
+class RegionAllocator
+{
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_swap;
+    typedef std::true_type propagate_on_container_move_assignment;
+    RegionAllocator(bool hugePages = false) : m_hugePages(hugePages) {}
+    template <typename U>
+    RegionAllocator(const RegionAllocator<U>& other) : m_hugePages(other.hugePages()) {}
+    T* allocate(size_t n)
+    {
+        if(mapped(n))
+            return static_cast<T*>(mapHugeRegion(n * sizeof(T)));
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    void deallocate(T* p, size_t n)
+    {
+        if(mapped(n))
+            unmapHugeRegion(p, n * sizeof(T));
+        else
+            ::operator delete(p);
+    }
+    bool hugePages() const { return m_hugePages; }
+    template <typename U>
+    bool operator==(const RegionAllocator<U>& other) const { return m_hugePages == other.hugePages(); }
+    template <typename U>
+    bool operator!=(const RegionAllocator<U>& other) const { return m_hugePages != other.hugePages(); }
+private:
+    bool m_hugePages;
+
+    bool mapped(size_t n) const { return m_hugePages && n * sizeof(T) >= k_hugePageSize; }
+};
+
+#endif // NODEPOOL_INCLUDED
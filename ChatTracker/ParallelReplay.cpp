@@ -0,0 +1,313 @@
+#include "ParallelReplay.h"
+#include "HashMap.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <sstream>
+#include <utility>
+using namespace std;
+
+static const size_t k_none = size_t(-1);
+
+// Purpose: give name the next ID if it does not have one yet, and return its ID
+static size_t nameId(HashMap<string, size_t>& ids, vector<string>& names, const string& name)
+{
+    pair<size_t*, bool> id = ids.try_emplace(name, names.size());
+    if(id.second)
+        names.push_back(name);
+    return *id.first;
+}
+
+// Memberships Class Declaration
+// The users in each chat and the chats of each user as the trace goes along, without counts: just
+// enough to know which chat a leave of the current chat leaves and who a terminate removes.
+// A user's chats are in the order the user last joined them, so the current chat is the last.
+class Memberships
+{
+public:
+    Memberships(size_t users, size_t chats) : m_userChats(users), m_chatUsers(chats), m_positions(1024) {}
+    void join(size_t user, size_t chat);
+    void leave(size_t user, size_t chat);
+    size_t currentChat(size_t user) const { return m_userChats[user].empty() ? k_none : m_userChats[user].back(); }
+    const vector<size_t>& users(size_t chat) const { return m_chatUsers[chat]; }
+    void terminate(size_t chat);
+private:
+    vector<vector<size_t>> m_userChats;
+    vector<vector<size_t>> m_chatUsers;
+    // The place of each member in its chat's users, keyed by user and chat
+    HashMap<uint64_t, size_t> m_positions;
+
+    static uint64_t key(size_t user, size_t chat) { return uint64_t(user) << 32 | chat; }
+    void removeChat(size_t user, size_t chat);
+};
+
+void Memberships::join(size_t user, size_t chat)
+{
+    pair<size_t*, bool> position = m_positions.try_emplace(key(user, chat), m_chatUsers[chat].size());
+    if(position.second)
+        m_chatUsers[chat].push_back(user);
+    else
+        removeChat(user, chat);
+    m_userChats[user].push_back(chat);
+}
+
+void Memberships::leave(size_t user, size_t chat)
+{
+    size_t* position = m_positions.find(key(user, chat));
+    if(position == nullptr)
+        return;
+    // The chat's last member takes the leaving member's place
+    vector<size_t>& members = m_chatUsers[chat];
+    size_t moved = members.back();
+    members[*position] = moved;
+    *m_positions.find(key(moved, chat)) = *position;
+    members.pop_back();
+    m_positions.erase(key(user, chat));
+    removeChat(user, chat);
+}
+
+void Memberships::terminate(size_t chat)
+{
+    for(size_t user : m_chatUsers[chat])
+    {
+        m_positions.erase(key(user, chat));
+        removeChat(user, chat);
+    }
+    m_chatUsers[chat].clear();
+}
+
+void Memberships::removeChat(size_t user, size_t chat)
+{
+    vector<size_t>& chats = m_userChats[user];
+    chats.erase(find(chats.begin(), chats.end(), chat));
+}
+
+// *************** ParallelReplay implementations *******************
+
+// The analysis: replay the memberships (but not the counts) in trace order, noting for each user and
+// chat the last operation on it, so each operation can be made to depend on the last ones on what it touches
+ParallelReplay::ParallelReplay(const vector<TraceOp>& ops) : m_ops(ops), m_criticalPath(0), m_joins(0)
+{
+    HashMap<string, size_t> userIds(1024);
+    HashMap<string, size_t> chatIds(1024);
+    vector<size_t> userOf(ops.size(), k_none);
+    vector<size_t> chatOf(ops.size(), k_none);
+    for(size_t k = 0; k < ops.size(); k++)
+    {
+        if(ops[k].type != TraceOp::TERMINATE)
+            userOf[k] = nameId(userIds, m_userNames, ops[k].user);
+        if(ops[k].type == TraceOp::JOIN || ops[k].type == TraceOp::LEAVE2 || ops[k].type == TraceOp::TERMINATE)
+            chatOf[k] = nameId(chatIds, m_chatNames, ops[k].chat);
+        if(ops[k].type == TraceOp::JOIN)
+            m_joins++;
+    }
+
+    Memberships memberships(m_userNames.size(), m_chatNames.size());
+    vector<size_t> lastOnUser(m_userNames.size(), k_none);
+    vector<size_t> lastOnChat(m_chatNames.size(), k_none);
+    vector<pair<size_t, size_t>> edges;
+    vector<size_t> depth(ops.size(), 1);
+    m_predecessors.assign(ops.size(), 0);
+    auto dependOn = [&](size_t k, size_t before)
+    {
+        if(before == k_none)
+            return;
+        edges.push_back(make_pair(before, k));
+        m_predecessors[k]++;
+        depth[k] = max(depth[k], depth[before] + 1);
+    };
+    for(size_t k = 0; k < ops.size(); k++)
+    {
+        size_t user = userOf[k];
+        size_t chat = chatOf[k];
+        switch(ops[k].type)
+        {
+          case TraceOp::JOIN:
+            memberships.join(user, chat);
+            break;
+          case TraceOp::LEAVE2:
+            memberships.leave(user, chat);
+            break;
+          case TraceOp::LEAVE1:
+            chat = memberships.currentChat(user);
+            if(chat != k_none)
+                memberships.leave(user, chat);
+            break;
+          case TraceOp::TERMINATE:
+            // The members' operations before the terminate count in its total, and their next ones see them gone
+            for(size_t member : memberships.users(chat))
+            {
+                dependOn(k, lastOnUser[member]);
+                lastOnUser[member] = k;
+            }
+            memberships.terminate(chat);
+            break;
+          case TraceOp::CONTRIBUTE:
+            // Contributions to a chat add up in any order, so a contribute depends only on its user
+            break;
+        }
+        if(user != k_none)
+        {
+            dependOn(k, lastOnUser[user]);
+            lastOnUser[user] = k;
+        }
+        if(chat != k_none)
+        {
+            dependOn(k, lastOnChat[chat]);
+            lastOnChat[chat] = k;
+        }
+        m_criticalPath = max(m_criticalPath, depth[k]);
+    }
+
+    // List each operation's successors together
+    m_firstSuccessor.assign(ops.size() + 1, 0);
+    for(const pair<size_t, size_t>& e : edges)
+        m_firstSuccessor[e.first + 1]++;
+    for(size_t k = 0; k < ops.size(); k++)
+        m_firstSuccessor[k + 1] += m_firstSuccessor[k];
+    m_successors.resize(edges.size());
+    vector<size_t> filled(m_firstSuccessor.begin(), m_firstSuccessor.end() - 1);
+    for(const pair<size_t, size_t>& e : edges)
+        m_successors[filled[e.first]++] = e.second;
+}
+
+ParallelReplay::~ParallelReplay()
+{
+}
+
+// Each thread applies an operation whose predecessors are done, then counts it off in its successors'
+// waiting counts.  The first successor that it makes ready it applies next itself; any others go on a
+// shared list for idle threads to take.
+void ParallelReplay::run(int threads, vector<int>& results)
+{
+    size_t n = m_ops.size();
+    results.assign(n, 0);
+    ChatTracker::Options options;
+    options.expectedUsers = m_userNames.size();
+    options.expectedChats = m_chatNames.size();
+    options.expectedMemberships = m_joins;
+    options.concurrentContributions = true;
+    m_tracker.reset(new ChatTracker(options));
+
+    unique_ptr<atomic<size_t>[]> waiting(new atomic<size_t>[n]);
+    vector<size_t> ready;
+    for(size_t k = 0; k < n; k++)
+    {
+        waiting[k].store(m_predecessors[k], memory_order_relaxed);
+        if(m_predecessors[k] == 0)
+            ready.push_back(k);
+    }
+    mutex readyMutex;
+    condition_variable readyChanged;
+    size_t done = 0;  // guarded by readyMutex
+    shared_timed_mutex trackerMutex;
+
+    auto work = [&]()
+    {
+        vector<size_t> released;
+        size_t next = k_none;
+        size_t finished = 0;
+        for(;;)
+        {
+            if(next == k_none)
+            {
+                unique_lock<mutex> lock(readyMutex);
+                done += finished;
+                finished = 0;
+                if(done == n)
+                    readyChanged.notify_all();
+                while(ready.empty() && done < n)
+                    readyChanged.wait(lock);
+                if(ready.empty())
+                    return;
+                next = ready.back();
+                ready.pop_back();
+            }
+            size_t k = next;
+            next = k_none;
+            if(m_ops[k].type == TraceOp::CONTRIBUTE)
+            {
+                shared_lock<shared_timed_mutex> lock(trackerMutex);
+                results[k] = applyOp(*m_tracker, m_ops[k]);
+            }
+            else
+            {
+                unique_lock<shared_timed_mutex> lock(trackerMutex);
+                results[k] = applyOp(*m_tracker, m_ops[k]);
+            }
+            finished++;
+
+            for(size_t s = m_firstSuccessor[k]; s < m_firstSuccessor[k + 1]; s++)
+            {
+                size_t successor = m_successors[s];
+                if(waiting[successor].fetch_sub(1, memory_order_acq_rel) != 1)
+                    continue;
+                if(next == k_none)
+                    next = successor;
+                else
+                    released.push_back(successor);
+            }
+            if(!released.empty())
+            {
+                lock_guard<mutex> lock(readyMutex);
+                ready.insert(ready.end(), released.begin(), released.end());
+                released.clear();
+                readyChanged.notify_all();
+            }
+        }
+    };
+    vector<thread> pool;
+    for(int k = 1; k < threads; k++)
+        pool.push_back(thread(work));
+    work();
+    for(thread& t : pool)
+        t.join();
+}
+
+int ParallelReplay::chatTotal(const string& chat) const
+{
+    return m_tracker != nullptr ? m_tracker->chatTotal(chat) : 0;
+}
+
+vector<string> ParallelReplay::members(const string& chat) const
+{
+    return m_tracker != nullptr ? m_tracker->members(chat) : vector<string>();
+}
+
+string ParallelReplay::currentChat(const string& user)
+{
+    return m_tracker != nullptr ? m_tracker->currentChat(user) : string();
+}
+
+string ParallelReplay::verify(const vector<int>& results)
+{
+    ChatTracker::Options options;
+    options.expectedUsers = m_userNames.size();
+    options.expectedChats = m_chatNames.size();
+    ChatTracker sequential(options);
+    for(size_t k = 0; k < m_ops.size(); k++)
+    {
+        int expected = applyOp(sequential, m_ops[k]);
+        if(k >= results.size() || results[k] != expected)
+        {
+            ostringstream msg;
+            msg << "operation " << k << " returned " << (k < results.size() ? results[k] : 0)
+                << " instead of " << expected;
+            return msg.str();
+        }
+    }
+    for(const string& chat : m_chatNames)
+    {
+        if(chatTotal(chat) != sequential.chatTotal(chat) || members(chat) != sequential.members(chat))
+            return "chat \"" + chat + "\" ends up different";
+    }
+    for(const string& user : m_userNames)
+    {
+        if(currentChat(user) != sequential.currentChat(user))
+            return "user \"" + user + "\" ends up in a different chat";
+    }
+    return "";
+}
@@ -0,0 +1,99 @@
+#ifndef PARALLELREPLAY_INCLUDED
+#define PARALLELREPLAY_INCLUDED
+
+#include "ChatTracker.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+// One operation of a trace
+struct TraceOp
+{
+    enum Type { JOIN, TERMINATE, CONTRIBUTE, LEAVE2, LEAVE1 };
+    Type type;
+    std::string user;  // empty for TERMINATE
+    std::string chat;  // empty for CONTRIBUTE and LEAVE1
+};
+
+// Applies op to any tracker with ChatTracker's operations and returns the
+// operation's result (0 for join)
+template <typename Tracker>
+int applyOp(Tracker& t, const TraceOp& op)
+{
+    switch(op.type)
+    {
+      case TraceOp::JOIN:
+        t.join(op.user, op.chat);
+        return 0;
+      case TraceOp::TERMINATE:
+        return t.terminate(op.chat);
+      case TraceOp::CONTRIBUTE:
+        return t.contribute(op.user);
+      case TraceOp::LEAVE2:
+        return t.leave(op.user, op.chat);
+      case TraceOp::LEAVE1:
+        return t.leave(op.user);
+    }
+    return 0;
+}
+
+// Replays a trace on several threads with exactly the results of replaying
+// it in order.  Each operation depends on the operation before it on its
+// user and, for joins and leaves, on the one before it on its chat (a
+// leave of the user's current chat is on the chat it will leave); a
+// terminate depends on the last operation of each user who is then a
+// member, and is the operation before the next one on each of them.  The
+// operations and these dependencies make a DAG, and a pool of threads
+// applies each operation as soon as those it depends on are done.  They
+// all share one tracker made for concurrent contributions: a contribute
+// holds a shared lock, so contributions of different users run at once,
+// and every other operation holds the lock alone.
+// The replay can go no faster than the longest chain of dependencies, nor
+// than the operations other than contribute, which are applied one at a
+// time.
+class ParallelReplay
+{
+  public:
+    explicit ParallelReplay(const std::vector<TraceOp>& ops);
+    ~ParallelReplay();
+      // Number of dependencies, and operations in the longest chain of them
+    size_t dependencies() const { return m_successors.size(); }
+    size_t criticalPath() const { return m_criticalPath; }
+      // Replays the trace on the given number of threads; results[k] is set
+      // to the result of the k-th operation.  The tracker is kept, so the
+      // final state can be read afterwards.
+    void run(int threads, std::vector<int>& results);
+      // The final state, read from the tracker
+    int chatTotal(const std::string& chat) const;
+    std::vector<std::string> members(const std::string& chat) const;
+    std::string currentChat(const std::string& user);
+      // Replays the trace in order on a single ChatTracker and compares each
+      // result with results (from run) and the final state of every chat and
+      // user with this replay's.  Returns "" if all agree, or else a
+      // description of the first difference.
+    std::string verify(const std::vector<int>& results);
+
+    ParallelReplay(const ParallelReplay&) = delete;
+    ParallelReplay& operator=(const ParallelReplay&) = delete;
+
+  private:
+      // The replay keeps its own copy, so the trace it was given need not
+      // outlive it
+    std::vector<TraceOp> m_ops;
+      // The operations that depend on op k are m_successors[m_firstSuccessor[k]]
+      // up to m_successors[m_firstSuccessor[k+1]]; m_predecessors[k] counts
+      // the operations op k depends on (an operation it depends on twice
+      // counts twice, and lists it twice as a successor)
+    std::vector<size_t> m_firstSuccessor;
+    std::vector<size_t> m_successors;
+    std::vector<size_t> m_predecessors;
+    size_t m_criticalPath;
+    std::vector<std::string> m_userNames;
+    std::vector<std::string> m_chatNames;
+    size_t m_joins;
+      // The tracker the trace was last replayed on
+    std::unique_ptr<ChatTracker> m_tracker;
+};
+
+#endif // PARALLELREPLAY_INCLUDED
@@ -0,0 +1,682 @@
+
+#include "SharedChatTracker.h"
+#include "HashMap.h"
+#include <atomic>
+#include <thread>
+#include <new>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+using namespace std;
+
+// Every field in the segment is a 64-bit word that both the writer and the readers access atomically
+// (relaxed; the sequence number provides the ordering).  A location in the segment is an offset from
+// its start, and offset 0 (where the header is) means null.
+typedef atomic<uint64_t> Word;
+
+static uint64_t get(const Word& w)
+{
+    return w.load(memory_order_relaxed);
+}
+
+static void put(Word& w, uint64_t v)
+{
+    w.store(v, memory_order_relaxed);
+}
+
+static const uint64_t k_magic = 0x3154524b54414843ull;  // "CHATKRT1"
+// Blocks are powers of two from 16 bytes up, with a free list for each size
+static const size_t k_minBlock = 16;
+static const size_t k_classes = 40;
+
+struct SharedSegmentHeader
+{
+    Word magic;  // stored last, so a reader never sees a half-built segment
+    uint64_t size;
+    // Odd while the writer is changing the segment
+    Word sequence;
+    uint64_t userTable;
+    uint64_t userBuckets;
+    uint64_t chatTable;
+    uint64_t chatBuckets;
+    // Used only by the writer
+    uint64_t arenaNext;
+    uint64_t arenaEnd;
+    uint64_t freeLists[k_classes];
+};
+
+// A name: its length, followed by its bytes
+struct SharedName
+{
+    Word length;
+    char bytes[1];
+};
+
+// Users and chats start with the same three fields, so the same code walks both tables' chains
+struct SharedNode
+{
+    Word next;
+    Word hash;
+    Word name;
+};
+
+struct SharedUser : SharedNode
+{
+    Word chats;  // the user's memberships, current chat first
+};
+
+struct SharedChat : SharedNode
+{
+    Word total;
+    Word firstMember;  // members in the order they joined
+    Word lastMember;
+};
+
+// One user's membership in one chat; it is in both the user's list and the chat's list
+struct SharedMembership
+{
+    Word user;
+    Word chat;
+    Word count;
+    Word nextInUser;
+    Word prevInUser;
+    Word nextInChat;
+    Word prevInChat;
+};
+
+static uint64_t nameHash(const string& name)
+{
+    return WyHash::hashBytes(name.data(), name.size());
+}
+
+static size_t roundUpToPowerOfTwo(size_t n)
+{
+    size_t p = 1;
+    while(p < n)
+        p <<= 1;
+    return p;
+}
+
+static size_t alignUp(size_t n)
+{
+    return (n + k_minBlock - 1) / k_minBlock * k_minBlock;
+}
+
+// Reads made without the writer's cooperation can see a structure halfway through a change, so every
+// offset a reader follows is checked before use; a bad one just means the read has to be retried
+static bool inSegment(size_t size, uint64_t offset, size_t bytes)
+{
+    return offset >= sizeof(SharedSegmentHeader) && offset % 8 == 0 && bytes <= size && offset <= size - bytes;
+}
+
+// Purpose: find the node with the name in a table's chain
+// Sets found to the node's offset (0 if there is none); returns false if the chain is damaged (possible only for readers)
+static bool findNode(const char* base, size_t size, uint64_t table, uint64_t buckets, const string& name, uint64_t hash, uint64_t& found)
+{
+    const Word* bucket = reinterpret_cast<const Word*>(base + table) + (hash & (buckets - 1));
+    uint64_t node = get(*bucket);
+    // A chain can never be longer than the number of blocks that fit in the segment
+    for(size_t steps = 0; node != 0; steps++)
+    {
+        if(steps > size / k_minBlock || !inSegment(size, node, sizeof(SharedNode)))
+            return false;
+        const SharedNode* n = reinterpret_cast<const SharedNode*>(base + node);
+        if(get(n->hash) == hash)
+        {
+            uint64_t nameOffset = get(n->name);
+            if(!inSegment(size, nameOffset, sizeof(Word)))
+                return false;
+            const SharedName* s = reinterpret_cast<const SharedName*>(base + nameOffset);
+            uint64_t length = get(s->length);
+            if(length > size - nameOffset - sizeof(Word))
+                return false;
+            if(length == name.size() && memcmp(s->bytes, name.data(), length) == 0)
+            {
+                found = node;
+                return true;
+            }
+        }
+        node = get(n->next);
+    }
+    found = 0;
+    return true;
+}
+
+// Purpose: copy the name stored at offset into out; returns false if it is damaged
+static bool readName(const char* base, size_t size, uint64_t offset, string& out)
+{
+    if(!inSegment(size, offset, sizeof(Word)))
+        return false;
+    const SharedName* s = reinterpret_cast<const SharedName*>(base + offset);
+    uint64_t length = get(s->length);
+    if(length > size - offset - sizeof(Word))
+        return false;
+    out.assign(s->bytes, length);
+    return true;
+}
+
+// *************** SharedChatTracker implementations *******************
+
+// The segment holds the header, the two bucket tables and an arena for users, chats, memberships and names.
+// Blocks are rounded up to powers of two, so names are given twice their size (plus their length word).
+SharedChatTracker::SharedChatTracker(const string& name, const Capacity& capacity)
+ : m_name(name), m_base(nullptr), m_size(0), m_header(nullptr), m_ok(false)
+{
+    size_t userBuckets = roundUpToPowerOfTwo(capacity.users < 1 ? 1 : capacity.users);
+    size_t chatBuckets = roundUpToPowerOfTwo(capacity.chats < 1 ? 1 : capacity.chats);
+    size_t arena = capacity.users * roundUpToPowerOfTwo(sizeof(SharedUser))
+                   + capacity.chats * roundUpToPowerOfTwo(sizeof(SharedChat))
+                   + capacity.memberships * roundUpToPowerOfTwo(sizeof(SharedMembership))
+                   + 2 * (capacity.nameBytes + (capacity.users + capacity.chats) * sizeof(Word))
+                   + 64 * 1024;
+    size_t userTable = alignUp(sizeof(SharedSegmentHeader));
+    size_t chatTable = alignUp(userTable + userBuckets * sizeof(Word));
+    size_t arenaStart = alignUp(chatTable + chatBuckets * sizeof(Word));
+    m_size = arenaStart + alignUp(arena);
+
+    // Replace any segment left behind with the same name
+    shm_unlink(m_name.c_str());
+    int fd = shm_open(m_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(fd < 0)
+        return;
+    if(ftruncate(fd, off_t(m_size)) != 0)
+    {
+        close(fd);
+        shm_unlink(m_name.c_str());
+        return;
+    }
+    void* p = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED)
+    {
+        shm_unlink(m_name.c_str());
+        return;
+    }
+
+    // The new segment is zero-filled, so the bucket tables start empty
+    m_base = static_cast<char*>(p);
+    m_header = new (m_base) SharedSegmentHeader();
+    m_header->size = m_size;
+    m_header->userTable = userTable;
+    m_header->userBuckets = userBuckets;
+    m_header->chatTable = chatTable;
+    m_header->chatBuckets = chatBuckets;
+    m_header->arenaNext = arenaStart;
+    m_header->arenaEnd = m_size;
+    m_header->magic.store(k_magic, memory_order_release);
+    m_ok = true;
+}
+
+SharedChatTracker::~SharedChatTracker()
+{
+    if(m_base != nullptr)
+    {
+        munmap(m_base, m_size);
+        shm_unlink(m_name.c_str());
+    }
+}
+
+void SharedChatTracker::beginWrite()
+{
+    put(m_header->sequence, get(m_header->sequence) + 1);
+    atomic_thread_fence(memory_order_release);
+}
+
+void SharedChatTracker::endWrite()
+{
+    m_header->sequence.store(get(m_header->sequence) + 1, memory_order_release);
+}
+
+// Purpose: take a block of at least bytes from the arena, reusing a freed block of the same size if there is one
+// Returns 0 if the segment is full
+uint64_t SharedChatTracker::allocate(size_t bytes)
+{
+    size_t c = 0;
+    while((k_minBlock << c) < bytes)
+        c++;
+    uint64_t offset = m_header->freeLists[c];
+    if(offset != 0)
+    {
+        m_header->freeLists[c] = get(*reinterpret_cast<Word*>(m_base + offset));
+        return offset;
+    }
+    size_t block = k_minBlock << c;
+    if(m_header->arenaEnd - m_header->arenaNext < block)
+    {
+        m_ok = false;
+        return 0;
+    }
+    offset = m_header->arenaNext;
+    m_header->arenaNext += block;
+    return offset;
+}
+
+void SharedChatTracker::deallocate(uint64_t offset, size_t bytes)
+{
+    size_t c = 0;
+    while((k_minBlock << c) < bytes)
+        c++;
+    put(*reinterpret_cast<Word*>(m_base + offset), m_header->freeLists[c]);
+    m_header->freeLists[c] = offset;
+}
+
+uint64_t SharedChatTracker::storeName(const string& name)
+{
+    uint64_t offset = allocate(sizeof(Word) + name.size());
+    if(offset != 0)
+    {
+        SharedName* s = reinterpret_cast<SharedName*>(m_base + offset);
+        put(s->length, name.size());
+        memcpy(s->bytes, name.data(), name.size());
+    }
+    return offset;
+}
+
+uint64_t SharedChatTracker::findUser(const string& user, uint64_t hash) const
+{
+    uint64_t found = 0;
+    findNode(m_base, m_size, m_header->userTable, m_header->userBuckets, user, hash, found);
+    return found;
+}
+
+uint64_t SharedChatTracker::findChat(const string& chat, uint64_t hash) const
+{
+    uint64_t found = 0;
+    findNode(m_base, m_size, m_header->chatTable, m_header->chatBuckets, chat, hash, found);
+    return found;
+}
+
+// Purpose: add a user with no chats to the table of users; returns 0 if the segment is full
+uint64_t SharedChatTracker::createUser(const string& user, uint64_t hash)
+{
+    uint64_t node = allocate(sizeof(SharedUser));
+    uint64_t name = (node != 0 ? storeName(user) : 0);
+    if(name == 0)
+    {
+        if(node != 0)
+            deallocate(node, sizeof(SharedUser));
+        return 0;
+    }
+    SharedUser* u = reinterpret_cast<SharedUser*>(m_base + node);
+    Word& bucket = reinterpret_cast<Word*>(m_base + m_header->userTable)[hash & (m_header->userBuckets - 1)];
+    put(u->hash, hash);
+    put(u->name, name);
+    put(u->chats, 0);
+    put(u->next, get(bucket));
+    put(bucket, node);
+    return node;
+}
+
+// Purpose: add a chat with no members and no contributions to the table of chats; returns 0 if the segment is full
+uint64_t SharedChatTracker::createChat(const string& chat, uint64_t hash)
+{
+    uint64_t node = allocate(sizeof(SharedChat));
+    uint64_t name = (node != 0 ? storeName(chat) : 0);
+    if(name == 0)
+    {
+        if(node != 0)
+            deallocate(node, sizeof(SharedChat));
+        return 0;
+    }
+    SharedChat* c = reinterpret_cast<SharedChat*>(m_base + node);
+    Word& bucket = reinterpret_cast<Word*>(m_base + m_header->chatTable)[hash & (m_header->chatBuckets - 1)];
+    put(c->hash, hash);
+    put(c->name, name);
+    put(c->total, 0);
+    put(c->firstMember, 0);
+    put(c->lastMember, 0);
+    put(c->next, get(bucket));
+    put(bucket, node);
+    return node;
+}
+
+uint64_t SharedChatTracker::findMembership(uint64_t user, uint64_t chat) const
+{
+    SharedUser* u = reinterpret_cast<SharedUser*>(m_base + user);
+    for(uint64_t m = get(u->chats); m != 0; m = get(reinterpret_cast<SharedMembership*>(m_base + m)->nextInUser))
+    {
+        if(get(reinterpret_cast<SharedMembership*>(m_base + m)->chat) == chat)
+            return m;
+    }
+    return 0;
+}
+
+// Purpose: unlink a membership from its user's and its chat's lists and free it
+// Returns the user's contributions to the chat
+int SharedChatTracker::removeMembership(uint64_t membership)
+{
+    SharedMembership* m = reinterpret_cast<SharedMembership*>(m_base + membership);
+    SharedUser* u = reinterpret_cast<SharedUser*>(m_base + get(m->user));
+    SharedChat* c = reinterpret_cast<SharedChat*>(m_base + get(m->chat));
+    uint64_t prev = get(m->prevInUser);
+    uint64_t next = get(m->nextInUser);
+    if(prev != 0)
+        put(reinterpret_cast<SharedMembership*>(m_base + prev)->nextInUser, next);
+    else
+        put(u->chats, next);
+    if(next != 0)
+        put(reinterpret_cast<SharedMembership*>(m_base + next)->prevInUser, prev);
+
+    prev = get(m->prevInChat);
+    next = get(m->nextInChat);
+    if(prev != 0)
+        put(reinterpret_cast<SharedMembership*>(m_base + prev)->nextInChat, next);
+    else
+        put(c->firstMember, next);
+    if(next != 0)
+        put(reinterpret_cast<SharedMembership*>(m_base + next)->prevInChat, prev);
+    else
+        put(c->lastMember, prev);
+
+    int count = int(get(m->count));
+    deallocate(membership, sizeof(SharedMembership));
+    return count;
+}
+
+// Purpose: remove a node from its table's chain and free it and its name
+void SharedChatTracker::eraseNode(uint64_t bucketTable, uint64_t buckets, uint64_t node)
+{
+    SharedNode* n = reinterpret_cast<SharedNode*>(m_base + node);
+    Word* link = &reinterpret_cast<Word*>(m_base + bucketTable)[get(n->hash) & (buckets - 1)];
+    while(get(*link) != node)
+        link = &reinterpret_cast<SharedNode*>(m_base + get(*link))->next;
+    put(*link, get(n->next));
+    uint64_t name = get(n->name);
+    deallocate(name, sizeof(Word) + get(reinterpret_cast<SharedName*>(m_base + name)->length));
+}
+
+// A user with no chats behaves exactly like an unknown user, so it is freed
+void SharedChatTracker::reclaimUser(uint64_t user)
+{
+    if(get(reinterpret_cast<SharedUser*>(m_base + user)->chats) != 0)
+        return;
+    eraseNode(m_header->userTable, m_header->userBuckets, user);
+    deallocate(user, sizeof(SharedUser));
+}
+
+// A chat with no members and no contributions behaves exactly like a chat that was never joined, so it is freed
+void SharedChatTracker::reclaimChat(uint64_t chat)
+{
+    SharedChat* c = reinterpret_cast<SharedChat*>(m_base + chat);
+    if(get(c->firstMember) != 0 || get(c->total) != 0)
+        return;
+    eraseNode(m_header->chatTable, m_header->chatBuckets, chat);
+    deallocate(chat, sizeof(SharedChat));
+}
+
+void SharedChatTracker::join(const string& user, const string& chat)
+{
+    if(m_base == nullptr)
+        return;
+    uint64_t userHash = nameHash(user);
+    uint64_t chatHash = nameHash(chat);
+    beginWrite();
+
+    // Find or create the user and the chat
+    uint64_t u = findUser(user, userHash);
+    if(u == 0)
+        u = createUser(user, userHash);
+    uint64_t c = (u != 0 ? findChat(chat, chatHash) : 0);
+    if(u != 0 && c == 0)
+        c = createChat(chat, chatHash);
+
+    uint64_t m = (c != 0 ? findMembership(u, c) : 0);
+    SharedUser* un = reinterpret_cast<SharedUser*>(m_base + u);
+    if(m != 0)
+    {
+        // Already a member: the chat just becomes the user's current chat
+        SharedMembership* mn = reinterpret_cast<SharedMembership*>(m_base + m);
+        uint64_t prev = get(mn->prevInUser);
+        if(prev != 0)
+        {
+            uint64_t next = get(mn->nextInUser);
+            put(reinterpret_cast<SharedMembership*>(m_base + prev)->nextInUser, next);
+            if(next != 0)
+                put(reinterpret_cast<SharedMembership*>(m_base + next)->prevInUser, prev);
+            put(mn->prevInUser, 0);
+            put(mn->nextInUser, get(un->chats));
+            put(reinterpret_cast<SharedMembership*>(m_base + get(un->chats))->prevInUser, m);
+            put(un->chats, m);
+        }
+    }
+    else if(c != 0 && (m = allocate(sizeof(SharedMembership))) != 0)
+    {
+        // A new membership goes at the front of the user's list and the back of the chat's
+        SharedMembership* mn = reinterpret_cast<SharedMembership*>(m_base + m);
+        SharedChat* cn = reinterpret_cast<SharedChat*>(m_base + c);
+        put(mn->user, u);
+        put(mn->chat, c);
+        put(mn->count, 0);
+        put(mn->prevInUser, 0);
+        put(mn->nextInUser, get(un->chats));
+        if(get(un->chats) != 0)
+            put(reinterpret_cast<SharedMembership*>(m_base + get(un->chats))->prevInUser, m);
+        put(un->chats, m);
+        put(mn->nextInChat, 0);
+        put(mn->prevInChat, get(cn->lastMember));
+        if(get(cn->lastMember) != 0)
+            put(reinterpret_cast<SharedMembership*>(m_base + get(cn->lastMember))->nextInChat, m);
+        else
+            put(cn->firstMember, m);
+        put(cn->lastMember, m);
+    }
+    else
+    {
+        // Out of room: undo whatever was created
+        if(c != 0)
+            reclaimChat(c);
+        if(u != 0)
+            reclaimUser(u);
+    }
+    endWrite();
+}
+
+int SharedChatTracker::terminate(const string& chat)
+{
+    if(m_base == nullptr)
+        return 0;
+    uint64_t c = findChat(chat, nameHash(chat));
+    if(c == 0)
+        return 0;
+    SharedChat* cn = reinterpret_cast<SharedChat*>(m_base + c);
+    beginWrite();
+    // Every member leaves the chat, and users who were only in this chat are freed
+    while(get(cn->firstMember) != 0)
+    {
+        uint64_t m = get(cn->firstMember);
+        uint64_t u = get(reinterpret_cast<SharedMembership*>(m_base + m)->user);
+        removeMembership(m);
+        reclaimUser(u);
+    }
+    int total = int(get(cn->total));
+    eraseNode(m_header->chatTable, m_header->chatBuckets, c);
+    deallocate(c, sizeof(SharedChat));
+    endWrite();
+    return total;
+}
+
+int SharedChatTracker::contribute(const string& user)
+{
+    if(m_base == nullptr)
+        return 0;
+    uint64_t u = findUser(user, nameHash(user));
+    uint64_t m = (u != 0 ? get(reinterpret_cast<SharedUser*>(m_base + u)->chats) : 0);
+    if(m == 0)
+        return 0;
+    SharedMembership* mn = reinterpret_cast<SharedMembership*>(m_base + m);
+    SharedChat* cn = reinterpret_cast<SharedChat*>(m_base + get(mn->chat));
+    beginWrite();
+    uint64_t count = get(mn->count) + 1;
+    put(mn->count, count);
+    put(cn->total, get(cn->total) + 1);
+    endWrite();
+    return int(count);
+}
+
+int SharedChatTracker::leave(const string& user, const string& chat)
+{
+    if(m_base == nullptr)
+        return -1;
+    uint64_t u = findUser(user, nameHash(user));
+    uint64_t c = (u != 0 ? findChat(chat, nameHash(chat)) : 0);
+    uint64_t m = (c != 0 ? findMembership(u, c) : 0);
+    if(m == 0)
+        return -1;
+    beginWrite();
+    int count = removeMembership(m);
+    reclaimChat(c);
+    reclaimUser(u);
+    endWrite();
+    return count;
+}
+
+int SharedChatTracker::leave(const string& user)
+{
+    if(m_base == nullptr)
+        return -1;
+    uint64_t u = findUser(user, nameHash(user));
+    uint64_t m = (u != 0 ? get(reinterpret_cast<SharedUser*>(m_base + u)->chats) : 0);
+    if(m == 0)
+        return -1;
+    uint64_t c = get(reinterpret_cast<SharedMembership*>(m_base + m)->chat);
+    beginWrite();
+    int count = removeMembership(m);
+    reclaimChat(c);
+    reclaimUser(u);
+    endWrite();
+    return count;
+}
+
+// *************** SharedChatReader implementations *******************
+
+SharedChatReader::SharedChatReader(const string& name) : m_base(nullptr), m_size(0)
+{
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if(fd < 0)
+        return;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(SharedSegmentHeader))
+    {
+        close(fd);
+        return;
+    }
+    void* p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED)
+        return;
+    const SharedSegmentHeader* header = static_cast<const SharedSegmentHeader*>(p);
+    if(header->magic.load(memory_order_acquire) != k_magic || header->size != size_t(st.st_size))
+    {
+        munmap(p, size_t(st.st_size));
+        return;
+    }
+    m_base = static_cast<const char*>(p);
+    m_size = size_t(st.st_size);
+}
+
+SharedChatReader::~SharedChatReader()
+{
+    if(m_base != nullptr)
+        munmap(const_cast<char*>(m_base), m_size);
+}
+
+// Purpose: run read (which returns false if it found the segment damaged) until it runs without the writer
+//          changing the segment in the meantime
+template <typename Read>
+void SharedChatReader::readConsistent(Read read) const
+{
+    const SharedSegmentHeader* header = reinterpret_cast<const SharedSegmentHeader*>(m_base);
+    for(;;)
+    {
+        uint64_t before = header->sequence.load(memory_order_acquire);
+        if(before % 2 != 0)
+        {
+            this_thread::yield();
+            continue;
+        }
+        bool valid = read(header);
+        atomic_thread_fence(memory_order_acquire);
+        if(valid && get(header->sequence) == before)
+            return;
+    }
+}
+
+int SharedChatReader::chatTotal(const string& chat) const
+{
+    if(m_base == nullptr)
+        return 0;
+    uint64_t hash = nameHash(chat);
+    int total = 0;
+    readConsistent([&](const SharedSegmentHeader* header)
+    {
+        uint64_t c = 0;
+        if(!findNode(m_base, m_size, header->chatTable, header->chatBuckets, chat, hash, c))
+            return false;
+        total = (c != 0 ? int(get(reinterpret_cast<const SharedChat*>(m_base + c)->total)) : 0);
+        return true;
+    });
+    return total;
+}
+
+string SharedChatReader::currentChat(const string& user) const
+{
+    if(m_base == nullptr)
+        return "";
+    uint64_t hash = nameHash(user);
+    string chat;
+    readConsistent([&](const SharedSegmentHeader* header)
+    {
+        chat.clear();
+        uint64_t u = 0;
+        if(!findNode(m_base, m_size, header->userTable, header->userBuckets, user, hash, u))
+            return false;
+        if(u == 0)
+            return true;
+        uint64_t m = get(reinterpret_cast<const SharedUser*>(m_base + u)->chats);
+        if(m == 0)
+            return true;
+        if(!inSegment(m_size, m, sizeof(SharedMembership)))
+            return false;
+        uint64_t c = get(reinterpret_cast<const SharedMembership*>(m_base + m)->chat);
+        if(!inSegment(m_size, c, sizeof(SharedChat)))
+            return false;
+        return readName(m_base, m_size, get(reinterpret_cast<const SharedChat*>(m_base + c)->name), chat);
+    });
+    return chat;
+}
+
+vector<string> SharedChatReader::members(const string& chat) const
+{
+    vector<string> result;
+    if(m_base == nullptr)
+        return result;
+    uint64_t hash = nameHash(chat);
+    readConsistent([&](const SharedSegmentHeader* header)
+    {
+        result.clear();
+        uint64_t c = 0;
+        if(!findNode(m_base, m_size, header->chatTable, header->chatBuckets, chat, hash, c))
+            return false;
+        if(c == 0)
+            return true;
+        uint64_t m = get(reinterpret_cast<const SharedChat*>(m_base + c)->firstMember);
+        for(size_t steps = 0; m != 0; steps++)
+        {
+            if(steps > m_size / k_minBlock || !inSegment(m_size, m, sizeof(SharedMembership)))
+                return false;
+            const SharedMembership* mn = reinterpret_cast<const SharedMembership*>(m_base + m);
+            uint64_t u = get(mn->user);
+            if(!inSegment(m_size, u, sizeof(SharedUser)))
+                return false;
+            string name;
+            if(!readName(m_base, m_size, get(reinterpret_cast<const SharedUser*>(m_base + u)->name), name))
+                return false;
+            result.push_back(std::move(name));
+            m = get(mn->nextInChat);
+        }
+        return true;
+    });
+    return result;
+}
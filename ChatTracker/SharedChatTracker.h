@@ -0,0 +1,102 @@
+#ifndef SHAREDCHATTRACKER_INCLUDED
+#define SHAREDCHATTRACKER_INCLUDED
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+struct SharedSegmentHeader;
+
+// A ChatTracker whose data lives in a named shared-memory segment
+// (shm_open + mmap), so other processes can read it with SharedChatReader
+// without asking the writing process.  Everything in the segment refers to
+// everything else by its offset from the start of the segment, so each
+// process can map it at a different address.  Readers use a seqlock: the
+// writer bumps a sequence number before and after each change, and a
+// reader retries any read that overlapped a change.
+// The segment is sized when the tracker is created and does not grow.  If
+// it fills up, the operation that needed more memory is not applied and
+// ok() becomes false.
+class SharedChatTracker
+{
+  public:
+    struct Capacity
+    {
+        Capacity() : users(0), chats(0), memberships(0), nameBytes(0) {}
+        size_t users;
+        size_t chats;
+        size_t memberships;  // (user, chat) pairs, summed over all users
+        size_t nameBytes;    // total length of the users' and chats' names
+    };
+
+      // Creates (or replaces) the segment called name, which must look like
+      // "/something" (on macOS, at most 31 characters).  The destructor
+      // removes the name; processes that have the segment mapped keep it.
+    SharedChatTracker(const std::string& name, const Capacity& capacity);
+    ~SharedChatTracker();
+      // False if the segment could not be created or has run out of room
+    bool ok() const { return m_ok; }
+
+    void join(const std::string& user, const std::string& chat);
+    int terminate(const std::string& chat);
+    int contribute(const std::string& user);
+    int leave(const std::string& user, const std::string& chat);
+    int leave(const std::string& user);
+
+    SharedChatTracker(const SharedChatTracker&) = delete;
+    SharedChatTracker& operator=(const SharedChatTracker&) = delete;
+
+  private:
+    std::string m_name;
+    char* m_base;
+    size_t m_size;
+    SharedSegmentHeader* m_header;
+    bool m_ok;
+
+    uint64_t findUser(const std::string& user, uint64_t hash) const;
+    uint64_t findChat(const std::string& chat, uint64_t hash) const;
+    uint64_t createUser(const std::string& user, uint64_t hash);
+    uint64_t createChat(const std::string& chat, uint64_t hash);
+    uint64_t findMembership(uint64_t user, uint64_t chat) const;
+    int removeMembership(uint64_t membership);
+    void reclaimUser(uint64_t user);
+    void reclaimChat(uint64_t chat);
+    void eraseNode(uint64_t bucketTable, uint64_t buckets, uint64_t node);
+    uint64_t allocate(size_t bytes);
+    void deallocate(uint64_t offset, size_t bytes);
+    uint64_t storeName(const std::string& name);
+    void beginWrite();
+    void endWrite();
+};
+
+// A read-only view of a SharedChatTracker's segment, usable from any
+// process.  Reads never block the writer; a read that overlaps a change is
+// simply retried.
+class SharedChatReader
+{
+  public:
+    explicit SharedChatReader(const std::string& name);
+    ~SharedChatReader();
+      // False if the segment could not be opened
+    bool ok() const { return m_base != nullptr; }
+
+      // The contributions made to a chat so far (what terminate would return)
+    int chatTotal(const std::string& chat) const;
+      // The user's current chat, or "" if the user has none
+    std::string currentChat(const std::string& user) const;
+      // The chat's members, in the order they joined
+    std::vector<std::string> members(const std::string& chat) const;
+
+    SharedChatReader(const SharedChatReader&) = delete;
+    SharedChatReader& operator=(const SharedChatReader&) = delete;
+
+  private:
+    const char* m_base;
+    size_t m_size;
+
+    template <typename Read>
+    void readConsistent(Read read) const;
+};
+
+#endif // SHAREDCHATTRACKER_INCLUDED
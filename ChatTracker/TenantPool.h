@@ -0,0 +1,46 @@
+#ifndef TENANTPOOL_INCLUDED
+#define TENANTPOOL_INCLUDED
+
+#include "NodePool.h"
+#include "NameStore.h"
+#include "LatencyStats.h"
+#include <memory>
+#include <cstddef>
+
+// What many small trackers (one per tenant, say) share: the pool their table
+// entries and list nodes come from, one recorder for the latencies of all of
+// their operations and, with shareNames, one store of their users' names.
+// A tracker built with a TenantPool (see ChatTracker::Options) starts with a
+// single bucket per table and sets nothing aside, so an empty tracker takes
+// well under a kilobyte and a microsecond or two to build, and it grows with
+// its own users and chats.  Trackers on different threads may use the same
+// pool at once (the pool and the store take a lock on each call), but a
+// checkpoint must not be started while other threads are using the pool: the
+// process writing it could inherit a lock that is never released.  The pool
+// must outlive its trackers.
+class TenantPool
+{
+  public:
+    explicit TenantPool(bool shareNames = true, bool hugePages = false)
+     : m_nodes(hugePages, true), m_names(shareNames ? new NameStore(true) : nullptr) {}
+
+    NodePool& nodes() { return m_nodes; }
+      // The shared store of names, or nullptr if each tracker keeps its own
+    NameStore* names() { return m_names.get(); }
+      // The latencies of every tracker using the pool
+    LatencyRecorder& latency() { return m_latency; }
+      // Bytes obtained from the system for nodes, and used by the shared
+      // names (a tracker's memoryUsage counts its own entries and nodes, and
+      // its names at their length)
+    size_t memoryUsage() const { return m_nodes.capacity() + (m_names ? m_names->memoryUsage() : 0); }
+
+    TenantPool(const TenantPool&) = delete;
+    TenantPool& operator=(const TenantPool&) = delete;
+
+  private:
+    NodePool m_nodes;
+    std::unique_ptr<NameStore> m_names;
+    LatencyRecorder m_latency;
+};
+
+#endif // TENANTPOOL_INCLUDED
@@ -0,0 +1,136 @@
+
+#include "TraceEvents.h"
+#include <ostream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <unistd.h>
+using namespace std;
+
+// *************** Trace rings *******************
+// Each thread records its spans in a ring of its own, so recording takes no lock.  A ring is created the first
+// time its thread records a span and is kept after the thread ends, so its spans can still be written.
+
+struct TraceRing
+{
+    struct Span
+    {
+        atomic<const char*> name;
+        atomic<uint64_t> start;
+        atomic<uint64_t> end;
+    };
+    // One slot more than the spans kept, for the span being recorded while the others are read
+    static const size_t k_slots = k_traceRingSize + 1;
+    unsigned tid;
+    // Spans recorded by the thread, ever; span i is in spans[i % k_slots]
+    atomic<uint64_t> recorded;
+    // Spans before this one have been cleared
+    atomic<uint64_t> first;
+    Span spans[k_slots];
+};
+
+static mutex s_ringsMutex;
+static vector<TraceRing*> s_rings;
+static thread_local TraceRing* t_ring = nullptr;
+
+// Purpose: return this thread's ring, creating it the first time
+static TraceRing* ringOfThisThread()
+{
+    if(t_ring == nullptr)
+    {
+        TraceRing* ring = new TraceRing;
+        ring->recorded.store(0, memory_order_relaxed);
+        ring->first.store(0, memory_order_relaxed);
+        lock_guard<mutex> lock(s_ringsMutex);
+        ring->tid = unsigned(s_rings.size() + 1);
+        s_rings.push_back(ring);
+        t_ring = ring;
+    }
+    return t_ring;
+}
+
+// *************** TraceSpan implementations *******************
+
+uint64_t TraceSpan::traceClock()
+{
+    return uint64_t(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Only this thread writes its ring.  The fence keeps the span's stores from being seen before the count the
+// last span published, so a reader that sees them also sees that the slot it read is being overwritten.
+void TraceSpan::recordTraceSpan(const char* name, uint64_t start, uint64_t end)
+{
+    TraceRing* ring = ringOfThisThread();
+    uint64_t i = ring->recorded.load(memory_order_relaxed);
+    TraceRing::Span& span = ring->spans[i % TraceRing::k_slots];
+    atomic_thread_fence(memory_order_release);
+    span.name.store(name, memory_order_relaxed);
+    span.start.store(start, memory_order_relaxed);
+    span.end.store(end, memory_order_relaxed);
+    ring->recorded.store(i + 1, memory_order_release);
+}
+
+// *************** Trace output *******************
+
+// Purpose: append nanoseconds as microseconds with three decimals, as the trace-event format counts time
+static void appendMicroseconds(string& text, uint64_t nanoseconds)
+{
+    text += to_string(nanoseconds / 1000);
+    text += '.';
+    string fraction = to_string(nanoseconds % 1000);
+    text.append(3 - fraction.size(), '0');
+    text += fraction;
+}
+
+void writeTraceEvents(ostream& out)
+{
+    lock_guard<mutex> lock(s_ringsMutex);
+    string pid = to_string(getpid());
+    string text = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool firstEvent = true;
+    for(TraceRing* ring : s_rings)
+    {
+        uint64_t recorded = ring->recorded.load(memory_order_acquire);
+        uint64_t from = ring->first.load(memory_order_relaxed);
+        if(recorded > k_traceRingSize && from < recorded - k_traceRingSize)
+            from = recorded - k_traceRingSize;
+        vector<const char*> names;
+        vector<uint64_t> starts, ends;
+        for(uint64_t i = from; i < recorded; i++)
+        {
+            TraceRing::Span& span = ring->spans[i % TraceRing::k_slots];
+            names.push_back(span.name.load(memory_order_relaxed));
+            starts.push_back(span.start.load(memory_order_relaxed));
+            ends.push_back(span.end.load(memory_order_relaxed));
+        }
+        // Spans the thread has started to overwrite since they were read are left out
+        atomic_thread_fence(memory_order_acquire);
+        uint64_t now = ring->recorded.load(memory_order_relaxed);
+        uint64_t intact = (now + 1 > TraceRing::k_slots ? now + 1 - TraceRing::k_slots : 0);
+        for(uint64_t i = max(from, intact); i < recorded; i++)
+        {
+            size_t k = size_t(i - from);
+            text += firstEvent ? "\n" : ",\n";
+            firstEvent = false;
+            text += "{\"name\":\"";
+            text += names[k];
+            text += "\",\"cat\":\"ChatTracker\",\"ph\":\"X\",\"pid\":" + pid + ",\"tid\":" + to_string(ring->tid) + ",\"ts\":";
+            appendMicroseconds(text, starts[k]);
+            text += ",\"dur\":";
+            appendMicroseconds(text, ends[k] - starts[k]);
+            text += '}';
+        }
+    }
+    text += "\n]}\n";
+    out << text;
+}
+
+void clearTraceEvents()
+{
+    lock_guard<mutex> lock(s_ringsMutex);
+    for(TraceRing* ring : s_rings)
+        ring->first.store(ring->recorded.load(memory_order_acquire), memory_order_relaxed);
+}
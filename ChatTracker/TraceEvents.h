@@ -0,0 +1,58 @@
+#ifndef TRACEEVENTS_INCLUDED
+#define TRACEEVENTS_INCLUDED
+
+#include <iosfwd>
+#include <cstddef>
+#include <cstdint>
+
+// Spans of time in the phases of an operation (hashing a name, walking a bucket, scanning a list,
+// allocating), for finding out where a slow operation spent its time.  TRACE_SPAN(name) times the rest of the
+// enclosing block and records it in a ring buffer belonging to the thread, which keeps the thread's most
+// recent k_traceRingSize spans.  writeTraceEvents writes the spans of every thread as Chrome trace-event JSON
+// (for chrome://tracing or Perfetto), where spans recorded inside others appear nested under them.
+//
+// Tracing is compiled in only when CHATTRACKER_TRACE is defined.  Otherwise TRACE_SPAN expands to nothing, so
+// no clock is read and nothing is recorded, and writeTraceEvents writes an empty list of events.  Reading the
+// clock takes tens of nanoseconds, as long as some of the phases traced, so a traced build runs several times
+// slower; the spans show where the time goes, not how long an untraced operation takes.
+
+const size_t k_traceRingSize = 32768;
+
+// Writes the spans recorded so far by every thread, oldest first within each thread.  It may be called while
+// other threads record spans; one that a thread is writing as it is read is left out.
+void writeTraceEvents(std::ostream& out);
+// Forgets the spans recorded so far
+void clearTraceEvents();
+
+// Times its own lifetime and records it as a span; name must be a string literal (only the pointer is kept).
+// It is declared in every build, so files built with and without tracing link together.
+class TraceSpan
+{
+  public:
+    explicit TraceSpan(const char* name) : m_name(name), m_start(traceClock()) {}
+    ~TraceSpan() { recordTraceSpan(m_name, m_start, traceClock()); }
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    // Nanoseconds on the steady clock
+    static uint64_t traceClock();
+    static void recordTraceSpan(const char* name, uint64_t start, uint64_t end);
+
+  private:
+    const char* m_name;
+    uint64_t m_start;
+};
+
+#ifdef CHATTRACKER_TRACE
+
+#define TRACE_SPAN_NAME2(line) traceSpan##line
+#define TRACE_SPAN_NAME(line) TRACE_SPAN_NAME2(line)
+#define TRACE_SPAN(name) TraceSpan TRACE_SPAN_NAME(__LINE__)(name)
+
+#else
+
+#define TRACE_SPAN(name)
+
+#endif // CHATTRACKER_TRACE
+
+#endif // TRACEEVENTS_INCLUDED
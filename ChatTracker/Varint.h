@@ -0,0 +1,41 @@
+#ifndef VARINT_INCLUDED
+#define VARINT_INCLUDED
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+// *************** Varints *******************
+// An unsigned value in 7-bit groups, lowest first, with the top bit of each byte set if another byte follows,
+// so values below 128 take one byte.
+
+// Purpose: append value to out as a varint
+inline void appendVarint(std::string& out, uint64_t value)
+{
+    while(value >= 0x80)
+    {
+        out += char((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += char(value);
+}
+
+// Purpose: read the varint at p and move p past it
+inline uint64_t readVarint(const char*& p)
+{
+    // Nearly every value fits in one byte
+    if(!(*p & 0x80))
+        return static_cast<unsigned char>(*p++);
+    uint64_t value = 0;
+    unsigned shift = 0;
+    unsigned char byte;
+    do
+    {
+        byte = static_cast<unsigned char>(*p++);
+        value |= uint64_t(byte & 0x7f) << shift;
+        shift += 7;
+    } while(byte & 0x80);
+    return value;
+}
+
+#endif // VARINT_INCLUDED
@@ -8,12 +8,50 @@
 //   l userName           which requests a call to leave(userName)
 
 #include "ChatTracker.h"
+#include "HashMap.h"
+#include "AsyncChatTracker.h"
+#include "ChangeFeed.h"
+#include "ChatReplica.h"
+#include "SharedChatTracker.h"
+#include "ParallelReplay.h"
+#include "ChatReports.h"
+#include "DenseChatTracker.h"
+#include "TraceEvents.h"
+#include "NameStore.h"
+#include "TenantPool.h"
+#include "ChatServer.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <string>
 #include <vector>
 #include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <iomanip>
+#include <random>
+#include <cmath>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <poll.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <set>
+#include <map>
+#include <algorithm>
+#include <memory>
+#include <functional>
+#include <stdexcept>
 using namespace std;
 
 const char* commandFileName = "sampletest.txt";
@@ -38,6 +76,39 @@ class SlowChatTracker
     vector<Info> m_usersWhoLeft;
 };
 
+  // The same behavior as SlowChatTracker, kept in ordered maps so that each
+  // operation takes O(log n).  Every join gets a stamp from a counter; a
+  // user's current chat is the one it joined with the largest stamp.  A
+  // chat's total includes the contributions of members who have left.
+
+class IndexedChatTracker
+{
+  public:
+    IndexedChatTracker() : m_clock(0) {}
+    void join(string user, string chat);
+    int terminate(string chat);
+    int contribute(string user);
+    int leave(string user, string chat);
+    int leave(string user);
+      // The state as a ChatTracker dump: a chat's members are in the order
+      // of the stamps they got when they joined
+    void dump(ChatTracker::Dump& dump) const;
+  private:
+    struct Membership
+    {
+        long long stamp;
+        long long joined;  // the stamp of the join that made the user a member
+        int count;
+    };
+    long long m_clock;
+    map<pair<string, string>, Membership> m_memberships;  // (user, chat)
+    map<string, map<long long, string>> m_userChats;       // user -> stamp -> chat
+    map<string, set<string>> m_chatUsers;                  // chat -> users
+    map<string, long long> m_chatTotals;                   // chat -> contributions
+
+    int remove(const string& user, const string& chat);
+};
+
 struct Command
 {
     static Command* create(string line, int lineno);
@@ -50,13 +121,101 @@ struct Command
 };
 
 void extractCommands(istream& dataf, vector<Command*>& commands);
-string testCorrectness(const vector<Command*>& commands);
+string genName(char c, int n);
+string testCorrectness(const vector<Command*>& commands, size_t memoryBudget = 0, bool hugePages = false);
 void testPerformance(const vector<Command*>& commands);
+void testHashPolicies();
+string testHashMap();
+string testServer();
+string testAsyncTrackers();
+void testAsyncSubmission();
+string testChangeFeed(const vector<Command*>& commands);
+void testChangeFeedOverhead();
+string testReplica(const vector<Command*>& commands);
+string testReplicaProcess(const vector<Command*>& commands);
+string testSlowReplica();
+string testSharedMemory(const vector<Command*>& commands);
+string testParallelReplay(const vector<Command*>& commands);
+string testIndexedOracle(const vector<Command*>& commands);
+string differentialRun(istream& trace, long long& nops, double& msec);
+void timeParallelReplay(const vector<Command*>& commands);
+string testBulkLoad(const vector<Command*>& commands);
+void timeBulkLoad();
+string testReports(const vector<Command*>& commands);
+void timeReports();
+string testMemberListing(const vector<Command*>& commands);
+void timeMemberListing();
+string testCheckpoint(const vector<Command*>& commands, size_t memoryBudget = 0);
+string testCheckpointIsolation(const vector<Command*>& commands);
+string testSpillFile(const vector<Command*>& commands);
+void timeCheckpoint();
+string testDenseTracker(const vector<Command*>& commands);
+void timeDenseTracker(const vector<Command*>& commands);
+void timeHugePages();
+string testLatencyStats(const vector<Command*>& commands);
+void timeLatencyStats(const vector<Command*>& commands);
+string testTraceEvents(const vector<Command*>& commands);
+void compareBackends(const vector<Command*>& commands);
+string testNameStore();
+void timeNameStorage();
+string testTenants(const vector<Command*>& commands);
+void timeTenants();
+string testConcurrentContributions(const vector<Command*>& commands);
+void timeHotChat();
+string testColdTier(const vector<Command*>& commands);
+void timeColdTier();
 
-int main()
+int main(int argc, char* argv[])
 {
     vector<Command*> commands;
 
+      // testChatTracker --diff FILE  checks ChatTracker against the indexed
+      // oracle over a trace of any size, read as it goes ("-" means stdin)
+
+    if (argc == 3  &&  string(argv[1]) == "--diff")
+    {
+        ifstream tracef;
+        if (string(argv[2]) != "-")
+        {
+            tracef.open(argv[2]);
+            if ( ! tracef)
+            {
+                cout << "Cannot open " << argv[2] << endl;
+                return 1;
+            }
+        }
+        long long nops;
+        double elapsed;
+        string result = differentialRun(string(argv[2]) == "-" ? cin : tracef, nops, elapsed);
+        cout << result << " (" << nops << " commands, "
+             << int(nops / elapsed) << " commands per msec.)" << endl;
+        return result == "Passed" ? 0 : 1;
+    }
+
+      // testChatTracker --trace FILE  replays the commands in the command
+      // file and writes the spans the last of them recorded to FILE as
+      // Chrome trace-event JSON (spans are only recorded in a build with
+      // CHATTRACKER_TRACE defined)
+
+    if (argc == 3  &&  string(argv[1]) == "--trace")
+    {
+        ifstream commandf(commandFileName);
+        ofstream tracef(argv[2]);
+        if ( ! commandf  ||  ! tracef)
+        {
+            cout << "Cannot open " << ( ! commandf ? commandFileName : argv[2]) << endl;
+            return 1;
+        }
+        extractCommands(commandf, commands);
+        ChatTracker ct;
+        for (const Command* cmd : commands)
+            cmd->execute(ct);
+        writeTraceEvents(tracef);
+        for (size_t k = 0; k < commands.size(); k++)
+            delete commands[k];
+        return 0;
+    }
+
       // Basic correctness test
 
     istringstream basicf(
@@ -98,6 +257,63 @@ int main()
     cout << "Basic correctness test: " << flush;
     cout << testCorrectness(commands) << endl;
 
+      // A budget this small evicts every user after every command, so each
+      // command has to reload its users from the spill file
+
+    cout << "Basic correctness test with eviction: " << flush;
+    cout << testCorrectness(commands, 1) << endl;
+
+    cout << "Basic change feed test: " << flush;
+    cout << testChangeFeed(commands) << endl;
+
+    cout << "Basic replica test: " << flush;
+    cout << testReplica(commands) << endl;
+
+    cout << "Basic replica test (separate process): " << flush;
+    cout << testReplicaProcess(commands) << endl;
+
+    cout << "Slow replica test: " << flush;
+    cout << testSlowReplica() << endl;
+
+    cout << "Basic shared memory test: " << flush;
+    cout << testSharedMemory(commands) << endl;
+
+    cout << "Basic parallel replay test: " << flush;
+    cout << testParallelReplay(commands) << endl;
+
+    cout << "Indexed oracle test: " << flush;
+    cout << testIndexedOracle(commands) << endl;
+
+    cout << "Basic bulk load test: " << flush;
+    cout << testBulkLoad(commands) << endl;
+
+    cout << "Basic report test: " << flush;
+    cout << testReports(commands) << endl;
+
+    cout << "Basic member listing test: " << flush;
+    cout << testMemberListing(commands) << endl;
+
+    cout << "Basic checkpoint test: " << flush;
+    cout << testCheckpoint(commands) << endl;
+
+    cout << "Basic checkpoint test with eviction: " << flush;
+    cout << testCheckpoint(commands, 1) << endl;
+
+    cout << "Basic latency statistics test: " << flush;
+    cout << testLatencyStats(commands) << endl;
+
+    cout << "Basic trace event test: " << flush;
+    cout << testTraceEvents(commands) << endl;
+
+    cout << "HashMap test: " << flush;
+    cout << testHashMap() << endl;
+
+    cout << "Server test: " << flush;
+    cout << testServer() << endl;
+
+    cout << "Async tracker test: " << flush;
+    cout << testAsyncTrackers() << endl;
+
     for (size_t k = 0; k < commands.size(); k++)
         delete commands[k];
     commands.clear();
@@ -117,9 +333,124 @@ int main()
     cout << "Thorough correctness test: " << flush;
     cout << testCorrectness(commands) << endl;
 
+    cout << "Thorough correctness test with huge pages: " << flush;
+    cout << testCorrectness(commands, 0, true) << endl;
+
+    cout << "Thorough change feed test: " << flush;
+    cout << testChangeFeed(commands) << endl;
+
+    cout << "Thorough replica test: " << flush;
+    cout << testReplica(commands) << endl;
+
+    cout << "Thorough replica test (separate process): " << flush;
+    cout << testReplicaProcess(commands) << endl;
+
+    cout << "Thorough shared memory test: " << flush;
+    cout << testSharedMemory(commands) << endl;
+
+    cout << "Thorough parallel replay test: " << flush;
+    cout << testParallelReplay(commands) << endl;
+
+    cout << "Thorough bulk load test: " << flush;
+    cout << testBulkLoad(commands) << endl;
+
+    cout << "Thorough report test: " << flush;
+    cout << testReports(commands) << endl;
+
+    cout << "Thorough member listing test: " << flush;
+    cout << testMemberListing(commands) << endl;
+
+    cout << "Thorough checkpoint test: " << flush;
+    cout << testCheckpoint(commands) << endl;
+
+    cout << "Thorough checkpoint isolation test: " << flush;
+    cout << testCheckpointIsolation(commands) << endl;
+
+    cout << "Thorough spill file test: " << flush;
+    cout << testSpillFile(commands) << endl;
+
+    cout << "Thorough dense tracker test: " << flush;
+    cout << testDenseTracker(commands) << endl;
+
+    cout << "Thorough latency statistics test: " << flush;
+    cout << testLatencyStats(commands) << endl;
+
+    cout << "Thorough trace event test: " << flush;
+    cout << testTraceEvents(commands) << endl;
+
+    cout << "Name store test: " << flush;
+    cout << testNameStore() << endl;
+
+    cout << "Thorough tenant pool test: " << flush;
+    cout << testTenants(commands) << endl;
+
+    cout << "Thorough concurrent contribution test: " << flush;
+    cout << testConcurrentContributions(commands) << endl;
+
+    cout << "Thorough cold tier test: " << flush;
+    cout << testColdTier(commands) << endl;
+
+    {
+        ifstream difff(commandFileName);
+        long long nops;
+        double elapsed;
+        cout << "Thorough differential test: " << flush;
+        string result = differentialRun(difff, nops, elapsed);
+        cout << result << " (" << int(nops / elapsed)
+             << " commands per msec.)" << endl;
+    }
+
     cout << "Performance test on " << commands.size() << " commands: " << flush;
     testPerformance(commands);
 
+    cout << "Hash policy comparison:" << endl;
+    testHashPolicies();
+
+    cout << "Submission from many threads (operations per msec):" << endl;
+    testAsyncSubmission();
+
+    cout << "Change feed overhead on contribute:" << endl;
+    testChangeFeedOverhead();
+
+    cout << "Parallel replay (msec.):" << endl;
+    timeParallelReplay(commands);
+
+    cout << "Bulk load (msec.):" << endl;
+    timeBulkLoad();
+
+    cout << "Reports (msec.):" << endl;
+    timeReports();
+
+    cout << "Member listing on a chat of 300000 members:" << endl;
+    timeMemberListing();
+
+    cout << "Checkpoint while contributing:" << endl;
+    timeCheckpoint();
+
+    cout << "Dense tracker on " << commands.size() << " commands (msec.):" << endl;
+    timeDenseTracker(commands);
+
+    cout << "Huge pages on 2000000 users:" << endl;
+    timeHugePages();
+
+    cout << "Latency statistics:" << endl;
+    timeLatencyStats(commands);
+
+    cout << "Backends on " << commands.size() << " commands:" << endl;
+    compareBackends(commands);
+
+    cout << "Name storage:" << endl;
+    timeNameStorage();
+
+    cout << "Trackers per tenant:" << endl;
+    timeTenants();
+
+    cout << "Contributions to one hot chat (operations per usec.):" << endl;
+    timeHotChat();
+
+    cout << "Cold tier on 1000000 users:" << endl;
+    timeColdTier();
+
     for (size_t k = 0; k < commands.size(); k++)
         delete commands[k];
 }
@@ -271,9 +602,34 @@ void extractCommands(istream& dataf, vector<Command*>& commands)
     }
 }
 
-string testCorrectness(const vector<Command*>& commands)
+  // A file in the temporary directory whose name is unique to this process,
+  // removed when the object goes away (so declare it before a tracker that
+  // uses it)
+
+struct TempFile
 {
-    ChatTracker ct;
+    TempFile(const string& name)
+    {
+        const char* dir = getenv("TMPDIR");
+        path = string(dir != nullptr ? dir : "/tmp") + "/chattracker." + to_string(getpid()) + "." + name;
+    }
+    ~TempFile()
+    {
+        remove(path.c_str());
+    }
+    string path;
+};
+
+string testCorrectness(const vector<Command*>& commands, size_t memoryBudget, bool hugePages)
+{
+    TempFile spill("spilltest.dat");
+    ChatTracker::Options options;
+    options.expectedUsers = 20000;
+    options.expectedChats = 20000;
+    options.hugePages = hugePages;
+    ChatTracker ct(options);
+    if (memoryBudget != 0)
+        ct.setMemoryBudget(memoryBudget, spill.path);
     SlowChatTracker sct;
     for (size_t k = 0; k < commands.size(); k++)
     {
@@ -290,150 +646,3553 @@ string testCorrectness(const vector<Command*>& commands)
     return "Passed";
 }
 
-//========================================================================
-// Timer t;                 // create a timer and start it
-// t.start();               // (re)start the timer
-// double d = t.elapsed();  // milliseconds since timer was last started
-//========================================================================
-
-#include <chrono>
+  // Every chat anyone joins in the commands
 
-class Timer
+vector<string> chatsJoined(const vector<Command*>& commands)
 {
-  public:
-    Timer()
+    vector<string> chats;
+    for (size_t k = 0; k < commands.size(); k++)
     {
-        start();
+        const JoinCmd* j = dynamic_cast<const JoinCmd*>(commands[k]);
+        if (j != nullptr)
+            chats.push_back(j->m_chat);
     }
-    void start()
+    return chats;
+}
+
+  // Runs the commands with the change feed enabled and replays the events
+  // into a second tracker as they arrive.  Each replayed operation must
+  // return the value its event carries, and in the end the second tracker
+  // must read like the first.  This is done for a tracker that keeps every
+  // user and for one whose budget forgets users (it has no spill file),
+  // whose events must include a leave for each chat a forgotten user was
+  // in.  Then users join and leave chats of their own many times over, and
+  // the feed must give the IDs of the names it forgot to new names rather
+  // than use ever more IDs.
+
+string testChangeFeed(const vector<Command*>& commands)
+{
+    vector<string> chats = chatsJoined(commands);
+    for (int budgeted = 0; budgeted <= 1; budgeted++)
     {
-        m_time = std::chrono::high_resolution_clock::now();
+        ChatTracker ct;
+        if (budgeted)
+            ct.setMemoryBudget(64 * 1024);
+        ChangeFeed& feed = ct.enableChangeFeed(7);
+        ChangeFeed::Subscription* sub = feed.subscribe(64);
+        ChatTracker replay;
+        ChangeEvent events[64];
+        size_t total = 0;
+        for (size_t k = 0; k <= commands.size(); k++)
+        {
+            if (k < commands.size())
+                commands[k]->execute(ct);
+            else
+                feed.flush();
+            size_t n = sub->poll(events, 64);
+            for (size_t e = 0; e < n; e++, total++)
+            {
+                const ChangeEvent& ev = events[e];
+                int value = 0;
+                switch (ev.type)
+                {
+                  case ChangeEvent::JOIN:
+                    replay.join(feed.name(ev.user), feed.name(ev.chat));
+                    break;
+                  case ChangeEvent::CONTRIBUTE:
+                    value = replay.contribute(feed.name(ev.user));
+                    break;
+                  case ChangeEvent::LEAVE:
+                    value = replay.leave(feed.name(ev.user), feed.name(ev.chat));
+                    break;
+                  case ChangeEvent::TERMINATE:
+                    value = replay.terminate(feed.name(ev.chat));
+                    break;
+                }
+                if (value != ev.value)
+                {
+                    ostringstream msg;
+                    msg << "*** FAILED *** event " << total << " replayed as "
+                        << value << ", expected " << ev.value
+                        << (budgeted ? " with a memory budget" : "");
+                    return msg.str();
+                }
+            }
+        }
+        if (sub->consumed() != feed.published())
+            return "*** FAILED *** events were published but never delivered";
+        for (const string& chat : chats)
+        {
+            if (replay.chatTotal(chat) != ct.chatTotal(chat)  ||  replay.members(chat) != ct.members(chat))
+                return string("*** FAILED *** the replayed tracker differs for chat \"") + chat + "\""
+                       + (budgeted ? " with a memory budget" : "");
+        }
     }
-    double elapsed() const
+
+    ChatTracker ct;
+    ChangeFeed& feed = ct.enableChangeFeed(7);
+    ChangeFeed::Subscription* sub = feed.subscribe(64);
+    ChangeEvent events[64];
+    uint32_t highest = 0;
+    int seen = 0;
+    for (int k = 0; k < 100000; k++)
     {
-        std::chrono::duration<double,std::milli> diff =
-                          std::chrono::high_resolution_clock::now() - m_time;
-        return diff.count();
+        ct.join(genName('u', k), genName('c', k));
+        ct.leave(genName('u', k));
+        size_t n = sub->poll(events, 64);
+        for (size_t e = 0; e < n; e++, seen++)
+        {
+              // Each user joins and leaves, so event 2j and 2j+1 are user j's
+            if (feed.name(events[e].user) != genName('u', seen / 2)  ||
+                    feed.name(events[e].chat) != genName('c', seen / 2))
+                return "*** FAILED *** an ID reused for a new name gives the wrong name";
+            highest = max(highest, max(events[e].user, events[e].chat));
+        }
     }
-  private:
-    std::chrono::high_resolution_clock::time_point m_time;
-};
+    if (highest > 1000)
+        return "*** FAILED *** the feed uses " + to_string(highest + 1) + " IDs for names that come and go";
+    return "Passed";
+}
 
-void testPerformance(const vector<Command*>& commands)
+string compareReads(const ChatTracker& expected, const ChatReplica& replica,
+                    const vector<string>& chats)
 {
-    double endConstruction;
-    double endCommands;
-
-    Timer timer;
+    for (size_t k = 0; k < chats.size(); k++)
     {
-        ChatTracker ct;
-
-        endConstruction = timer.elapsed();
-
-        for (size_t k = 0; k < commands.size(); k++)
-            commands[k]->execute(ct);
-
-        endCommands = timer.elapsed();
+        if (replica.chatTotal(chats[k]) != expected.chatTotal(chats[k])  ||
+            replica.members(chats[k]) != expected.members(chats[k]))
+            return "*** FAILED *** replica differs for chat \"" + chats[k] + "\"";
     }
+    return "Passed";
+}
 
-    double end = timer.elapsed();
+  // The replica follows a tracker in the same process; once the feed is
+  // flushed and the replica has caught up, its reads must match the tracker's
 
-    cout << end << " milliseconds." << endl
-         << "   Construction: " << endConstruction << " msec." << endl
-         << "       Commands: " << (endCommands - endConstruction) << " msec." << endl
-         << "    Destruction: " << (end - endCommands) << " msec." << endl;
+string testReplica(const vector<Command*>& commands)
+{
+    ChatTracker ct;
+    ChatReplica replica(ct);
+    for (size_t k = 0; k < commands.size(); k++)
+        commands[k]->execute(ct);
+    ct.changeFeed()->flush();
+    replica.waitForApplied(ct.changeFeed()->published());
+      // A replica that fell a ring behind starts again from a checkpoint
+    TempFile checkpoint("replicacheckpoint.txt");
+    while (replica.needsResync())
+    {
+        if ( ! replica.resync(ct, checkpoint.path))
+            return "*** FAILED *** cannot resync replica";
+        replica.waitForApplied(ct.changeFeed()->published());
+    }
+    if (replica.lag() != 0)
+        return "*** FAILED *** replica reports lag after catching up";
+    return compareReads(ct, replica, chatsJoined(commands));
 }
 
-void SlowChatTracker::join(string user, string chat)
+  // While a reader holds the replica's lock, the primary keeps writing far
+  // more than the replica's ring holds; it must finish without waiting for
+  // the replica, which must then need a resync, and after the resync read
+  // the same as the primary
+
+string testSlowReplica()
 {
-    vector<Info>::iterator p = m_info.end();
-    while (p > m_info.begin())
+    ChatTracker ct;
+    ChatReplica replica(ct, 1024);
+    atomic<bool> writing(true);
+    atomic<bool> reading(false);
+      // The reader gives up after 20 seconds, so a primary that waits fails
+      // the test rather than hanging it
+    thread reader([&] {
+        replica.read([&](const ChatTracker&) {
+            reading = true;
+            auto deadline = chrono::steady_clock::now() + chrono::seconds(20);
+            while (writing  &&  chrono::steady_clock::now() < deadline)
+                this_thread::sleep_for(chrono::milliseconds(1));
+        });
+    });
+    while ( ! reading)
+        this_thread::yield();
+    vector<string> chats;
+    for (int k = 0; k < 100; k++)
+        chats.push_back(genName('c', k));
+    auto start = chrono::steady_clock::now();
+    for (int k = 0; k < 100000; k++)
+        ct.join(genName('u', k), chats[k % 100]);
+    ct.changeFeed()->flush();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    writing = false;
+    reader.join();
+    if (seconds > 10)
+        return "*** FAILED *** the primary waited for the replica";
+    replica.waitForApplied(ct.changeFeed()->published());
+    if ( ! replica.needsResync())
+        return "*** FAILED *** a replica that fell behind does not need a resync";
+    TempFile checkpoint("slowreplica.txt");
+    if ( ! replica.resync(ct, checkpoint.path))
+        return "*** FAILED *** cannot resync replica";
+      // Changes made during the resync must reach the replica too
+    for (int k = 0; k < 1000; k++)
+        ct.leave(genName('u', k), chats[k % 100]);
+    ct.changeFeed()->flush();
+    replica.waitForApplied(ct.changeFeed()->published());
+    if (replica.needsResync()  ||  replica.lag() != 0)
+        return "*** FAILED *** replica did not catch up after a resync";
+    string result = compareReads(ct, replica, chats);
+    if (result != "Passed")
+        return result;
+    replica.read([&](const ChatTracker& t) {
+        if (t.chatTotal(chats[0]) != ct.chatTotal(chats[0]))
+            result = "*** FAILED *** read differs from the primary";
+    });
+    if (result != "Passed")
+        return result;
+
+      // A sender whose replica reads nothing until the primary is done must
+      // be dropped, and the replica told it needs a resync
+    int fds[2];
+    if (pipe(fds) != 0)
+        return "*** FAILED *** cannot create pipe";
+    cout << flush;
+    pid_t pid = fork();
+    if (pid < 0)
+        return "*** FAILED *** cannot fork";
+    if (pid == 0)
     {
-        p--;
-        if (p->user == user  &&  p->chat == chat)
+        close(fds[0]);
+        ChatTracker primary;
+        bool lost;
         {
-            Info info = *p;
-            m_info.erase(p);
-            m_info.push_back(info);
-            return;
+            FeedSender sender(primary, fds[1], 1024);
+            for (int k = 0; k < 100000; k++)
+                primary.join(genName('u', k), chats[k % 100]);
+            lost = sender.lost();
         }
+        close(fds[1]);
+        _exit(lost ? 0 : 1);
     }
-    m_info.push_back(Info(user, chat));
+    close(fds[1]);
+    this_thread::sleep_for(chrono::milliseconds(500));
+    {
+        ChatReplica remote(fds[0]);
+        remote.waitForApplied(UINT64_MAX);
+        if ( ! remote.needsResync())
+            result = "*** FAILED *** a dropped sender does not tell the replica";
+    }
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if (result == "Passed"  &&  ( ! WIFEXITED(status)  ||  WEXITSTATUS(status) != 0))
+        result = "*** FAILED *** the feed did not drop a sender that fell behind";
+    return result;
 }
 
-int SlowChatTracker::terminate(string chat)
+  // A child process runs the commands and sends its feed through a pipe;
+  // the replica in this process must end up matching a tracker that ran the
+  // same commands here
+
+string testReplicaProcess(const vector<Command*>& commands)
 {
-    int total = 0;
-    vector<Info>::iterator p = m_info.begin();
-    while (p != m_info.end())
+    int fds[2];
+    if (pipe(fds) != 0)
+        return "*** FAILED *** cannot create pipe";
+    cout << flush;
+    pid_t pid = fork();
+    if (pid < 0)
+        return "*** FAILED *** cannot fork";
+    if (pid == 0)
     {
-        if (p->chat == chat)
-    {
-            total += p->count;
-            p = m_info.erase(p);
-    }
-    else
-        p++;
+        close(fds[0]);
+        ChatTracker ct;
+        {
+              // A ring that holds every change, so the sender is never dropped
+            FeedSender sender(ct, fds[1], commands.size());
+            for (size_t k = 0; k < commands.size(); k++)
+                commands[k]->execute(ct);
+        }
+        close(fds[1]);
+        _exit(0);
     }
-    p = m_usersWhoLeft.begin();
-    while (p != m_usersWhoLeft.end())
-    {
-        if (p->chat == chat)
+    close(fds[1]);
+
+    ChatTracker expected;
+    for (size_t k = 0; k < commands.size(); k++)
+        commands[k]->execute(expected);
+    string result;
     {
-            total += p->count;
-            p = m_usersWhoLeft.erase(p);
+        ChatReplica replica(fds[0]);
+        replica.waitForApplied(UINT64_MAX);
+        if (replica.lag() != 0)
+            result = "*** FAILED *** replica did not receive every change";
+        else
+            result = compareReads(expected, replica, chatsJoined(commands));
     }
-    else
-        p++;
+    close(fds[0]);
+    waitpid(pid, nullptr, 0);
+    return result;
+}
+
+  // Runs a command on any tracker with ChatTracker's operations and returns
+  // its result (0 for join)
+
+template <typename Tracker>
+int runCommand(Tracker& t, const Command* cmd)
+{
+    if (const JoinCmd* c = dynamic_cast<const JoinCmd*>(cmd))
+    {
+        t.join(c->m_user, c->m_chat);
+        return 0;
     }
-    return total;
+    if (const TerminateCmd* c = dynamic_cast<const TerminateCmd*>(cmd))
+        return t.terminate(c->m_chat);
+    if (const ContributeCmd* c = dynamic_cast<const ContributeCmd*>(cmd))
+        return t.contribute(c->m_user);
+    if (const Leave2Cmd* c = dynamic_cast<const Leave2Cmd*>(cmd))
+        return t.leave(c->m_user, c->m_chat);
+    const Leave1Cmd* c = static_cast<const Leave1Cmd*>(cmd);
+    return t.leave(c->m_user);
 }
 
-int SlowChatTracker::contribute(string user)
+  // The reader process: while the writer runs the commands, it reads chats
+  // over and over (a torn read would show up as a member listed twice);
+  // once the writer is done, every chat and user must read as in expected.
+  // Returns the process's exit status.
+
+int readSharedSegment(const string& name, int doneFd, ChatTracker& expected,
+                      const vector<Command*>& commands)
 {
-    vector<Info>::iterator p = m_info.end();
-    while (p > m_info.begin())
+    SharedChatReader reader(name);
+    if ( ! reader.ok())
+        return 1;
+    vector<string> chats = chatsJoined(commands);
+    for (size_t k = 0; ; k++)
     {
-        p--;
-        if (p->user == user)
+        if (k % 256 == 0)
         {
-            p->count++;
-            return p->count;
+            pollfd pfd = { doneFd, POLLIN, 0 };
+            if (poll(&pfd, 1, 0) > 0)
+                break;
         }
+        vector<string> members = reader.members(chats[k % chats.size()]);
+        if (set<string>(members.begin(), members.end()).size() != members.size()  ||
+            reader.chatTotal(chats[k % chats.size()]) < 0)
+            return 1;
+    }
+    for (size_t k = 0; k < commands.size(); k++)
+    {
+        const JoinCmd* j = dynamic_cast<const JoinCmd*>(commands[k]);
+        if (j == nullptr)
+            continue;
+        if (reader.chatTotal(j->m_chat) != expected.chatTotal(j->m_chat)  ||
+            reader.members(j->m_chat) != expected.members(j->m_chat)  ||
+            reader.currentChat(j->m_user) != expected.currentChat(j->m_user))
+            return 1;
     }
     return 0;
 }
 
-int SlowChatTracker::leave(string user, string chat)
+  // The commands are run on a SharedChatTracker, whose results must match a
+  // ChatTracker's, while a second process reads the shared segment
+
+string testSharedMemory(const vector<Command*>& commands)
 {
-    vector<Info>::iterator p = m_info.end();
-    while (p > m_info.begin())
+    SharedChatTracker::Capacity capacity;
+    for (size_t k = 0; k < commands.size(); k++)
     {
-        p--;
-        if (p->user == user  &&  p->chat == chat)
+        const JoinCmd* j = dynamic_cast<const JoinCmd*>(commands[k]);
+        if (j != nullptr)
         {
-            int count = p->count;
-            m_usersWhoLeft.push_back(*p);
-            m_info.erase(p);
-            return count;
+            capacity.users++;
+            capacity.chats++;
+            capacity.memberships++;
+            capacity.nameBytes += j->m_user.size() + j->m_chat.size();
         }
     }
-    return -1;
-}
+    ChatTracker expected;
+    for (size_t k = 0; k < commands.size(); k++)
+        commands[k]->execute(expected);
 
-int SlowChatTracker::leave(string user)
-{
-    vector<Info>::iterator p = m_info.end();
-    while (p > m_info.begin())
+    ostringstream name;
+    name << "/chattracker." << getpid();
+    SharedChatTracker sct(name.str(), capacity);
+    if ( ! sct.ok())
+        return "*** FAILED *** cannot create shared memory segment";
+
+    int fds[2];
+    if (pipe(fds) != 0)
+        return "*** FAILED *** cannot create pipe";
+    cout << flush;
+    pid_t pid = fork();
+    if (pid < 0)
+        return "*** FAILED *** cannot fork";
+    if (pid == 0)
     {
-        p--;
-        if (p->user == user)
+        close(fds[1]);
+        _exit(readSharedSegment(name.str(), fds[0], expected, commands));
+    }
+    close(fds[0]);
+
+    string result = "Passed";
+    ChatTracker ct;
+    for (size_t k = 0; k < commands.size(); k++)
+    {
+        if (runCommand(sct, commands[k]) != runCommand(ct, commands[k]))
         {
-            int count = p->count;
-            m_usersWhoLeft.push_back(*p);
-            m_info.erase(p);
-            return count;
+            ostringstream msg;
+            msg << "*** FAILED *** line " << commands[k]->m_lineno
+                << ": \"" << commands[k]->m_line << "\"";
+            result = msg.str();
+            break;
         }
     }
-    return -1;
+    if ( ! sct.ok())
+        result = "*** FAILED *** shared memory segment filled up";
+    close(fds[1]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (result == "Passed"  &&  ( ! WIFEXITED(status)  ||  WEXITSTATUS(status) != 0))
+        result = "*** FAILED *** reader process saw the wrong state";
+    return result;
+}
+
+TraceOp toTraceOp(const Command* cmd)
+{
+    if (const JoinCmd* c = dynamic_cast<const JoinCmd*>(cmd))
+        return TraceOp{ TraceOp::JOIN, c->m_user, c->m_chat };
+    if (const TerminateCmd* c = dynamic_cast<const TerminateCmd*>(cmd))
+        return TraceOp{ TraceOp::TERMINATE, "", c->m_chat };
+    if (const ContributeCmd* c = dynamic_cast<const ContributeCmd*>(cmd))
+        return TraceOp{ TraceOp::CONTRIBUTE, c->m_user, "" };
+    if (const Leave2Cmd* c = dynamic_cast<const Leave2Cmd*>(cmd))
+        return TraceOp{ TraceOp::LEAVE2, c->m_user, c->m_chat };
+    const Leave1Cmd* c = static_cast<const Leave1Cmd*>(cmd);
+    return TraceOp{ TraceOp::LEAVE1, c->m_user, "" };
+}
+
+vector<TraceOp> toTrace(const vector<Command*>& commands)
+{
+    vector<TraceOp> ops;
+    for (size_t k = 0; k < commands.size(); k++)
+        ops.push_back(toTraceOp(commands[k]));
+    return ops;
+}
+
+  // The parallel replay must give every operation the result the
+  // sequential replay gives it, and end in the same state, both on the
+  // commands and on random traces over a handful of users and chats, where
+  // nearly every operation depends on the one before.  The replay is given
+  // its trace as a temporary, which must not outlive the constructor.
+
+string testParallelReplay(const vector<Command*>& commands)
+{
+    {
+        ParallelReplay replay(toTrace(commands));
+        vector<int> results;
+        replay.run(4, results);
+        string difference = replay.verify(results);
+        if ( ! difference.empty())
+            return "*** FAILED *** " + difference;
+    }
+    mt19937 gen(36);
+    for (int t = 0; t < 20; t++)
+    {
+        vector<TraceOp> ops;
+        for (int k = 0; k < 2000; k++)
+        {
+            string user(1, char('a' + gen() % 8));
+            string chat(1, char('A' + gen() % 5));
+            int r = int(gen() % 10);
+            TraceOp::Type type = (r < 3 ? TraceOp::JOIN : r < 6 ? TraceOp::CONTRIBUTE :
+                                  r < 7 ? TraceOp::LEAVE2 : r < 9 ? TraceOp::LEAVE1 : TraceOp::TERMINATE);
+            ops.push_back(TraceOp{ type, user, chat });
+        }
+        ParallelReplay replay(ops);
+        vector<int> results;
+        replay.run(4, results);
+        string difference = replay.verify(results);
+        if ( ! difference.empty())
+            return "*** FAILED *** random trace " + to_string(t) + ": " + difference;
+    }
+    return "Passed";
+}
+
+  // The indexed oracle must agree with SlowChatTracker on the commands and
+  // on random traces over a handful of users and chats, where the same
+  // users and chats keep meeting
+
+string testIndexedOracle(const vector<Command*>& commands)
+{
+    vector<vector<TraceOp>> traces;
+    traces.push_back(toTrace(commands));
+    mt19937 gen(37);
+    for (int t = 0; t < 50; t++)
+    {
+        vector<TraceOp> ops;
+        for (int k = 0; k < 2000; k++)
+        {
+            string user(1, char('a' + gen() % 8));
+            string chat(1, char('A' + gen() % 5));
+            int r = int(gen() % 10);
+            TraceOp::Type type = (r < 3 ? TraceOp::JOIN : r < 6 ? TraceOp::CONTRIBUTE :
+                                  r < 7 ? TraceOp::LEAVE2 : r < 9 ? TraceOp::LEAVE1 : TraceOp::TERMINATE);
+            ops.push_back(TraceOp{ type, user, chat });
+        }
+        traces.push_back(ops);
+    }
+    for (size_t t = 0; t < traces.size(); t++)
+    {
+        SlowChatTracker slow;
+        IndexedChatTracker indexed;
+        for (size_t k = 0; k < traces[t].size(); k++)
+        {
+            if (applyOp(slow, traces[t][k]) != applyOp(indexed, traces[t][k]))
+            {
+                ostringstream msg;
+                msg << "*** FAILED *** trace " << t << ", operation " << k;
+                return msg.str();
+            }
+        }
+    }
+    return "Passed";
+}
+
+//========================================================================
+// Timer t;                 // create a timer and start it
+// t.start();               // (re)start the timer
+// double d = t.elapsed();  // milliseconds since timer was last started
+//========================================================================
+
+#include <chrono>
+
+class Timer
+{
+  public:
+    Timer()
+    {
+        start();
+    }
+    void start()
+    {
+        m_time = std::chrono::high_resolution_clock::now();
+    }
+    double elapsed() const
+    {
+        std::chrono::duration<double,std::milli> diff =
+                          std::chrono::high_resolution_clock::now() - m_time;
+        return diff.count();
+    }
+  private:
+    std::chrono::high_resolution_clock::time_point m_time;
+};
+
+  // Every chat and user named in the first n operations must read the same
+  // in a tracker loaded from a dump as in one that ran those operations.
+  // Returns "" if they do, or else a description of the first difference.
+
+string compareLoaded(ChatTracker& loaded, ChatTracker& replayed, const vector<TraceOp>& ops, size_t n)
+{
+    for (size_t k = 0; k < n; k++)
+    {
+        const TraceOp& op = ops[k];
+        if (op.type == TraceOp::TERMINATE  ||  op.type == TraceOp::JOIN)
+        {
+            if (loaded.chatTotal(op.chat) != replayed.chatTotal(op.chat)  ||
+                    loaded.members(op.chat) != replayed.members(op.chat))
+                return "chat \"" + op.chat + "\" loads differently";
+        }
+        if (op.type != TraceOp::TERMINATE  &&
+                loaded.currentChat(op.user) != replayed.currentChat(op.user))
+            return "user \"" + op.user + "\" loads differently";
+    }
+    return "";
+}
+
+  // The first half of the commands is run on the indexed oracle, whose
+  // state is dumped, written out as text and read back.  A tracker loaded
+  // from the dump must read like one that ran the first half, and then give
+  // the oracle's results for the second half.
+
+string testBulkLoad(const vector<Command*>& commands)
+{
+    vector<TraceOp> ops = toTrace(commands);
+    size_t half = ops.size() / 2;
+    IndexedChatTracker oracle;
+    ChatTracker replayed;
+    for (size_t k = 0; k < half; k++)
+    {
+        applyOp(oracle, ops[k]);
+        applyOp(replayed, ops[k]);
+    }
+    ChatTracker::Dump dump;
+    oracle.dump(dump);
+    stringstream text;
+    ChatTracker::writeDump(text, dump);
+    ChatTracker::Dump reread;
+    if ( ! ChatTracker::readDump(text, reread)  ||
+            reread.memberships.size() != dump.memberships.size()  ||
+            reread.totals.size() != dump.totals.size())
+        return "*** FAILED *** the dump does not read back";
+
+    const int levels[] = { 1, 4 };
+    for (int threads : levels)
+    {
+        ChatTracker loaded(reread, threads);
+        string difference = compareLoaded(loaded, replayed, ops, half);
+        if ( ! difference.empty())
+            return "*** FAILED *** " + difference;
+        IndexedChatTracker continued = oracle;
+        for (size_t k = half; k < ops.size(); k++)
+        {
+            if (applyOp(loaded, ops[k]) != applyOp(continued, ops[k]))
+            {
+                ostringstream msg;
+                msg << "*** FAILED *** " << threads << " threads, operation " << k;
+                return msg.str();
+            }
+        }
+    }
+    return "Passed";
+}
+
+  // The report computed straight from a dump, one row at a time
+
+ChatReport reportFromDump(const ChatTracker::Dump& dump, size_t largest)
+{
+    map<string, size_t> userChats;
+    map<string, size_t> chatMembers;
+    map<string, long long> chatTotals;
+    for (const ChatTracker::Dump::Membership& m : dump.memberships)
+    {
+        userChats[m.user]++;
+        chatMembers[m.chat]++;
+        chatTotals[m.chat] += m.count;
+    }
+    for (const ChatTracker::Dump::Total& t : dump.totals)
+        chatTotals[t.chat] = t.total;
+
+    ChatReport report;
+    report.users = userChats.size();
+    for (auto& u : userChats)
+    {
+        if (u.second >= report.chatsPerUser.size())
+            report.chatsPerUser.resize(u.second + 1, 0);
+        report.chatsPerUser[u.second]++;
+    }
+    vector<pair<long long, string>> bySize;
+    for (auto& c : chatTotals)
+    {
+        size_t members = chatMembers.count(c.first) ? chatMembers[c.first] : 0;
+        if (members == 0  &&  c.second == 0)
+            continue;  // a chat no one is in and no one contributed to is gone
+        report.chats++;
+        report.totalContributions += c.second;
+        size_t k = 0;
+        while ((1LL << k) <= c.second)
+            k++;
+        if (k >= report.contributionsPerChat.size())
+            report.contributionsPerChat.resize(k + 1, 0);
+        report.contributionsPerChat[k]++;
+        bySize.push_back(make_pair(-(long long)members, c.first));
+    }
+    sort(bySize.begin(), bySize.end());
+    for (size_t k = 0; k < bySize.size()  &&  k < largest; k++)
+        report.largestChats.push_back(make_pair(bySize[k].second, size_t(-bySize[k].first)));
+    return report;
+}
+
+  // After each eighth of the commands, the reports built on 1 and 4 threads
+  // must match the report computed from the indexed oracle's dump, both for
+  // a tracker that keeps every user and for one whose budget evicts them
+  // all to a spill file
+
+string testReports(const vector<Command*>& commands)
+{
+    TempFile spill("reportspill.dat");
+    vector<TraceOp> ops = toTrace(commands);
+    IndexedChatTracker oracle;
+    ChatTracker ct;
+    ChatTracker evicting;
+    evicting.setMemoryBudget(1, spill.path);
+    for (int step = 1; step <= 8; step++)
+    {
+        for (size_t k = ops.size() * (step - 1) / 8; k < ops.size() * step / 8; k++)
+        {
+            applyOp(oracle, ops[k]);
+            applyOp(ct, ops[k]);
+            applyOp(evicting, ops[k]);
+        }
+        ChatTracker::Dump dump;
+        oracle.dump(dump);
+        ChatReport expected = reportFromDump(dump, 20);
+        const int levels[] = { 1, 4 };
+        for (int threads : levels)
+        {
+            for (const ChatTracker* tracker : { &ct, &evicting })
+            {
+                ChatReport report = buildReport(*tracker, threads, 20);
+                if (report.users != expected.users  ||  report.chats != expected.chats  ||
+                        report.totalContributions != expected.totalContributions  ||
+                        report.contributionsPerChat != expected.contributionsPerChat  ||
+                        report.chatsPerUser != expected.chatsPerUser  ||
+                        report.largestChats != expected.largestChats)
+                {
+                    ostringstream msg;
+                    msg << "*** FAILED *** after " << ops.size() * step / 8
+                        << " operations on " << threads << " threads"
+                        << (tracker == &evicting ? " with every user evicted" : "");
+                    return msg.str();
+                }
+            }
+        }
+    }
+    return "Passed";
+}
+
+  // After each eighth of the commands, every chat's members must be listed
+  // in the order the indexed oracle's dump gives them, whether read all at
+  // once, one at a time or a page at a time, and counted the same
+
+string testMemberListing(const vector<Command*>& commands)
+{
+    vector<TraceOp> ops = toTrace(commands);
+    IndexedChatTracker oracle;
+    ChatTracker ct;
+    vector<string> page;
+    for (int step = 1; step <= 8; step++)
+    {
+        for (size_t k = ops.size() * (step - 1) / 8; k < ops.size() * step / 8; k++)
+        {
+            applyOp(oracle, ops[k]);
+            applyOp(ct, ops[k]);
+        }
+        ChatTracker::Dump dump;
+        oracle.dump(dump);
+        map<string, vector<string>> expected;
+        for (const ChatTracker::Dump::Membership& m : dump.memberships)
+            expected[m.chat].push_back(m.user);
+        for (size_t k = 0; k < ops.size(); k++)
+        {
+            const string& chat = ops[k].chat;
+            if (ops[k].type != TraceOp::JOIN  ||  expected.count(chat) == 0)
+                continue;
+            const vector<string>& members = expected[chat];
+            vector<string> each;
+            ct.forEachMember(chat, [&](const string& name) { each.push_back(name); });
+            vector<string> paged;
+            size_t cursor = 0;
+            do
+            {
+                cursor = ct.members(chat, cursor, 7, page);
+                paged.insert(paged.end(), page.begin(), page.end());
+            } while (cursor != 0);
+            if (ct.memberCount(chat) != members.size()  ||  ct.members(chat) != members  ||
+                    each != members  ||  paged != members)
+                return "*** FAILED *** chat \"" + chat + "\" lists its members wrongly";
+            expected.erase(chat);
+        }
+        if (ct.memberCount("no such chat") != 0  ||  ct.members("no such chat", 0, 10, page) != 0  ||
+                ! page.empty())
+            return "*** FAILED *** a chat that does not exist has members";
+    }
+    return "Passed";
+}
+
+  // A checkpoint is taken after the first half of the commands, which then
+  // go on running on the tracker while it is written.  A tracker loaded
+  // from the checkpoint must read like one that ran only the first half, and
+  // then give the indexed oracle's results for the second half.  With a
+  // memory budget, the checkpoint has to reload evicted users.
+
+string testCheckpoint(const vector<Command*>& commands, size_t memoryBudget)
+{
+    TempFile checkpoint("checkpointtest.txt");
+    TempFile spill("checkpointspill.dat");
+    const string& path = checkpoint.path;
+    vector<TraceOp> ops = toTrace(commands);
+    size_t half = ops.size() / 2;
+    IndexedChatTracker oracle;
+    ChatTracker replayed;
+    ChatTracker ct;
+    if (memoryBudget != 0)
+        ct.setMemoryBudget(memoryBudget, spill.path);
+    for (size_t k = 0; k < half; k++)
+    {
+        applyOp(oracle, ops[k]);
+        applyOp(replayed, ops[k]);
+        applyOp(ct, ops[k]);
+    }
+    if ( ! ct.checkpointAsync(path))
+        return "*** FAILED *** cannot start a checkpoint";
+    for (size_t k = half; k < ops.size(); k++)
+        applyOp(ct, ops[k]);
+    if ( ! ct.waitForCheckpoint()  ||  ct.checkpointRunning())
+        return "*** FAILED *** the checkpoint was not written";
+
+    ifstream checkpointf(path);
+    ChatTracker::Dump dump;
+    if ( ! ChatTracker::readDump(checkpointf, dump))
+        return "*** FAILED *** the checkpoint does not read back";
+    ChatTracker loaded(dump, 1);
+    string difference = compareLoaded(loaded, replayed, ops, half);
+    if ( ! difference.empty())
+        return "*** FAILED *** " + difference;
+    for (size_t k = half; k < ops.size(); k++)
+    {
+        if (applyOp(loaded, ops[k]) != applyOp(oracle, ops[k]))
+        {
+            ostringstream msg;
+            msg << "*** FAILED *** operation " << k;
+            return msg.str();
+        }
+    }
+    return "Passed";
+}
+
+  // The process's resident memory in bytes, as the kernel counts it
+
+size_t residentBytes()
+{
+    ifstream statm("/proc/self/statm");
+    size_t pages = 0;
+    size_t resident = 0;
+    statm >> pages >> resident;
+    return resident * size_t(sysconf(_SC_PAGESIZE));
+}
+
+  // The pages the process's finished children have faulted in, such as the
+  // copies they made of pages they shared with the parent and wrote to
+
+long childPageFaults()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_CHILDREN, &usage);
+    return usage.ru_minflt;
+}
+
+  // What the tracker reports about itself: its memory and every user and
+  // chat a scan visits
+
+string trackerState(const ChatTracker& ct)
+{
+    vector<string> lines;
+    vector<ChatTracker::UserInfo> users;
+    ct.scanUsers(0, 1, users);
+    for (const ChatTracker::UserInfo& info : users)
+        lines.push_back("u " + info.name + " " + to_string(info.chats) + " " + to_string(info.contributions));
+    vector<ChatTracker::ChatInfo> chats;
+    ct.scanChats(0, 1, chats);
+    for (const ChatTracker::ChatInfo& info : chats)
+        lines.push_back("c " + *info.name + " " + to_string(info.total) + " " + to_string(info.members));
+    sort(lines.begin(), lines.end());
+    string state = to_string(ct.memoryUsage());
+    for (const string& line : lines)
+        state += "\n" + line;
+    return state;
+}
+
+  // The first half of the commands runs on a tracker whose idle users go
+  // cold, and then a memory budget evicts some of the rest to a spill file.
+  // A checkpoint of it must leave the tracker's resident memory and state as
+  // they were, and its child must read cold and evicted users where they
+  // are, without decompressing or reloading them into pages it shares with
+  // the tracker (so it copies few of them).  The checkpoint must read like a
+  // tracker that ran the first half, and the tracker must then give the
+  // indexed oracle's results for the second half.
+
+string testCheckpointIsolation(const vector<Command*>& commands)
+{
+    TempFile checkpoint("isolationtest.txt");
+    TempFile spill("isolationspill.dat");
+    vector<TraceOp> ops = toTrace(commands);
+    size_t half = ops.size() / 2;
+    IndexedChatTracker oracle;
+    ChatTracker replayed;
+    ChatTracker::Options options;
+    options.coldAfterMsec = 1;
+    ChatTracker ct(options);
+    for (size_t k = 0; k < half; k++)
+    {
+        if (k % 500 == 0)
+            usleep(2000);
+        applyOp(oracle, ops[k]);
+        applyOp(replayed, ops[k]);
+        applyOp(ct, ops[k]);
+    }
+    ct.setMemoryBudget(ct.memoryUsage() * 9 / 10, spill.path);
+
+    string before = trackerState(ct);
+    size_t residentBefore = residentBytes();
+    long childFaultsBefore = childPageFaults();
+    if ( ! ct.checkpointAsync(checkpoint.path)  ||  ! ct.waitForCheckpoint())
+        return "*** FAILED *** the checkpoint was not written";
+    size_t residentAfter = residentBytes();
+    long childFaults = childPageFaults() - childFaultsBefore;
+    if (trackerState(ct) != before)
+        return "*** FAILED *** the checkpoint changed the tracker";
+    if (residentAfter > residentBefore + 256 * 1024)
+        return "*** FAILED *** the checkpoint grew the resident memory by "
+               + to_string((residentAfter - residentBefore) / 1024) + " KB";
+    if (childFaults > long(residentBefore / size_t(sysconf(_SC_PAGESIZE)) / 8))
+        return "*** FAILED *** the checkpoint's child wrote to " + to_string(childFaults)
+               + " pages it shared with the tracker";
+
+    ifstream checkpointf(checkpoint.path);
+    ChatTracker::Dump dump;
+    if ( ! ChatTracker::readDump(checkpointf, dump))
+        return "*** FAILED *** the checkpoint does not read back";
+    ChatTracker loaded(dump, 1);
+    string difference = compareLoaded(loaded, replayed, ops, half);
+    if ( ! difference.empty())
+        return "*** FAILED *** " + difference;
+    for (size_t k = half; k < ops.size(); k++)
+    {
+        if (applyOp(ct, ops[k]) != applyOp(oracle, ops[k]))
+        {
+            ostringstream msg;
+            msg << "*** FAILED *** operation " << k << " after the checkpoint";
+            return msg.str();
+        }
+    }
+    return "Passed";
+}
+
+  // Every user is evicted after every command, so the commands keep
+  // reloading users and leaving their old records behind in the spill file.
+  // The results must be the indexed oracle's, and in the end the file must
+  // hold at most twice the bytes of the users' records (a record is 4 bytes,
+  // and 8 bytes and the name of each of the user's chats) plus the dead
+  // bytes the tracker lets pile up before it rewrites the file.
+
+string testSpillFile(const vector<Command*>& commands)
+{
+    TempFile spill("spillfile.dat");
+    vector<TraceOp> ops = toTrace(commands);
+    IndexedChatTracker oracle;
+    ChatTracker ct;
+    ct.setMemoryBudget(1, spill.path);
+    for (size_t k = 0; k < ops.size(); k++)
+    {
+        if (applyOp(ct, ops[k]) != applyOp(oracle, ops[k]))
+        {
+            ostringstream msg;
+            msg << "*** FAILED *** line " << commands[k]->m_lineno
+                << ": \"" << commands[k]->m_line << "\"";
+            return msg.str();
+        }
+    }
+    ChatTracker::Dump dump;
+    oracle.dump(dump);
+    set<string> users;
+    long long live = 0;
+    for (const ChatTracker::Dump::Membership& m : dump.memberships)
+    {
+        users.insert(m.user);
+        live += 8 + m.chat.size();
+    }
+    live += 4 * users.size();
+    ifstream spillf(spill.path, ios::binary | ios::ate);
+    long long bytes = spillf.tellg();
+    if (bytes > 2 * live + 64 * 1024)
+        return "*** FAILED *** the spill file holds " + to_string(bytes) + " bytes for " +
+               to_string(live) + " bytes of records";
+    return "Passed";
+}
+
+  // The dense tracker, sized for the test generator's 10000 users and 1000
+  // chats, must give SlowChatTracker's result for every command, and end
+  // with the same chats and current chats as ChatTracker.  A name whose
+  // number is out of range, even one so long it would wrap around into
+  // range, must name no user.
+
+typedef DenseChatTracker<10000, 1000> GeneratorTracker;
+
+string testDenseTracker(const vector<Command*>& commands)
+{
+    const char* outOfRange[] = { "u10000", "u000000000000000000000010000", "u18446744073709551658",
+                                 "u99999999999999999999999999999999" };
+    for (const char* name : outOfRange)
+    {
+        if (GeneratorTracker::idOf(name) != GeneratorTracker::k_none)
+            return "*** FAILED *** \"" + string(name) + "\" is numbered " + to_string(GeneratorTracker::idOf(name));
+    }
+    if (GeneratorTracker::idOf("u0000000000000000000000009999") != 9999)
+        return "*** FAILED *** leading zeros change a number";
+    vector<TraceOp> ops = toTrace(commands);
+    unique_ptr<GeneratorTracker> dense(new GeneratorTracker);
+    SlowChatTracker sct;
+    ChatTracker ct;
+    for (size_t k = 0; k < ops.size(); k++)
+    {
+        applyOp(ct, ops[k]);
+        if (applyOp(*dense, ops[k]) != applyOp(sct, ops[k]))
+        {
+            ostringstream msg;
+            msg << "*** FAILED *** line " << commands[k]->m_lineno
+                << ": \"" << commands[k]->m_line << "\"";
+            return msg.str();
+        }
+    }
+    for (const TraceOp& op : ops)
+    {
+        if (op.type == TraceOp::JOIN)
+        {
+            vector<size_t> members;
+            for (const string& name : ct.members(op.chat))
+                members.push_back(GeneratorTracker::idOf(name));
+            size_t chat = GeneratorTracker::idOf(op.chat);
+            if (dense->chatTotal(chat) != ct.chatTotal(op.chat)  ||
+                    dense->members(chat) != members  ||  dense->memberCount(chat) != members.size())
+                return "*** FAILED *** chat \"" + op.chat + "\" ends up different";
+        }
+        if (op.type != TraceOp::TERMINATE)
+        {
+            string current = ct.currentChat(op.user);
+            size_t expected = current.empty() ? GeneratorTracker::k_none : GeneratorTracker::idOf(current);
+            if (dense->currentChat(GeneratorTracker::idOf(op.user)) != expected)
+                return "*** FAILED *** user \"" + op.user + "\" ends up in a different chat";
+        }
+    }
+    return "Passed";
+}
+
+  // The operation a trace operation is timed as
+
+LatencyStats::Op latencyOp(const TraceOp& op)
+{
+    switch (op.type)
+    {
+      case TraceOp::JOIN:        return LatencyStats::JOIN;
+      case TraceOp::TERMINATE:   return LatencyStats::TERMINATE;
+      case TraceOp::CONTRIBUTE:  return LatencyStats::CONTRIBUTE;
+      case TraceOp::LEAVE2:      return LatencyStats::LEAVE;
+      case TraceOp::LEAVE1:      return LatencyStats::LEAVE_CURRENT;
+    }
+    return LatencyStats::k_ops;
+}
+
+  // Sampling every operation, the histograms must count each operation
+  // once, whichever thread ran it: the first half of the commands runs on
+  // this thread and the second half on another, while a third thread reads
+  // the histograms (which must never shrink).  A reset returns the same
+  // counts and empties the histograms, and with sampling off they stay
+  // empty.  Every latency must fall in its bucket's range.
+
+string testLatencyStats(const vector<Command*>& commands)
+{
+#ifdef CHATTRACKER_NO_LATENCY
+    (void) commands;
+    return "Passed (timing compiled out)";
+#else
+    for (uint64_t v = 0; v < (uint64_t(1) << 40); v = v < 64 ? v + 1 : v + v / 7)
+    {
+        size_t b = LatencyHistogram::bucketOf(v);
+        if (b >= LatencyHistogram::k_buckets  ||  LatencyHistogram::bucketLow(b) > v  ||
+                (LatencyHistogram::bucketHigh(b) < v  &&  b != LatencyHistogram::k_buckets - 1))
+        {
+            ostringstream msg;
+            msg << "*** FAILED *** " << v << " ns is put in the wrong bucket";
+            return msg.str();
+        }
+    }
+    for (size_t b = 0; b + 1 < LatencyHistogram::k_buckets; b++)
+    {
+        if (LatencyHistogram::bucketHigh(b) + 1 != LatencyHistogram::bucketLow(b + 1))
+            return "*** FAILED *** the buckets leave gaps or overlap";
+    }
+
+    vector<TraceOp> ops = toTrace(commands);
+    size_t half = ops.size() / 2;
+    uint64_t expected[LatencyStats::k_ops] = { 0 };
+    for (const TraceOp& op : ops)
+        expected[latencyOp(op)]++;
+
+    ChatTracker ct;
+    ct.setLatencySampling(1);
+      // This thread picks up the new setting at its next sample, so get
+      // there with operations that change nothing, and forget them
+    for (int k = 0; k < 1024; k++)
+        ct.leave("");
+    ct.resetLatencyStats();
+    for (size_t k = 0; k < half; k++)
+        applyOp(ct, ops[k]);
+    atomic<bool> done(false);
+    bool shrank = false;
+    thread reader([&]()
+    {
+        uint64_t last = 0;
+        while ( ! done)
+        {
+            LatencyStats stats = ct.latencyStats();
+            uint64_t samples = 0;
+            for (const LatencyHistogram& h : stats.ops)
+                samples += h.samples();
+            if (samples < last)
+                shrank = true;
+            last = samples;
+        }
+    });
+    thread second([&]()
+    {
+        for (size_t k = half; k < ops.size(); k++)
+            applyOp(ct, ops[k]);
+    });
+    second.join();
+    done = true;
+    reader.join();
+    if (shrank)
+        return "*** FAILED *** a read saw fewer samples than the read before it";
+
+    LatencyStats stats = ct.latencyStats();
+    if (stats.sampleEvery != 1)
+        return "*** FAILED *** the sampling rate is not reported";
+    for (size_t op = 0; op < LatencyStats::k_ops; op++)
+    {
+        const LatencyHistogram& h = stats.ops[op];
+        if (h.samples() != expected[op])
+        {
+            ostringstream msg;
+            msg << "*** FAILED *** " << h.samples() << " " << LatencyStats::name(LatencyStats::Op(op))
+                << " operations timed instead of " << expected[op];
+            return msg.str();
+        }
+        if (h.percentile(0.5) > h.percentile(0.999))
+            return "*** FAILED *** the percentiles are out of order";
+    }
+    LatencyStats reset = ct.resetLatencyStats();
+    for (size_t op = 0; op < LatencyStats::k_ops; op++)
+    {
+        if (reset.ops[op].counts != stats.ops[op].counts)
+            return "*** FAILED *** the reset returned different histograms";
+        if (ct.latencyStats().ops[op].samples() != 0)
+            return "*** FAILED *** the reset did not empty the histograms";
+    }
+
+    ct.setLatencySampling(0);
+    for (size_t k = 0; k < half; k++)
+        applyOp(ct, ops[k]);
+    for (const LatencyHistogram& h : ct.latencyStats().ops)
+    {
+        if (h.samples() != 0)
+            return "*** FAILED *** operations were timed with sampling off";
+    }
+    return "Passed";
+#endif
+}
+
+  // The spans written after the commands run on a new tracker must be well
+  // formed, all on this thread, and hold the most recent spans only: every
+  // one of the commands if the ring has room for them all, else a full ring.  Each
+  // span within an operation (hashing, list scans and so on) must lie
+  // inside the span of an operation recorded after it.  A build without
+  // CHATTRACKER_TRACE must write no spans.
+
+struct TracedSpan
+{
+    string name;
+    int tid;
+    double start;  // usec.
+    double end;
+};
+
+string testTraceEvents(const vector<Command*>& commands)
+{
+    vector<TraceOp> ops = toTrace(commands);
+    ChatTracker ct;
+    clearTraceEvents();
+    for (const TraceOp& op : ops)
+        applyOp(ct, op);
+    ostringstream out;
+    writeTraceEvents(out);
+
+    string text = out.str();
+    const string head = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    if (text.compare(0, head.size(), head) != 0  ||  text.size() < 4  ||
+            text.compare(text.size() - 4, 4, "\n]}\n") != 0)
+        return "*** FAILED *** the trace is not a list of trace events";
+    vector<TracedSpan> spans;
+    istringstream lines(text.substr(head.size()));
+    string line;
+    while (getline(lines, line))
+    {
+        if (line.empty()  ||  line == "]}")
+            continue;
+        char name[64];
+        int pid;
+        TracedSpan span;
+        double duration;
+        if (sscanf(line.c_str(), "{\"name\":\"%63[^\"]\",\"cat\":\"ChatTracker\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%lf,\"dur\":%lf}",
+                   name, &pid, &span.tid, &span.start, &duration) != 5  ||  pid != getpid())
+            return "*** FAILED *** bad trace event " + line;
+        span.name = name;
+        span.end = span.start + duration;
+        spans.push_back(span);
+    }
+#ifndef CHATTRACKER_TRACE
+    return spans.empty() ? "Passed (tracing compiled out)" : "*** FAILED *** spans were recorded with tracing compiled out";
+#else
+    const set<string> operations = { "join", "terminate", "contribute", "leave", "leave current" };
+    size_t outer = 0;
+    for (size_t k = 0; k < spans.size(); k++)
+    {
+        if (spans[k].tid != spans[0].tid)
+            return "*** FAILED *** the spans of one thread have different thread IDs";
+        if (operations.count(spans[k].name) != 0)
+        {
+            outer++;
+            continue;
+        }
+        size_t j = k + 1;
+        while (j < spans.size()  &&  operations.count(spans[j].name) == 0)
+            j++;
+        if (j == spans.size()  ||  spans[k].start < spans[j].start  ||  spans[k].end > spans[j].end)
+            return "*** FAILED *** a \"" + spans[k].name + "\" span is not inside an operation";
+    }
+    if (spans.size() < k_traceRingSize  ?  outer != ops.size()  :  spans.size() != k_traceRingSize)
+    {
+        ostringstream msg;
+        msg << "*** FAILED *** " << spans.size() << " spans of " << outer << " operations written for "
+            << ops.size() << " operations";
+        return msg.str();
+    }
+    return "Passed";
+#endif
+}
+
+  // Reads commands one line at a time (so the trace is never held in memory)
+  // and runs each on a ChatTracker and on the indexed oracle, stopping at
+  // the first result on which they disagree
+
+string differentialRun(istream& trace, long long& nops, double& msec)
+{
+    Timer timer;
+    ChatTracker ct;
+    IndexedChatTracker oracle;
+    string commandLine;
+    int lineNumber = 0;
+    nops = 0;
+    while (getline(trace, commandLine))
+    {
+        lineNumber++;
+        Command* cmd = Command::create(commandLine, lineNumber);
+        if (cmd == nullptr)
+            continue;
+        nops++;
+        int actual = runCommand(ct, cmd);
+        int expected = runCommand(oracle, cmd);
+        delete cmd;
+        if (actual != expected)
+        {
+            msec = timer.elapsed();
+            ostringstream msg;
+            msg << "*** FAILED *** line " << lineNumber << ": \"" << commandLine
+                << "\" returned " << actual << " instead of " << expected;
+            return msg.str();
+        }
+    }
+    msec = timer.elapsed();
+    return "Passed";
+}
+
+void testPerformance(const vector<Command*>& commands)
+{
+    double endConstruction;
+    double endCommands;
+
+    Timer timer;
+    {
+        ChatTracker ct;
+
+        endConstruction = timer.elapsed();
+
+        for (size_t k = 0; k < commands.size(); k++)
+            commands[k]->execute(ct);
+
+        endCommands = timer.elapsed();
+    }
+
+    double end = timer.elapsed();
+
+    cout << end << " milliseconds." << endl
+         << "   Construction: " << endConstruction << " msec." << endl
+         << "       Commands: " << (endCommands - endConstruction) << " msec." << endl
+         << "    Destruction: " << (end - endCommands) << " msec." << endl;
+}
+
+  // Names in the same form generateTests produces: 11 repeated letters and a
+  // 5-digit number.  Lookups pick chats with the generator's 1/(k+2)^1.2
+  // weighting and users uniformly.
+
+string genName(char c, int n)
+{
+    ostringstream oss;
+    oss << string(11, c) << setw(5) << setfill('0') << n;
+    return oss.str();
+}
+
+  // Best of three runs, since a single run is easily disturbed by the machine
+
+template <typename Hasher>
+double timeHashPolicy(const vector<string>& names, const vector<int>& lookups)
+{
+    double best = 0;
+    for (int run = 0; run < 3; run++)
+    {
+        Timer timer;
+        HashMap<string, int, Hasher> map(1000);
+        for (size_t k = 0; k < names.size(); k++)
+            map.associate(names[k], int(k));
+        long hits = 0;
+        for (size_t k = 0; k < lookups.size(); k++)
+            if (map.find(names[lookups[k]]) != nullptr)
+                hits++;
+        double elapsed = timer.elapsed();
+        if (hits != long(lookups.size()))
+            cout << "*** hash policy lost keys ***" << endl;
+        if (run == 0  ||  elapsed < best)
+            best = elapsed;
+    }
+    return best;
+}
+
+void testHashPolicies()
+{
+    const int NCHATS = 1000;
+    const int NUSERS = 10000;
+    const int NLOOKUPS = 2000000;
+
+    vector<string> names;
+    for (int k = 0; k < NUSERS; k++)
+        names.push_back(genName('u', k));
+    for (int k = 0; k < NCHATS; k++)
+        names.push_back(genName('c', k));
+
+    vector<double> weights;
+    for (int k = 0; k < NCHATS; k++)
+        weights.push_back(1.0 / pow(k+2, 1.2));
+    default_random_engine gen(12345);
+    discrete_distribution<int> chatDistro(weights.begin(), weights.end());
+    uniform_int_distribution<int> userDistro(0, NUSERS-1);
+    vector<int> lookups;
+    for (int k = 0; k < NLOOKUPS; k++)
+        lookups.push_back(k % 2 == 0 ? userDistro(gen) : NUSERS + chatDistro(gen));
+
+    cout << "      std::hash: " << timeHashPolicy<StdHash>(names, lookups) << " msec." << endl
+         << "         WyHash: " << timeHashPolicy<WyHash>(names, lookups) << " msec." << endl;
+}
+
+  // A hash policy that counts its calls and gives keys only 1000 distinct
+  // hashes, so chains are long and keys with equal hashes share them
+
+struct CountingHash
+{
+    static long calls;
+    uint64_t operator()(int key) const
+    {
+        calls++;
+        return uint64_t(key % 1000) * 0x9e3779b97f4a7c15ull;
+    }
+};
+
+long CountingHash::calls = 0;
+
+  // Check every entry of a map against the map it should hold: iteration
+  // must visit each key exactly once
+
+string compareMap(HashMap<int, int, CountingHash>& hm, const map<int, int>& expected)
+{
+    if (hm.size() != expected.size())
+        return "wrong size";
+    size_t visited = 0;
+    for (HashMap<int, int, CountingHash>::iterator p = hm.begin(); p != hm.end(); ++p)
+    {
+        auto e = expected.find(p->first);
+        if (e == expected.end()  ||  e->second != p->second)
+            return "iteration visits a wrong entry for key " + to_string(p->first);
+        visited++;
+    }
+    if (visited != expected.size())
+        return "iteration visits some entry twice or misses one";
+    for (auto& e : expected)
+    {
+        const int* v = hm.find(e.first);
+        if (v == nullptr  ||  *v != e.second)
+            return "key " + to_string(e.first) + " is not found";
+    }
+    return "";
+}
+
+  // try_emplace, insert_or_assign, erase, and extract and insert of nodes
+  // between a map with a pool and one without, checked against std::map;
+  // then erasing during iteration, and growing a map through many rehashes,
+  // which must not hash any key again
+
+string testHashMap()
+{
+    mt19937 gen(27);
+    NodePool pool;
+    HashMap<int, int, CountingHash> a(1, &pool);
+    HashMap<int, int, CountingHash> b(1);
+    map<int, int> inA;
+    map<int, int> inB;
+    for (int k = 1; k <= 200000; k++)
+    {
+        int key = int(gen() % 20000);
+        int value = int(gen() % 1000);
+        switch (gen() % 6)
+        {
+          case 0:
+          {
+            pair<int*, bool> r = a.try_emplace(key, value);
+            if (r.second != (inA.count(key) == 0))
+                return "*** FAILED *** try_emplace reports the wrong outcome";
+            if (r.second)
+                inA[key] = value;
+            if (*r.first != inA[key])
+                return "*** FAILED *** try_emplace changes an existing value";
+            break;
+          }
+          case 1:
+          {
+            pair<int*, bool> r = a.insert_or_assign(key, value);
+            if (r.second != (inA.count(key) == 0)  ||  *r.first != value)
+                return "*** FAILED *** insert_or_assign does not assign";
+            inA[key] = value;
+            break;
+          }
+          case 2:
+            if (a.erase(key) != (inA.erase(key) == 1))
+                return "*** FAILED *** erase reports the wrong outcome";
+            break;
+          case 3:
+          case 4:
+          {
+              // Move the key's node to the other map (the handle keeps it
+              // if the other map has the key already)
+            bool fromA = (gen() % 2 == 0);
+            HashMap<int, int, CountingHash>& from = (fromA ? a : b);
+            HashMap<int, int, CountingHash>& to = (fromA ? b : a);
+            map<int, int>& inFrom = (fromA ? inA : inB);
+            map<int, int>& inTo = (fromA ? inB : inA);
+            HashMap<int, int, CountingHash>::NodeHandle node = from.extract(key);
+            if (node.empty() != (inFrom.count(key) == 0))
+                return "*** FAILED *** extract reports the wrong outcome";
+            if (node.empty())
+            {
+                if (to.insert(move(node)).first != nullptr)
+                    return "*** FAILED *** inserting an empty node inserts something";
+                break;
+            }
+            if (node.key() != key  ||  node.mapped() != inFrom[key])
+                return "*** FAILED *** an extracted node holds the wrong entry";
+            inFrom.erase(key);
+            node.mapped() = value;
+            pair<int*, bool> r = to.insert(move(node));
+            if (r.second != (inTo.count(key) == 0)  ||  r.second != node.empty())
+                return "*** FAILED *** insert of a node reports the wrong outcome";
+            if (r.second)
+                inTo[key] = value;
+            if (*r.first != inTo[key])
+                return "*** FAILED *** insert of a node changes an existing value";
+            break;
+          }
+          default:
+          {
+            const int* v = a.find(key);
+            if ((v == nullptr) != (inA.count(key) == 0)  ||  (v != nullptr  &&  *v != inA[key]))
+                return "*** FAILED *** find gives the wrong value";
+            break;
+          }
+        }
+        if (k % 20000 == 0)
+        {
+            string difference = compareMap(a, inA);
+            if (difference.empty())
+                difference = compareMap(b, inB);
+            if ( ! difference.empty())
+                return "*** FAILED *** " + difference;
+        }
+    }
+
+    for (HashMap<int, int, CountingHash>::iterator p = a.begin(); p != a.end(); )
+    {
+        if (p->first % 2 != 0)
+            p = a.erase(p);
+        else
+            ++p;
+    }
+    for (auto e = inA.begin(); e != inA.end(); )
+    {
+        if (e->first % 2 != 0)
+            e = inA.erase(e);
+        else
+            ++e;
+    }
+    string difference = compareMap(a, inA);
+    if ( ! difference.empty())
+        return "*** FAILED *** after erasing while iterating, " + difference;
+
+    const int KEYS = 100000;
+    HashMap<int, int, CountingHash> grown(1, &pool);
+    CountingHash::calls = 0;
+    for (int key = 0; key < KEYS; key++)
+        grown.try_emplace(key, key);
+    grown.reserve(4 * KEYS);
+    if (CountingHash::calls != KEYS)
+        return "*** FAILED *** a rehash hashes keys again";
+    if (grown.bucketCount() < size_t(KEYS))
+        return "*** FAILED *** the map did not grow";
+    for (int key = 0; key < KEYS; key++)
+    {
+        const int* v = grown.find(key);
+        if (v == nullptr  ||  *v != key)
+            return "*** FAILED *** a key is lost in a rehash";
+    }
+
+      // Memory set aside by reserve survives a trim until it has been handed
+      // out; once its objects have all been freed, trim gives it back
+    NodePool reserved;
+    reserved.reserve(32, 10000);
+    size_t before = reserved.capacity();
+    if (reserved.trim() != 0  ||  reserved.capacity() != before)
+        return "*** FAILED *** trim gives back reserved memory that was never used";
+    vector<void*> objects;
+    for (int k = 0; k < 10000; k++)
+        objects.push_back(reserved.allocate(32));
+    if (reserved.capacity() != before)
+        return "*** FAILED *** reserved objects come from new memory";
+    for (size_t k = 0; k < objects.size(); k += 2)
+        reserved.deallocate(objects[k], 32);
+    if (reserved.trim() != 0)
+        return "*** FAILED *** trim gives back memory still in use";
+    for (size_t k = 1; k < objects.size(); k += 2)
+        reserved.deallocate(objects[k], 32);
+    if (reserved.trim() != before  ||  reserved.capacity() != 0)
+        return "*** FAILED *** trim keeps memory whose objects were all freed";
+    return "Passed";
+}
+
+  // Connects to a server listening on a Unix domain socket; returns -1 if it
+  // cannot
+
+int connectTo(const string& path)
+{
+    sockaddr_storage addr;
+    socklen_t addrLen;
+    parseAddress("unix:" + path, addr, addrLen);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0  &&  connect(fd, reinterpret_cast<sockaddr*>(&addr), addrLen) != 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+  // A client sends millions of requests and reads no answer until it has
+  // sent them all.  Once its unsent answers pile up the server must stop
+  // reading it, so the requests stop being carried out while the client is
+  // still sending; then every request must be answered as the client reads.
+
+string testUnreadAnswers()
+{
+    TempFile socketFile("unread.sock");
+    ChatTracker ct;
+    ChangeFeed& feed = ct.enableChangeFeed();
+    ChatServer server(ct);
+    if ( ! server.listen("unix:" + socketFile.path))
+        return "*** FAILED *** cannot listen on " + socketFile.path;
+    thread serving([&] { server.run(); });
+
+    const size_t REQUESTS = 3000000;
+    string requests;
+    for (size_t k = 0; k < REQUESTS; k++)
+        requests += "j u c\n";
+    string result = "Passed";
+    int fd = connectTo(socketFile.path);
+    if (fd < 0)
+        result = "*** FAILED *** cannot connect";
+    else
+    {
+        atomic<bool> sent(false);
+        thread sender([&] {
+            for (size_t off = 0; off < requests.size(); )
+            {
+                ssize_t n = send(fd, requests.data() + off, requests.size() - off, 0);
+                if (n <= 0)
+                    break;
+                off += n;
+            }
+            sent = true;
+        });
+
+          // Wait until half a second goes by with no request carried out
+        uint64_t executed = 0;
+        for (int still = 0; still < 5  &&  ! sent; )
+        {
+            usleep(100000);
+            uint64_t now = feed.published();
+            still = (now == executed ? still + 1 : 0);
+            executed = now;
+        }
+        if (sent)
+            result = "*** FAILED *** the server took every request of a client that reads no answers";
+        else if (executed > REQUESTS / 2)
+            result = "*** FAILED *** the server carried out " + to_string(executed) +
+                     " requests of a client that reads no answers";
+
+        size_t answers = 0;
+        char buf[64 * 1024];
+        ssize_t n;
+        while (answers < REQUESTS  &&  (n = recv(fd, buf, sizeof(buf), 0)) > 0)
+            answers += count(buf, buf + n, '\n');
+        sender.join();
+        if (result == "Passed"  &&  answers != REQUESTS)
+            result = "*** FAILED *** " + to_string(answers) + " answers to " + to_string(REQUESTS) +
+                     " requests sent without reading";
+        close(fd);
+    }
+    server.stop();
+    serving.join();
+    return result;
+}
+
+  // A server in a child process that may only open a few more descriptors
+  // gets more connections than it can keep.  It must turn away the ones it
+  // cannot keep rather than spin on them (using well under a second of
+  // processor time in its three seconds), and go on answering the ones it
+  // kept.
+
+string testOutOfDescriptors()
+{
+    TempFile socketFile("descriptors.sock");
+    cout << flush;
+    pid_t pid = fork();
+    if (pid < 0)
+        return "*** FAILED *** cannot fork";
+    if (pid == 0)
+    {
+        ChatTracker ct;
+        ChatServer server(ct);
+        if ( ! server.listen("unix:" + socketFile.path))
+            _exit(2);
+          // Room for the server's poller and reserve descriptor and four
+          // connections: the six lowest free descriptors are the only free
+          // ones below the limit
+        int spare[6];
+        for (int& fd : spare)
+            fd = open("/dev/null", O_RDONLY);
+        rlimit limit;
+        getrlimit(RLIMIT_NOFILE, &limit);
+        limit.rlim_cur = *max_element(spare, spare + 6) + 1;
+        for (int fd : spare)
+            close(fd);
+        setrlimit(RLIMIT_NOFILE, &limit);
+        thread serving([&] { server.run(); });
+        sleep(3);
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        server.stop();
+        serving.join();
+        double seconds = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+                         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+        _exit(seconds < 0.5 ? 0 : 1);
+    }
+
+    string result = "Passed";
+    vector<int> clients;
+    for (int attempt = 0; attempt < 100  &&  clients.empty(); attempt++)
+    {
+        int fd = connectTo(socketFile.path);
+        if (fd >= 0)
+            clients.push_back(fd);
+        else
+            usleep(10000);
+    }
+    for (int k = 1; k < 12  &&  ! clients.empty(); k++)
+        clients.push_back(connectTo(socketFile.path));
+    if (clients.empty())
+        result = "*** FAILED *** cannot connect";
+    else
+    {
+        timeval timeout = { 2, 0 };
+        setsockopt(clients[0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(clients.back(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        string answers;
+        char buf[64];
+        ssize_t n;
+        if (send(clients[0], "j a b\nc a\n", 10, 0) != 10)
+            result = "*** FAILED *** cannot send a request";
+        while (answers.size() < 4  &&  (n = recv(clients[0], buf, sizeof(buf), 0)) > 0)
+            answers.append(buf, n);
+        if (result == "Passed"  &&  answers != "0\n1\n")
+            result = "*** FAILED *** a kept connection is answered \"" + answers + "\"";
+        if (result == "Passed"  &&  recv(clients.back(), buf, sizeof(buf), 0) != 0)
+            result = "*** FAILED *** a connection the server cannot keep is not closed";
+    }
+    for (int fd : clients)
+        if (fd >= 0)
+            close(fd);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (result == "Passed"  &&  ( ! WIFEXITED(status)  ||  WEXITSTATUS(status) != 0))
+        result = WIFEXITED(status)  &&  WEXITSTATUS(status) == 1
+                     ? "*** FAILED *** a server out of descriptors spins"
+                     : "*** FAILED *** the server cannot listen on " + socketFile.path;
+    return result;
+}
+
+  // Serves a tracker on a Unix domain socket and sends it many requests
+  // before reading any answer, then malformed and overlong lines, then a last
+  // request with no newline, and shuts down the sending side.  Every request
+  // must be answered, in order and as the tracker answers it, before the
+  // server closes the connection.
+
+string testServer()
+{
+    TempFile socketFile("server.sock");
+    ChatTracker ct;
+    ChatServer server(ct);
+    if ( ! server.listen("unix:" + socketFile.path))
+        return "*** FAILED *** cannot listen on " + socketFile.path;
+    thread serving([&] { server.run(); });
+
+    const int REQUESTS = 40000;
+    ChatTracker oracle;
+    string requests;
+    string expected;
+    for (int k = 0; k < REQUESTS; k++)
+    {
+        string user = "u" + to_string(k % 500);
+        string chat = "chat " + to_string(k % 37);
+        int result = 0;
+        switch (k % 8)
+        {
+          case 0: case 1: case 2:
+            requests += "j " + user + " " + chat + "\n";
+            oracle.join(user, chat);
+            break;
+          case 3: case 4: case 5:
+            requests += "c " + user + "\n";
+            result = oracle.contribute(user);
+            break;
+          case 6:
+            requests += "l " + user + " " + chat + "\r\n";
+            result = oracle.leave(user, chat);
+            break;
+          case 7:
+            requests += "t " + chat + "\n";
+            result = oracle.terminate(chat);
+            break;
+        }
+        expected += to_string(result) + "\n";
+    }
+    requests += "x u1\n" "j u1\n" "c\n\n";
+    requests += "c " + string(ChatServer::k_maxLine + 10, 'a') + "\n";
+    expected += "error\n" "error\n" "error\n" "error\n";
+    requests += "c u1";
+    expected += to_string(oracle.contribute("u1")) + "\n";
+
+    string result;
+    sockaddr_storage addr;
+    socklen_t addrLen;
+    parseAddress("unix:" + socketFile.path, addr, addrLen);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0  ||  connect(fd, reinterpret_cast<sockaddr*>(&addr), addrLen) != 0)
+        result = "*** FAILED *** cannot connect";
+    else
+    {
+          // Send on another thread, since the server answers while the
+          // requests are still arriving
+
+        bool sendFailed = false;
+        thread sender([&] {
+            for (size_t off = 0; off < requests.size(); )
+            {
+                ssize_t n = send(fd, requests.data() + off, requests.size() - off, 0);
+                if (n <= 0)
+                {
+                    sendFailed = true;
+                    break;
+                }
+                off += n;
+            }
+            shutdown(fd, SHUT_WR);
+        });
+        string answers;
+        char buf[64 * 1024];
+        ssize_t n;
+        while ((n = recv(fd, buf, sizeof(buf), 0)) > 0)
+            answers.append(buf, n);
+        sender.join();
+        if (sendFailed)
+            result = "*** FAILED *** cannot send the requests";
+        else if (answers != expected)
+        {
+            size_t k = 0;
+            while (k < answers.size()  &&  k < expected.size()  &&  answers[k] == expected[k])
+                k++;
+            size_t line = count(expected.begin(), expected.begin() + k, '\n');
+            result = "*** FAILED *** " + to_string(count(answers.begin(), answers.end(), '\n')) +
+                     " answers to " + to_string(REQUESTS + 5) + " requests, first wrong at " + to_string(line);
+        }
+        else
+            result = "Passed";
+    }
+    if (fd >= 0)
+        close(fd);
+    server.stop();
+    serving.join();
+    if (result != "Passed")
+        return result;
+    result = testUnreadAnswers();
+    if (result != "Passed")
+        return result;
+    return testOutOfDescriptors();
+}
+
+  // Producers each submit to two AsyncChatTrackers in turn and wait for
+  // every result.  A producer's operations on each tracker must be applied
+  // in the order it submitted them, so its user's contributions count up one
+  // by one in both trackers.
+
+string testAsyncTrackers()
+{
+    const int PRODUCERS = 4;
+    const int CONTRIBUTIONS = 2000;
+    AsyncChatTracker first;
+    AsyncChatTracker second;
+    AsyncChatTracker* trackers[2] = { &first, &second };
+    atomic<bool> outOfOrder(false);
+    vector<thread> threads;
+    for (int p = 0; p < PRODUCERS; p++)
+    {
+        threads.push_back(thread([&, p] {
+            string user = genName('u', p);
+            for (AsyncChatTracker* act : trackers)
+                act->join(user, genName('c', p % 2));
+            for (int k = 1; k <= CONTRIBUTIONS; k++)
+            {
+                for (AsyncChatTracker* act : trackers)
+                {
+                    AsyncResult result;
+                    act->contribute(user, &result);
+                    if (result.get() != k)
+                        outOfOrder = true;
+                }
+            }
+        }));
+    }
+    for (size_t k = 0; k < threads.size(); k++)
+        threads[k].join();
+    if (outOfOrder)
+        return "*** FAILED *** a contribution was applied out of order";
+    for (AsyncChatTracker* act : trackers)
+    {
+        act->drain();
+        for (int c = 0; c < 2; c++)
+        {
+            if (act->tracker().chatTotal(genName('c', c)) != PRODUCERS / 2 * CONTRIBUTIONS)
+                return "*** FAILED *** wrong total for " + genName('c', c);
+        }
+    }
+
+      // Names too long to be copied into the ring's cells, and a thread
+      // that submits to many trackers one after another
+
+    string longUser(100, 'u');
+    string longChat(200, 'c');
+    for (int k = 0; k < 100; k++)
+    {
+        AsyncChatTracker act;
+        AsyncResult contributed;
+        AsyncResult terminated;
+        act.join(longUser, longChat);
+        act.join(genName('u', k), longChat);
+        act.contribute(longUser, &contributed);
+        act.terminate(longChat, &terminated);
+        if (contributed.get() != 1  ||  terminated.get() != 1)
+            return "*** FAILED *** wrong result for long names";
+    }
+    return "Passed";
+}
+
+  // Each producer thread has its own users, who join a few chats and then
+  // contribute.  The same operations are submitted once through a ChatTracker
+  // guarded by a mutex and once through an AsyncChatTracker.
+
+const int OPS_PER_PRODUCER = 50000;
+
+template <typename Submit>
+void produce(int producer, Submit submit)
+{
+    for (int k = 0; k < OPS_PER_PRODUCER; k++)
+    {
+        string user = genName('u', producer * 100 + k % 100);
+        if (k < 100)
+            submit('j', user, genName('c', k % 37));
+        else
+            submit('c', user, string());
+    }
+}
+
+template <typename Body>
+double timeProducers(int producers, Body body)
+{
+    Timer timer;
+    vector<thread> threads;
+    for (int p = 0; p < producers; p++)
+        threads.push_back(thread(body, p));
+    for (size_t k = 0; k < threads.size(); k++)
+        threads[k].join();
+    return timer.elapsed();
+}
+
+void testAsyncSubmission()
+{
+    const int levels[] = { 1, 8, 16, 32 };
+    cout << "   producers      mutex      async" << endl;
+    for (int producers : levels)
+    {
+        double totalOps = double(producers) * OPS_PER_PRODUCER;
+
+        ChatTracker ct;
+        mutex m;
+        double locked = timeProducers(producers, [&](int p) {
+            produce(p, [&](char op, const string& user, const string& chat) {
+                lock_guard<mutex> lock(m);
+                if (op == 'j')
+                    ct.join(user, chat);
+                else
+                    ct.contribute(user);
+            });
+        });
+
+        double async;
+        {
+            Timer timer;
+            AsyncChatTracker act;
+            timeProducers(producers, [&](int p) {
+                produce(p, [&](char op, const string& user, const string& chat) {
+                    if (op == 'j')
+                        act.join(user, chat);
+                    else
+                        act.contribute(user);
+                });
+            });
+            act.drain();
+            async = timer.elapsed();
+        }
+
+        cout << setw(12) << producers << setw(11) << int(totalOps / locked)
+             << setw(11) << int(totalOps / async) << endl;
+    }
+}
+
+  // Users who have all joined a chat contribute over and over, first with
+  // the feed off and then with it on.  The subscription is drained every
+  // 1024 contributions by the same thread, so the time includes both
+  // publishing and consuming the events whatever the number of cores.
+
+void testChangeFeedOverhead()
+{
+    const int NUSERS = 10000;
+    const int NCONTRIBUTIONS = 2000000;
+    vector<string> users;
+    for (int k = 0; k < NUSERS; k++)
+        users.push_back(genName('u', k));
+
+    double times[2];
+    for (int enabled = 0; enabled < 2; enabled++)
+    {
+        ChatTracker ct;
+        for (int k = 0; k < NUSERS; k++)
+            ct.join(users[k], genName('c', k % 1000));
+        ChangeFeed::Subscription* sub = nullptr;
+        if (enabled)
+            sub = ct.enableChangeFeed().subscribe();
+
+        ChangeEvent events[1024];
+        Timer timer;
+        for (int k = 0; k < NCONTRIBUTIONS; k++)
+        {
+            ct.contribute(users[k % NUSERS]);
+            if (sub != nullptr && k % 1024 == 1023)
+                sub->poll(events, 1024);
+        }
+        times[enabled] = timer.elapsed();
+    }
+    cout << "    feed off: " << times[0] << " msec." << endl
+         << "     feed on: " << times[1] << " msec. ("
+         << (times[1] - times[0]) * 1e6 / NCONTRIBUTIONS << " nsec. per contribute)" << endl;
+}
+
+  // A trace of many small communities: each community's users only join
+  // its own chats, so operations depend only on others in their community
+
+vector<TraceOp> communityTrace(int communities, int nops)
+{
+    const int USERS = 20;
+    const int CHATS = 4;
+    mt19937 gen(36);
+    vector<TraceOp> ops;
+    for (int k = 0; k < nops; k++)
+    {
+        int community = int(gen() % communities);
+        string user = genName('u', community * USERS + int(gen() % USERS));
+        string chat = genName('c', community * CHATS + int(gen() % CHATS));
+        int r = int(gen() % 100);
+        if (r < 20)
+            ops.push_back(TraceOp{ TraceOp::JOIN, user, chat });
+        else if (r < 90)
+            ops.push_back(TraceOp{ TraceOp::CONTRIBUTE, user, "" });
+        else if (r < 95)
+            ops.push_back(TraceOp{ TraceOp::LEAVE2, user, chat });
+        else if (r < 98)
+            ops.push_back(TraceOp{ TraceOp::LEAVE1, user, "" });
+        else
+            ops.push_back(TraceOp{ TraceOp::TERMINATE, "", chat });
+    }
+    return ops;
+}
+
+void timeReplay(const string& title, const vector<TraceOp>& ops)
+{
+    Timer timer;
+    {
+        ChatTracker ct;
+        for (size_t k = 0; k < ops.size(); k++)
+            applyOp(ct, ops[k]);
+    }
+    double sequential = timer.elapsed();
+
+    ParallelReplay replay(ops);
+    cout << "  " << title << ": " << ops.size() << " operations, "
+         << replay.dependencies() << " dependencies, longest chain "
+         << replay.criticalPath() << endl;
+    cout << "    sequential: " << sequential << endl;
+    const int levels[] = { 1, 2, 4, 8 };
+    for (int threads : levels)
+    {
+        vector<int> results;
+        timer.start();
+        replay.run(threads, results);
+        double elapsed = timer.elapsed();
+        string difference = replay.verify(results);
+        cout << setw(6) << threads << " threads: " << elapsed
+             << (difference.empty() ? "" : "  *** FAILED *** " + difference) << endl;
+    }
+}
+
+void timeParallelReplay(const vector<Command*>& commands)
+{
+    timeReplay("test commands", toTrace(commands));
+    timeReplay("communities", communityTrace(500, 400000));
+}
+
+  // A dump of the given numbers of users in 1 to 4 chats each, each with up
+  // to 30 contributions
+
+ChatTracker::Dump generateDump(int users, int chats, unsigned seed)
+{
+    mt19937 gen(seed);
+    ChatTracker::Dump dump;
+    for (int u = 0; u < users; u++)
+    {
+        int nchats = 1 + int(gen() % 4);
+        for (int p = 0; p < nchats; p++)
+        {
+            int count = int(gen() % 31);
+            dump.memberships.push_back(ChatTracker::Dump::Membership{
+                    genName('u', u), genName('c', int(gen() % chats)), size_t(p), count });
+        }
+    }
+    return dump;
+}
+
+  // 200000 users in 20000 chats, built by joining and contributing and then
+  // by loading a dump (each time includes destroying the tracker)
+
+void timeBulkLoad()
+{
+    ChatTracker::Dump dump = generateDump(200000, 20000, 38);
+    long long contributions = 0;
+    for (const ChatTracker::Dump::Membership& m : dump.memberships)
+        contributions += m.count;
+
+    Timer timer;
+    {
+        ChatTracker ct;
+          // Each user joins its chats from the last position to the first
+        size_t k = 0;
+        while (k < dump.memberships.size())
+        {
+            size_t end = k;
+            while (end < dump.memberships.size()  &&
+                    dump.memberships[end].user == dump.memberships[k].user)
+                end++;
+            for (size_t j = end; j > k; j--)
+            {
+                const ChatTracker::Dump::Membership& m = dump.memberships[j-1];
+                ct.join(m.user, m.chat);
+                for (int c = 0; c < m.count; c++)
+                    ct.contribute(m.user);
+            }
+            k = end;
+        }
+    }
+    cout << "  " << dump.memberships.size() << " memberships, "
+         << contributions << " contributions" << endl;
+    cout << "    join and contribute: " << timer.elapsed() << endl;
+
+    stringstream text;
+    ChatTracker::writeDump(text, dump);
+    timer.start();
+    ChatTracker::Dump reread;
+    ChatTracker::readDump(text, reread);
+    cout << "    read text dump: " << timer.elapsed() << endl;
+
+    const int levels[] = { 1, 2, 4, 8 };
+    for (int threads : levels)
+    {
+        timer.start();
+        {
+            ChatTracker ct(dump, threads);
+        }
+        cout << setw(6) << threads << " threads: " << timer.elapsed() << endl;
+    }
+}
+
+  // One chat that 300000 users join, and half of them (every other one)
+  // then leave, so the listing has to pass over empty places
+
+void timeMemberListing()
+{
+    const int USERS = 300000;
+    ChatTracker ct;
+    for (int u = 0; u < USERS; u++)
+        ct.join(genName('u', u), "big");
+    for (int u = 1; u < USERS; u += 2)
+        ct.leave(genName('u', u), "big");
+
+    const int CALLS = 1000000;
+    Timer timer;
+    size_t sum = 0;
+    for (int k = 0; k < CALLS; k++)
+        sum += ct.memberCount("big");
+    double counting = timer.elapsed();
+
+    timer.start();
+    size_t seen = 0;
+    ct.forEachMember("big", [&](const string& name) { seen += name.size(); });
+    double each = timer.elapsed();
+
+    timer.start();
+    vector<string> page;
+    size_t pages = 0;
+    size_t cursor = 0;
+    do
+    {
+        cursor = ct.members("big", cursor, 100, page);
+        pages++;
+    } while (cursor != 0);
+    double paging = timer.elapsed();
+
+    cout << "    memberCount: " << counting * 1e6 / CALLS << " nsec. per call"
+         << (sum == size_t(CALLS) * ct.memberCount("big") ? "" : "  *** wrong count ***") << endl;
+    cout << "  forEachMember: " << each * 1e6 / ct.memberCount("big") << " nsec. per member" << endl;
+    cout << "  pages of 100: " << paging * 1e6 / pages << " nsec. per page" << endl;
+}
+
+  // Counts this process's dTLB load misses from construction on, where the
+  // processor exposes the counter (virtual machines often do not)
+
+class TlbMissCounter
+{
+  public:
+    TlbMissCounter() : m_fd(-1)
+    {
+#ifdef __linux__
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        m_fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+    ~TlbMissCounter()
+    {
+        if (m_fd >= 0)
+            close(m_fd);
+    }
+    bool available() const { return m_fd >= 0; }
+    long long misses() const
+    {
+        long long count = 0;
+        if (m_fd < 0  ||  ::read(m_fd, &count, sizeof(count)) != sizeof(count))
+            return -1;
+        return count;
+    }
+  private:
+    int m_fd;
+};
+
+  // Kilobytes of this process's memory in huge pages (transparent and
+  // hugetlbfs), or -1 if the system does not say
+
+long long hugePageKB()
+{
+    ifstream smaps("/proc/self/smaps_rollup");
+    if ( ! smaps)
+        return -1;
+    long long total = 0;
+    string line;
+    while (getline(smaps, line))
+    {
+        if (line.compare(0, 14, "AnonHugePages:") == 0  ||  line.compare(0, 16, "Private_Hugetlb:") == 0)
+            total += atoll(line.c_str() + line.find(':') + 1);
+    }
+    return total;
+}
+
+  // 2000000 users in 200000 chats, loaded from a dump with and without huge
+  // pages, then 2000000 contributions and 500000 joins by users picked at
+  // random, so nearly every lookup lands on a page it has not touched lately
+
+void timeHugePages()
+{
+    const int USERS = 2000000;
+    const int OPS = 2000000;
+    ChatTracker::Dump dump = generateDump(USERS, USERS / 10, 43);
+    vector<string> users;
+    vector<string> chats;
+    mt19937 gen(43);
+    for (int k = 0; k < OPS; k++)
+        users.push_back(genName('u', int(gen() % USERS)));
+    for (int k = 0; k < OPS / 4; k++)
+        chats.push_back(genName('c', int(gen() % (USERS / 10))));
+
+    // Each mode runs in a child process of its own, so neither starts with
+    // a heap the other has left in pieces
+    const bool modes[] = { false, true };
+    for (bool huge : modes)
+    {
+        cout << flush;
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            cout << "  *** cannot fork ***" << endl;
+            return;
+        }
+        if (pid != 0)
+        {
+            waitpid(pid, nullptr, 0);
+            continue;
+        }
+        ChatTracker::Options options;
+        options.hugePages = huge;
+        ChatTracker ct(dump, 1, options);
+        long long hugeKB = hugePageKB();
+        TlbMissCounter tlb;
+        Timer timer;
+        for (int k = 0; k < OPS; k++)
+            ct.contribute(users[k]);
+        double contributing = timer.elapsed();
+        timer.start();
+        for (int k = 0; k < OPS / 4; k++)
+            ct.join(users[k], chats[k]);
+        double joining = timer.elapsed();
+        long long misses = tlb.misses();
+
+        cout << (huge ? "  huge pages: " : "  4 KB pages: ")
+             << int(OPS / contributing) << " contributions and "
+             << int(OPS / 4 / joining) << " joins per msec.; ";
+        if (misses >= 0)
+            cout << double(misses) / (OPS + OPS / 4) << " dTLB misses per operation; ";
+        else
+            cout << "dTLB misses not available; ";
+        if (hugeKB >= 0)
+            cout << hugeKB / 1024 << " MB in huge pages" << endl;
+        else
+            cout << "huge page use not available" << endl;
+        _exit(0);
+    }
+}
+
+  // Reports on 1000000 users in 100000 chats
+
+void timeReports()
+{
+    ChatTracker ct(generateDump(1000000, 100000, 39));
+    cout << "  " << ct.memoryUsage() / (1024 * 1024) << " MB tracker" << endl;
+    const int levels[] = { 1, 2, 4, 8 };
+    for (int threads : levels)
+    {
+        Timer timer;
+        ChatReport report = buildReport(ct, threads);
+        double elapsed = timer.elapsed();
+        cout << setw(6) << threads << " threads: " << elapsed
+             << " (" << report.users << " users, " << report.chats << " chats, "
+             << report.totalContributions << " contributions)" << endl;
+    }
+}
+
+  // Contributions by 100000 of the users of a 1000000-user tracker, first
+  // alone and then while a checkpoint of the tracker is written; the time
+  // checkpointAsync takes is all the contributions wait for the checkpoint
+  // (apart from the copying of the pages they change while it is written)
+
+struct ContributeTiming
+{
+    long long ops;
+    double msec;
+    double slowest;  // usec.
+};
+
+template <typename Until>
+ContributeTiming timeContributions(ChatTracker& ct, const vector<string>& names, Until until)
+{
+    ContributeTiming timing = { 0, 0, 0 };
+    Timer timer;
+    auto last = std::chrono::high_resolution_clock::now();
+    while ( ! until(timing.ops))
+    {
+        for (int k = 0; k < 1024; k++)
+        {
+            ct.contribute(names[timing.ops % names.size()]);
+            timing.ops++;
+            auto now = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double,std::micro> op = now - last;
+            timing.slowest = max(timing.slowest, op.count());
+            last = now;
+        }
+    }
+    timing.msec = timer.elapsed();
+    return timing;
+}
+
+void timeCheckpoint()
+{
+    const char* path = "checkpointtime.txt";
+    ChatTracker ct(generateDump(1000000, 100000, 39));
+    vector<string> names;
+    mt19937 gen(41);
+    for (int k = 0; k < 100000; k++)
+        names.push_back(genName('u', int(gen() % 1000000)));
+    cout << "  " << ct.memoryUsage() / (1024 * 1024) << " MB tracker" << endl;
+
+    ContributeTiming alone = timeContributions(ct, names, [](long long ops) { return ops >= 2000000; });
+
+    Timer timer;
+    if ( ! ct.checkpointAsync(path))
+    {
+        cout << "  *** cannot start a checkpoint ***" << endl;
+        return;
+    }
+    double stall = timer.elapsed();
+    ContributeTiming during = timeContributions(ct, names, [&](long long) { return ! ct.checkpointRunning(); });
+    bool written = ct.waitForCheckpoint();
+    double writing = timer.elapsed();
+    ifstream checkpointf(path, ios::binary | ios::ate);
+    double megabytes = double(checkpointf.tellg()) / (1024 * 1024);
+    remove(path);
+
+    cout << "    checkpointAsync: " << stall * 1000 << " usec." << endl;
+    cout << "    contribute alone: " << int(alone.ops / alone.msec) << " per msec., slowest "
+         << alone.slowest << " usec." << endl;
+    cout << "    contribute while writing: " << int(during.ops / during.msec) << " per msec., slowest "
+         << during.slowest << " usec." << endl;
+    cout << "    checkpoint: " << int(megabytes) << " MB in " << writing << " msec. ("
+         << int(megabytes * 1000 / writing) << " MB per sec.)"
+         << (written ? "" : "  *** not written ***") << endl;
+}
+
+  // The test commands replayed on ChatTracker and on the dense tracker,
+  // given names (which the dense tracker turns into numbers) and given the
+  // numbers themselves; the best of five runs of each, including
+  // construction and destruction
+
+struct DenseOp
+{
+    TraceOp::Type type;
+    size_t user;
+    size_t chat;
+};
+
+template <typename Replay>
+double bestOfFive(Replay replay)
+{
+    double best = 0;
+    for (int run = 0; run < 5; run++)
+    {
+        Timer timer;
+        replay();
+        double elapsed = timer.elapsed();
+        if (run == 0  ||  elapsed < best)
+            best = elapsed;
+    }
+    return best;
+}
+
+void timeDenseTracker(const vector<Command*>& commands)
+{
+    vector<TraceOp> ops = toTrace(commands);
+    vector<DenseOp> numbered;
+    for (const TraceOp& op : ops)
+        numbered.push_back(DenseOp{ op.type, GeneratorTracker::idOf(op.user), GeneratorTracker::idOf(op.chat) });
+
+    // Each replay sums its results, which must come out the same
+    long long sums[3] = { 0, 0, 0 };
+    double hashed = bestOfFive([&]()
+    {
+        ChatTracker ct;
+        for (const TraceOp& op : ops)
+            sums[0] += applyOp(ct, op);
+    });
+    double names = bestOfFive([&]()
+    {
+        unique_ptr<GeneratorTracker> dense(new GeneratorTracker);
+        for (const TraceOp& op : ops)
+            sums[1] += applyOp(*dense, op);
+    });
+    double numbers = bestOfFive([&]()
+    {
+        unique_ptr<GeneratorTracker> dense(new GeneratorTracker);
+        for (const DenseOp& op : numbered)
+        {
+            switch (op.type)
+            {
+              case TraceOp::JOIN:        dense->join(op.user, op.chat);             break;
+              case TraceOp::TERMINATE:   sums[2] += dense->terminate(op.chat);      break;
+              case TraceOp::CONTRIBUTE:  sums[2] += dense->contribute(op.user);     break;
+              case TraceOp::LEAVE2:      sums[2] += dense->leave(op.user, op.chat); break;
+              case TraceOp::LEAVE1:      sums[2] += dense->leave(op.user);          break;
+            }
+        }
+    });
+    cout << "       ChatTracker: " << hashed << endl;
+    cout << "    dense, by name: " << names << endl;
+    cout << "  dense, by number: " << numbers
+         << (sums[0] == sums[1]  &&  sums[1] == sums[2] ? "" : "  *** results differ ***") << endl;
+}
+
+  // Contributions by 1000 users to their chats with latency sampling off,
+  // at the default rate and on every one, best of five runs each; then the
+  // test commands' latencies with every operation timed
+
+void timeLatencyStats(const vector<Command*>& commands)
+{
+    const int nops = 2000000;
+    ChatTracker ct;
+    vector<string> names;
+    for (int k = 0; k < 1000; k++)
+    {
+        names.push_back(genName('u', k));
+        ct.join(names.back(), genName('c', k % 100));
+    }
+      // The three settings take turns, so that a disturbance of the machine
+      // does not fall on one of them only; each keeps its best run
+    const unsigned settings[3] = { 0, 64, 1 };
+    double best[3] = { 0, 0, 0 };
+    for (int run = 0; run < 5; run++)
+    {
+        for (int s = 0; s < 3; s++)
+        {
+            ct.setLatencySampling(settings[s]);
+            for (int k = 0; k < 1024; k++)
+                ct.leave("");
+            Timer timer;
+            for (int k = 0; k < nops; k++)
+                ct.contribute(names[k % names.size()]);
+            double elapsed = timer.elapsed() * 1e6 / nops;
+            if (run == 0  ||  elapsed < best[s])
+                best[s] = elapsed;
+        }
+    }
+    cout << fixed << setprecision(1);
+    cout << "  contribute, sampling off: " << setw(6) << best[0] << " ns." << endl;
+    cout << "  contribute, 1 in 64:      " << setw(6) << best[1] << " ns. ("
+         << showpos << (best[1] - best[0]) * 100 / best[0] << noshowpos << "%)" << endl;
+    cout << "  contribute, every one:    " << setw(6) << best[2] << " ns. ("
+         << showpos << (best[2] - best[0]) * 100 / best[0] << noshowpos << "%)" << endl;
+    cout.unsetf(ios::fixed);
+    cout << setprecision(6);
+
+    vector<TraceOp> ops = toTrace(commands);
+    ChatTracker replayed;
+    replayed.setLatencySampling(1);
+    for (const TraceOp& op : ops)
+        applyOp(replayed, op);
+    LatencyStats stats = replayed.latencyStats();
+    cout << "  test commands (ns.)   samples    p50    p99  p99.9" << endl;
+    for (size_t op = 0; op < LatencyStats::k_ops; op++)
+    {
+        const LatencyHistogram& h = stats.ops[op];
+        cout << "    " << left << setw(15) << LatencyStats::name(LatencyStats::Op(op)) << right
+             << setw(11) << h.samples() << setw(7) << h.percentile(0.5)
+             << setw(7) << h.percentile(0.99) << setw(7) << h.percentile(0.999) << endl;
+    }
+}
+
+  // A backend is a tracker configuration to compare with others on the same
+  // trace.  It is a type with
+  //     typedef ... Tracker;   any type applyOp accepts
+  //     static const char* name();
+  //     static Tracker* create(const TraceSizes& sizes);
+  // where sizes describes the trace.  compareBackend<B> replays the trace through applyOp<B::Tracker>, so the
+  // timed loop calls the tracker's own functions, with no virtual call; the
+  // results are kept and compared with the indexed oracle's afterwards.
+
+struct TraceSizes
+{
+    size_t users;
+    size_t chats;
+    size_t joins;
+};
+
+struct DefaultBackend
+{
+    typedef ChatTracker Tracker;
+    static const char* name() { return "ChatTracker"; }
+    static Tracker* create(const TraceSizes&) { return new ChatTracker; }
+};
+
+struct FewBucketsBackend
+{
+    typedef ChatTracker Tracker;
+    static const char* name() { return "ChatTracker, 64 buckets"; }
+    static Tracker* create(const TraceSizes&) { return new ChatTracker(64); }
+};
+
+  // Sized for the trace's users, chats and joins, so its tables and pool
+  // never grow
+struct PresizedBackend
+{
+    typedef ChatTracker Tracker;
+    static const char* name() { return "ChatTracker, presized"; }
+    static Tracker* create(const TraceSizes& sizes)
+    {
+        ChatTracker::Options options;
+        options.expectedUsers = sizes.users;
+        options.expectedChats = sizes.chats;
+        options.expectedMemberships = sizes.joins;
+        return new ChatTracker(options);
+    }
+};
+
+struct UntimedBackend
+{
+    typedef ChatTracker Tracker;
+    static const char* name() { return "ChatTracker, no latency"; }
+    static Tracker* create(const TraceSizes&)
+    {
+        ChatTracker* ct = new ChatTracker;
+        ct->setLatencySampling(0);
+        return ct;
+    }
+};
+
+struct DenseBackend
+{
+    typedef GeneratorTracker Tracker;
+    static const char* name() { return "dense"; }
+    static Tracker* create(const TraceSizes&) { return new GeneratorTracker; }
+};
+
+struct IndexedBackend
+{
+    typedef IndexedChatTracker Tracker;
+    static const char* name() { return "indexed oracle"; }
+    static Tracker* create(const TraceSizes&) { return new IndexedChatTracker; }
+};
+
+struct SlowBackend
+{
+    typedef SlowChatTracker Tracker;
+    static const char* name() { return "slow oracle"; }
+    static Tracker* create(const TraceSizes&) { return new SlowChatTracker; }
+};
+
+  // Bytes the process has allocated with malloc (and so with new), or -1
+  // where the C library does not say
+
+long long heapBytes()
+{
+#if defined(__GLIBC__)  &&  (__GLIBC__ > 2  ||  __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 info = mallinfo2();
+    return (long long)(info.uordblks + info.hblkhd);
+#else
+    return -1;
+#endif
+}
+
+  // One row of the table: whether every result matched, the best of three
+  // times of each phase, and the heap the tracker held after the replay
+
+template <typename Backend>
+void compareBackend(const vector<TraceOp>& ops, const TraceSizes& sizes, const vector<int>& expected)
+{
+    typedef typename Backend::Tracker Tracker;
+    vector<int> results(ops.size());
+    bool correct = true;
+    double best[3] = { 0, 0, 0 };
+    long long heap = 0;
+    for (int run = 0; run < 3; run++)
+    {
+        long long before = heapBytes();
+        Timer timer;
+        Tracker* tracker = Backend::create(sizes);
+        double construction = timer.elapsed();
+        timer.start();
+        for (size_t k = 0; k < ops.size(); k++)
+            results[k] = applyOp(*tracker, ops[k]);
+        double replay = timer.elapsed();
+        heap = heapBytes() - before;
+        timer.start();
+        delete tracker;
+        double destruction = timer.elapsed();
+
+        correct = correct  &&  results == expected;
+        double times[3] = { construction, replay, destruction };
+        for (int phase = 0; phase < 3; phase++)
+        {
+            if (run == 0  ||  times[phase] < best[phase])
+                best[phase] = times[phase];
+        }
+    }
+    cout << "    " << left << setw(25) << Backend::name() << right
+         << setw(9) << (correct ? "yes" : "NO") << fixed << setprecision(2);
+    for (double t : best)
+        cout << setw(11) << t;
+    if (heap >= 0)
+        cout << setw(9) << setprecision(1) << heap / (1024.0 * 1024.0);
+    else
+        cout << setw(9) << "n/a";
+    cout << endl;
+    cout.unsetf(ios::fixed);
+    cout << setprecision(6);
+}
+
+template <typename... Backends>
+void compareBackendList(const vector<TraceOp>& ops)
+{
+    vector<int> expected;
+    IndexedChatTracker oracle;
+    set<string> users, chats;
+    TraceSizes sizes = { 0, 0, 0 };
+    for (const TraceOp& op : ops)
+    {
+        expected.push_back(applyOp(oracle, op));
+        if (op.type == TraceOp::JOIN)
+        {
+            users.insert(op.user);
+            chats.insert(op.chat);
+            sizes.joins++;
+        }
+    }
+    sizes.users = users.size();
+    sizes.chats = chats.size();
+    cout << "    backend                    correct  construct     replay    destroy     heap" << endl;
+    cout << "                                          (msec.)    (msec.)    (msec.)     (MB)" << endl;
+    int rows[] = { (compareBackend<Backends>(ops, sizes, expected), 0)... };
+    (void) rows;
+}
+
+void compareBackends(const vector<Command*>& commands)
+{
+    compareBackendList<DefaultBackend, FewBucketsBackend, PresizedBackend, UntimedBackend,
+                       DenseBackend, IndexedBackend, SlowBackend>(toTrace(commands));
+}
+
+  // Names are added to and removed from a store at random, in a few parts,
+  // and every stored name must read back as it was added: names sharing
+  // long prefixes, the empty name, names too long for a one-byte length,
+  // and names added again under another ID.  A name must compare equal to
+  // itself and to no other name, and a reader must read the names back in
+  // the order of their IDs and in random order.  Once every name is removed
+  // the store must hold no memory.
+
+string testNameStore()
+{
+    mt19937 gen(47);
+    NameStore store;
+    map<NameStore::Id, string> expected;
+    vector<NameStore::Id> ids;
+    for (int k = 1; k <= 200000; k++)
+    {
+        if (ids.empty()  ||  gen() % 3 != 0)
+        {
+            string name;
+            switch (gen() % 4)
+            {
+              case 0:
+                name = "tenant" + to_string(gen() % 10) + "/user" + to_string(gen() % 5000);
+                break;
+              case 1:
+                name = genName('u', int(gen() % 100000));
+                break;
+              case 2:
+                name = string(gen() % 300, char('a' + gen() % 26));
+                break;
+              default:
+                if (gen() % 2 == 0)
+                    name = genName('c', int(gen() % 10));
+                break;
+            }
+            NameStore::Id id = store.add(name, gen() % 4);
+            if ( ! expected.insert(make_pair(id, name)).second)
+                return "*** FAILED *** an ID was given out twice";
+            ids.push_back(id);
+        }
+        else
+        {
+            size_t pick = gen() % ids.size();
+            store.remove(ids[pick]);
+            expected.erase(ids[pick]);
+            ids[pick] = ids.back();
+            ids.pop_back();
+        }
+        if (k % 10000 == 0)
+        {
+            if (store.size() != expected.size())
+                return "*** FAILED *** wrong number of names";
+            const string* last = &expected.begin()->second;
+            NameStore::Reader inOrder(store);
+            for (auto& e : expected)
+            {
+                if (store.name(e.first) != e.second)
+                    return "*** FAILED *** \"" + e.second.substr(0, 40) + "\" reads back wrong";
+                if ( ! store.equals(e.first, e.second)  ||  store.equals(e.first, e.second + "x")  ||
+                     (!e.second.empty()  &&  store.equals(e.first, e.second.substr(0, e.second.size() - 1))))
+                    return "*** FAILED *** \"" + e.second.substr(0, 40) + "\" compares wrong with itself";
+                if (store.equals(e.first, *last) != (*last == e.second))
+                    return "*** FAILED *** \"" + e.second.substr(0, 40) + "\" compares wrong with another name";
+                last = &e.second;
+                if (inOrder.read(e.first) != e.second)
+                    return "*** FAILED *** a reader reads \"" + e.second.substr(0, 40) + "\" back wrong";
+            }
+            NameStore::Reader atRandom(store);
+            for (int j = 0; j < 1000; j++)
+            {
+                NameStore::Id id = ids[gen() % ids.size()];
+                if (atRandom.read(id) != expected[id])
+                    return "*** FAILED *** a reader reads \"" + expected[id].substr(0, 40) + "\" back wrong at random";
+            }
+        }
+    }
+    for (NameStore::Id id : ids)
+        store.remove(id);
+    if (store.size() != 0  ||  store.memoryUsage() != 0)
+        return "*** FAILED *** an empty store holds memory";
+    return "Passed";
+}
+
+  // A user name of the form "tenant042/user10000123"
+
+string tenantUserName(int tenant, int user)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "tenant%03d/user%d", tenant, 10000000 + user);
+    return name;
+}
+
+  // Heap bytes per name of 10000000 user names of 100 tenants and the time
+  // to read one back by its index or ID, kept as std::strings and in name
+  // stores: one with the names added tenant by tenant and one with the
+  // tenants interleaved, as users arrive.  Then the bytes per user (by the
+  // tracker's count and by the heap) of 1000000 such users, each in 1 to 4
+  // of 100000 chats, and the whole tracker's heap bytes per name it holds
+  // (users' and chats'), against what the names alone take as std::strings.
+
+void timeNameStorage()
+{
+    const int NAMES = 10000000;
+    const int LOOKUPS = 1000000;
+    mt19937 gen(47);
+    vector<uint32_t> picks(LOOKUPS);
+    for (uint32_t& pick : picks)
+        pick = gen() % NAMES;
+
+    cout << "    " << NAMES << " names        bytes/name  lookup (nsec.)" << endl;
+    {
+        long long before = heapBytes();
+        vector<string> names;
+        names.reserve(NAMES);
+        for (int k = 0; k < NAMES; k++)
+            names.push_back(tenantUserName(k / (NAMES / 100), k));
+        double bytes = double(heapBytes() - before) / NAMES;
+        Timer timer;
+        string out;
+        size_t sum = 0;
+        for (uint32_t pick : picks)
+        {
+            out = names[pick];
+            sum += out.size();
+        }
+        double lookup = timer.elapsed() * 1e6 / LOOKUPS;
+        cout << "    std::string              " << setw(8) << fixed << setprecision(1) << bytes
+             << setw(14) << lookup << (sum != 0 ? "" : "  *** nothing read ***") << endl;
+    }
+    for (int interleaved = 0; interleaved < 2; interleaved++)
+    {
+        long long before = heapBytes();
+        NameStore store;
+        vector<NameStore::Id> ids(NAMES);
+        for (int k = 0; k < NAMES; k++)
+            ids[k] = store.add(tenantUserName(interleaved ? k % 100 : k / (NAMES / 100), k));
+        double bytes = double(heapBytes() - before - ids.capacity() * sizeof(NameStore::Id)) / NAMES;
+        Timer timer;
+        string out;
+        size_t sum = 0;
+        for (uint32_t pick : picks)
+        {
+            store.get(ids[pick], out);
+            sum += out.size();
+        }
+        double lookup = timer.elapsed() * 1e6 / LOOKUPS;
+        cout << "    NameStore, " << (interleaved ? "interleaved  " : "tenant order ") << setw(8) << bytes
+             << setw(14) << lookup << (sum != 0 ? "" : "  *** nothing read ***") << endl;
+    }
+
+    const int USERS = 1000000;
+    const int CHATS = 100000;
+    long long before = heapBytes();
+    unique_ptr<ChatTracker> ct(new ChatTracker);
+    for (int u = 0; u < USERS; u++)
+    {
+        string user = tenantUserName(42, u);
+        int nchats = 1 + int(gen() % 4);
+        for (int k = 0; k < nchats; k++)
+            ct->join(user, "tenant042/chat" + to_string(1000000 + gen() % CHATS));
+    }
+    long long trackerBytes = heapBytes() - before;
+    cout << "    ChatTracker, " << USERS << " users: " << double(ct->memoryUsage()) / USERS
+         << " bytes/user counted, " << double(trackerBytes) / USERS << " bytes/user of heap" << endl;
+    vector<ChatTracker::ChatInfo> chats;
+    ct->scanChats(0, 1, chats);
+    size_t names = USERS + chats.size();
+    before = heapBytes();
+    {
+        vector<string> copies;
+        copies.reserve(names);
+        for (int u = 0; u < USERS; u++)
+            copies.push_back(tenantUserName(42, u));
+        for (const ChatTracker::ChatInfo& chat : chats)
+            copies.push_back(*chat.name);
+        cout << "    ChatTracker, " << names << " names: " << double(trackerBytes) / names
+             << " bytes/name of heap (the names alone as std::strings: "
+             << double(heapBytes() - before) / names << ")" << endl;
+    }
+    cout.unsetf(ios::fixed);
+    cout << setprecision(6);
+}
+
+  // The commands run on three trackers sharing a tenant pool and its names,
+  // one operation on each in turn, so the same names are stored for all
+  // three; on a tracker whose pool keeps no names; and on four threads at
+  // once, each with two trackers of its own on one pool.  Every result must
+  // be the indexed oracle's.  An empty tracker must take little memory, and
+  // once the trackers are gone the shared store must hold no names.
+
+string testTenants(const vector<Command*>& commands)
+{
+    vector<TraceOp> ops = toTrace(commands);
+    vector<int> expected(ops.size());
+    {
+        IndexedChatTracker oracle;
+        for (size_t k = 0; k < ops.size(); k++)
+            expected[k] = applyOp(oracle, ops[k]);
+    }
+    TenantPool pool;
+    TenantPool unshared(false);
+    ChatTracker::Options options;
+    options.tenantPool = &pool;
+    {
+        ChatTracker empty(options);
+        if (empty.memoryUsage() > 1024)
+            return "*** FAILED *** an empty tenant counts " + to_string(empty.memoryUsage()) + " bytes";
+    }
+    {
+        vector<unique_ptr<ChatTracker>> tenants;
+        for (int t = 0; t < 3; t++)
+            tenants.emplace_back(new ChatTracker(options));
+        ChatTracker::Options own;
+        own.tenantPool = &unshared;
+        tenants.emplace_back(new ChatTracker(own));
+        for (size_t k = 0; k < ops.size(); k++)
+        {
+            for (size_t t = 0; t < tenants.size(); t++)
+            {
+                if (applyOp(*tenants[t], ops[k]) != expected[k])
+                {
+                    ostringstream msg;
+                    msg << "*** FAILED *** tenant " << t << ", line " << commands[k]->m_lineno
+                        << ": \"" << commands[k]->m_line << "\"";
+                    return msg.str();
+                }
+            }
+        }
+    }
+    if (pool.names()->size() != 0)
+        return "*** FAILED *** names outlive their trackers";
+
+    atomic<int> failures(0);
+    vector<thread> threads;
+    for (int th = 0; th < 4; th++)
+    {
+        threads.emplace_back([&]() {
+            ChatTracker first(options);
+            ChatTracker second(options);
+            for (size_t k = 0; k < ops.size(); k++)
+            {
+                if (applyOp(first, ops[k]) != expected[k]  ||  applyOp(second, ops[k]) != expected[k])
+                {
+                    failures++;
+                    return;
+                }
+            }
+        });
+    }
+    for (thread& th : threads)
+        th.join();
+    if (failures != 0)
+        return "*** FAILED *** " + to_string(failures.load()) + " threads got wrong results";
+    if (pool.names()->size() != 0)
+        return "*** FAILED *** names outlive their trackers";
+    return "Passed";
+}
+
+  // Microseconds to create and destroy a tracker and heap bytes per tracker,
+  // empty and after two users join a chat, for trackers with their own
+  // memory (made as ChatTracker() and as ChatTracker(Options())) and for
+  // trackers on a tenant pool, with and without shared names
+
+void timeTenants()
+{
+    TenantPool shared;
+    TenantPool unshared(false);
+    const char* names[] = { "ChatTracker()", "Options()", "pool", "pool, shared names" };
+    cout << "                        create  destroy  empty bytes  2-user bytes" << endl;
+    for (int mode = 0; mode < 4; mode++)
+    {
+        const int N = (mode == 0 ? 100 : 10000);
+        ChatTracker::Options options;
+        if (mode == 2)
+            options.tenantPool = &unshared;
+        else if (mode == 3)
+            options.tenantPool = &shared;
+        vector<ChatTracker*> tenants(N);
+        long long before = heapBytes();
+        Timer timer;
+        for (ChatTracker*& ct : tenants)
+            ct = (mode == 0 ? new ChatTracker : new ChatTracker(options));
+        double create = timer.elapsed() * 1000 / N;
+        long long empty = heapBytes() - before;
+        for (ChatTracker* ct : tenants)
+        {
+            ct->join("tenant/user1", "tenant/chat1");
+            ct->join("tenant/user2", "tenant/chat1");
+            ct->contribute("tenant/user1");
+        }
+        long long used = heapBytes() - before;
+        timer.start();
+        for (ChatTracker* ct : tenants)
+            delete ct;
+        double destroy = timer.elapsed() * 1000 / N;
+        cout << "    " << left << setw(20) << names[mode] << right << fixed << setprecision(2)
+             << setw(8) << create << setw(9) << destroy << setw(13) << empty / N << setw(14) << used / N << endl;
+    }
+    cout.unsetf(ios::fixed);
+    cout << setprecision(6);
+}
+
+  // The commands run on a tracker with concurrent contributions, whose
+  // results must be the indexed oracle's.  Then 8 threads contribute at once
+  // for 200 users each, most of them in one hot chat and the rest in 4 warm
+  // ones, in three rounds; between rounds some users leave and join again.
+  // Each contribute must return the user's count, and after each round the
+  // chats' totals, the scanned totals and the leaves' results must count
+  // every contribution; terminate must return the final totals.  Giving such
+  // a tracker a memory budget, cold tier or change feed must throw, whether
+  // it is built or loaded from a dump with one or is given one later.
+
+string testConcurrentContributions(const vector<Command*>& commands)
+{
+    ChatTracker::Options options;
+    options.concurrentContributions = true;
+    {
+        vector<TraceOp> ops = toTrace(commands);
+        IndexedChatTracker oracle;
+        ChatTracker ct(options);
+        for (size_t k = 0; k < ops.size(); k++)
+        {
+            if (applyOp(ct, ops[k]) != applyOp(oracle, ops[k]))
+            {
+                ostringstream msg;
+                msg << "*** FAILED *** line " << commands[k]->m_lineno
+                    << ": \"" << commands[k]->m_line << "\"";
+                return msg.str();
+            }
+        }
+    }
+
+    {
+        ChatTracker::Options budgeted = options;
+        budgeted.memoryBudget = 1 << 20;
+        ChatTracker::Options cooled = options;
+        cooled.coldAfterMsec = 1000;
+        ChatTracker::Dump dump;
+        dump.memberships.push_back(ChatTracker::Dump::Membership{"u", "c", 0, 1});
+        ChatTracker ct(options);
+        vector<function<void()>> misuses = {
+            [&]() { ChatTracker built(budgeted); },
+            [&]() { ChatTracker built(cooled); },
+            [&]() { ChatTracker loaded(dump, 1, cooled); },
+            [&]() { ct.setMemoryBudget(1 << 20); },
+            [&]() { ct.setColdTier(1000); },
+            [&]() { ct.enableChangeFeed(); },
+        };
+        for (size_t k = 0; k < misuses.size(); k++)
+        {
+            bool threw = false;
+            try
+            {
+                misuses[k]();
+            }
+            catch (const invalid_argument&)
+            {
+                threw = true;
+            }
+            if ( ! threw)
+                return "*** FAILED *** misuse " + to_string(k) + " of a concurrent tracker did not throw";
+        }
+        if (ct.changeFeed() != nullptr)
+            return "*** FAILED *** a concurrent tracker has a change feed";
+        ct.setMemoryBudget(0);
+        ct.setColdTier(0);
+    }
+
+    const int THREADS = 8;
+    const int USERS = 200;
+    const int ROUNDS = 3;
+    ChatTracker ct(options);
+    vector<string> users;
+    vector<string> chats;
+    map<string, int> totals;
+    for (int u = 0; u < THREADS * USERS; u++)
+    {
+        users.push_back(genName('u', u));
+        chats.push_back(u % 5 == 0 ? "warm" + to_string(u % 4) : "hot");
+        ct.join(users[u], chats[u]);
+    }
+    vector<int> counts(users.size(), 0);
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        atomic<int> failures(0);
+        vector<thread> threads;
+        for (int th = 0; th < THREADS; th++)
+        {
+            threads.emplace_back([&, th]() {
+                for (int k = 0; k < 50; k++)
+                {
+                    for (int u = th * USERS; u < (th + 1) * USERS; u++)
+                    {
+                        if (ct.contribute(users[u]) != counts[u] + 1)
+                            failures++;
+                        counts[u]++;
+                    }
+                }
+            });
+        }
+        for (thread& th : threads)
+            th.join();
+        if (failures != 0)
+            return "*** FAILED *** contribute returned a wrong count";
+        totals.clear();
+        for (size_t u = 0; u < users.size(); u++)
+            totals[chats[u]] += 50;
+        for (auto& t : totals)
+        {
+            int expected = t.second * (round + 1);
+            if (ct.chatTotal(t.first) != expected)
+                return "*** FAILED *** " + t.first + " has total " + to_string(ct.chatTotal(t.first))
+                       + ", not " + to_string(expected);
+        }
+        vector<ChatTracker::ChatInfo> scanned;
+        ct.scanChats(0, 1, scanned);
+        for (const ChatTracker::ChatInfo& info : scanned)
+        {
+            if (info.total != totals[*info.name] * (round + 1))
+                return "*** FAILED *** scan gives " + *info.name + " a wrong total";
+        }
+        for (size_t u = 0; u < users.size(); u += 7)
+        {
+            if (ct.leave(users[u], chats[u]) != counts[u])
+                return "*** FAILED *** leave returned a wrong count";
+            ct.join(users[u], chats[u]);
+            counts[u] = 0;
+        }
+    }
+    for (auto& t : totals)
+    {
+        if (ct.terminate(t.first) != t.second * ROUNDS)
+            return "*** FAILED *** terminate of " + t.first + " returned a wrong total";
+    }
+    return "Passed";
+}
+
+  // Threads contributing for users of their own, all in one chat, on a
+  // tracker behind one mutex (what calling from many threads took before
+  // concurrent contributions) and on a tracker with concurrent
+  // contributions; 2000000 contributions in all, split among the threads
+
+void timeHotChat()
+{
+    const int CONTRIBUTIONS = 2000000;
+    const int USERS = 1000;
+    const int threadCounts[] = { 1, 2, 4, 8, 16, 32 };
+    cout << "    threads    one lock  concurrent" << endl;
+    for (int threads : threadCounts)
+    {
+        cout << "    " << setw(7) << threads;
+        for (int concurrent = 0; concurrent < 2; concurrent++)
+        {
+            ChatTracker::Options options;
+            options.concurrentContributions = (concurrent != 0);
+            ChatTracker ct(options);
+            vector<vector<string>> users(threads);
+            for (int th = 0; th < threads; th++)
+            {
+                for (int u = 0; u < USERS; u++)
+                {
+                    users[th].push_back(genName('u', th * USERS + u));
+                    ct.join(users[th].back(), "hot");
+                }
+            }
+            mutex lock;
+            vector<thread> workers;
+            Timer timer;
+            for (int th = 0; th < threads; th++)
+            {
+                workers.emplace_back([&, th]() {
+                    const vector<string>& mine = users[th];
+                    for (int k = 0; k < CONTRIBUTIONS / threads; k++)
+                    {
+                        if (concurrent)
+                            ct.contribute(mine[k % USERS]);
+                        else
+                        {
+                            lock_guard<mutex> guard(lock);
+                            ct.contribute(mine[k % USERS]);
+                        }
+                    }
+                });
+            }
+            for (thread& w : workers)
+                w.join();
+            double rate = (CONTRIBUTIONS / threads * threads) / (timer.elapsed() * 1000);
+            cout << setw(12) << fixed << setprecision(2) << rate;
+            if (ct.terminate("hot") != CONTRIBUTIONS / threads * threads)
+                cout << " *** wrong total ***";
+        }
+        cout << endl;
+    }
+    cout.unsetf(ios::fixed);
+    cout << setprecision(6);
+}
+
+  // The commands run on a tracker whose users go cold after a millisecond
+  // of idleness, with a pause every 500 commands so that every user not
+  // used since is compressed; its results must be the indexed oracle's.
+  // Halfway, with the idle users compressed, the tracker must use less
+  // memory than one without a cold tier that ran the same commands, scan
+  // the same users, checkpoint to the same state, and read the same.
+  // Before that, every user of a tracker of 20000 is compressed, which must
+  // give back at least 40% of the heap (by the C library's count) and of
+  // the memory the tracker counts; then every other user is decompressed,
+  // so most of the compressed bytes are dead and are compacted, and every
+  // user must still scan and contribute with its counts.  A tracker loaded
+  // from a dump whose users are each in a chat of their own and in one
+  // shared chat must give back at least 60% of its heap once the chats of
+  // their own are terminated and the users compressed.
+
+string testColdTier(const vector<Command*>& commands)
+{
+    {
+        const int USERS = 20000;
+        long long heapBefore = heapBytes();
+        ChatTracker ct;
+        for (int u = 0; u < USERS; u++)
+        {
+            for (int k = 0; k < 3; k++)
+                ct.join(genName('u', u), genName('c', (u * 7 + k * 13) % 2000));
+            for (int k = 0; k < u % 3; k++)
+                ct.contribute(genName('u', u));
+        }
+        long long hotHeap = heapBytes() - heapBefore;
+        size_t hotBytes = ct.memoryUsage();
+        ct.setColdTier(1);
+        usleep(2000);
+        ct.setColdTier(3600000);
+        long long coldHeap = heapBytes() - heapBefore;
+        if (ct.memoryUsage() > hotBytes * 6 / 10)
+            return "*** FAILED *** compressing every user leaves " + to_string(ct.memoryUsage()) + " of "
+                   + to_string(hotBytes) + " bytes";
+        if (heapBefore >= 0  &&  coldHeap > hotHeap * 6 / 10)
+            return "*** FAILED *** compressing every user leaves " + to_string(coldHeap) + " of "
+                   + to_string(hotHeap) + " bytes of heap";
+        for (int u = 0; u < USERS; u += 2)
+        {
+            if (ct.contribute(genName('u', u)) != u % 3 + 1)
+                return "*** FAILED *** a decompressed user has the wrong count";
+        }
+        vector<ChatTracker::UserInfo> scanned;
+        ct.scanUsers(0, 1, scanned);
+        if (scanned.size() != size_t(USERS))
+            return "*** FAILED *** the scan finds " + to_string(scanned.size()) + " users, not " + to_string(USERS);
+        for (const ChatTracker::UserInfo& info : scanned)
+        {
+            int u = atoi(info.name.c_str() + 11);
+            if (info.name != genName('u', u)  ||  info.chats != 3  ||  info.contributions != u % 3 + (u % 2 == 0))
+                return "*** FAILED *** the scan reads user \"" + info.name + "\" wrongly";
+        }
+        for (int u = 1; u < USERS; u += 2)
+        {
+            if (ct.contribute(genName('u', u)) != u % 3 + 1)
+                return "*** FAILED *** a user compressed among dead bytes has the wrong count";
+        }
+    }
+
+    {
+        const int USERS = 20000;
+        ChatTracker::Dump dump;
+        for (int u = 0; u < USERS; u++)
+        {
+            dump.memberships.push_back(ChatTracker::Dump::Membership{genName('u', u), genName('c', u), 0, 1});
+            dump.memberships.push_back(ChatTracker::Dump::Membership{genName('u', u), "shared", 1, 0});
+        }
+        long long heapBefore = heapBytes();
+        ChatTracker ct(dump, 2);
+        long long loadedHeap = heapBytes() - heapBefore;
+        for (int u = 0; u < USERS; u++)
+            ct.terminate(genName('c', u));
+        ct.setColdTier(1);
+        usleep(2000);
+        ct.setColdTier(3600000);
+        long long coldHeap = heapBytes() - heapBefore;
+        if (heapBefore >= 0  &&  coldHeap > loadedHeap * 4 / 10)
+            return "*** FAILED *** compressing the users of a loaded tracker whose chats are gone leaves "
+                   + to_string(coldHeap) + " of " + to_string(loadedHeap) + " bytes of heap";
+    }
+
+    const char* path = "coldcheckpoint.txt";
+    vector<TraceOp> ops = toTrace(commands);
+    size_t half = ops.size() / 2;
+    IndexedChatTracker oracle;
+    ChatTracker replayed;
+    ChatTracker::Options options;
+    options.coldAfterMsec = 1;
+    ChatTracker ct(options);
+    for (size_t k = 0; k < ops.size(); k++)
+    {
+        if (k % 500 == 0)
+            usleep(2000);
+        if (applyOp(ct, ops[k]) != applyOp(oracle, ops[k]))
+        {
+            ostringstream msg;
+            msg << "*** FAILED *** line " << commands[k]->m_lineno
+                << ": \"" << commands[k]->m_line << "\"";
+            return msg.str();
+        }
+        if (k >= half)
+            continue;
+        applyOp(replayed, ops[k]);
+        if (k + 1 < half)
+            continue;
+
+        usleep(2000);
+        ct.setColdTier(1);
+        if (ct.memoryUsage() >= replayed.memoryUsage())
+            return "*** FAILED *** compressing the users saves no memory";
+        map<string, pair<size_t, long long>> users;
+        vector<ChatTracker::UserInfo> scanned;
+        replayed.scanUsers(0, 1, scanned);
+        for (const ChatTracker::UserInfo& info : scanned)
+            users[info.name] = make_pair(info.chats, info.contributions);
+        ct.scanUsers(0, 1, scanned);
+        if (scanned.size() != users.size())
+            return "*** FAILED *** the scan finds " + to_string(scanned.size()) + " users, not "
+                   + to_string(users.size());
+        for (const ChatTracker::UserInfo& info : scanned)
+        {
+            if (users[info.name] != make_pair(info.chats, info.contributions))
+                return "*** FAILED *** the scan reads user \"" + info.name + "\" differently";
+        }
+        if ( ! ct.checkpointAsync(path)  ||  ! ct.waitForCheckpoint())
+            return "*** FAILED *** the checkpoint was not written";
+        ifstream checkpointf(path);
+        ChatTracker::Dump dump;
+        if ( ! ChatTracker::readDump(checkpointf, dump))
+            return "*** FAILED *** the checkpoint does not read back";
+        remove(path);
+        ChatTracker loaded(dump, 1);
+        string difference = compareLoaded(loaded, replayed, ops, half);
+        if (difference.empty())
+            difference = compareLoaded(ct, replayed, ops, half);
+        if ( ! difference.empty())
+            return "*** FAILED *** " + difference;
+    }
+    return "Passed";
+}
+
+  // 1000000 users of one tenant, each in 1 to 4 of 100000 chats: the bytes
+  // per user (by the tracker's count and by the heap) with every user hot
+  // and with every user cold, the time to compress them all, and the time
+  // of a contribution by one of 100000 users picked at random while they
+  // are hot, while they are cold (so it decompresses the user), and again
+  // once they have been decompressed
+
+void timeColdTier()
+{
+    const int USERS = 1000000;
+    const int CHATS = 100000;
+    const int PICKS = 100000;
+    mt19937 gen(50);
+    long long before = heapBytes();
+    unique_ptr<ChatTracker> ct(new ChatTracker);
+    vector<string> names;
+    for (int u = 0; u < USERS; u++)
+    {
+        names.push_back(tenantUserName(50, u));
+        int nchats = 1 + int(gen() % 4);
+        for (int k = 0; k < nchats; k++)
+            ct->join(names.back(), "tenant050/chat" + to_string(1000000 + gen() % CHATS));
+    }
+    long long namesBytes = names.capacity() * sizeof(string);
+    vector<int> order(USERS);
+    for (int u = 0; u < USERS; u++)
+        order[u] = u;
+    shuffle(order.begin(), order.end(), gen);
+    vector<string> picks;
+    for (int k = 0; k < PICKS; k++)
+        picks.push_back(names[order[k]]);
+
+    auto contributeAll = [&]() {
+        Timer timer;
+        for (const string& user : picks)
+            ct->contribute(user);
+        return timer.elapsed() * 1e6 / PICKS;
+    };
+    cout << "                   bytes/user counted  bytes/user of heap  contribute (nsec.)" << endl;
+    double hotBytes = double(ct->memoryUsage()) / USERS;
+    double hotHeap = double(heapBytes() - before - namesBytes) / USERS;
+    double hot = contributeAll();
+    Timer timer;
+    ct->setColdTier(1);
+    usleep(2000);
+    ct->setColdTier(3600000);
+    double freezing = timer.elapsed();
+    double coldBytes = double(ct->memoryUsage()) / USERS;
+    double coldHeap = double(heapBytes() - before - namesBytes) / USERS;
+    double cold = contributeAll();
+    double thawed = contributeAll();
+    cout << fixed << setprecision(1);
+    cout << "    hot         " << setw(20) << hotBytes << setw(20) << hotHeap << setw(20) << hot << endl;
+    cout << "    cold        " << setw(20) << coldBytes << setw(20) << coldHeap << setw(20) << cold << endl;
+    cout << "    decompressed" << setw(60) << thawed << endl;
+    cout << "    compressing every user: " << freezing << " msec." << endl;
+    cout.unsetf(ios::fixed);
+    cout << setprecision(6);
+}
+
+void SlowChatTracker::join(string user, string chat)
+{
+    vector<Info>::iterator p = m_info.end();
+    while (p > m_info.begin())
+    {
+        p--;
+        if (p->user == user  &&  p->chat == chat)
+        {
+            Info info = *p;
+            m_info.erase(p);
+            m_info.push_back(info);
+            return;
+        }
+    }
+    m_info.push_back(Info(user, chat));
+}
+
+int SlowChatTracker::terminate(string chat)
+{
+    int total = 0;
+    vector<Info>::iterator p = m_info.begin();
+    while (p != m_info.end())
+    {
+        if (p->chat == chat)
+    {
+            total += p->count;
+            p = m_info.erase(p);
+    }
+    else
+        p++;
+    }
+    p = m_usersWhoLeft.begin();
+    while (p != m_usersWhoLeft.end())
+    {
+        if (p->chat == chat)
+    {
+            total += p->count;
+            p = m_usersWhoLeft.erase(p);
+    }
+    else
+        p++;
+    }
+    return total;
+}
+
+int SlowChatTracker::contribute(string user)
+{
+    vector<Info>::iterator p = m_info.end();
+    while (p > m_info.begin())
+    {
+        p--;
+        if (p->user == user)
+        {
+            p->count++;
+            return p->count;
+        }
+    }
+    return 0;
+}
+
+int SlowChatTracker::leave(string user, string chat)
+{
+    vector<Info>::iterator p = m_info.end();
+    while (p > m_info.begin())
+    {
+        p--;
+        if (p->user == user  &&  p->chat == chat)
+        {
+            int count = p->count;
+            m_usersWhoLeft.push_back(*p);
+            m_info.erase(p);
+            return count;
+        }
+    }
+    return -1;
+}
+
+int SlowChatTracker::leave(string user)
+{
+    vector<Info>::iterator p = m_info.end();
+    while (p > m_info.begin())
+    {
+        p--;
+        if (p->user == user)
+        {
+            int count = p->count;
+            m_usersWhoLeft.push_back(*p);
+            m_info.erase(p);
+            return count;
+        }
+    }
+    return -1;
+}
+
+void IndexedChatTracker::join(string user, string chat)
+{
+    m_clock++;
+    pair<string, string> key(user, chat);
+    map<pair<string, string>, Membership>::iterator p = m_memberships.find(key);
+    if (p != m_memberships.end())
+    {
+        m_userChats[user].erase(p->second.stamp);
+        p->second.stamp = m_clock;
+    }
+    else
+    {
+        m_memberships[key] = Membership{ m_clock, m_clock, 0 };
+        m_chatUsers[chat].insert(user);
+    }
+    m_userChats[user][m_clock] = chat;
+}
+
+int IndexedChatTracker::terminate(string chat)
+{
+    map<string, set<string>>::iterator users = m_chatUsers.find(chat);
+    if (users != m_chatUsers.end())
+    {
+        set<string> members = users->second;
+        for (set<string>::iterator u = members.begin(); u != members.end(); u++)
+            remove(*u, chat);
+    }
+    long long total = m_chatTotals[chat];
+    m_chatTotals.erase(chat);
+    m_chatUsers.erase(chat);
+    return int(total);
+}
+
+int IndexedChatTracker::contribute(string user)
+{
+    map<string, map<long long, string>>::iterator chats = m_userChats.find(user);
+    if (chats == m_userChats.end()  ||  chats->second.empty())
+        return 0;
+    const string& chat = chats->second.rbegin()->second;
+    m_chatTotals[chat]++;
+    return ++m_memberships[make_pair(user, chat)].count;
+}
+
+int IndexedChatTracker::leave(string user, string chat)
+{
+    if (m_memberships.find(make_pair(user, chat)) == m_memberships.end())
+        return -1;
+    return remove(user, chat);
+}
+
+int IndexedChatTracker::leave(string user)
+{
+    map<string, map<long long, string>>::iterator chats = m_userChats.find(user);
+    if (chats == m_userChats.end()  ||  chats->second.empty())
+        return -1;
+    string chat = chats->second.rbegin()->second;
+    return remove(user, chat);
+}
+
+  // Removes an existing membership (its contributions stay in the chat's
+  // total) and returns the user's contributions to the chat
+
+int IndexedChatTracker::remove(const string& user, const string& chat)
+{
+    map<pair<string, string>, Membership>::iterator p = m_memberships.find(make_pair(user, chat));
+    int count = p->second.count;
+    map<string, map<long long, string>>::iterator chats = m_userChats.find(user);
+    chats->second.erase(p->second.stamp);
+    if (chats->second.empty())
+        m_userChats.erase(chats);
+    m_chatUsers[chat].erase(user);
+    m_memberships.erase(p);
+    return count;
+}
+
+void IndexedChatTracker::dump(ChatTracker::Dump& dump) const
+{
+      // Listing every membership in the order the users joined puts each
+      // chat's members in order
+    map<long long, ChatTracker::Dump::Membership> byJoin;
+    for (auto& uc : m_userChats)
+    {
+        size_t position = 0;
+        for (auto p = uc.second.rbegin(); p != uc.second.rend(); p++, position++)
+        {
+            const Membership& m = m_memberships.at(make_pair(uc.first, p->second));
+            byJoin[m.joined] = ChatTracker::Dump::Membership{ uc.first, p->second, position, m.count };
+        }
+    }
+    for (auto& m : byJoin)
+        dump.memberships.push_back(m.second);
+    for (auto& t : m_chatTotals)
+        dump.totals.push_back(ChatTracker::Dump::Total{ t.first, int(t.second) });
 }